@@ -0,0 +1,104 @@
+/*
+ * arch/arm/mach-tegra/cpu-tegra3-policy.c
+ *
+ * CPU auto-hotplug decisions for Tegra3 CPUs
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "cpu-tegra3-policy.h"
+
+/*
+ * Another core is brought online when the runqueue depth, projected one
+ * sample ahead from its trend, exceeds up_load per online core. One is
+ * taken offline once the depth has stayed below down_load per remaining
+ * core for down_samples samples. down_load below up_load is the
+ * hysteresis that keeps a core from bouncing.
+ */
+static int up_threshold(const struct tegra_hp_params *params, unsigned int n)
+{
+	return n * params->up_load;
+}
+
+static int down_threshold(const struct tegra_hp_params *params,
+			  unsigned int n)
+{
+	return n ? (n - 1) * params->down_load : 0;
+}
+
+void tegra_hp_load_reset(struct tegra_hp_load *load, unsigned int nr_running,
+			 unsigned int nr_online)
+{
+	load->avg = nr_running * TEGRA_HP_LOAD_SCALE;
+	load->trend = 0;
+	load->below = 0;
+	load->nr_online = nr_online;
+}
+
+void tegra_hp_load_update(struct tegra_hp_load *load,
+			  const struct tegra_hp_params *params,
+			  unsigned int nr_running, unsigned int nr_online)
+{
+	int sample = nr_running * TEGRA_HP_LOAD_SCALE;
+	int weight = params->load_weight;
+	int avg;
+
+	avg = (load->avg * (100 - weight) + sample * weight) / 100;
+	load->trend = avg - load->avg;
+	load->avg = avg;
+
+	/* The count is for the cores online now, restart it on a change. */
+	if (nr_online != load->nr_online) {
+		load->below = 0;
+		load->nr_online = nr_online;
+	}
+
+	if (avg < down_threshold(params, nr_online))
+		load->below++;
+	else
+		load->below = 0;
+}
+
+int tegra_hp_decide(const struct tegra_hp_load *load,
+		    const struct tegra_hp_params *params,
+		    const struct tegra_hp_cpus *cpus)
+{
+	unsigned int n = cpus->nr_online;
+	int predicted = load->avg + (load->trend > 0 ? load->trend : 0);
+
+	if (n < cpus->min_cpus)
+		return TEGRA_HP_ONLINE;
+
+	if (n > cpus->max_cpus ||
+	    (cpus->edp_favor_down && n > cpus->min_cpus))
+		return TEGRA_HP_OFFLINE;
+
+	if (predicted > up_threshold(params, n)) {
+		if (n < cpus->max_cpus && cpus->edp_favor_up)
+			return TEGRA_HP_ONLINE;
+		return TEGRA_HP_HOLD;
+	}
+
+	/*
+	 * At the bottom speed, or with the load on a few cores only, the
+	 * depth being below the threshold now is enough.
+	 */
+	if (n > cpus->min_cpus && load->avg < down_threshold(params, n) &&
+	    (cpus->idle || cpus->skewed ||
+	     load->below >= params->down_samples))
+		return TEGRA_HP_OFFLINE;
+
+	return TEGRA_HP_HOLD;
+}
@@ -0,0 +1,79 @@
+/*
+ * arch/arm/mach-tegra/cpu-tegra3-policy.h
+ *
+ * CPU auto-hotplug decisions for Tegra3 CPUs
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __MACH_TEGRA_CPU_TEGRA3_POLICY_H
+#define __MACH_TEGRA_CPU_TEGRA3_POLICY_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stdbool.h>
+#endif
+
+/*
+ * Runqueue depths are kept in hundredths of a runnable task. Nothing in
+ * here touches kernel state: the caller samples the system and applies
+ * the decision, so the policy can be replayed against recorded traces
+ * with tools/tegra-hotplug.
+ */
+#define TEGRA_HP_LOAD_SCALE	100
+
+enum {
+	TEGRA_HP_HOLD,
+	TEGRA_HP_ONLINE,
+	TEGRA_HP_OFFLINE,
+};
+
+struct tegra_hp_params {
+	unsigned int load_weight;	/* % weight of the newest sample */
+	unsigned int up_load;		/* per online core */
+	unsigned int down_load;		/* per core left after offlining */
+	unsigned int down_samples;	/* samples below down_load to offline */
+};
+
+/* Runqueue depth history */
+struct tegra_hp_load {
+	int avg;
+	int trend;		/* change of avg at the last sample */
+	unsigned int below;	/* samples in a row below the down threshold */
+	unsigned int nr_online;	/* cores online at the last sample */
+};
+
+/* What the caller knows about the cores at the time of a decision */
+struct tegra_hp_cpus {
+	unsigned int nr_online;
+	unsigned int min_cpus;
+	unsigned int max_cpus;
+	bool edp_favor_up;	/* EDP leaves room for one more core */
+	bool edp_favor_down;	/* EDP would rather have one core less */
+	bool skewed;		/* two or more cores far below the fastest */
+	bool idle;		/* cpu speed at the bottom of the G cluster */
+};
+
+void tegra_hp_load_reset(struct tegra_hp_load *load, unsigned int nr_running,
+			 unsigned int nr_online);
+void tegra_hp_load_update(struct tegra_hp_load *load,
+			  const struct tegra_hp_params *params,
+			  unsigned int nr_running, unsigned int nr_online);
+int tegra_hp_decide(const struct tegra_hp_load *load,
+		    const struct tegra_hp_params *params,
+		    const struct tegra_hp_cpus *cpus);
+
+#endif
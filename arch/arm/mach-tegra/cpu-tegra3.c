@@ -33,9 +33,11 @@
 #include <linux/debugfs.h>
 #include <linux/seq_file.h>
 #include <linux/pm_qos_params.h>
+#include <linux/ktime.h>
 
 #include "pm.h"
 #include "cpu-tegra.h"
+#include "cpu-tegra3-policy.h"
 #include "clock.h"
 
 #define INITIAL_STATE		TEGRA_HP_DISABLED
@@ -69,6 +71,19 @@ module_param(mp_overhead, int, 0644);
 static int balance_level = 75;
 module_param(balance_level, int, 0644);
 
+/* See cpu-tegra3-policy.c; runqueue depths are in hundredths of a task */
+static unsigned int load_weight = 50;
+static unsigned int up_load = 125;
+static unsigned int down_load = 80;
+static unsigned int down_samples = 10;
+module_param(load_weight, uint, 0644);
+module_param(up_load, uint, 0644);
+module_param(down_load, uint, 0644);
+module_param(down_samples, uint, 0644);
+
+static struct tegra_hp_load hp_load;
+static unsigned long hp_load_stamp;
+
 static struct clk *cpu_clk;
 static struct clk *cpu_g_clk;
 static struct clk *cpu_lp_clk;
@@ -79,11 +94,42 @@ static struct {
 	unsigned int up_down_count;
 } hp_stats[CONFIG_NR_CPUS + 1];	/* Append LP CPU entry at the end */
 
+enum {
+	HP_LATENCY_ONLINE,
+	HP_LATENCY_OFFLINE,
+	HP_LATENCY_TO_LP,
+	HP_LATENCY_TO_G,
+	HP_LATENCY_TYPES,
+};
+
+static const char * const hp_latency_names[HP_LATENCY_TYPES] = {
+	"online:", "offline:", "G->LP:", "LP->G:",
+};
+
+/* Buckets double from under 128us to 64ms and over */
+#define HP_LATENCY_BUCKETS	11
+#define HP_LATENCY_MIN_SHIFT	7
+
+static unsigned int hp_latency[HP_LATENCY_TYPES][HP_LATENCY_BUCKETS];
+
+static void hp_latency_update(int type, ktime_t start)
+{
+	s64 us = ktime_us_delta(ktime_get(), start);
+	int i = 0;
+
+	while ((i < HP_LATENCY_BUCKETS - 1) &&
+	       (us >= (1LL << (HP_LATENCY_MIN_SHIFT + i))))
+		i++;
+	hp_latency[type][i]++;
+}
+
 static void hp_init_stats(void)
 {
 	int i;
 	u64 cur_jiffies = get_jiffies_64();
 
+	memset(hp_latency, 0, sizeof(hp_latency));
+
 	for (i = 0; i <= CONFIG_NR_CPUS; i++) {
 		hp_stats[i].time_up_total = 0;
 		hp_stats[i].last_update = cur_jiffies;
@@ -123,6 +169,18 @@ static void hp_stats_update(unsigned int cpu, bool up)
 	hp_stats[cpu].last_update = cur_jiffies;
 }
 
+static int hp_switch_cluster(struct clk *parent)
+{
+	ktime_t start = ktime_get();
+	int ret;
+
+	ret = clk_set_parent(cpu_clk, parent);
+	if (!ret)
+		hp_latency_update((parent == cpu_lp_clk) ?
+				  HP_LATENCY_TO_LP : HP_LATENCY_TO_G, start);
+	return ret;
+}
+
 
 enum {
 	TEGRA_HP_DISABLED = 0,
@@ -177,43 +235,47 @@ static struct kernel_param_ops tegra_hp_state_ops = {
 module_param_cb(auto_hotplug, &tegra_hp_state_ops, &hp_state, 0644);
 
 
-enum {
-	TEGRA_CPU_SPEED_BALANCED,
-	TEGRA_CPU_SPEED_BIASED,
-	TEGRA_CPU_SPEED_SKEWED,
-};
-
-static noinline int tegra_cpu_speed_balance(void)
+/*
+ * Sample the runqueue depth into the history, starting it over if it has
+ * not been sampled for a while, and let the policy decide.
+ */
+static int tegra_hp_decision(bool idle)
 {
+	struct tegra_hp_params params;
+	struct tegra_hp_cpus cpus;
 	unsigned long highest_speed = tegra_cpu_highest_speed();
-	unsigned long balanced_speed = highest_speed * balance_level / 100;
-	unsigned long skewed_speed = balanced_speed / 2;
-	unsigned int nr_cpus = num_online_cpus();
-	unsigned int max_cpus = pm_qos_request(PM_QOS_MAX_ONLINE_CPUS) ? : 4;
-	unsigned int min_cpus = pm_qos_request(PM_QOS_MIN_ONLINE_CPUS);
-
-	/* balanced: freq targets for all CPUs are above 50% of highest speed
-	   biased: freq target for at least one CPU is below 50% threshold
-	   skewed: freq targets for at least 2 CPUs are below 25% threshold */
-	if (((tegra_count_slow_cpus(skewed_speed) >= 2) ||
-	     tegra_cpu_edp_favor_down(nr_cpus, mp_overhead) ||
-	     (highest_speed <= idle_bottom_freq) || (nr_cpus > max_cpus)) &&
-	    (nr_cpus > min_cpus))
-		return TEGRA_CPU_SPEED_SKEWED;
-
-	if (((tegra_count_slow_cpus(balanced_speed) >= 1) ||
-	     (!tegra_cpu_edp_favor_up(nr_cpus, mp_overhead)) ||
-	     (highest_speed <= idle_bottom_freq) || (nr_cpus == max_cpus)) &&
-	    (nr_cpus >= min_cpus))
-		return TEGRA_CPU_SPEED_BIASED;
-
-	return TEGRA_CPU_SPEED_BALANCED;
+	unsigned long skewed_speed = highest_speed * balance_level / 100 / 2;
+	unsigned int nr_online = num_online_cpus();
+	/* the worker making the decision is running, don't count it */
+	unsigned int nr = nr_running() - 1;
+
+	params.load_weight = clamp(load_weight, 1U, 100U);
+	params.up_load = up_load;
+	params.down_load = down_load;
+	params.down_samples = down_samples;
+
+	if (time_after(jiffies, hp_load_stamp + 2 * down_delay))
+		tegra_hp_load_reset(&hp_load, nr, nr_online);
+	else
+		tegra_hp_load_update(&hp_load, &params, nr, nr_online);
+	hp_load_stamp = jiffies;
+
+	cpus.nr_online = nr_online;
+	cpus.min_cpus = pm_qos_request(PM_QOS_MIN_ONLINE_CPUS);
+	cpus.max_cpus = pm_qos_request(PM_QOS_MAX_ONLINE_CPUS) ? : 4;
+	cpus.edp_favor_up = tegra_cpu_edp_favor_up(nr_online, mp_overhead);
+	cpus.edp_favor_down = tegra_cpu_edp_favor_down(nr_online, mp_overhead);
+	cpus.skewed = (tegra_count_slow_cpus(skewed_speed) >= 2);
+	cpus.idle = idle || (highest_speed <= idle_bottom_freq);
+
+	return tegra_hp_decide(&hp_load, &params, &cpus);
 }
 
 static void tegra_auto_hotplug_work_func(struct work_struct *work)
 {
 	bool up = false;
 	unsigned int cpu = nr_cpu_ids;
+	ktime_t start;
 
 	mutex_lock(tegra3_cpu_lock);
 
@@ -224,12 +286,16 @@ static void tegra_auto_hotplug_work_func(struct work_struct *work)
 	case TEGRA_HP_DOWN:
 		cpu = tegra_get_slowest_cpu_n();
 		if (cpu < nr_cpu_ids) {
-			up = false;
+			/* keep the core while the runqueues still need it */
+			if (tegra_hp_decision(true) == TEGRA_HP_OFFLINE) {
+				up = false;
+				hp_stats_update(cpu, false);
+			} else
+				cpu = nr_cpu_ids;
 			queue_delayed_work(
 				hotplug_wq, &hotplug_work, down_delay);
-			hp_stats_update(cpu, false);
 		} else if (!is_lp_cluster() && !no_lp) {
-			if(!clk_set_parent(cpu_clk, cpu_lp_clk)) {
+			if (!hp_switch_cluster(cpu_lp_clk)) {
 				hp_stats_update(CONFIG_NR_CPUS, true);
 				hp_stats_update(0, false);
 				/* catch-up with governor target speed */
@@ -241,32 +307,31 @@ static void tegra_auto_hotplug_work_func(struct work_struct *work)
 		break;
 	case TEGRA_HP_UP:
 		if (is_lp_cluster() && !no_lp) {
-			if(!clk_set_parent(cpu_clk, cpu_g_clk)) {
+			if (!hp_switch_cluster(cpu_g_clk)) {
 				hp_stats_update(CONFIG_NR_CPUS, false);
 				hp_stats_update(0, true);
 				/* catch-up with governor target speed */
 				tegra_cpu_set_speed_cap(NULL);
 			}
 		} else {
-			switch (tegra_cpu_speed_balance()) {
-			/* cpu speed is up and balanced - one more on-line */
-			case TEGRA_CPU_SPEED_BALANCED:
+			switch (tegra_hp_decision(false)) {
+			/* runqueues are getting deeper - one more on-line */
+			case TEGRA_HP_ONLINE:
 				cpu = cpumask_next_zero(0, cpu_online_mask);
 				if (cpu < nr_cpu_ids) {
 					up = true;
 					hp_stats_update(cpu, true);
 				}
 				break;
-			/* cpu speed is up, but skewed - remove one core */
-			case TEGRA_CPU_SPEED_SKEWED:
+			/* runqueues stayed shallow - remove one core */
+			case TEGRA_HP_OFFLINE:
 				cpu = tegra_get_slowest_cpu_n();
 				if (cpu < nr_cpu_ids) {
 					up = false;
 					hp_stats_update(cpu, false);
 				}
 				break;
-			/* cpu speed is up, but under-utilized - do nothing */
-			case TEGRA_CPU_SPEED_BIASED:
+			case TEGRA_HP_HOLD:
 			default:
 				break;
 			}
@@ -281,10 +346,14 @@ static void tegra_auto_hotplug_work_func(struct work_struct *work)
 	mutex_unlock(tegra3_cpu_lock);
 
 	if (cpu < nr_cpu_ids) {
-		if (up)
-			cpu_up(cpu);
-		else
-			cpu_down(cpu);
+		start = ktime_get();
+		if (up ? cpu_up(cpu) : cpu_down(cpu))
+			return;
+
+		mutex_lock(tegra3_cpu_lock);
+		hp_latency_update(up ? HP_LATENCY_ONLINE : HP_LATENCY_OFFLINE,
+				  start);
+		mutex_unlock(tegra3_cpu_lock);
 	}
 }
 
@@ -298,7 +367,7 @@ static int min_cpus_notify(struct notifier_block *nb, unsigned long n, void *p)
 			tegra_getspeed(0), clk_get_min_rate(cpu_g_clk) / 1000);
 		tegra_update_cpu_speed(speed);
 
-		if (!clk_set_parent(cpu_clk, cpu_g_clk)) {
+		if (!hp_switch_cluster(cpu_g_clk)) {
 			hp_stats_update(CONFIG_NR_CPUS, false);
 			hp_stats_update(0, true);
 		}
@@ -325,7 +394,7 @@ void tegra3_auto_hotplug_governor(unsigned int cpu_freq, bool suspend)
 
 		/* Switch to G-mode if suspend rate is high enough */
 		if (is_lp_cluster() && (cpu_freq >= idle_bottom_freq)) {
-			if (!clk_set_parent(cpu_clk, cpu_g_clk)) {
+			if (!hp_switch_cluster(cpu_g_clk)) {
 				hp_stats_update(CONFIG_NR_CPUS, false);
 				hp_stats_update(0, true);
 			}
@@ -438,7 +507,7 @@ struct pm_qos_request_list max_cpu_req;
 
 static int hp_stats_show(struct seq_file *s, void *data)
 {
-	int i;
+	int i, j;
 	u64 cur_jiffies = get_jiffies_64();
 
 	mutex_lock(tegra3_cpu_lock);
@@ -472,6 +541,20 @@ static int hp_stats_show(struct seq_file *s, void *data)
 	seq_printf(s, "%-15s %llu\n", "time-stamp:",
 		   cputime64_to_clock_t(cur_jiffies));
 
+	seq_printf(s, "\n%-15s ", "latency (us):");
+	for (i = 0; i < HP_LATENCY_BUCKETS - 1; i++)
+		seq_printf(s, "<%-9u ", 1U << (HP_LATENCY_MIN_SHIFT + i));
+	seq_printf(s, ">=%u\n", 1U << (HP_LATENCY_MIN_SHIFT + i - 1));
+
+	mutex_lock(tegra3_cpu_lock);
+	for (i = 0; i < HP_LATENCY_TYPES; i++) {
+		seq_printf(s, "%-15s ", hp_latency_names[i]);
+		for (j = 0; j < HP_LATENCY_BUCKETS; j++)
+			seq_printf(s, "%-10u ", hp_latency[i][j]);
+		seq_printf(s, "\n");
+	}
+	mutex_unlock(tegra3_cpu_lock);
+
 	return 0;
 }
 
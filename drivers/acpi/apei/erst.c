@@ -929,16 +929,19 @@ static int erst_check_table(struct acpi_table_erst *erst_tab)
 	return 0;
 }
 
-static size_t erst_reader(u64 *id, enum pstore_type_id *type,
-		       struct timespec *time);
+static ssize_t erst_reader(u64 *id, enum pstore_type_id *type,
+			   struct timespec *time, char **buf,
+			   struct pstore_info *psi);
 static u64 erst_writer(enum pstore_type_id type, size_t size);
+static int erst_clearer(enum pstore_type_id type, u64 id,
+			struct pstore_info *psi);
 
 static struct pstore_info erst_info = {
 	.owner		= THIS_MODULE,
 	.name		= "erst",
 	.read		= erst_reader,
 	.write		= erst_writer,
-	.erase		= erst_clear
+	.erase		= erst_clearer
 };
 
 #define CPER_CREATOR_PSTORE						\
@@ -957,8 +960,9 @@ struct cper_pstore_record {
 	char data[];
 } __packed;
 
-static size_t erst_reader(u64 *id, enum pstore_type_id *type,
-		       struct timespec *time)
+static ssize_t erst_reader(u64 *id, enum pstore_type_id *type,
+			   struct timespec *time, char **buf,
+			   struct pstore_info *psi)
 {
 	int rc;
 	ssize_t len;
@@ -1005,7 +1009,13 @@ skip:
 		time->tv_sec = 0;
 	time->tv_nsec = 0;
 
-	return len - sizeof(*rcd);
+	len -= sizeof(*rcd);
+	*buf = kmalloc(len, GFP_KERNEL);
+	if (!*buf)
+		return -ENOMEM;
+	memcpy(*buf, rcd->data, len);
+
+	return len;
 }
 
 static u64 erst_writer(enum pstore_type_id type, size_t size)
@@ -1051,6 +1061,12 @@ static u64 erst_writer(enum pstore_type_id type, size_t size)
 	return rcd->hdr.record_id;
 }
 
+static int erst_clearer(enum pstore_type_id type, u64 id,
+			struct pstore_info *psi)
+{
+	return erst_clear(id);
+}
+
 static int __init erst_init(void)
 {
 	int rc = 0;
@@ -0,0 +1,127 @@
+/*
+ * drivers/cpufreq/cpufreq_fake.c
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * A cpufreq driver for machines that can't change speed, such as virtual
+ * ones. It remembers the speed a governor asks for and reports the
+ * transition, but leaves the cpu alone, so that governors can be
+ * compared by when and how they change speed (the cpu_frequency trace
+ * events and cpufreq_stats) wherever the kernel runs.
+ */
+
+#include <linux/cpufreq.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/percpu.h>
+
+static struct cpufreq_frequency_table fake_freq_table[] = {
+	{ 0, 200000 },
+	{ 1, 400000 },
+	{ 2, 600000 },
+	{ 3, 800000 },
+	{ 4, 1000000 },
+	{ 5, 1200000 },
+	{ 6, 1400000 },
+	{ 0, CPUFREQ_TABLE_END },
+};
+
+static DEFINE_PER_CPU(unsigned int, fake_cur_freq);
+
+static int fake_verify(struct cpufreq_policy *policy)
+{
+	return cpufreq_frequency_table_verify(policy, fake_freq_table);
+}
+
+static int fake_target(struct cpufreq_policy *policy,
+		       unsigned int target_freq, unsigned int relation)
+{
+	struct cpufreq_freqs freqs;
+	unsigned int index;
+	int ret;
+
+	ret = cpufreq_frequency_table_target(policy, fake_freq_table,
+					     target_freq, relation, &index);
+	if (ret)
+		return ret;
+
+	freqs.cpu = policy->cpu;
+	freqs.old = per_cpu(fake_cur_freq, policy->cpu);
+	freqs.new = fake_freq_table[index].frequency;
+	if (freqs.old == freqs.new)
+		return 0;
+
+	cpufreq_notify_transition(&freqs, CPUFREQ_PRECHANGE);
+	per_cpu(fake_cur_freq, policy->cpu) = freqs.new;
+	cpufreq_notify_transition(&freqs, CPUFREQ_POSTCHANGE);
+	return 0;
+}
+
+static unsigned int fake_get(unsigned int cpu)
+{
+	return per_cpu(fake_cur_freq, cpu);
+}
+
+static int fake_cpu_init(struct cpufreq_policy *policy)
+{
+	int ret;
+
+	ret = cpufreq_frequency_table_cpuinfo(policy, fake_freq_table);
+	if (ret)
+		return ret;
+
+	if (!per_cpu(fake_cur_freq, policy->cpu))
+		per_cpu(fake_cur_freq, policy->cpu) =
+			fake_freq_table[0].frequency;
+	policy->cur = per_cpu(fake_cur_freq, policy->cpu);
+	policy->cpuinfo.transition_latency = 50000;	/* ns */
+	cpufreq_frequency_table_get_attr(fake_freq_table, policy->cpu);
+	return 0;
+}
+
+static int fake_cpu_exit(struct cpufreq_policy *policy)
+{
+	cpufreq_frequency_table_put_attr(policy->cpu);
+	return 0;
+}
+
+static struct freq_attr *fake_attr[] = {
+	&cpufreq_freq_attr_scaling_available_freqs,
+	NULL,
+};
+
+/* Nothing really changes speed, so delays and clocks need no scaling. */
+static struct cpufreq_driver fake_cpufreq_driver = {
+	.name		= "fake",
+	.owner		= THIS_MODULE,
+	.flags		= CPUFREQ_CONST_LOOPS,
+	.verify		= fake_verify,
+	.target		= fake_target,
+	.get		= fake_get,
+	.init		= fake_cpu_init,
+	.exit		= fake_cpu_exit,
+	.attr		= fake_attr,
+};
+
+static int __init fake_cpufreq_init(void)
+{
+	return cpufreq_register_driver(&fake_cpufreq_driver);
+}
+
+static void __exit fake_cpufreq_exit(void)
+{
+	cpufreq_unregister_driver(&fake_cpufreq_driver);
+}
+
+module_init(fake_cpufreq_init);
+module_exit(fake_cpufreq_exit);
+
+MODULE_DESCRIPTION("cpufreq driver that only pretends to change speed");
+MODULE_LICENSE("GPL");
@@ -20,11 +20,11 @@
 #include <linux/cpu.h>
 #include <linux/cpumask.h>
 #include <linux/cpufreq.h>
+#include <linux/input.h>
+#include <linux/ktime.h>
 #include <linux/mutex.h>
 #include <linux/sched.h>
-#ifdef CONFIG_DYNAMIC_FREQ_MODE
 #include <linux/slab.h>
-#endif
 #include <linux/tick.h>
 #include <linux/timer.h>
 #include <linux/workqueue.h>
@@ -32,6 +32,8 @@
 
 #include <asm/cputime.h>
 
+#include "cpufreq_interactive_policy.h"
+
 static void (*pm_idle_old)(void);
 static atomic_t active_count = ATOMIC_INIT(0);
 
@@ -50,6 +52,11 @@ struct cpufreq_interactive_cpuinfo {
 	struct cpufreq_frequency_table *freq_table;
 	unsigned int target_freq;
 	int governor_enabled;
+	u64 boost_until;
+	/* Up worker of the policy this cpu owns, kept across governor stops */
+	struct task_struct *up_task;
+	spinlock_t up_lock;
+	int up_pending;
 #ifdef CONFIG_DYNAMIC_FREQ_MODE
 	unsigned long boosted;
 #endif
@@ -57,18 +64,25 @@ struct cpufreq_interactive_cpuinfo {
 
 static DEFINE_PER_CPU(struct cpufreq_interactive_cpuinfo, cpuinfo);
 
-/* Workqueues handle frequency scaling */
-static struct task_struct *up_task;
+/*
+ * Ramping up is done by a realtime worker per policy, ramping down by a
+ * workqueue shared by all policies.
+ */
 static struct workqueue_struct *down_wq;
 static struct work_struct freq_scale_down_work;
-static cpumask_t up_cpumask;
-static spinlock_t up_cpumask_lock;
 static cpumask_t down_cpumask;
 static spinlock_t down_cpumask_lock;
 
-/* Go to max speed when CPU load at or above this value. */
+/*
+ * Go to max speed when CPU load at or above the target load for the
+ * current speed. The table is "load freq:load freq:load ...": the first
+ * load applies below the first freq, each following load from its freq up.
+ */
 #define DEFAULT_GO_MAXSPEED_LOAD 85
-static unsigned long go_maxspeed_load;
+static unsigned int default_target_loads[] = { DEFAULT_GO_MAXSPEED_LOAD };
+static unsigned int *target_loads = default_target_loads;
+static int ntarget_loads = ARRAY_SIZE(default_target_loads);
+static DEFINE_SPINLOCK(target_loads_lock);
 
 /* Base of exponential raise to max speed; if 0 - jump to maximum */
 static unsigned long boost_factor;
@@ -91,6 +105,14 @@ static unsigned long sustain_load;
 #define DEFAULT_MIN_SAMPLE_TIME 30000;
 static unsigned long min_sample_time;
 
+/*
+ * On touch or key input, hold every policy at input_boost_freq (kHz, 0 for
+ * the policy max) for input_boost_duration us. A duration of 0 disables it.
+ */
+#define DEFAULT_INPUT_BOOST_DURATION 80000
+static unsigned long input_boost_duration;
+static unsigned long input_boost_freq;
+
 #ifdef CONFIG_DYNAMIC_FREQ_MODE
 /*
  * Parameters for dynamic frequency mode
@@ -383,37 +405,29 @@ static unsigned int cpufreq_interactive_dynamic_freq_get_target(
 }
 #endif /* CONFIG_DYNAMIC_FREQ_MODE */
 
-static unsigned int cpufreq_interactive_get_target(
-	int cpu_load, int load_since_change, struct cpufreq_policy *policy)
+static unsigned int freq_to_targetload(unsigned int freq)
 {
-	unsigned int target_freq;
-
-	/*
-	 * Choose greater of short-term load (since last idle timer
-	 * started or timer function re-armed itself) or long-term load
-	 * (since last frequency change).
-	 */
-	if (load_since_change > cpu_load)
-		cpu_load = load_since_change;
-
-	if (cpu_load >= go_maxspeed_load) {
-		if (!boost_factor)
-			return policy->max;
-
-		target_freq = policy->cur * boost_factor;
-
-		if (max_boost && target_freq > policy->cur + max_boost)
-			target_freq = policy->cur + max_boost;
-	}
-	else {
-		if (!sustain_load)
-			return policy->max * cpu_load / 100;
+	unsigned long flags;
+	unsigned int ret;
 
-		target_freq = policy->cur * cpu_load / sustain_load;
-	}
+	spin_lock_irqsave(&target_loads_lock, flags);
+	ret = interactive_target_load(target_loads, ntarget_loads, freq);
+	spin_unlock_irqrestore(&target_loads_lock, flags);
+	return ret;
+}
 
-	target_freq = min(target_freq, policy->max);
-	return target_freq;
+static unsigned int cpufreq_interactive_get_target(
+	int cpu_load, int load_since_change, struct cpufreq_policy *policy)
+{
+	struct interactive_params params = {
+		.boost_factor = boost_factor,
+		.max_boost = max_boost,
+		.sustain_load = sustain_load,
+	};
+
+	return interactive_get_target(&params, freq_to_targetload(policy->cur),
+				      cpu_load, load_since_change,
+				      policy->cur, policy->max);
 }
 
 static inline cputime64_t get_cpu_iowait_time(
@@ -427,6 +441,26 @@ static inline cputime64_t get_cpu_iowait_time(
 	return iowait_time;
 }
 
+static unsigned int cpufreq_interactive_boost_freq(
+	struct cpufreq_interactive_cpuinfo *pcpu)
+{
+	return interactive_boost_freq(input_boost_freq, pcpu->policy->max);
+}
+
+/* Hand pcpu->target_freq to the up worker of its policy. */
+static void cpufreq_interactive_up(struct cpufreq_interactive_cpuinfo *pcpu)
+{
+	unsigned long flags;
+
+#if DEBUG
+	up_request_time = ktime_to_us(ktime_get());
+#endif
+	spin_lock_irqsave(&pcpu->up_lock, flags);
+	pcpu->up_pending = 1;
+	spin_unlock_irqrestore(&pcpu->up_lock, flags);
+	wake_up_process(pcpu->up_task);
+}
+
 static void cpufreq_interactive_timer(unsigned long data)
 {
 	unsigned int delta_idle;
@@ -532,6 +566,11 @@ static void cpufreq_interactive_timer(unsigned long data)
 	new_freq = cpufreq_interactive_get_target(cpu_load, load_since_change,
 						  pcpu->policy);
 
+	/* Stay at the input boost speed until the boost runs out. */
+	smp_rmb();
+	if (pcpu->timer_run_time < pcpu->boost_until)
+		new_freq = max(new_freq, cpufreq_interactive_boost_freq(pcpu));
+
 	if (cpufreq_frequency_table_target(pcpu->policy, pcpu->freq_table,
 					   new_freq, CPUFREQ_RELATION_H,
 					   &index)) {
@@ -569,13 +608,7 @@ static void cpufreq_interactive_timer(unsigned long data)
 		queue_work(down_wq, &freq_scale_down_work);
 	} else {
 		pcpu->target_freq = new_freq;
-#if DEBUG
-		up_request_time = ktime_to_us(ktime_get());
-#endif
-		spin_lock_irqsave(&up_cpumask_lock, flags);
-		cpumask_set_cpu(data, &up_cpumask);
-		spin_unlock_irqrestore(&up_cpumask_lock, flags);
-		wake_up_process(up_task);
+		cpufreq_interactive_up(pcpu);
 	}
 
 rearm_if_notmax:
@@ -712,10 +745,9 @@ static void cpufreq_interactive_idle(void)
 
 static int cpufreq_interactive_up_task(void *data)
 {
-	unsigned int cpu;
-	cpumask_t tmp_mask;
+	unsigned int cpu = (unsigned long)data;
+	struct cpufreq_interactive_cpuinfo *pcpu = &per_cpu(cpuinfo, cpu);
 	unsigned long flags;
-	struct cpufreq_interactive_cpuinfo *pcpu;
 
 #if DEBUG
 	u64 now;
@@ -725,19 +757,21 @@ static int cpufreq_interactive_up_task(void *data)
 
 	while (1) {
 		set_current_state(TASK_INTERRUPTIBLE);
-		spin_lock_irqsave(&up_cpumask_lock, flags);
+		spin_lock_irqsave(&pcpu->up_lock, flags);
 
-		if (cpumask_empty(&up_cpumask)) {
-			spin_unlock_irqrestore(&up_cpumask_lock, flags);
+		if (!pcpu->up_pending) {
+			spin_unlock_irqrestore(&pcpu->up_lock, flags);
 			schedule();
 
 			if (kthread_should_stop())
 				break;
 
-			spin_lock_irqsave(&up_cpumask_lock, flags);
+			spin_lock_irqsave(&pcpu->up_lock, flags);
 		}
 
 		set_current_state(TASK_RUNNING);
+		pcpu->up_pending = 0;
+		spin_unlock_irqrestore(&pcpu->up_lock, flags);
 
 #if DEBUG
 		then = up_request_time;
@@ -751,38 +785,167 @@ static int cpufreq_interactive_up_task(void *data)
 		}
 #endif
 
-		tmp_mask = up_cpumask;
-		cpumask_clear(&up_cpumask);
-		spin_unlock_irqrestore(&up_cpumask_lock, flags);
+		if (nr_running() == 1) {
+			dbgpr("up %d: tgt=%d nothing else running\n", cpu,
+			      pcpu->target_freq);
+		}
 
-		for_each_cpu(cpu, &tmp_mask) {
-			pcpu = &per_cpu(cpuinfo, cpu);
+		smp_rmb();
 
-			if (nr_running() == 1) {
-				dbgpr("up %d: tgt=%d nothing else running\n", cpu,
-				      pcpu->target_freq);
-			}
+		if (!pcpu->governor_enabled)
+			continue;
 
-			smp_rmb();
+		__cpufreq_driver_target(pcpu->policy,
+					pcpu->target_freq,
+					CPUFREQ_RELATION_H);
+		pcpu->freq_change_time_in_idle =
+			get_cpu_idle_time_us(cpu,
+					     &pcpu->freq_change_time);
+		pcpu->freq_change_time_in_iowait =
+			get_cpu_iowait_time(cpu, NULL);
+		dbgpr("up %d: set tgt=%d (actual=%d)\n", cpu, pcpu->target_freq, pcpu->policy->cur);
+	}
 
-			if (!pcpu->governor_enabled)
-				continue;
-
-			__cpufreq_driver_target(pcpu->policy,
-						pcpu->target_freq,
-						CPUFREQ_RELATION_H);
-			pcpu->freq_change_time_in_idle =
-				get_cpu_idle_time_us(cpu,
-						     &pcpu->freq_change_time);
-			pcpu->freq_change_time_in_iowait =
-				get_cpu_iowait_time(cpu, NULL);
-			dbgpr("up %d: set tgt=%d (actual=%d)\n", cpu, pcpu->target_freq, pcpu->policy->cur);
-		}
+	__set_current_state(TASK_RUNNING);
+	return 0;
+}
+
+static int cpufreq_interactive_start_up_task(unsigned int cpu)
+{
+	struct cpufreq_interactive_cpuinfo *pcpu = &per_cpu(cpuinfo, cpu);
+	struct sched_param param = { .sched_priority = MAX_RT_PRIO-1 };
+	struct task_struct *task;
+
+	if (pcpu->up_task)
+		return 0;
+
+	task = kthread_create(cpufreq_interactive_up_task,
+			      (void *)(unsigned long)cpu, "kinteractiveup/%u",
+			      cpu);
+	if (IS_ERR(task))
+		return PTR_ERR(task);
+
+	sched_setscheduler_nocheck(task, SCHED_FIFO, &param);
+	get_task_struct(task);
+	pcpu->up_task = task;
+	return 0;
+}
+
+/*
+ * Raise every policy to the input boost speed right away, rather than
+ * waiting for the load the input is about to cause to show up in a
+ * timer sample. Called with the input device's event lock held.
+ */
+static void cpufreq_interactive_boost(void)
+{
+	unsigned int cpu;
+	unsigned int freq;
+	u64 now = ktime_to_us(ktime_get());
+	struct cpufreq_interactive_cpuinfo *pcpu;
+
+	for_each_online_cpu(cpu) {
+		pcpu = &per_cpu(cpuinfo, cpu);
+
+		smp_rmb();
+
+		if (!pcpu->governor_enabled)
+			continue;
+
+		pcpu->boost_until = now + input_boost_duration;
+		smp_wmb();
+
+		freq = cpufreq_interactive_boost_freq(pcpu);
+		if (pcpu->target_freq >= freq)
+			continue;
+
+		dbgpr("boost %d: cur=%d tgt=%d\n", cpu, pcpu->target_freq, freq);
+		pcpu->target_freq = freq;
+		cpufreq_interactive_up(pcpu);
 	}
+}
+
+static void cpufreq_interactive_input_event(struct input_handle *handle,
+					    unsigned int type,
+					    unsigned int code, int value)
+{
+	/* Once per report rather than once per axis or key. */
+	if (type == EV_SYN && code == SYN_REPORT && input_boost_duration)
+		cpufreq_interactive_boost();
+}
+
+static int cpufreq_interactive_input_connect(struct input_handler *handler,
+					     struct input_dev *dev,
+					     const struct input_device_id *id)
+{
+	struct input_handle *handle;
+	int ret;
+
+	handle = kzalloc(sizeof(*handle), GFP_KERNEL);
+	if (!handle)
+		return -ENOMEM;
+
+	handle->dev = dev;
+	handle->handler = handler;
+	handle->name = "cpufreq_interactive";
+
+	ret = input_register_handle(handle);
+	if (ret)
+		goto err_input_register_handle;
+
+	ret = input_open_device(handle);
+	if (ret)
+		goto err_input_open_device;
 
 	return 0;
+
+err_input_open_device:
+	input_unregister_handle(handle);
+err_input_register_handle:
+	kfree(handle);
+	return ret;
 }
 
+static void cpufreq_interactive_input_disconnect(struct input_handle *handle)
+{
+	input_close_device(handle);
+	input_unregister_handle(handle);
+	kfree(handle);
+}
+
+static const struct input_device_id cpufreq_interactive_ids[] = {
+	/* multi-touch touchscreens */
+	{
+		.flags = INPUT_DEVICE_ID_MATCH_EVBIT |
+			 INPUT_DEVICE_ID_MATCH_ABSBIT,
+		.evbit = { BIT_MASK(EV_ABS) },
+		.absbit = { [BIT_WORD(ABS_MT_POSITION_X)] =
+			    BIT_MASK(ABS_MT_POSITION_X) |
+			    BIT_MASK(ABS_MT_POSITION_Y) },
+	},
+	/* touchpads and single-touch touchscreens */
+	{
+		.flags = INPUT_DEVICE_ID_MATCH_KEYBIT |
+			 INPUT_DEVICE_ID_MATCH_ABSBIT,
+		.keybit = { [BIT_WORD(BTN_TOUCH)] = BIT_MASK(BTN_TOUCH) },
+		.absbit = { [BIT_WORD(ABS_X)] =
+			    BIT_MASK(ABS_X) | BIT_MASK(ABS_Y) },
+	},
+	/* keypads */
+	{
+		.flags = INPUT_DEVICE_ID_MATCH_EVBIT,
+		.evbit = { BIT_MASK(EV_KEY) },
+	},
+	{ },
+};
+
+static struct input_handler cpufreq_interactive_input_handler = {
+	.event		= cpufreq_interactive_input_event,
+	.connect	= cpufreq_interactive_input_connect,
+	.disconnect	= cpufreq_interactive_input_disconnect,
+	.name		= "cpufreq_interactive",
+	.id_table	= cpufreq_interactive_ids,
+};
+
 static void cpufreq_interactive_freq_down(struct work_struct *work)
 {
 	unsigned int cpu;
@@ -815,18 +978,127 @@ static void cpufreq_interactive_freq_down(struct work_struct *work)
 	}
 }
 
+/*
+ * Parse "load freq:load freq:load ...", with loads of 1 to 100 and freqs
+ * in increasing order.
+ */
+static unsigned int *get_target_loads(const char *buf, int *num_tokens)
+{
+	const char *cp;
+	unsigned int *tokens;
+	int ntokens = 1;
+	int i;
+
+	cp = buf;
+	while ((cp = strpbrk(cp + 1, " :")))
+		ntokens++;
+
+	if (!(ntokens & 0x1))
+		return ERR_PTR(-EINVAL);
+
+	tokens = kmalloc(ntokens * sizeof(unsigned int), GFP_KERNEL);
+	if (!tokens)
+		return ERR_PTR(-ENOMEM);
+
+	cp = buf;
+	for (i = 0; i < ntokens; i++) {
+		if (sscanf(cp, "%u", &tokens[i]) != 1)
+			goto err;
+
+		if (i & 0x1) {
+			if (i > 1 && tokens[i] <= tokens[i - 2])
+				goto err;
+		} else if (!tokens[i] || tokens[i] > 100) {
+			goto err;
+		}
+
+		cp = strpbrk(cp, " :");
+		if (cp)
+			cp++;
+		else if (i != ntokens - 1)
+			goto err;
+	}
+
+	*num_tokens = ntokens;
+	return tokens;
+
+err:
+	kfree(tokens);
+	return ERR_PTR(-EINVAL);
+}
+
+static void set_target_loads(unsigned int *new_target_loads, int ntokens)
+{
+	unsigned int *old;
+	unsigned long flags;
+
+	spin_lock_irqsave(&target_loads_lock, flags);
+	old = target_loads;
+	target_loads = new_target_loads;
+	ntarget_loads = ntokens;
+	spin_unlock_irqrestore(&target_loads_lock, flags);
+
+	if (old != default_target_loads)
+		kfree(old);
+}
+
+static ssize_t show_target_loads(struct kobject *kobj,
+				 struct attribute *attr, char *buf)
+{
+	unsigned long flags;
+	ssize_t ret = 0;
+	int i;
+
+	spin_lock_irqsave(&target_loads_lock, flags);
+	for (i = 0; i < ntarget_loads; i++)
+		ret += sprintf(buf + ret, "%u%s", target_loads[i],
+			       i & 0x1 ? ":" : " ");
+	spin_unlock_irqrestore(&target_loads_lock, flags);
+
+	buf[ret - 1] = '\n';
+	return ret;
+}
+
+static ssize_t store_target_loads(struct kobject *kobj,
+			struct attribute *attr, const char *buf, size_t count)
+{
+	unsigned int *new_target_loads;
+	int ntokens;
+
+	new_target_loads = get_target_loads(buf, &ntokens);
+	if (IS_ERR(new_target_loads))
+		return PTR_ERR(new_target_loads);
+
+	set_target_loads(new_target_loads, ntokens);
+	return count;
+}
+
+static struct global_attr target_loads_attr = __ATTR(target_loads, 0644,
+		show_target_loads, store_target_loads);
+
+/* The old single threshold: reads the first load, writes a flat table. */
 static ssize_t show_go_maxspeed_load(struct kobject *kobj,
 				     struct attribute *attr, char *buf)
 {
-	return sprintf(buf, "%lu\n", go_maxspeed_load);
+	return sprintf(buf, "%u\n", freq_to_targetload(0));
 }
 
 static ssize_t store_go_maxspeed_load(struct kobject *kobj,
 			struct attribute *attr, const char *buf, size_t count)
 {
-	if (!strict_strtoul(buf, 0, &go_maxspeed_load))
-		return count;
-	return -EINVAL;
+	unsigned int *new_target_loads;
+	unsigned long val;
+
+	if (strict_strtoul(buf, 0, &val) || !val || val > 100)
+		return -EINVAL;
+
+	new_target_loads = kmalloc(sizeof(unsigned int), GFP_KERNEL);
+	if (!new_target_loads)
+		return -ENOMEM;
+
+	new_target_loads[0] = val;
+	set_target_loads(new_target_loads, 1);
+	return count;
 }
 
 static struct global_attr go_maxspeed_load_attr = __ATTR(go_maxspeed_load, 0644,
@@ -918,6 +1190,41 @@ static ssize_t store_min_sample_time(struct kobject *kobj,
 static struct global_attr min_sample_time_attr = __ATTR(min_sample_time, 0644,
 		show_min_sample_time, store_min_sample_time);
 
+static ssize_t show_input_boost_duration(struct kobject *kobj,
+				struct attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", input_boost_duration);
+}
+
+static ssize_t store_input_boost_duration(struct kobject *kobj,
+			struct attribute *attr, const char *buf, size_t count)
+{
+	if (!strict_strtoul(buf, 0, &input_boost_duration))
+		return count;
+	return -EINVAL;
+}
+
+static struct global_attr input_boost_duration_attr =
+	__ATTR(input_boost_duration, 0644, show_input_boost_duration,
+	       store_input_boost_duration);
+
+static ssize_t show_input_boost_freq(struct kobject *kobj,
+				struct attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", input_boost_freq);
+}
+
+static ssize_t store_input_boost_freq(struct kobject *kobj,
+			struct attribute *attr, const char *buf, size_t count)
+{
+	if (!strict_strtoul(buf, 0, &input_boost_freq))
+		return count;
+	return -EINVAL;
+}
+
+static struct global_attr input_boost_freq_attr = __ATTR(input_boost_freq,
+		0644, show_input_boost_freq, store_input_boost_freq);
+
 #ifdef CONFIG_DYNAMIC_FREQ_MODE
 static ssize_t show_dynamic_freq_mode(struct kobject *kobj,
 			struct attribute *attr, char *buf)
@@ -947,12 +1254,15 @@ static struct global_attr dynamic_freq_mode_attr = __ATTR(dynamic_freq_mode,
 #endif /* CONFIG_DYNAMIC_FREQ_MODE */
 
 static struct attribute *interactive_attributes[] = {
+	&target_loads_attr.attr,
 	&go_maxspeed_load_attr.attr,
 	&boost_factor_attr.attr,
 	&max_boost_attr.attr,
 	&io_is_busy_attr.attr,
 	&sustain_load_attr.attr,
 	&min_sample_time_attr.attr,
+	&input_boost_duration_attr.attr,
+	&input_boost_freq_attr.attr,
 #ifdef CONFIG_DYNAMIC_FREQ_MODE
 	&dynamic_freq_mode_attr.attr,
 #endif
@@ -976,6 +1286,10 @@ static int cpufreq_governor_interactive(struct cpufreq_policy *new_policy,
 		if (!cpu_online(new_policy->cpu))
 			return -EINVAL;
 
+		rc = cpufreq_interactive_start_up_task(new_policy->cpu);
+		if (rc)
+			return rc;
+
 		pcpu->policy = new_policy;
 		pcpu->freq_table = cpufreq_frequency_get_table(new_policy->cpu);
 		pcpu->target_freq = new_policy->cur;
@@ -987,6 +1301,7 @@ static int cpufreq_governor_interactive(struct cpufreq_policy *new_policy,
 			get_cpu_iowait_time(new_policy->cpu, NULL);
 		pcpu->time_in_iowait = pcpu->freq_change_time_in_iowait;
 		pcpu->idle_exit_time = pcpu->freq_change_time;
+		pcpu->boost_until = 0;
 		pcpu->timer_idlecancel = 1;
 		pcpu->governor_enabled = 1;
 		smp_wmb();
@@ -1006,6 +1321,11 @@ static int cpufreq_governor_interactive(struct cpufreq_policy *new_policy,
 		if (rc)
 			return rc;
 
+		rc = input_register_handler(&cpufreq_interactive_input_handler);
+		if (rc)
+			pr_warn("%s: failed to register input handler: %d\n",
+				__func__, rc);
+
 		pm_idle_old = pm_idle;
 		pm_idle = cpufreq_interactive_idle;
 #ifdef CONFIG_DYNAMIC_FREQ_MODE
@@ -1029,6 +1349,7 @@ static int cpufreq_governor_interactive(struct cpufreq_policy *new_policy,
 		if (atomic_dec_return(&active_count) > 0)
 			return 0;
 
+		input_unregister_handler(&cpufreq_interactive_input_handler);
 		sysfs_remove_group(cpufreq_global_kobject,
 				&interactive_attr_group);
 
@@ -1051,13 +1372,12 @@ static int __init cpufreq_interactive_init(void)
 {
 	unsigned int i;
 	struct cpufreq_interactive_cpuinfo *pcpu;
-	struct sched_param param = { .sched_priority = MAX_RT_PRIO-1 };
 #ifdef CONFIG_DYNAMIC_FREQ_MODE
 	int ret;
 #endif
 
-	go_maxspeed_load = DEFAULT_GO_MAXSPEED_LOAD;
 	min_sample_time = DEFAULT_MIN_SAMPLE_TIME;
+	input_boost_duration = DEFAULT_INPUT_BOOST_DURATION;
 
 	/* Initalize per-cpu timers */
 	for_each_possible_cpu(i) {
@@ -1065,6 +1385,7 @@ static int __init cpufreq_interactive_init(void)
 		init_timer(&pcpu->cpu_timer);
 		pcpu->cpu_timer.function = cpufreq_interactive_timer;
 		pcpu->cpu_timer.data = i;
+		spin_lock_init(&pcpu->up_lock);
 	}
 
 #ifdef CONFIG_DYNAMIC_FREQ_MODE
@@ -1073,29 +1394,16 @@ static int __init cpufreq_interactive_init(void)
 		return ret;
 #endif
 
-	up_task = kthread_create(cpufreq_interactive_up_task, NULL,
-				 "kinteractiveup");
-	if (IS_ERR(up_task)) {
-#ifdef CONFIG_DYNAMIC_FREQ_MODE
-		cpufreq_interactive_dynamic_freq_free();
-#endif
-		return PTR_ERR(up_task);
-	}
-
-	sched_setscheduler_nocheck(up_task, SCHED_FIFO, &param);
-	get_task_struct(up_task);
-
 	/* No rescuer thread, bind to CPU queuing the work for possibly
 	   warm cache (probably doesn't matter much). */
 	down_wq = alloc_workqueue("knteractive_down", 0, 1);
 
 	if (! down_wq)
-		goto err_freeuptask;
+		goto err_free;
 
 	INIT_WORK(&freq_scale_down_work,
 		  cpufreq_interactive_freq_down);
 
-	spin_lock_init(&up_cpumask_lock);
 	spin_lock_init(&down_cpumask_lock);
 
 #if DEBUG
@@ -1106,8 +1414,7 @@ static int __init cpufreq_interactive_init(void)
 
 	return cpufreq_register_governor(&cpufreq_gov_interactive);
 
-err_freeuptask:
-	put_task_struct(up_task);
+err_free:
 #ifdef CONFIG_DYNAMIC_FREQ_MODE
 	cpufreq_interactive_dynamic_freq_free();
 #endif
@@ -1122,10 +1429,22 @@ module_init(cpufreq_interactive_init);
 
 static void __exit cpufreq_interactive_exit(void)
 {
+	unsigned int i;
+	struct cpufreq_interactive_cpuinfo *pcpu;
+
 	cpufreq_unregister_governor(&cpufreq_gov_interactive);
-	kthread_stop(up_task);
-	put_task_struct(up_task);
+
+	for_each_possible_cpu(i) {
+		pcpu = &per_cpu(cpuinfo, i);
+		if (!pcpu->up_task)
+			continue;
+		kthread_stop(pcpu->up_task);
+		put_task_struct(pcpu->up_task);
+	}
+
 	destroy_workqueue(down_wq);
+	set_target_loads(default_target_loads,
+			 ARRAY_SIZE(default_target_loads));
 #ifdef CONFIG_DYNAMIC_FREQ_MODE
 	cpufreq_interactive_dynamic_freq_free();
 #endif
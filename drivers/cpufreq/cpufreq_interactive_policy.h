@@ -0,0 +1,89 @@
+/*
+ * drivers/cpufreq/cpufreq_interactive_policy.h
+ *
+ * Speed selection of the interactive governor
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef __CPUFREQ_INTERACTIVE_POLICY_H
+#define __CPUFREQ_INTERACTIVE_POLICY_H
+
+/*
+ * Nothing in here touches kernel state: the governor samples the load and
+ * applies the speed, so the choice can be replayed against recorded load
+ * traces with tools/cpufreq-interactive.
+ */
+
+struct interactive_params {
+	unsigned long boost_factor;	/* 0 jumps to max on target load */
+	unsigned long max_boost;	/* kHz, 0 for no limit */
+	unsigned long sustain_load;	/* 0 scales from max, not cur */
+};
+
+/*
+ * Looks up the target load for a speed in a "load freq:load ..." table,
+ * which holds ntarget_loads (odd) entries with freqs increasing.
+ */
+static inline unsigned int
+interactive_target_load(const unsigned int *target_loads, int ntarget_loads,
+			unsigned int freq)
+{
+	int i;
+
+	for (i = 0; i < ntarget_loads - 1 && freq >= target_loads[i + 1]; i += 2)
+		;
+	return target_loads[i];
+}
+
+/*
+ * The speed wanted for the greater of the short-term load (since the
+ * timer was armed) and the long-term load (since the last speed change),
+ * given the target load of the current speed.
+ */
+static inline unsigned int
+interactive_get_target(const struct interactive_params *params,
+		       unsigned int target_load, int cpu_load,
+		       int load_since_change, unsigned int cur,
+		       unsigned int max)
+{
+	unsigned int target_freq;
+
+	if (load_since_change > cpu_load)
+		cpu_load = load_since_change;
+
+	if (cpu_load >= (int)target_load) {
+		if (!params->boost_factor)
+			return max;
+
+		target_freq = cur * params->boost_factor;
+
+		if (params->max_boost && target_freq > cur + params->max_boost)
+			target_freq = cur + params->max_boost;
+	} else {
+		if (!params->sustain_load)
+			return max * cpu_load / 100;
+
+		target_freq = cur * cpu_load / params->sustain_load;
+	}
+
+	return target_freq < max ? target_freq : max;
+}
+
+/* The floor held during an input boost, boost_freq 0 meaning max */
+static inline unsigned int
+interactive_boost_freq(unsigned int boost_freq, unsigned int max)
+{
+	if (!boost_freq || boost_freq > max)
+		return max;
+	return boost_freq;
+}
+
+#endif
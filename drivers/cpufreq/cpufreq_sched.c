@@ -0,0 +1,451 @@
+/*
+ * drivers/cpufreq/cpufreq_sched.c
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * A cpufreq governor driven by the scheduler rather than by a sampling
+ * timer. The scheduler reports every enqueue, dequeue and tick; from
+ * those the governor knows how long each runqueue has had runnable tasks
+ * in the current and the previous window, and asks for a new speed as
+ * soon as that changes what the policy needs.
+ */
+
+#include <linux/cpufreq.h>
+#include <linux/cpumask.h>
+#include <linux/kthread.h>
+#include <linux/math64.h>
+#include <linux/percpu.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/timer.h>
+
+static atomic_t active_count = ATOMIC_INIT(0);
+
+/* Length of the windows busy time is accounted in. */
+#define DEFAULT_WINDOW_US		10000
+#define MAX_WINDOW_US			1000000
+static unsigned long window_us = DEFAULT_WINDOW_US;
+
+/* Pick the speed that keeps the busiest cpu of a policy at this load. */
+#define DEFAULT_TARGET_LOAD		80
+static unsigned long target_load = DEFAULT_TARGET_LOAD;
+
+/*
+ * Minimum time between two requests for a policy, going up and going
+ * down. Ramping down is held off longer so a short lull in a busy period
+ * does not cost a round trip through the lower speeds.
+ */
+#define DEFAULT_UP_THROTTLE_US		1000
+#define DEFAULT_DOWN_THROTTLE_US	20000
+static unsigned long up_throttle_us = DEFAULT_UP_THROTTLE_US;
+static unsigned long down_throttle_us = DEFAULT_DOWN_THROTTLE_US;
+
+struct cpufreq_sched_policy {
+	struct cpufreq_policy *policy;
+	raw_spinlock_t lock;		/* serializes requests */
+	unsigned int requested_freq;
+	bool limits_changed;		/* task must apply the limits */
+	u64 last_request;
+	struct timer_list kick;		/* wakes the task */
+	struct task_struct *task;
+	unsigned int target_freq;	/* last speed the task set */
+};
+
+/*
+ * Busy time is scaled by the speed it was spent at over the max speed,
+ * so windows accounted at different speeds compare.
+ */
+struct cpufreq_sched_cpu {
+	struct cpufreq_sched_policy *sp;
+	u64 last_update;
+	u64 window_start;
+	u64 curr_busy;
+	u64 prev_busy;
+	unsigned int nr_running;
+	unsigned int freq;		/* speed this cpu alone needs */
+};
+
+static DEFINE_PER_CPU(struct cpufreq_sched_cpu, cpufreq_sched_cpu);
+
+static int cpufreq_governor_sched(struct cpufreq_policy *policy,
+		unsigned int event);
+
+#ifndef CONFIG_CPU_FREQ_DEFAULT_GOV_SCHED
+static
+#endif
+struct cpufreq_governor cpufreq_gov_sched = {
+	.name = "sched",
+	.governor = cpufreq_governor_sched,
+	.max_transition_latency = 10000000,
+	.owner = THIS_MODULE,
+};
+
+static inline u64 cpufreq_sched_scale(struct cpufreq_policy *policy, u64 delta)
+{
+	return div_u64(delta * policy->cur, policy->cpuinfo.max_freq);
+}
+
+static void cpufreq_sched_account(struct cpufreq_sched_cpu *sc,
+				  struct cpufreq_policy *policy, u64 now,
+				  u64 window)
+{
+	u64 window_end = sc->window_start + window;
+	u64 from = sc->last_update;
+	u64 nr_windows;
+
+	if (now >= window_end) {
+		if (sc->nr_running)
+			sc->curr_busy += cpufreq_sched_scale(policy,
+							     window_end - from);
+		sc->prev_busy = sc->curr_busy;
+		sc->curr_busy = 0;
+
+		/* Windows without an update were busy or idle throughout. */
+		nr_windows = div_u64(now - window_end, window);
+		if (nr_windows)
+			sc->prev_busy = sc->nr_running ?
+				cpufreq_sched_scale(policy, window) : 0;
+
+		sc->window_start = window_end + nr_windows * window;
+		from = sc->window_start;
+	}
+
+	if (sc->nr_running)
+		sc->curr_busy += cpufreq_sched_scale(policy, now - from);
+	sc->last_update = now;
+}
+
+static unsigned int cpufreq_sched_policy_freq(struct cpufreq_sched_policy *sp,
+					      u64 now, u64 window)
+{
+	struct cpufreq_sched_cpu *sc;
+	unsigned int freq = 0;
+	int cpu;
+
+	for_each_cpu_and(cpu, sp->policy->cpus, cpu_online_mask) {
+		sc = &per_cpu(cpufreq_sched_cpu, cpu);
+
+		/* A cpu that went idle a while ago needs nothing. */
+		if (!sc->nr_running && (s64)(now - sc->last_update) > window)
+			continue;
+
+		freq = max(freq, sc->freq);
+	}
+
+	return clamp(freq, sp->policy->min, sp->policy->max);
+}
+
+static void cpufreq_sched_request(struct cpufreq_sched_policy *sp, u64 now,
+				  u64 window)
+{
+	unsigned int freq;
+	u64 throttle;
+
+	/*
+	 * Every enqueue and dequeue of every cpu in the policy gets here,
+	 * almost always without anything to change. Only take the lock,
+	 * and its cacheline, when a different speed looks to be needed.
+	 */
+	freq = cpufreq_sched_policy_freq(sp, now, window);
+	if (freq == ACCESS_ONCE(sp->requested_freq))
+		return;
+
+	raw_spin_lock(&sp->lock);
+
+	freq = cpufreq_sched_policy_freq(sp, now, window);
+	if (freq == sp->requested_freq)
+		goto out;
+
+	throttle = freq > sp->requested_freq ? up_throttle_us : down_throttle_us;
+	if ((s64)(now - sp->last_request) < (s64)(throttle * NSEC_PER_USEC))
+		goto out;
+
+	sp->requested_freq = freq;
+	sp->last_request = now;
+
+	/*
+	 * The runqueue lock is held, so the task can't be woken from here.
+	 * A timer due now wakes it from the next tick instead. An irq_work
+	 * would not be any quicker where the arch can't raise one itself,
+	 * as on ARM, and a cpu going idle meanwhile would stop its tick and
+	 * hold the irq_work back until some other interrupt; a pending
+	 * timer keeps that tick.
+	 */
+	if (!timer_pending(&sp->kick))
+		mod_timer(&sp->kick, jiffies);
+out:
+	raw_spin_unlock(&sp->lock);
+}
+
+/*
+ * Called by the scheduler with the runqueue of @cpu locked, after a task
+ * of any class is enqueued or dequeued, and on each tick. @nr_running
+ * counts the tasks of all classes. @now is the runqueue clock, in ns.
+ */
+void cpufreq_sched_update(int cpu, u64 now, unsigned int nr_running)
+{
+	struct cpufreq_sched_cpu *sc = &per_cpu(cpufreq_sched_cpu, cpu);
+	struct cpufreq_sched_policy *sp = ACCESS_ONCE(sc->sp);
+	struct cpufreq_policy *policy;
+	u64 window = window_us * NSEC_PER_USEC;
+	u64 busy;
+
+	if (!sp)
+		return;
+
+	policy = sp->policy;
+
+	if (!sc->last_update) {
+		sc->window_start = now;
+		sc->last_update = now;
+		sc->nr_running = nr_running;
+		return;
+	}
+
+	if (now < sc->last_update)
+		return;
+
+	cpufreq_sched_account(sc, policy, now, window);
+	sc->nr_running = nr_running;
+
+	busy = max(sc->prev_busy, sc->curr_busy);
+	sc->freq = div_u64(div_u64(busy * policy->cpuinfo.max_freq,
+				   (u32)window) * 100, target_load);
+
+	cpufreq_sched_request(sp, now, window);
+}
+
+static void cpufreq_sched_kick(unsigned long data)
+{
+	struct cpufreq_sched_policy *sp = (struct cpufreq_sched_policy *)data;
+
+	wake_up_process(sp->task);
+}
+
+static int cpufreq_sched_thread(void *data)
+{
+	struct cpufreq_sched_policy *sp = data;
+	unsigned long flags;
+	unsigned int freq;
+	bool limits_changed;
+
+	while (!kthread_should_stop()) {
+		set_current_state(TASK_INTERRUPTIBLE);
+
+		raw_spin_lock_irqsave(&sp->lock, flags);
+		freq = sp->requested_freq;
+		limits_changed = sp->limits_changed;
+		sp->limits_changed = false;
+		raw_spin_unlock_irqrestore(&sp->lock, flags);
+
+		if (freq == sp->target_freq && !limits_changed) {
+			schedule();
+			continue;
+		}
+
+		__set_current_state(TASK_RUNNING);
+		sp->target_freq = freq;
+		__cpufreq_driver_target(sp->policy, freq, CPUFREQ_RELATION_L);
+	}
+
+	__set_current_state(TASK_RUNNING);
+	return 0;
+}
+
+static int cpufreq_sched_start(struct cpufreq_policy *policy)
+{
+	struct sched_param param = { .sched_priority = MAX_RT_PRIO-1 };
+	struct cpufreq_sched_policy *sp;
+	struct cpufreq_sched_cpu *sc;
+	int cpu;
+
+	sp = kzalloc(sizeof(*sp), GFP_KERNEL);
+	if (!sp)
+		return -ENOMEM;
+
+	sp->policy = policy;
+	sp->requested_freq = policy->cur;
+	sp->target_freq = policy->cur;
+	raw_spin_lock_init(&sp->lock);
+	setup_timer(&sp->kick, cpufreq_sched_kick, (unsigned long)sp);
+
+	sp->task = kthread_create(cpufreq_sched_thread, sp, "kschedfreq/%u",
+				  policy->cpu);
+	if (IS_ERR(sp->task)) {
+		int ret = PTR_ERR(sp->task);
+
+		kfree(sp);
+		return ret;
+	}
+
+	sched_setscheduler_nocheck(sp->task, SCHED_FIFO, &param);
+	get_task_struct(sp->task);
+	wake_up_process(sp->task);
+
+	for_each_cpu(cpu, policy->cpus) {
+		sc = &per_cpu(cpufreq_sched_cpu, cpu);
+		sc->last_update = 0;
+		sc->curr_busy = 0;
+		sc->prev_busy = 0;
+		sc->nr_running = 0;
+		sc->freq = 0;
+		smp_wmb();
+		sc->sp = sp;
+	}
+
+	return 0;
+}
+
+/*
+ * New limits go through the task like any other request, so that only
+ * the task ever drives the policy and the speed it set stays in step with
+ * requested_freq. The next request is free to leave the clamped speed
+ * once a limit is lifted.
+ */
+static void cpufreq_sched_limits(struct cpufreq_policy *policy)
+{
+	struct cpufreq_sched_policy *sp;
+	unsigned long flags;
+
+	sp = per_cpu(cpufreq_sched_cpu, policy->cpu).sp;
+	if (!sp)
+		return;
+
+	raw_spin_lock_irqsave(&sp->lock, flags);
+	sp->requested_freq = clamp(sp->requested_freq, policy->min,
+				   policy->max);
+	sp->limits_changed = true;
+	raw_spin_unlock_irqrestore(&sp->lock, flags);
+
+	wake_up_process(sp->task);
+}
+
+static void cpufreq_sched_stop(struct cpufreq_policy *policy)
+{
+	struct cpufreq_sched_policy *sp;
+	struct cpufreq_sched_cpu *sc;
+	int cpu;
+
+	sp = per_cpu(cpufreq_sched_cpu, policy->cpu).sp;
+	if (!sp)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		sc = &per_cpu(cpufreq_sched_cpu, cpu);
+		if (sc->sp == sp)
+			sc->sp = NULL;
+	}
+
+	/* Updates run with the runqueue locked, wait for those in flight. */
+	synchronize_sched();
+	del_timer_sync(&sp->kick);
+
+	kthread_stop(sp->task);
+	put_task_struct(sp->task);
+	kfree(sp);
+}
+
+#define define_sched_tunable(name, min, max)				\
+static ssize_t show_##name(struct kobject *kobj,			\
+			   struct attribute *attr, char *buf)		\
+{									\
+	return sprintf(buf, "%lu\n", name);				\
+}									\
+									\
+static ssize_t store_##name(struct kobject *kobj,			\
+		struct attribute *attr, const char *buf, size_t count)	\
+{									\
+	unsigned long val;						\
+									\
+	if (strict_strtoul(buf, 0, &val) || val < (min) || val > (max))	\
+		return -EINVAL;						\
+	name = val;							\
+	return count;							\
+}									\
+									\
+static struct global_attr name##_attr = __ATTR(name, 0644,		\
+		show_##name, store_##name)
+
+define_sched_tunable(window_us, 1000, MAX_WINDOW_US);
+define_sched_tunable(target_load, 1, 100);
+define_sched_tunable(up_throttle_us, 0, ULONG_MAX);
+define_sched_tunable(down_throttle_us, 0, ULONG_MAX);
+
+static struct attribute *sched_attributes[] = {
+	&window_us_attr.attr,
+	&target_load_attr.attr,
+	&up_throttle_us_attr.attr,
+	&down_throttle_us_attr.attr,
+	NULL,
+};
+
+static struct attribute_group sched_attr_group = {
+	.attrs = sched_attributes,
+	.name = "sched",
+};
+
+static int cpufreq_governor_sched(struct cpufreq_policy *policy,
+		unsigned int event)
+{
+	int rc;
+
+	switch (event) {
+	case CPUFREQ_GOV_START:
+		if (!cpu_online(policy->cpu))
+			return -EINVAL;
+
+		rc = cpufreq_sched_start(policy);
+		if (rc)
+			return rc;
+
+		if (atomic_inc_return(&active_count) > 1)
+			return 0;
+
+		rc = sysfs_create_group(cpufreq_global_kobject,
+				&sched_attr_group);
+		if (rc) {
+			atomic_dec(&active_count);
+			cpufreq_sched_stop(policy);
+			return rc;
+		}
+		break;
+
+	case CPUFREQ_GOV_STOP:
+		cpufreq_sched_stop(policy);
+
+		if (atomic_dec_return(&active_count) > 0)
+			return 0;
+
+		sysfs_remove_group(cpufreq_global_kobject,
+				&sched_attr_group);
+		break;
+
+	case CPUFREQ_GOV_LIMITS:
+		cpufreq_sched_limits(policy);
+		break;
+	}
+	return 0;
+}
+
+static int __init cpufreq_sched_init(void)
+{
+	return cpufreq_register_governor(&cpufreq_gov_sched);
+}
+
+#ifdef CONFIG_CPU_FREQ_DEFAULT_GOV_SCHED
+fs_initcall(cpufreq_sched_init);
+#else
+module_init(cpufreq_sched_init);
+#endif
+
+MODULE_DESCRIPTION("'cpufreq_sched' - A cpufreq governor driven by "
+	"scheduler events");
+MODULE_LICENSE("GPL");
@@ -19,6 +19,7 @@
 #include <linux/fdtable.h>
 #include <linux/file.h>
 #include <linux/fs.h>
+#include <linux/ktime.h>
 #include <linux/list.h>
 #include <linux/miscdevice.h>
 #include <linux/mm.h>
@@ -35,8 +36,9 @@
 #include <linux/vmalloc.h>
 
 #include "binder.h"
+#include "binder_trace.h"
 
-static DEFINE_MUTEX(binder_lock);
+static DEFINE_MUTEX(binder_main_lock);
 static DEFINE_MUTEX(binder_deferred_lock);
 
 static HLIST_HEAD(binder_procs);
@@ -80,6 +82,9 @@ BINDER_DEBUG_ENTRY(proc);
 
 #define BINDER_SMALL_BUF_SIZE (PAGE_SIZE * 64)
 
+/* transactions at or below this size are counted as small in alloc stats */
+#define BINDER_SMALL_TRANSACTION_SIZE 256
+
 enum {
 	BINDER_DEBUG_USER_ERROR             = 1U << 0,
 	BINDER_DEBUG_FAILED_TRANSACTION     = 1U << 1,
@@ -105,6 +110,18 @@ module_param_named(debug_mask, binder_debug_mask, uint, S_IWUSR | S_IRUGO);
 static int binder_debug_no_lock;
 module_param_named(proc_no_lock, binder_debug_no_lock, bool, S_IWUSR | S_IRUGO);
 
+static int binder_inherit_rt = 1;
+module_param_named(inherit_rt, binder_inherit_rt, bool, S_IWUSR | S_IRUGO);
+
+/*
+ * Number of pages per process that stay mapped after the buffer using them
+ * is freed, so that the next transaction landing there skips the page
+ * allocation and the kernel and user space mappings.
+ */
+static int binder_max_cached_pages = 4;
+module_param_named(max_cached_pages, binder_max_cached_pages, int,
+		   S_IWUSR | S_IRUGO);
+
 static DECLARE_WAIT_QUEUE_HEAD(binder_user_error_wait);
 static int binder_stop_on_user_error;
 
@@ -164,6 +181,33 @@ static inline void binder_stats_created(enum binder_stat_types type)
 	binder_stats.obj_created[type]++;
 }
 
+/*
+ * binder_main_lock serializes all binder state but the buffer allocator
+ * of each proc, which has its own alloc_lock so that binder_transaction
+ * can allocate and fill the target's buffer with the main lock dropped.
+ * Every acquisition goes through these helpers so that contention can be
+ * measured and traced on real devices, e.g. with tools/binder-stress.
+ */
+static unsigned long binder_lock_acquired;
+static unsigned long binder_lock_contended;
+
+static inline void binder_lock(const char *tag)
+{
+	trace_binder_lock(tag);
+	if (!mutex_trylock(&binder_main_lock)) {
+		mutex_lock(&binder_main_lock);
+		binder_lock_contended++;
+	}
+	binder_lock_acquired++;
+	trace_binder_locked(tag);
+}
+
+static inline void binder_unlock(const char *tag)
+{
+	trace_binder_unlock(tag);
+	mutex_unlock(&binder_main_lock);
+}
+
 struct binder_transaction_log_entry {
 	int debug_id;
 	int call_type;
@@ -232,6 +276,7 @@ struct binder_node {
 	unsigned accept_fds:1;
 	unsigned min_priority:8;
 	struct list_head async_todo;
+	unsigned long transactions;
 };
 
 struct binder_ref_death {
@@ -273,6 +318,39 @@ struct binder_buffer {
 	uint8_t data[0];
 };
 
+/*
+ * Latency histograms use power of two buckets in microseconds: bucket 0
+ * counts samples below 1us, bucket n counts [2^(n-1), 2^n) us and the
+ * last bucket also holds everything above.
+ */
+#define BINDER_LATENCY_BUCKETS 20
+
+struct binder_latency_hist {
+	unsigned long deliver[BINDER_LATENCY_BUCKETS];
+	unsigned long reply[BINDER_LATENCY_BUCKETS];
+};
+
+static void binder_latency_add(unsigned long *hist, s64 latency_us)
+{
+	int bucket = 0;
+
+	if (latency_us > 0)
+		bucket = min_t(int, fls64(latency_us),
+			       BINDER_LATENCY_BUCKETS - 1);
+	hist[bucket]++;
+}
+
+struct binder_alloc_stats {
+	unsigned long alloc;
+	unsigned long alloc_small;
+	unsigned long alloc_failed;
+	unsigned long free;
+	unsigned long pages_mapped;
+	unsigned long pages_unmapped;
+	unsigned long pages_cache_hit;
+	unsigned long pages_prefilled;
+};
+
 enum binder_deferred_state {
 	BINDER_DEFERRED_PUT_FILES    = 0x01,
 	BINDER_DEFERRED_FLUSH        = 0x02,
@@ -294,12 +372,22 @@ struct binder_proc {
 	void *buffer;
 	ptrdiff_t user_buffer_offset;
 
+	/*
+	 * Protects the buffer allocator: buffers, the two buffer trees,
+	 * free_async_space, pages, pages_cached and alloc_stats.  Nests
+	 * inside binder_main_lock, but is also taken on its own by senders
+	 * filling a buffer of this proc with binder_main_lock dropped.
+	 */
+	struct mutex alloc_lock;
 	struct list_head buffers;
 	struct rb_root free_buffers;
 	struct rb_root allocated_buffers;
 	size_t free_async_space;
 
 	struct page **pages;
+	int pages_cached;
+	struct binder_alloc_stats alloc_stats;
+	struct binder_latency_hist latency;
 	size_t buffer_size;
 	uint32_t buffer_free;
 	struct list_head todo;
@@ -312,6 +400,14 @@ struct binder_proc {
 	int ready_threads;
 	long default_priority;
 	struct dentry *debugfs_entry;
+	/*
+	 * Senders between allocating a buffer here and queueing their
+	 * transaction, with binder_main_lock dropped in between; the last
+	 * of them frees the proc if it was released meanwhile.  Both under
+	 * binder_main_lock.
+	 */
+	int tmp_ref;
+	int is_dead;
 };
 
 enum {
@@ -336,6 +432,9 @@ struct binder_thread {
 		/* we are also waiting on */
 	wait_queue_head_t wait;
 	struct binder_stats stats;
+	int rt_inherited;
+	int base_policy;	/* policy and rt priority to return to once */
+	int base_rt_priority;	/* all inherited priorities are dropped */
 };
 
 struct binder_transaction {
@@ -354,7 +453,12 @@ struct binder_transaction {
 	unsigned int	flags;
 	long	priority;
 	long	saved_priority;
+	int	policy;
+	int	rt_priority;
+	int	saved_policy;
+	int	saved_rt_priority;
 	uid_t	sender_euid;
+	ktime_t	start_time;
 };
 
 static void
@@ -515,6 +619,59 @@ static void binder_set_nice(long nice)
 	binder_user_error("binder: %d RLIMIT_NICE not set\n", current->pid);
 }
 
+static int binder_is_rt_policy(int policy)
+{
+	return policy == SCHED_FIFO || policy == SCHED_RR;
+}
+
+static void binder_set_sched(int policy, int rt_priority)
+{
+	struct sched_param param = { .sched_priority = rt_priority };
+	int ret;
+
+	if (current->policy == policy && current->rt_priority == rt_priority)
+		return;
+	ret = sched_setscheduler_nocheck(current, policy, &param);
+	if (ret)
+		binder_debug(BINDER_DEBUG_PRIORITY_CAP,
+			     "binder: %d: set policy %d prio %d failed %d\n",
+			     current->pid, policy, rt_priority, ret);
+}
+
+/*
+ * Run the thread handling a synchronous transaction at the caller's
+ * real-time priority if the caller had one.  Returns without doing
+ * anything if the thread already runs at an equal or higher rt priority.
+ */
+static void binder_inherit_priority(struct binder_thread *thread,
+				    struct binder_transaction *t)
+{
+	if (!binder_inherit_rt || (t->flags & TF_ONE_WAY) ||
+	    !binder_is_rt_policy(t->policy))
+		return;
+	if (binder_is_rt_policy(current->policy) &&
+	    current->rt_priority >= t->rt_priority)
+		return;
+	if (!thread->rt_inherited) {
+		thread->base_policy = current->policy;
+		thread->base_rt_priority = current->rt_priority;
+	}
+	thread->rt_inherited = 1;
+	binder_set_sched(t->policy, t->rt_priority);
+}
+
+static void binder_restore_priority(struct binder_thread *thread,
+				    struct binder_transaction *t)
+{
+	if (thread->rt_inherited && t->to_thread == thread) {
+		binder_set_sched(t->saved_policy, t->saved_rt_priority);
+		if (t->saved_policy == thread->base_policy &&
+		    t->saved_rt_priority == thread->base_rt_priority)
+			thread->rt_inherited = 0;
+	}
+	binder_set_nice(t->saved_priority);
+}
+
 static size_t binder_buffer_size(struct binder_proc *proc,
 				 struct binder_buffer *buffer)
 {
@@ -586,13 +743,15 @@ static void binder_insert_allocated_buffer(struct binder_proc *proc,
 static struct binder_buffer *binder_buffer_lookup(struct binder_proc *proc,
 						  void __user *user_ptr)
 {
-	struct rb_node *n = proc->allocated_buffers.rb_node;
-	struct binder_buffer *buffer;
+	struct rb_node *n;
+	struct binder_buffer *buffer = NULL;
 	struct binder_buffer *kern_ptr;
 
 	kern_ptr = user_ptr - proc->user_buffer_offset
 		- offsetof(struct binder_buffer, data);
 
+	mutex_lock(&proc->alloc_lock);
+	n = proc->allocated_buffers.rb_node;
 	while (n) {
 		buffer = rb_entry(n, struct binder_buffer, rb_node);
 		BUG_ON(buffer->free);
@@ -602,16 +761,79 @@ static struct binder_buffer *binder_buffer_lookup(struct binder_proc *proc,
 		else if (kern_ptr > buffer)
 			n = n->rb_right;
 		else
-			return buffer;
+			break;
+	}
+	mutex_unlock(&proc->alloc_lock);
+	return n ? buffer : NULL;
+}
+
+/*
+ * Describes the whole pages of a new buffer that are completely covered by
+ * the transaction payload.  binder_update_page_range copies the payload
+ * straight into those pages as they are mapped instead of zeroing them
+ * first and having binder_transaction copy over them afterwards.
+ */
+struct binder_buffer_fill {
+	const void __user *src;
+	void *data;
+	void *start;
+	void *end;
+	int failed;
+};
+
+static void binder_fill_page(struct binder_proc *proc,
+			     struct binder_buffer_fill *fill, void *page_addr)
+{
+	if (!fill || page_addr < fill->start || page_addr >= fill->end)
+		return;
+	/* copy_from_user zeroes whatever it could not copy */
+	if (copy_from_user(page_addr, fill->src + (page_addr - fill->data),
+			   PAGE_SIZE))
+		fill->failed = 1;
+	proc->alloc_stats.pages_prefilled++;
+}
+
+/*
+ * Undo a failed allocation for the pages of [start, end), which must all
+ * have been taken from the cache or newly allocated by it.  Pages already
+ * in the target's address space are zapped when the vma is known; without
+ * it they can only be pages left mapped by an earlier free, which go back
+ * to the cache.
+ */
+static void binder_unwind_page_range(struct binder_proc *proc,
+				     void *start, void *end,
+				     struct vm_area_struct *vma)
+{
+	void *page_addr;
+	struct page **page;
+
+	for (page_addr = end - PAGE_SIZE; page_addr >= start;
+	     page_addr -= PAGE_SIZE) {
+		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
+		if (*page == NULL)
+			continue;
+		if (page_mapped(*page)) {
+			if (vma == NULL) {
+				proc->pages_cached++;
+				continue;
+			}
+			zap_page_range(vma, (uintptr_t)page_addr +
+				proc->user_buffer_offset, PAGE_SIZE, NULL);
+		}
+		unmap_kernel_range((unsigned long)page_addr, PAGE_SIZE);
+		__free_page(*page);
+		*page = NULL;
 	}
-	return NULL;
 }
 
 static int binder_update_page_range(struct binder_proc *proc, int allocate,
 				    void *start, void *end,
-				    struct vm_area_struct *vma)
+				    struct vm_area_struct *vma,
+				    struct binder_buffer_fill *fill)
 {
 	void *page_addr;
+	void *alloc_start = start;
+	void *alloc_end = end;
 	unsigned long user_page_addr;
 	struct vm_struct tmp_area;
 	struct page **page;
@@ -624,6 +846,75 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 	if (end <= start)
 		return 0;
 
+	if (allocate == 0) {
+		while (end > start &&
+		       proc->pages_cached < binder_max_cached_pages) {
+			end -= PAGE_SIZE;
+			proc->pages_cached++;
+		}
+		if (end <= start)
+			return 0;
+	} else {
+		while (start < end &&
+		       proc->pages[(start - proc->buffer) / PAGE_SIZE]) {
+			binder_fill_page(proc, fill, start);
+			start += PAGE_SIZE;
+			proc->pages_cached--;
+			proc->alloc_stats.pages_cache_hit++;
+		}
+		while (end > start &&
+		       proc->pages[(end - PAGE_SIZE - proc->buffer) /
+				   PAGE_SIZE]) {
+			end -= PAGE_SIZE;
+			binder_fill_page(proc, fill, end);
+			proc->pages_cached--;
+			proc->alloc_stats.pages_cache_hit++;
+		}
+		if (end <= start)
+			return 0;
+	}
+
+	/*
+	 * New pages are allocated, mapped in the kernel and filled before
+	 * the target's mmap_sem is taken: filling faults on the sender's
+	 * memory, whose mmap_sem must not nest inside the target's.  The
+	 * target cannot see a page until vm_insert_page below.
+	 */
+	for (page_addr = start; allocate && page_addr < end;
+	     page_addr += PAGE_SIZE) {
+		struct page **page_array_ptr;
+		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
+
+		if (*page) {
+			/* left mapped by an earlier free */
+			binder_fill_page(proc, fill, page_addr);
+			proc->pages_cached--;
+			proc->alloc_stats.pages_cache_hit++;
+			continue;
+		}
+		if (fill && page_addr >= fill->start && page_addr < fill->end)
+			*page = alloc_page(GFP_KERNEL);
+		else
+			*page = alloc_page(GFP_KERNEL | __GFP_ZERO);
+		if (*page == NULL) {
+			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
+			       "for page at %p\n", proc->pid, page_addr);
+			goto err_alloc_page_failed;
+		}
+		tmp_area.addr = page_addr;
+		tmp_area.size = PAGE_SIZE + PAGE_SIZE /* guard page? */;
+		page_array_ptr = page;
+		if (map_vm_area(&tmp_area, PAGE_KERNEL, &page_array_ptr)) {
+			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
+			       "to map page at %p in kernel\n",
+			       proc->pid, page_addr);
+			__free_page(*page);
+			*page = NULL;
+			goto err_alloc_page_failed;
+		}
+		binder_fill_page(proc, fill, page_addr);
+	}
+
 	if (vma)
 		mm = NULL;
 	else
@@ -645,26 +936,11 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 
 	for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE) {
 		int ret;
-		struct page **page_array_ptr;
 		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
 
-		BUG_ON(*page);
-		*page = alloc_page(GFP_KERNEL | __GFP_ZERO);
-		if (*page == NULL) {
-			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
-			       "for page at %p\n", proc->pid, page_addr);
-			goto err_alloc_page_failed;
-		}
-		tmp_area.addr = page_addr;
-		tmp_area.size = PAGE_SIZE + PAGE_SIZE /* guard page? */;
-		page_array_ptr = page;
-		ret = map_vm_area(&tmp_area, PAGE_KERNEL, &page_array_ptr);
-		if (ret) {
-			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
-			       "to map page at %p in kernel\n",
-			       proc->pid, page_addr);
-			goto err_map_kernel_failed;
-		}
+		/* pages left mapped by an earlier free are in place already */
+		if (page_mapped(*page))
+			continue;
 		user_page_addr =
 			(uintptr_t)page_addr + proc->user_buffer_offset;
 		ret = vm_insert_page(vma, user_page_addr, page[0]);
@@ -675,6 +951,7 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 			goto err_vm_insert_page_failed;
 		}
 		/* vm_insert_page does not seem to increment the refcount */
+		proc->alloc_stats.pages_mapped++;
 	}
 	if (mm) {
 		up_write(&mm->mmap_sem);
@@ -686,28 +963,44 @@ free_range:
 	for (page_addr = end - PAGE_SIZE; page_addr >= start;
 	     page_addr -= PAGE_SIZE) {
 		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
+		proc->alloc_stats.pages_unmapped++;
 		if (vma)
 			zap_page_range(vma, (uintptr_t)page_addr +
 				proc->user_buffer_offset, PAGE_SIZE, NULL);
-err_vm_insert_page_failed:
 		unmap_kernel_range((unsigned long)page_addr, PAGE_SIZE);
-err_map_kernel_failed:
 		__free_page(*page);
 		*page = NULL;
-err_alloc_page_failed:
-		;
 	}
+	if (mm) {
+		up_write(&mm->mmap_sem);
+		mmput(mm);
+	}
+	return 0;
+
+err_vm_insert_page_failed:
 err_no_vma:
+	binder_unwind_page_range(proc, alloc_start, alloc_end, vma);
 	if (mm) {
 		up_write(&mm->mmap_sem);
 		mmput(mm);
 	}
 	return -ENOMEM;
+
+err_alloc_page_failed:
+	/*
+	 * Only the pages before page_addr and the cached ones trimmed off
+	 * either end were taken; the rest are still counted in pages_cached.
+	 */
+	binder_unwind_page_range(proc, alloc_start, page_addr, NULL);
+	binder_unwind_page_range(proc, end, alloc_end, NULL);
+	return -ENOMEM;
 }
 
-static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
-					      size_t data_size,
-					      size_t offsets_size, int is_async)
+static struct binder_buffer *__binder_alloc_buf(struct binder_proc *proc,
+						size_t data_size,
+						size_t offsets_size,
+						int is_async,
+						struct binder_buffer_fill *fill)
 {
 	struct rb_node *n = proc->free_buffers.rb_node;
 	struct binder_buffer *buffer;
@@ -722,6 +1015,8 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 		       proc->pid);
 		return NULL;
 	}
+	/* pairs with the smp_wmb() in binder_mmap */
+	smp_rmb();
 
 	size = ALIGN(data_size, sizeof(void *)) +
 		ALIGN(offsets_size, sizeof(void *));
@@ -737,6 +1032,7 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 		binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
 			     "binder: %d: binder_alloc_buf size %zd"
 			     "failed, no async space left\n", proc->pid, size);
+		proc->alloc_stats.alloc_failed++;
 		return NULL;
 	}
 
@@ -758,6 +1054,7 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 	if (best_fit == NULL) {
 		printk(KERN_ERR "binder: %d: binder_alloc_buf size %zd failed, "
 		       "no address space\n", proc->pid, size);
+		proc->alloc_stats.alloc_failed++;
 		return NULL;
 	}
 	if (n == NULL) {
@@ -781,9 +1078,21 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 		(void *)PAGE_ALIGN((uintptr_t)buffer->data + buffer_size);
 	if (end_page_addr > has_page_addr)
 		end_page_addr = has_page_addr;
+	if (fill) {
+		fill->data = buffer->data;
+		fill->start = (void *)PAGE_ALIGN((uintptr_t)buffer->data);
+		fill->end = (void *)(((uintptr_t)buffer->data + data_size) &
+				     PAGE_MASK);
+		if (fill->end < fill->start)
+			fill->end = fill->start;
+		fill->failed = 0;
+	}
 	if (binder_update_page_range(proc, 1,
-	    (void *)PAGE_ALIGN((uintptr_t)buffer->data), end_page_addr, NULL))
+	    (void *)PAGE_ALIGN((uintptr_t)buffer->data), end_page_addr, NULL,
+	    fill)) {
+		proc->alloc_stats.alloc_failed++;
 		return NULL;
+	}
 
 	rb_erase(best_fit, &proc->free_buffers);
 	buffer->free = 0;
@@ -800,6 +1109,11 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 	buffer->data_size = data_size;
 	buffer->offsets_size = offsets_size;
 	buffer->async_transaction = is_async;
+	/* no BC_FREE_BUFFER until the target has been handed the buffer */
+	buffer->allow_user_free = 0;
+	proc->alloc_stats.alloc++;
+	if (size <= BINDER_SMALL_TRANSACTION_SIZE)
+		proc->alloc_stats.alloc_small++;
 	if (is_async) {
 		proc->free_async_space -= size + sizeof(struct binder_buffer);
 		binder_debug(BINDER_DEBUG_BUFFER_ALLOC_ASYNC,
@@ -811,6 +1125,24 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 	return buffer;
 }
 
+/*
+ * Called without binder_main_lock by binder_transaction, which must keep
+ * the proc from being freed meanwhile.
+ */
+static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
+					      size_t data_size,
+					      size_t offsets_size, int is_async,
+					      struct binder_buffer_fill *fill)
+{
+	struct binder_buffer *buffer;
+
+	mutex_lock(&proc->alloc_lock);
+	buffer = __binder_alloc_buf(proc, data_size, offsets_size, is_async,
+				    fill);
+	mutex_unlock(&proc->alloc_lock);
+	return buffer;
+}
+
 static void *buffer_start_page(struct binder_buffer *buffer)
 {
 	return (void *)((uintptr_t)buffer & PAGE_MASK);
@@ -864,7 +1196,7 @@ static void binder_delete_free_buffer(struct binder_proc *proc,
 		binder_update_page_range(proc, 0, free_page_start ?
 			buffer_start_page(buffer) : buffer_end_page(buffer),
 			(free_page_end ? buffer_end_page(buffer) :
-			buffer_start_page(buffer)) + PAGE_SIZE, NULL);
+			buffer_start_page(buffer)) + PAGE_SIZE, NULL, NULL);
 	}
 }
 
@@ -873,6 +1205,7 @@ static void binder_free_buf(struct binder_proc *proc,
 {
 	size_t size, buffer_size;
 
+	mutex_lock(&proc->alloc_lock);
 	buffer_size = binder_buffer_size(proc, buffer);
 
 	size = ALIGN(buffer->data_size, sizeof(void *)) +
@@ -888,6 +1221,7 @@ static void binder_free_buf(struct binder_proc *proc,
 	BUG_ON((void *)buffer < proc->buffer);
 	BUG_ON((void *)buffer > proc->buffer + proc->buffer_size);
 
+	proc->alloc_stats.free++;
 	if (buffer->async_transaction) {
 		proc->free_async_space += size + sizeof(struct binder_buffer);
 
@@ -900,7 +1234,7 @@ static void binder_free_buf(struct binder_proc *proc,
 	binder_update_page_range(proc, 0,
 		(void *)PAGE_ALIGN((uintptr_t)buffer->data),
 		(void *)(((uintptr_t)buffer->data + buffer_size) & PAGE_MASK),
-		NULL);
+		NULL, NULL);
 	rb_erase(&buffer->rb_node, &proc->allocated_buffers);
 	buffer->free = 1;
 	if (!list_is_last(&buffer->entry, &proc->buffers)) {
@@ -921,6 +1255,7 @@ static void binder_free_buf(struct binder_proc *proc,
 		}
 	}
 	binder_insert_free_buffer(proc, buffer);
+	mutex_unlock(&proc->alloc_lock);
 }
 
 static struct binder_node *binder_get_node(struct binder_proc *proc,
@@ -1375,6 +1710,117 @@ static void binder_transaction_buffer_release(struct binder_proc *proc,
 	}
 }
 
+/*
+ * Copy the parts of the payload that binder_alloc_buf did not already
+ * place in the buffer while mapping its pages.
+ */
+static int binder_copy_payload(struct binder_buffer *buffer,
+			       const void __user *src, size_t data_size,
+			       struct binder_buffer_fill *fill)
+{
+	size_t head = data_size;
+	size_t tail = data_size;
+
+	if (fill && fill->end > fill->start) {
+		if (fill->failed)
+			return -EFAULT;
+		head = fill->start - (void *)buffer->data;
+		tail = fill->end - (void *)buffer->data;
+	}
+	if (copy_from_user(buffer->data, src, head))
+		return -EFAULT;
+	if (copy_from_user(buffer->data + tail, src + tail, data_size - tail))
+		return -EFAULT;
+	return 0;
+}
+
+/*
+ * Frees the buffers, pages and the proc itself once it has been released
+ * and no sender is filling one of its buffers any more.
+ */
+static void binder_free_proc(struct binder_proc *proc)
+{
+	struct binder_transaction *t;
+	struct rb_node *n;
+	int buffers, page_count;
+
+	BUG_ON(!proc->is_dead || proc->tmp_ref);
+
+	buffers = 0;
+	while ((n = rb_first(&proc->allocated_buffers))) {
+		struct binder_buffer *buffer = rb_entry(n, struct binder_buffer,
+							rb_node);
+		t = buffer->transaction;
+		if (t) {
+			t->buffer = NULL;
+			buffer->transaction = NULL;
+			printk(KERN_ERR "binder: release proc %d, "
+			       "transaction %d, not freed\n",
+			       proc->pid, t->debug_id);
+			/*BUG();*/
+		}
+		binder_free_buf(proc, buffer);
+		buffers++;
+	}
+
+	binder_stats_deleted(BINDER_STAT_PROC);
+
+	page_count = 0;
+	if (proc->pages) {
+		int i;
+		for (i = 0; i < proc->buffer_size / PAGE_SIZE; i++) {
+			if (proc->pages[i]) {
+				void *page_addr = proc->buffer + i * PAGE_SIZE;
+				binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
+					     "binder_release: %d: "
+					     "page %d at %p not freed\n",
+					     proc->pid, i,
+					     page_addr);
+				unmap_kernel_range((unsigned long)page_addr,
+					PAGE_SIZE);
+				__free_page(proc->pages[i]);
+				page_count++;
+			}
+		}
+		kfree(proc->pages);
+		vfree(proc->buffer);
+	}
+
+	put_task_struct(proc->tsk);
+
+	binder_debug(BINDER_DEBUG_OPEN_CLOSE,
+		     "binder_release: %d buffers %d, pages %d\n",
+		     proc->pid, buffers, page_count);
+
+	kfree(proc);
+}
+
+/* Caller must hold binder_main_lock. */
+static void binder_proc_dec_tmpref(struct binder_proc *proc)
+{
+	BUG_ON(proc->tmp_ref <= 0);
+	if (--proc->tmp_ref == 0 && proc->is_dead)
+		binder_free_proc(proc);
+}
+
+/*
+ * A thread of target_proc waiting on a transaction that 'thread' is
+ * handling takes new calls to that proc, as it could not handle them
+ * otherwise.
+ */
+static struct binder_thread *
+binder_stack_target_thread(struct binder_thread *thread,
+			   struct binder_proc *target_proc)
+{
+	struct binder_thread *target_thread = NULL;
+	struct binder_transaction *tmp;
+
+	for (tmp = thread->transaction_stack; tmp; tmp = tmp->from_parent)
+		if (tmp->from && tmp->from->proc == target_proc)
+			target_thread = tmp->from;
+	return target_thread;
+}
+
 static void binder_transaction(struct binder_proc *proc,
 			       struct binder_thread *thread,
 			       struct binder_transaction_data *tr, int reply)
@@ -1389,7 +1835,11 @@ static void binder_transaction(struct binder_proc *proc,
 	wait_queue_head_t *target_wait;
 	struct binder_transaction *in_reply_to = NULL;
 	struct binder_transaction_log_entry *e;
+	struct binder_transaction_log_entry log_entry;
 	uint32_t return_error;
+	s64 latency_us;
+	struct binder_buffer_fill fill;
+	const char *copy_failed = NULL;
 
 	e = binder_transaction_log_add(&binder_transaction_log);
 	e->call_type = reply ? 2 : !!(tr->flags & TF_ONE_WAY);
@@ -1408,7 +1858,7 @@ static void binder_transaction(struct binder_proc *proc,
 			return_error = BR_FAILED_REPLY;
 			goto err_empty_call_stack;
 		}
-		binder_set_nice(in_reply_to->saved_priority);
+		binder_restore_priority(thread, in_reply_to);
 		if (in_reply_to->to_thread != thread) {
 			binder_user_error("binder: %d:%d got reply transaction "
 				"with bad transaction stack,"
@@ -1442,6 +1892,10 @@ static void binder_transaction(struct binder_proc *proc,
 			goto err_dead_binder;
 		}
 		target_proc = target_thread->proc;
+		latency_us = ktime_us_delta(ktime_get(),
+					    in_reply_to->start_time);
+		binder_latency_add(target_proc->latency.reply, latency_us);
+		trace_binder_transaction_reply_done(in_reply_to, latency_us);
 	} else {
 		if (tr->target.handle) {
 			struct binder_ref *ref;
@@ -1481,21 +1935,12 @@ static void binder_transaction(struct binder_proc *proc,
 				return_error = BR_FAILED_REPLY;
 				goto err_bad_call_stack;
 			}
-			while (tmp) {
-				if (tmp->from && tmp->from->proc == target_proc)
-					target_thread = tmp->from;
-				tmp = tmp->from_parent;
-			}
+			target_thread = binder_stack_target_thread(thread,
+								   target_proc);
 		}
 	}
-	if (target_thread) {
+	if (target_thread)
 		e->to_thread = target_thread->pid;
-		target_list = &target_thread->todo;
-		target_wait = &target_thread->wait;
-	} else {
-		target_list = &target_proc->todo;
-		target_wait = &target_proc->wait;
-	}
 	e->to_proc = target_proc->pid;
 
 	/* TODO: reuse incoming transaction for reply */
@@ -1543,33 +1988,110 @@ static void binder_transaction(struct binder_proc *proc,
 	t->code = tr->code;
 	t->flags = tr->flags;
 	t->priority = task_nice(current);
+	t->policy = current->policy;
+	t->rt_priority = current->rt_priority;
+	t->start_time = ktime_get();
+
+	trace_binder_transaction(reply, t, target_node);
+
+	/*
+	 * The buffer is allocated and the payload copied in with
+	 * binder_main_lock dropped, so that senders only contend on the
+	 * alloc_lock of their target, and only while a buffer is carved
+	 * out.  Meanwhile the tmp_ref keeps target_proc from being freed,
+	 * the local strong ref keeps target_node, and t is not reachable
+	 * other than through its buffer.  The transaction log entry may
+	 * be reused, so what follows works on a copy.
+	 */
+	target_proc->tmp_ref++;
+	if (target_node)
+		binder_inc_node(target_node, 1, 0, NULL);
+	log_entry = *e;
+	e = &log_entry;
+	binder_unlock(__func__);
+
+	/*
+	 * Whole payload pages are copied in while the target buffer is
+	 * mapped, before any of them is visible to the target.
+	 */
+	fill.src = tr->data.ptr.buffer;
 	t->buffer = binder_alloc_buf(target_proc, tr->data_size,
-		tr->offsets_size, !reply && (t->flags & TF_ONE_WAY));
+		tr->offsets_size, !reply && (t->flags & TF_ONE_WAY), &fill);
+	if (t->buffer) {
+		t->buffer->debug_id = t->debug_id;
+		t->buffer->transaction = t;
+		t->buffer->target_node = target_node;
+		if (binder_copy_payload(t->buffer, tr->data.ptr.buffer,
+					tr->data_size, &fill))
+			copy_failed = "data";
+		else if (copy_from_user(t->buffer->data +
+					ALIGN(tr->data_size, sizeof(void *)),
+					tr->data.ptr.offsets,
+					tr->offsets_size))
+			copy_failed = "offsets";
+	}
+
+	binder_lock(__func__);
+	if (target_proc->is_dead) {
+		/*
+		 * Its buffers, ours included, go with it and its nodes
+		 * have dropped their local refs already.
+		 */
+		if (t->buffer)
+			t->buffer->transaction = NULL;
+		binder_proc_dec_tmpref(target_proc);
+		return_error = BR_DEAD_REPLY;
+		goto err_binder_alloc_buf_failed;
+	}
+	binder_proc_dec_tmpref(target_proc);
+
 	if (t->buffer == NULL) {
+		if (target_node)
+			binder_dec_node(target_node, 1, 0);
 		return_error = BR_FAILED_REPLY;
 		goto err_binder_alloc_buf_failed;
 	}
-	t->buffer->allow_user_free = 0;
-	t->buffer->debug_id = t->debug_id;
-	t->buffer->transaction = t;
-	t->buffer->target_node = target_node;
 	if (target_node)
-		binder_inc_node(target_node, 1, 0, NULL);
-
+		target_node->transactions++;
 	offp = (size_t *)(t->buffer->data + ALIGN(tr->data_size, sizeof(void *)));
-
-	if (copy_from_user(t->buffer->data, tr->data.ptr.buffer, tr->data_size)) {
+	if (copy_failed) {
 		binder_user_error("binder: %d:%d got transaction with invalid "
-			"data ptr\n", proc->pid, thread->pid);
+			"%s ptr\n", proc->pid, thread->pid, copy_failed);
 		return_error = BR_FAILED_REPLY;
 		goto err_copy_data_failed;
 	}
-	if (copy_from_user(offp, tr->data.ptr.offsets, tr->offsets_size)) {
-		binder_user_error("binder: %d:%d got transaction with invalid "
-			"offsets ptr\n", proc->pid, thread->pid);
-		return_error = BR_FAILED_REPLY;
-		goto err_copy_data_failed;
+
+	/* the threads found above may have exited meanwhile */
+	if (reply) {
+		if (in_reply_to->from == NULL) {
+			return_error = BR_DEAD_REPLY;
+			goto err_dead_target_thread;
+		}
+		if (in_reply_to->from->transaction_stack != in_reply_to) {
+			binder_user_error("binder: %d:%d got reply transaction "
+				"with bad target transaction stack %d, "
+				"expected %d\n",
+				proc->pid, thread->pid,
+				in_reply_to->from->transaction_stack ?
+				in_reply_to->from->transaction_stack->debug_id :
+				0, in_reply_to->debug_id);
+			return_error = BR_FAILED_REPLY;
+			in_reply_to = NULL;
+			goto err_dead_target_thread;
+		}
+	} else if (target_thread) {
+		target_thread = binder_stack_target_thread(thread,
+							   target_proc);
+		t->to_thread = target_thread;
+	}
+	if (target_thread) {
+		target_list = &target_thread->todo;
+		target_wait = &target_thread->wait;
+	} else {
+		target_list = &target_proc->todo;
+		target_wait = &target_proc->wait;
 	}
+
 	if (!IS_ALIGNED(tr->offsets_size, sizeof(size_t))) {
 		binder_user_error("binder: %d:%d got transaction with "
 			"invalid offsets size, %zd\n",
@@ -1610,6 +2132,7 @@ static void binder_transaction(struct binder_proc *proc,
 					proc->pid, thread->pid,
 					fp->binder, node->debug_id,
 					fp->cookie, node->cookie);
+				return_error = BR_FAILED_REPLY;
 				goto err_binder_get_ref_for_node_failed;
 			}
 			ref = binder_get_ref_for_node(target_proc, node);
@@ -1748,6 +2271,7 @@ err_binder_get_ref_failed:
 err_binder_new_node_failed:
 err_bad_object_type:
 err_bad_offset:
+err_dead_target_thread:
 err_copy_data_failed:
 	binder_transaction_buffer_release(target_proc, t->buffer, offp);
 	t->buffer->transaction = NULL;
@@ -1775,6 +2299,12 @@ err_no_context_mgr_node:
 		*fe = *e;
 	}
 
+	if (thread->return_error != BR_OK &&
+	    thread->return_error2 == BR_OK) {
+		/* a call of ours failed while binder_main_lock was dropped */
+		thread->return_error2 = thread->return_error;
+		thread->return_error = BR_OK;
+	}
 	BUG_ON(thread->return_error != BR_OK);
 	if (in_reply_to) {
 		thread->return_error = BR_TRANSACTION_COMPLETE;
@@ -2201,6 +2731,7 @@ static int binder_thread_read(struct binder_proc *proc,
 
 	int ret = 0;
 	int wait_for_proc_work;
+	s64 latency_us;
 
 	if (*consumed == 0) {
 		if (put_user(BR_NOOP, (uint32_t __user *)ptr))
@@ -2232,7 +2763,7 @@ retry:
 	thread->looper |= BINDER_LOOPER_STATE_WAITING;
 	if (wait_for_proc_work)
 		proc->ready_threads++;
-	mutex_unlock(&binder_lock);
+	binder_unlock(__func__);
 	if (wait_for_proc_work) {
 		if (!(thread->looper & (BINDER_LOOPER_STATE_REGISTERED |
 					BINDER_LOOPER_STATE_ENTERED))) {
@@ -2243,6 +2774,12 @@ retry:
 			wait_event_interruptible(binder_user_error_wait,
 						 binder_stop_on_user_error < 2);
 		}
+		if (thread->rt_inherited) {
+			/* a transaction ended without a reply */
+			binder_set_sched(thread->base_policy,
+					 thread->base_rt_priority);
+			thread->rt_inherited = 0;
+		}
 		binder_set_nice(proc->default_priority);
 		if (non_block) {
 			if (!binder_has_proc_work(proc, thread))
@@ -2256,7 +2793,7 @@ retry:
 		} else
 			ret = wait_event_interruptible(thread->wait, binder_has_thread_work(thread));
 	}
-	mutex_lock(&binder_lock);
+	binder_lock(__func__);
 	if (wait_for_proc_work)
 		proc->ready_threads--;
 	thread->looper &= ~BINDER_LOOPER_STATE_WAITING;
@@ -2402,17 +2939,24 @@ retry:
 			continue;
 
 		BUG_ON(t->buffer == NULL);
+		latency_us = ktime_us_delta(ktime_get(), t->start_time);
+		binder_latency_add(proc->latency.deliver, latency_us);
+		trace_binder_transaction_received(t, latency_us);
+
 		if (t->buffer->target_node) {
 			struct binder_node *target_node = t->buffer->target_node;
 			tr.target.ptr = target_node->ptr;
 			tr.cookie =  target_node->cookie;
 			t->saved_priority = task_nice(current);
+			t->saved_policy = current->policy;
+			t->saved_rt_priority = current->rt_priority;
 			if (t->priority < target_node->min_priority &&
 			    !(t->flags & TF_ONE_WAY))
 				binder_set_nice(t->priority);
 			else if (!(t->flags & TF_ONE_WAY) ||
 				 t->saved_priority > target_node->min_priority)
 				binder_set_nice(target_node->min_priority);
+			binder_inherit_priority(thread, t);
 			cmd = BR_TRANSACTION;
 		} else {
 			tr.target.ptr = NULL;
@@ -2598,12 +3142,12 @@ static unsigned int binder_poll(struct file *filp,
 	struct binder_thread *thread = NULL;
 	int wait_for_proc_work;
 
-	mutex_lock(&binder_lock);
+	binder_lock(__func__);
 	thread = binder_get_thread(proc);
 
 	wait_for_proc_work = thread->transaction_stack == NULL &&
 		list_empty(&thread->todo) && thread->return_error == BR_OK;
-	mutex_unlock(&binder_lock);
+	binder_unlock(__func__);
 
 	if (wait_for_proc_work) {
 		if (binder_has_proc_work(proc, thread))
@@ -2628,14 +3172,29 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 	struct binder_thread *thread;
 	unsigned int size = _IOC_SIZE(cmd);
 	void __user *ubuf = (void __user *)arg;
+	struct binder_write_read bwr;
+	int copy_bwr = 0;
 
 	/*printk(KERN_INFO "binder_ioctl: %d:%d %x %lx\n", proc->pid, current->pid, cmd, arg);*/
 
+	trace_binder_ioctl(cmd, arg);
+
 	ret = wait_event_interruptible(binder_user_error_wait, binder_stop_on_user_error < 2);
 	if (ret)
 		return ret;
 
-	mutex_lock(&binder_lock);
+	/*
+	 * bwr is copied in before binder_main_lock is taken, so a faulting
+	 * copy does not stall every other binder user in the system.
+	 */
+	if (cmd == BINDER_WRITE_READ) {
+		if (size != sizeof(struct binder_write_read))
+			return -EINVAL;
+		if (copy_from_user(&bwr, ubuf, sizeof(bwr)))
+			return -EFAULT;
+	}
+
+	binder_lock(__func__);
 	thread = binder_get_thread(proc);
 	if (thread == NULL) {
 		ret = -ENOMEM;
@@ -2644,26 +3203,17 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 
 	switch (cmd) {
 	case BINDER_WRITE_READ: {
-		struct binder_write_read bwr;
-		if (size != sizeof(struct binder_write_read)) {
-			ret = -EINVAL;
-			goto err;
-		}
-		if (copy_from_user(&bwr, ubuf, sizeof(bwr))) {
-			ret = -EFAULT;
-			goto err;
-		}
 		binder_debug(BINDER_DEBUG_READ_WRITE,
 			     "binder: %d:%d write %ld at %08lx, read %ld at %08lx\n",
 			     proc->pid, thread->pid, bwr.write_size, bwr.write_buffer,
 			     bwr.read_size, bwr.read_buffer);
 
+		/* bwr is copied back to user space once the lock is dropped */
+		copy_bwr = 1;
 		if (bwr.write_size > 0) {
 			ret = binder_thread_write(proc, thread, (void __user *)bwr.write_buffer, bwr.write_size, &bwr.write_consumed);
 			if (ret < 0) {
 				bwr.read_consumed = 0;
-				if (copy_to_user(ubuf, &bwr, sizeof(bwr)))
-					ret = -EFAULT;
 				goto err;
 			}
 		}
@@ -2671,20 +3221,13 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 			ret = binder_thread_read(proc, thread, (void __user *)bwr.read_buffer, bwr.read_size, &bwr.read_consumed, filp->f_flags & O_NONBLOCK);
 			if (!list_empty(&proc->todo))
 				wake_up_interruptible(&proc->wait);
-			if (ret < 0) {
-				if (copy_to_user(ubuf, &bwr, sizeof(bwr)))
-					ret = -EFAULT;
+			if (ret < 0)
 				goto err;
-			}
 		}
 		binder_debug(BINDER_DEBUG_READ_WRITE,
 			     "binder: %d:%d wrote %ld of %ld, read return %ld of %ld\n",
 			     proc->pid, thread->pid, bwr.write_consumed, bwr.write_size,
 			     bwr.read_consumed, bwr.read_size);
-		if (copy_to_user(ubuf, &bwr, sizeof(bwr))) {
-			ret = -EFAULT;
-			goto err;
-		}
 		break;
 	}
 	case BINDER_SET_MAX_THREADS:
@@ -2744,7 +3287,9 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 err:
 	if (thread)
 		thread->looper &= ~BINDER_LOOPER_STATE_NEED_RETURN;
-	mutex_unlock(&binder_lock);
+	binder_unlock(__func__);
+	if (copy_bwr && copy_to_user(ubuf, &bwr, sizeof(bwr)))
+		ret = -EFAULT;
 	wait_event_interruptible(binder_user_error_wait, binder_stop_on_user_error < 2);
 	if (ret && ret != -ERESTARTSYS)
 		printk(KERN_INFO "binder: %d:%d ioctl %x %lx returned %d\n", proc->pid, current->pid, cmd, arg, ret);
@@ -2837,7 +3382,7 @@ static int binder_mmap(struct file *filp, struct vm_area_struct *vma)
 	vma->vm_ops = &binder_vm_ops;
 	vma->vm_private_data = proc;
 
-	if (binder_update_page_range(proc, 1, proc->buffer, proc->buffer + PAGE_SIZE, vma)) {
+	if (binder_update_page_range(proc, 1, proc->buffer, proc->buffer + PAGE_SIZE, vma, NULL)) {
 		ret = -ENOMEM;
 		failure_string = "alloc small buf";
 		goto err_alloc_small_buf_failed;
@@ -2848,7 +3393,8 @@ static int binder_mmap(struct file *filp, struct vm_area_struct *vma)
 	buffer->free = 1;
 	binder_insert_free_buffer(proc, buffer);
 	proc->free_async_space = proc->buffer_size / 2;
-	barrier();
+	/* binder_alloc_buf checks proc->vma without binder_main_lock */
+	smp_wmb();
 	proc->files = get_files_struct(current);
 	proc->vma = vma;
 
@@ -2884,14 +3430,15 @@ static int binder_open(struct inode *nodp, struct file *filp)
 	proc->tsk = current;
 	INIT_LIST_HEAD(&proc->todo);
 	init_waitqueue_head(&proc->wait);
+	mutex_init(&proc->alloc_lock);
 	proc->default_priority = task_nice(current);
-	mutex_lock(&binder_lock);
+	binder_lock(__func__);
 	binder_stats_created(BINDER_STAT_PROC);
 	hlist_add_head(&proc->proc_node, &binder_procs);
 	proc->pid = current->group_leader->pid;
 	INIT_LIST_HEAD(&proc->delivered_death);
 	filp->private_data = proc;
-	mutex_unlock(&binder_lock);
+	binder_unlock(__func__);
 
 	if (binder_debugfs_dir_entry_proc) {
 		char strbuf[11];
@@ -2943,13 +3490,13 @@ static int binder_release(struct inode *nodp, struct file *filp)
 static void binder_deferred_release(struct binder_proc *proc)
 {
 	struct hlist_node *pos;
-	struct binder_transaction *t;
 	struct rb_node *n;
-	int threads, nodes, incoming_refs, outgoing_refs, buffers, active_transactions, page_count;
+	int threads, nodes, incoming_refs, outgoing_refs, active_transactions;
 
 	BUG_ON(proc->vma);
 	BUG_ON(proc->files);
 
+	proc->is_dead = 1;
 	hlist_del(&proc->proc_node);
 	if (binder_context_mgr_node && binder_context_mgr_node->proc == proc) {
 		binder_debug(BINDER_DEBUG_DEAD_BINDER,
@@ -3011,57 +3558,16 @@ static void binder_deferred_release(struct binder_proc *proc)
 		binder_delete_ref(ref);
 	}
 	binder_release_work(&proc->todo);
-	buffers = 0;
-
-	while ((n = rb_first(&proc->allocated_buffers))) {
-		struct binder_buffer *buffer = rb_entry(n, struct binder_buffer,
-							rb_node);
-		t = buffer->transaction;
-		if (t) {
-			t->buffer = NULL;
-			buffer->transaction = NULL;
-			printk(KERN_ERR "binder: release proc %d, "
-			       "transaction %d, not freed\n",
-			       proc->pid, t->debug_id);
-			/*BUG();*/
-		}
-		binder_free_buf(proc, buffer);
-		buffers++;
-	}
-
-	binder_stats_deleted(BINDER_STAT_PROC);
-
-	page_count = 0;
-	if (proc->pages) {
-		int i;
-		for (i = 0; i < proc->buffer_size / PAGE_SIZE; i++) {
-			if (proc->pages[i]) {
-				void *page_addr = proc->buffer + i * PAGE_SIZE;
-				binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
-					     "binder_release: %d: "
-					     "page %d at %p not freed\n",
-					     proc->pid, i,
-					     page_addr);
-				unmap_kernel_range((unsigned long)page_addr,
-					PAGE_SIZE);
-				__free_page(proc->pages[i]);
-				page_count++;
-			}
-		}
-		kfree(proc->pages);
-		vfree(proc->buffer);
-	}
-
-	put_task_struct(proc->tsk);
 
 	binder_debug(BINDER_DEBUG_OPEN_CLOSE,
 		     "binder_release: %d threads %d, nodes %d (ref %d), "
-		     "refs %d, active transactions %d, buffers %d, "
-		     "pages %d\n",
+		     "refs %d, active transactions %d%s\n",
 		     proc->pid, threads, nodes, incoming_refs, outgoing_refs,
-		     active_transactions, buffers, page_count);
+		     active_transactions,
+		     proc->tmp_ref ? ", buffers in use by senders" : "");
 
-	kfree(proc);
+	if (!proc->tmp_ref)
+		binder_free_proc(proc);
 }
 
 static void binder_deferred_func(struct work_struct *work)
@@ -3071,7 +3577,7 @@ static void binder_deferred_func(struct work_struct *work)
 
 	int defer;
 	do {
-		mutex_lock(&binder_lock);
+		binder_lock(__func__);
 		mutex_lock(&binder_deferred_lock);
 		if (!hlist_empty(&binder_deferred_list)) {
 			proc = hlist_entry(binder_deferred_list.first,
@@ -3096,9 +3602,9 @@ static void binder_deferred_func(struct work_struct *work)
 			binder_deferred_flush(proc);
 
 		if (defer & BINDER_DEFERRED_RELEASE)
-			binder_deferred_release(proc); /* frees proc */
+			binder_deferred_release(proc); /* frees proc, now or later */
 
-		mutex_unlock(&binder_lock);
+		binder_unlock(__func__);
 		if (files)
 			put_files_struct(files);
 	} while (proc);
@@ -3229,11 +3735,12 @@ static void print_binder_node(struct seq_file *m, struct binder_node *node)
 	hlist_for_each_entry(ref, pos, &node->refs, node_entry)
 		count++;
 
-	seq_printf(m, "  node %d: u%p c%p hs %d hw %d ls %d lw %d is %d iw %d",
+	seq_printf(m, "  node %d: u%p c%p hs %d hw %d ls %d lw %d is %d iw %d"
+		   " tr %lu",
 		   node->debug_id, node->ptr, node->cookie,
 		   node->has_strong_ref, node->has_weak_ref,
 		   node->local_strong_refs, node->local_weak_refs,
-		   node->internal_strong_refs, count);
+		   node->internal_strong_refs, count, node->transactions);
 	if (count) {
 		seq_puts(m, " proc");
 		hlist_for_each_entry(ref, pos, &node->refs, node_entry)
@@ -3279,9 +3786,11 @@ static void print_binder_proc(struct seq_file *m,
 			print_binder_ref(m, rb_entry(n, struct binder_ref,
 						     rb_node_desc));
 	}
+	mutex_lock(&proc->alloc_lock);
 	for (n = rb_first(&proc->allocated_buffers); n != NULL; n = rb_next(n))
 		print_binder_buffer(m, "  buffer",
 				    rb_entry(n, struct binder_buffer, rb_node));
+	mutex_unlock(&proc->alloc_lock);
 	list_for_each_entry(w, &proc->todo, entry)
 		print_binder_work(m, "  ", "  pending transaction", w);
 	list_for_each_entry(w, &proc->delivered_death, entry) {
@@ -3377,6 +3886,37 @@ static void print_binder_stats(struct seq_file *m, const char *prefix,
 	}
 }
 
+static void print_binder_latency(struct seq_file *m, const char *name,
+				 unsigned long *hist)
+{
+	int i;
+
+	for (i = 0; i < BINDER_LATENCY_BUCKETS; i++) {
+		if (!hist[i])
+			continue;
+		if (i == BINDER_LATENCY_BUCKETS - 1)
+			seq_printf(m, "  %s latency >=%lluus: %lu\n", name,
+				   1ULL << (i - 1), hist[i]);
+		else
+			seq_printf(m, "  %s latency <%lluus: %lu\n", name,
+				   1ULL << i, hist[i]);
+	}
+}
+
+static void print_binder_node_stats(struct seq_file *m,
+				    struct binder_proc *proc)
+{
+	struct rb_node *n;
+
+	for (n = rb_first(&proc->nodes); n != NULL; n = rb_next(n)) {
+		struct binder_node *node = rb_entry(n, struct binder_node,
+						    rb_node);
+		if (node->transactions)
+			seq_printf(m, "  node %d: transactions %lu\n",
+				   node->debug_id, node->transactions);
+	}
+}
+
 static void print_binder_proc_stats(struct seq_file *m,
 				    struct binder_proc *proc)
 {
@@ -3410,10 +3950,21 @@ static void print_binder_proc_stats(struct seq_file *m,
 	}
 	seq_printf(m, "  refs: %d s %d w %d\n", count, strong, weak);
 
+	mutex_lock(&proc->alloc_lock);
 	count = 0;
 	for (n = rb_first(&proc->allocated_buffers); n != NULL; n = rb_next(n))
 		count++;
 	seq_printf(m, "  buffers: %d\n", count);
+	seq_printf(m, "  alloc: %lu small %lu failed %lu free %lu\n"
+			"  pages: mapped %lu unmapped %lu cache hit %lu"
+			" cached %d prefilled %lu\n",
+			proc->alloc_stats.alloc, proc->alloc_stats.alloc_small,
+			proc->alloc_stats.alloc_failed, proc->alloc_stats.free,
+			proc->alloc_stats.pages_mapped,
+			proc->alloc_stats.pages_unmapped,
+			proc->alloc_stats.pages_cache_hit, proc->pages_cached,
+			proc->alloc_stats.pages_prefilled);
+	mutex_unlock(&proc->alloc_lock);
 
 	count = 0;
 	list_for_each_entry(w, &proc->todo, entry) {
@@ -3427,6 +3978,9 @@ static void print_binder_proc_stats(struct seq_file *m,
 	}
 	seq_printf(m, "  pending transactions: %d\n", count);
 
+	print_binder_latency(m, "delivery", proc->latency.deliver);
+	print_binder_latency(m, "reply", proc->latency.reply);
+	print_binder_node_stats(m, proc);
 	print_binder_stats(m, "  ", &proc->stats);
 }
 
@@ -3439,7 +3993,7 @@ static int binder_state_show(struct seq_file *m, void *unused)
 	int do_lock = !binder_debug_no_lock;
 
 	if (do_lock)
-		mutex_lock(&binder_lock);
+		binder_lock(__func__);
 
 	seq_puts(m, "binder state:\n");
 
@@ -3451,7 +4005,7 @@ static int binder_state_show(struct seq_file *m, void *unused)
 	hlist_for_each_entry(proc, pos, &binder_procs, proc_node)
 		print_binder_proc(m, proc, 1);
 	if (do_lock)
-		mutex_unlock(&binder_lock);
+		binder_unlock(__func__);
 	return 0;
 }
 
@@ -3462,16 +4016,18 @@ static int binder_stats_show(struct seq_file *m, void *unused)
 	int do_lock = !binder_debug_no_lock;
 
 	if (do_lock)
-		mutex_lock(&binder_lock);
+		binder_lock(__func__);
 
 	seq_puts(m, "binder stats:\n");
 
+	seq_printf(m, "lock: acquired %lu contended %lu\n",
+		   binder_lock_acquired, binder_lock_contended);
 	print_binder_stats(m, "", &binder_stats);
 
 	hlist_for_each_entry(proc, pos, &binder_procs, proc_node)
 		print_binder_proc_stats(m, proc);
 	if (do_lock)
-		mutex_unlock(&binder_lock);
+		binder_unlock(__func__);
 	return 0;
 }
 
@@ -3482,13 +4038,13 @@ static int binder_transactions_show(struct seq_file *m, void *unused)
 	int do_lock = !binder_debug_no_lock;
 
 	if (do_lock)
-		mutex_lock(&binder_lock);
+		binder_lock(__func__);
 
 	seq_puts(m, "binder transactions:\n");
 	hlist_for_each_entry(proc, pos, &binder_procs, proc_node)
 		print_binder_proc(m, proc, 0);
 	if (do_lock)
-		mutex_unlock(&binder_lock);
+		binder_unlock(__func__);
 	return 0;
 }
 
@@ -3498,11 +4054,11 @@ static int binder_proc_show(struct seq_file *m, void *unused)
 	int do_lock = !binder_debug_no_lock;
 
 	if (do_lock)
-		mutex_lock(&binder_lock);
+		binder_lock(__func__);
 	seq_puts(m, "binder proc state:\n");
 	print_binder_proc(m, proc, 1);
 	if (do_lock)
-		mutex_unlock(&binder_lock);
+		binder_unlock(__func__);
 	return 0;
 }
 
@@ -3598,3 +4154,6 @@ static int __init binder_init(void)
 device_initcall(binder_init);
 
 MODULE_LICENSE("GPL v2");
+
+#define CREATE_TRACE_POINTS
+#include "binder_trace.h"
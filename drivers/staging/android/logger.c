@@ -24,7 +24,15 @@
 #include <linux/uaccess.h>
 #include <linux/poll.h>
 #include <linux/slab.h>
+#include <linux/spinlock.h>
 #include <linux/time.h>
+#include <linux/pagemap.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/log2.h>
+#include <linux/workqueue.h>
+#include <linux/lzo.h>
+#include <linux/pstore.h>
 #include "logger.h"
 
 #include <asm/ioctls.h>
@@ -34,34 +42,357 @@
  *
  * This structure lives from module insertion until module removal, so it does
  * not need additional reference counting. The structure is protected by the
- * mutex 'mutex'.
+ * spinlock 'lock'. Nothing that can sleep or fault happens under it: writers
+ * copy from user space with page faults disabled and retry after faulting the
+ * pages in, readers copy each entry out through a private bounce buffer.
  */
 struct logger_log {
 	unsigned char 		*buffer;/* the ring buffer itself */
 	struct miscdevice	misc;	/* misc device representing the log */
 	wait_queue_head_t	wq;	/* wait queue for readers */
 	struct list_head	readers; /* this log's readers */
-	struct mutex		mutex;	/* mutex protecting buffer */
+	spinlock_t		lock;	/* lock protecting buffer */
 	size_t			w_off;	/* current write head offset */
 	size_t			head;	/* new readers start here */
-	size_t			size;	/* size of the log */
+	unsigned long		size;	/* size of the log */
+	struct logger_mmap_header *mmap_header; /* offsets seen by mmap() */
+	struct mutex		resize_mutex; /* buffer swaps vs. mmap() */
+	atomic_t		mappings; /* vmas mapping the ring */
+	struct logger_archive	*archive; /* compressed evicted entries */
+	int			id;	/* LOGGER_ID_*, tags entries in pstore */
+	unsigned char		*pstore_buf; /* tagged entry for pstore */
 };
 
 /*
  * struct logger_reader - a logging device open for reading
  *
  * This object lives from open to release, so we don't need additional
- * reference counting. The structure is protected by log->mutex.
+ * reference counting. The structure is protected by log->lock.
  */
 struct logger_reader {
 	struct logger_log	*log;	/* associated log */
 	struct list_head	list;	/* entry in logger_log's list */
 	size_t			r_off;	/* current read head offset */
+	unsigned char		*buf;	/* bounce buffer for one entry */
+	struct mutex		buf_mutex; /* serializes users of 'buf' */
+	int			batch;	/* read() returns as many entries as fit */
+	int			archive; /* read() returns archived entries */
+	u64			archive_seq; /* next archive chunk to read */
+	int			archive_done; /* stage already returned */
+	unsigned char		*abuf;	/* decompressed archive chunk */
+	size_t			abuf_len; /* valid bytes in abuf */
+	size_t			abuf_off; /* next entry in abuf */
 };
 
 /* logger_offset - returns index 'n' into the log via (optimized) modulus */
 #define logger_offset(n)	((n) & (log->size - 1))
 
+#ifdef CONFIG_ANDROID_LOGGER_ARCHIVE
+
+/* entries evicted from the ring are compressed in chunks of this size */
+#define LOGGER_ARCHIVE_CHUNK	(64 * 1024)
+
+/* compressed bytes kept per log, oldest chunks are dropped beyond this */
+static unsigned long logger_archive_size =
+	CONFIG_ANDROID_LOGGER_ARCHIVE_SIZE * 1024;
+module_param_named(archive_size, logger_archive_size, ulong, S_IRUGO);
+
+struct logger_archive_chunk {
+	struct list_head	list;	/* entry in logger_archive's chunks */
+	u64			seq;	/* position in the archive */
+	size_t			len;	/* compressed length of data */
+	size_t			orig_len; /* evicted bytes it holds */
+	unsigned char		data[0];
+};
+
+/*
+ * struct logger_archive - compressed tier behind a log
+ *
+ * Entries pushed out of the ring by writers are appended to 'stage' under
+ * log->lock. A full stage becomes 'pending' and is compressed into a chunk
+ * by 'work'; if the previous stage is still pending the evicted entries are
+ * dropped instead of stalling the writer. The chunk list is protected by
+ * 'mutex'.
+ */
+struct logger_archive {
+	struct logger_log	*log;
+	unsigned char		*stage;	/* collects evicted entries */
+	size_t			stage_len;
+	unsigned char		*pending; /* full stage being compressed */
+	size_t			pending_len;
+	unsigned char		*idle;	/* free stage buffer, if any */
+	unsigned long		dropped; /* evicted bytes lost to the archive */
+	struct work_struct	work;
+	struct mutex		mutex;
+	struct list_head	chunks;	/* oldest first */
+	size_t			bytes;	/* compressed bytes in chunks */
+	u64			next_seq;
+	void			*wrkmem; /* lzo scratch memory */
+	unsigned char		*cbuf;	/* lzo output */
+};
+
+/*
+ * archive_evict - saves 'len' bytes of whole entries starting at 'off' before
+ * the writer overwrites them.
+ *
+ * The caller needs to hold log->lock.
+ */
+static void archive_evict(struct logger_log *log, size_t off, size_t len)
+{
+	struct logger_archive *a = log->archive;
+	size_t first;
+
+	if (!a)
+		return;
+
+	if (a->stage_len + len > LOGGER_ARCHIVE_CHUNK) {
+		if (a->pending) {
+			a->dropped += len;
+			return;
+		}
+		a->pending = a->stage;
+		a->pending_len = a->stage_len;
+		a->stage = a->idle;
+		a->stage_len = 0;
+		a->idle = NULL;
+		schedule_work(&a->work);
+	}
+
+	first = min(len, log->size - off);
+	memcpy(a->stage + a->stage_len, log->buffer + off, first);
+	if (len != first)
+		memcpy(a->stage + a->stage_len + first, log->buffer,
+		       len - first);
+	a->stage_len += len;
+}
+
+static void archive_work_func(struct work_struct *work)
+{
+	struct logger_archive *a = container_of(work, struct logger_archive,
+						work);
+	struct logger_log *log = a->log;
+	struct logger_archive_chunk *chunk, *old;
+	unsigned long discarded = 0;
+	unsigned char *buf;
+	size_t len, clen;
+	int ret;
+
+	spin_lock(&log->lock);
+	buf = a->pending;
+	len = a->pending_len;
+	spin_unlock(&log->lock);
+
+	if (!buf)
+		return;
+
+	mutex_lock(&a->mutex);
+	ret = lzo1x_1_compress(buf, len, a->cbuf, &clen, a->wrkmem);
+	chunk = ret == LZO_E_OK ?
+		kmalloc(sizeof(*chunk) + clen, GFP_KERNEL) : NULL;
+	if (chunk) {
+		memcpy(chunk->data, a->cbuf, clen);
+		chunk->len = clen;
+		chunk->orig_len = len;
+		chunk->seq = a->next_seq++;
+		list_add_tail(&chunk->list, &a->chunks);
+		a->bytes += clen;
+	} else {
+		discarded = len;
+	}
+	while (a->bytes > logger_archive_size) {
+		old = list_first_entry(&a->chunks,
+				       struct logger_archive_chunk, list);
+		list_del(&old->list);
+		a->bytes -= old->len;
+		discarded += old->orig_len;
+		kfree(old);
+	}
+	mutex_unlock(&a->mutex);
+
+	spin_lock(&log->lock);
+	a->dropped += discarded;
+	a->idle = buf;
+	a->pending = NULL;
+	spin_unlock(&log->lock);
+}
+
+static int archive_init(struct logger_log *log)
+{
+	struct logger_archive *a;
+
+	if (!logger_archive_size)
+		return 0;
+
+	a = kzalloc(sizeof(*a), GFP_KERNEL);
+	if (!a)
+		return -ENOMEM;
+
+	a->log = log;
+	a->stage = vmalloc(LOGGER_ARCHIVE_CHUNK);
+	a->idle = vmalloc(LOGGER_ARCHIVE_CHUNK);
+	a->cbuf = vmalloc(lzo1x_worst_compress(LOGGER_ARCHIVE_CHUNK));
+	a->wrkmem = vmalloc(LZO1X_1_MEM_COMPRESS);
+	if (!a->stage || !a->idle || !a->cbuf || !a->wrkmem) {
+		vfree(a->stage);
+		vfree(a->idle);
+		vfree(a->cbuf);
+		vfree(a->wrkmem);
+		kfree(a);
+		return -ENOMEM;
+	}
+	INIT_WORK(&a->work, archive_work_func);
+	mutex_init(&a->mutex);
+	INIT_LIST_HEAD(&a->chunks);
+
+	log->archive = a;
+	return 0;
+}
+
+/*
+ * archive_load - decompresses the next archive chunk the reader has not seen
+ * into its buffer. Once the chunks are exhausted the entries still waiting
+ * for compression are returned, after that the archive reads as empty.
+ *
+ * Returns 1 if the buffer was refilled, 0 at the end of the archive.
+ * The caller needs to hold reader->buf_mutex.
+ */
+static int archive_load(struct logger_log *log, struct logger_reader *reader)
+{
+	struct logger_archive *a = log->archive;
+	struct logger_archive_chunk *chunk;
+	size_t len;
+	int ret;
+
+	reader->abuf_off = 0;
+	reader->abuf_len = 0;
+
+	mutex_lock(&a->mutex);
+	list_for_each_entry(chunk, &a->chunks, list) {
+		if (chunk->seq < reader->archive_seq)
+			continue;
+		len = 2 * LOGGER_ARCHIVE_CHUNK;
+		ret = lzo1x_decompress_safe(chunk->data, chunk->len,
+					    reader->abuf, &len);
+		reader->archive_seq = chunk->seq + 1;
+		mutex_unlock(&a->mutex);
+		if (ret != LZO_E_OK)
+			return -EIO;
+		reader->abuf_len = len;
+		return 1;
+	}
+	mutex_unlock(&a->mutex);
+
+	if (reader->archive_done)
+		return 0;
+	reader->archive_done = 1;
+
+	spin_lock(&log->lock);
+	if (a->pending) {
+		memcpy(reader->abuf, a->pending, a->pending_len);
+		reader->abuf_len = a->pending_len;
+	}
+	memcpy(reader->abuf + reader->abuf_len, a->stage, a->stage_len);
+	reader->abuf_len += a->stage_len;
+	spin_unlock(&log->lock);
+
+	return reader->abuf_len ? 1 : 0;
+}
+
+/*
+ * logger_read_archive - read() for a reader in archive mode. Returns as many
+ * whole archived entries as fit in 'buf', oldest first, and 0 once the
+ * archive has been read completely.
+ */
+static ssize_t logger_read_archive(struct logger_reader *reader,
+				   char __user *buf, size_t count)
+{
+	struct logger_log *log = reader->log;
+	size_t total = 0;
+	ssize_t ret = 0;
+
+	mutex_lock(&reader->buf_mutex);
+
+	if (reader->abuf_off == reader->abuf_len) {
+		ret = archive_load(log, reader);
+		if (ret <= 0)
+			goto out;
+	}
+
+	while (reader->abuf_off < reader->abuf_len) {
+		unsigned char *entry = reader->abuf + reader->abuf_off;
+		__u16 val;
+		size_t len;
+
+		memcpy(&val, entry, sizeof(val));
+		len = sizeof(struct logger_entry) + val;
+		if (count - total < len)
+			break;
+		if (copy_to_user(buf + total, entry, len)) {
+			ret = -EFAULT;
+			goto out;
+		}
+		total += len;
+		reader->abuf_off += len;
+	}
+	ret = total ? total : -EINVAL;
+
+out:
+	mutex_unlock(&reader->buf_mutex);
+	return ret;
+}
+
+static int logger_set_read_archive(struct logger_reader *reader, int enable)
+{
+	struct logger_log *log = reader->log;
+	int ret = 0;
+
+	if (!log->archive)
+		return -EOPNOTSUPP;
+
+	mutex_lock(&reader->buf_mutex);
+	if (enable && !reader->abuf) {
+		reader->abuf = vmalloc(2 * LOGGER_ARCHIVE_CHUNK);
+		if (!reader->abuf)
+			ret = -ENOMEM;
+	}
+	if (!ret) {
+		reader->archive = enable;
+		reader->archive_seq = 0;
+		reader->archive_done = 0;
+		reader->abuf_len = 0;
+		reader->abuf_off = 0;
+	}
+	mutex_unlock(&reader->buf_mutex);
+
+	return ret;
+}
+
+#else
+
+static inline void archive_evict(struct logger_log *log, size_t off,
+				 size_t len)
+{
+}
+
+static inline int archive_init(struct logger_log *log)
+{
+	return 0;
+}
+
+static inline ssize_t logger_read_archive(struct logger_reader *reader,
+					  char __user *buf, size_t count)
+{
+	return 0;
+}
+
+static inline int logger_set_read_archive(struct logger_reader *reader,
+					  int enable)
+{
+	return -EOPNOTSUPP;
+}
+
+#endif /* CONFIG_ANDROID_LOGGER_ARCHIVE */
+
 /*
  * file_get_log - Given a file structure, return the associated log
  *
@@ -85,11 +416,34 @@ static inline struct logger_log *file_get_log(struct file *file)
 		return file->private_data;
 }
 
+/*
+ * update_mmap_header - publishes the current offsets to the page mapped by
+ * logger_mmap(). 'seq' is odd while the offsets are being changed, so a
+ * reader in user space retries until it sees the same even value before and
+ * after reading them.
+ *
+ * Caller needs to hold log->lock.
+ */
+static void update_mmap_header(struct logger_log *log)
+{
+	struct logger_mmap_header *hdr = log->mmap_header;
+
+	if (!hdr)
+		return;
+
+	hdr->seq++;
+	smp_wmb();
+	hdr->w_off = log->w_off;
+	hdr->head = log->head;
+	smp_wmb();
+	hdr->seq++;
+}
+
 /*
  * get_entry_len - Grabs the length of the payload of the next entry starting
  * from 'off'.
  *
- * Caller needs to hold log->mutex.
+ * Caller needs to hold log->lock.
  */
 static __u32 get_entry_len(struct logger_log *log, size_t off)
 {
@@ -108,15 +462,14 @@ static __u32 get_entry_len(struct logger_log *log, size_t off)
 }
 
 /*
- * do_read_log_to_user - reads exactly 'count' bytes from 'log' into the
- * user-space buffer 'buf'. Returns 'count' on success.
+ * do_read_log - copies exactly 'count' bytes from 'log' into the reader's
+ * bounce buffer and advances the reader past them.
  *
- * Caller must hold log->mutex.
+ * Caller must hold log->lock.
  */
-static ssize_t do_read_log_to_user(struct logger_log *log,
-				   struct logger_reader *reader,
-				   char __user *buf,
-				   size_t count)
+static void do_read_log(struct logger_log *log,
+			struct logger_reader *reader,
+			size_t count)
 {
 	size_t len;
 
@@ -126,20 +479,16 @@ static ssize_t do_read_log_to_user(struct logger_log *log,
 	 * the log, whichever comes first.
 	 */
 	len = min(count, log->size - reader->r_off);
-	if (copy_to_user(buf, log->buffer + reader->r_off, len))
-		return -EFAULT;
+	memcpy(reader->buf, log->buffer + reader->r_off, len);
 
 	/*
 	 * Second, we read any remaining bytes, starting back at the head of
 	 * the log.
 	 */
 	if (count != len)
-		if (copy_to_user(buf + len, log->buffer, count - len))
-			return -EFAULT;
+		memcpy(reader->buf + len, log->buffer, count - len);
 
 	reader->r_off = logger_offset(reader->r_off + count);
-
-	return count;
 }
 
 /*
@@ -149,7 +498,8 @@ static ssize_t do_read_log_to_user(struct logger_log *log,
  *
  * 	- O_NONBLOCK works
  * 	- If there are no log entries to read, blocks until log is written to
- * 	- Atomically reads exactly one log entry
+ * 	- Atomically reads exactly one log entry, or in batch mode (see
+ * 	  LOGGER_SET_BATCH_READ) as many whole entries as fit in the buffer
  *
  * Optimal read size is LOGGER_ENTRY_MAX_LEN. Will set errno to EINVAL if read
  * buffer is insufficient to hold next entry.
@@ -159,16 +509,20 @@ static ssize_t logger_read(struct file *file, char __user *buf,
 {
 	struct logger_reader *reader = file->private_data;
 	struct logger_log *log = reader->log;
+	size_t total = 0;
 	ssize_t ret;
 	DEFINE_WAIT(wait);
 
+	if (reader->archive)
+		return logger_read_archive(reader, buf, count);
+
 start:
 	while (1) {
 		prepare_to_wait(&log->wq, &wait, TASK_INTERRUPTIBLE);
 
-		mutex_lock(&log->mutex);
+		spin_lock(&log->lock);
 		ret = (log->w_off == reader->r_off);
-		mutex_unlock(&log->mutex);
+		spin_unlock(&log->lock);
 		if (!ret)
 			break;
 
@@ -189,11 +543,13 @@ start:
 	if (ret)
 		return ret;
 
-	mutex_lock(&log->mutex);
+	mutex_lock(&reader->buf_mutex);
+	spin_lock(&log->lock);
 
 	/* is there still something to read or did we race? */
 	if (unlikely(log->w_off == reader->r_off)) {
-		mutex_unlock(&log->mutex);
+		spin_unlock(&log->lock);
+		mutex_unlock(&reader->buf_mutex);
 		goto start;
 	}
 
@@ -201,14 +557,40 @@ start:
 	ret = get_entry_len(log, reader->r_off);
 	if (count < ret) {
 		ret = -EINVAL;
+		spin_unlock(&log->lock);
 		goto out;
 	}
 
-	/* get exactly one entry from the log */
-	ret = do_read_log_to_user(log, reader, buf, ret);
+	while (1) {
+		/* get exactly one entry from the log */
+		do_read_log(log, reader, ret);
+
+		spin_unlock(&log->lock);
+
+		if (copy_to_user(buf + total, reader->buf, ret)) {
+			ret = total ? total : -EFAULT;
+			goto out;
+		}
+		total += ret;
+
+		if (!reader->batch)
+			break;
+
+		spin_lock(&log->lock);
+		if (log->w_off == reader->r_off) {
+			spin_unlock(&log->lock);
+			break;
+		}
+		ret = get_entry_len(log, reader->r_off);
+		if (count - total < ret) {
+			spin_unlock(&log->lock);
+			break;
+		}
+	}
+	ret = total;
 
 out:
-	mutex_unlock(&log->mutex);
+	mutex_unlock(&reader->buf_mutex);
 
 	return ret;
 }
@@ -217,7 +599,7 @@ out:
  * get_next_entry - return the offset of the first valid entry at least 'len'
  * bytes after 'off'.
  *
- * Caller must hold log->mutex.
+ * Caller must hold log->lock.
  */
 static size_t get_next_entry(struct logger_log *log, size_t off, size_t len)
 {
@@ -255,16 +637,26 @@ static inline int clock_interval(size_t a, size_t b, size_t c)
  * We do this by "pulling forward" the readers and start head to the first
  * entry after the new write head.
  *
- * The caller needs to hold log->mutex.
+ * The caller needs to hold log->lock.
  */
 static void fix_up_readers(struct logger_log *log, size_t len)
 {
 	size_t old = log->w_off;
 	size_t new = logger_offset(old + len);
 	struct logger_reader *reader;
+	size_t head;
+
+	/*
+	 * Every reader sits between the start head and the write head, so
+	 * none of them can be lapped unless the start head is.
+	 */
+	if (!clock_interval(old, new, log->head))
+		return;
 
-	if (clock_interval(old, new, log->head))
-		log->head = get_next_entry(log, log->head, len);
+	head = get_next_entry(log, log->head, len);
+	archive_evict(log, log->head, logger_offset(head - log->head));
+	log->head = head;
+	update_mmap_header(log);
 
 	list_for_each_entry(reader, &log->readers, list)
 		if (clock_interval(old, new, reader->r_off))
@@ -272,48 +664,80 @@ static void fix_up_readers(struct logger_log *log, size_t len)
 }
 
 /*
- * do_write_log - writes 'len' bytes from 'buf' to 'log'
+ * do_write_log - writes 'len' bytes from 'buf' to 'log' at offset 'off'.
+ * Returns the offset just past the written bytes.
  *
- * The caller needs to hold log->mutex.
+ * The caller needs to hold log->lock.
  */
-static void do_write_log(struct logger_log *log, const void *buf, size_t count)
+static size_t do_write_log(struct logger_log *log, size_t off,
+			   const void *buf, size_t count)
 {
 	size_t len;
 
-	len = min(count, log->size - log->w_off);
-	memcpy(log->buffer + log->w_off, buf, len);
+	len = min(count, log->size - off);
+	memcpy(log->buffer + off, buf, len);
 
 	if (count != len)
 		memcpy(log->buffer, buf + len, count - len);
 
-	log->w_off = logger_offset(log->w_off + count);
+	return logger_offset(off + count);
+}
 
+#ifdef CONFIG_PSTORE
+/*
+ * logger_pstore_write - copies the 'len' byte entry at 'off' to the pstore
+ * logger record, if the pstore backend keeps one, so that it survives a
+ * crash. The entry goes behind a struct logger_pstore_hdr naming the log,
+ * in a single write, so that entries of different logs don't mix.
+ *
+ * The caller needs to hold log->lock.
+ */
+static void logger_pstore_write(struct logger_log *log, size_t off,
+				size_t len)
+{
+	struct logger_pstore_hdr *hdr = (void *)log->pstore_buf;
+	size_t first = min(len, log->size - off);
+
+	if (!hdr)
+		return;
+	hdr->magic = LOGGER_PSTORE_MAGIC;
+	hdr->log_id = log->id;
+	memcpy(hdr + 1, log->buffer + off, first);
+	memcpy((unsigned char *)(hdr + 1) + first, log->buffer, len - first);
+	pstore_write_buf(PSTORE_TYPE_LOGGER, (const char *)hdr,
+			 sizeof(*hdr) + len);
 }
+#else
+static inline void logger_pstore_write(struct logger_log *log, size_t off,
+				       size_t len)
+{
+}
+#endif
 
 /*
- * do_write_log_user - writes 'len' bytes from the user-space buffer 'buf' to
- * the log 'log'
+ * do_write_log_from_user - writes 'len' bytes from the user-space buffer 'buf'
+ * to the log 'log' at offset 'off'. Must be called with page faults disabled;
+ * the caller has already checked the user range with access_ok().
  *
- * The caller needs to hold log->mutex.
+ * The caller needs to hold log->lock.
  *
- * Returns 'count' on success, negative error code on failure.
+ * Returns 0 on success, -EFAULT if the user pages are not resident.
  */
-static ssize_t do_write_log_from_user(struct logger_log *log,
-				      const void __user *buf, size_t count)
+static int do_write_log_from_user(struct logger_log *log, size_t off,
+				  const void __user *buf, size_t count)
 {
 	size_t len;
 
-	len = min(count, log->size - log->w_off);
-	if (len && copy_from_user(log->buffer + log->w_off, buf, len))
+	len = min(count, log->size - off);
+	if (len && __copy_from_user_inatomic(log->buffer + off, buf, len))
 		return -EFAULT;
 
 	if (count != len)
-		if (copy_from_user(log->buffer, buf + len, count - len))
+		if (__copy_from_user_inatomic(log->buffer, buf + len,
+					      count - len))
 			return -EFAULT;
 
-	log->w_off = logger_offset(log->w_off + count);
-
-	return count;
+	return 0;
 }
 
 /*
@@ -325,10 +749,13 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 			 unsigned long nr_segs, loff_t ppos)
 {
 	struct logger_log *log = file_get_log(iocb->ki_filp);
-	size_t orig = log->w_off;
 	struct logger_entry header;
 	struct timespec now;
-	ssize_t ret = 0;
+	const struct iovec *vec;
+	unsigned long seg;
+	size_t off;
+	ssize_t ret;
+	int fault;
 
 	now = current_kernel_time();
 
@@ -342,7 +769,16 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 	if (unlikely(!header.len))
 		return 0;
 
-	mutex_lock(&log->mutex);
+	for (seg = 0, ret = 0, vec = iov; seg < nr_segs; seg++, vec++) {
+		size_t len = min_t(size_t, vec->iov_len, header.len - ret);
+
+		if (!access_ok(VERIFY_READ, vec->iov_base, len))
+			return -EFAULT;
+		ret += len;
+	}
+
+again:
+	spin_lock(&log->lock);
 
 	/*
 	 * Fix up any readers, pulling them forward to the first readable
@@ -352,28 +788,49 @@ ssize_t logger_aio_write(struct kiocb *iocb, const struct iovec *iov,
 	 */
 	fix_up_readers(log, sizeof(struct logger_entry) + header.len);
 
-	do_write_log(log, &header, sizeof(struct logger_entry));
-
-	while (nr_segs-- > 0) {
-		size_t len;
-		ssize_t nr;
+	off = do_write_log(log, log->w_off, &header,
+			   sizeof(struct logger_entry));
 
+	fault = 0;
+	pagefault_disable();
+	for (seg = 0, ret = 0, vec = iov; seg < nr_segs; seg++, vec++) {
 		/* figure out how much of this vector we can keep */
-		len = min_t(size_t, iov->iov_len, header.len - ret);
+		size_t len = min_t(size_t, vec->iov_len, header.len - ret);
 
 		/* write out this segment's payload */
-		nr = do_write_log_from_user(log, iov->iov_base, len);
-		if (unlikely(nr < 0)) {
-			log->w_off = orig;
-			mutex_unlock(&log->mutex);
-			return nr;
-		}
+		fault = do_write_log_from_user(log, off, vec->iov_base, len);
+		if (unlikely(fault))
+			break;
 
-		iov++;
-		ret += nr;
+		off = logger_offset(off + len);
+		ret += len;
 	}
+	pagefault_enable();
 
-	mutex_unlock(&log->mutex);
+	/*
+	 * The entry only becomes visible to readers once w_off moves past it,
+	 * so a partial copy can simply be redone after faulting the user
+	 * pages in. Each segment is at most LOGGER_ENTRY_MAX_PAYLOAD bytes.
+	 */
+	if (unlikely(fault)) {
+		spin_unlock(&log->lock);
+		for (seg = 0, ret = 0, vec = iov; seg < nr_segs; seg++, vec++) {
+			size_t len = min_t(size_t, vec->iov_len,
+					   header.len - ret);
+
+			if (fault_in_pages_readable(vec->iov_base, len))
+				return -EFAULT;
+			ret += len;
+		}
+		goto again;
+	}
+
+	logger_pstore_write(log, log->w_off,
+			    sizeof(struct logger_entry) + header.len);
+	log->w_off = off;
+	update_mmap_header(log);
+
+	spin_unlock(&log->lock);
 
 	/* wake up any blocked readers */
 	wake_up_interruptible(&log->wq);
@@ -404,17 +861,24 @@ static int logger_open(struct inode *inode, struct file *file)
 	if (file->f_mode & FMODE_READ) {
 		struct logger_reader *reader;
 
-		reader = kmalloc(sizeof(struct logger_reader), GFP_KERNEL);
+		reader = kzalloc(sizeof(struct logger_reader), GFP_KERNEL);
 		if (!reader)
 			return -ENOMEM;
 
+		reader->buf = kmalloc(LOGGER_ENTRY_MAX_LEN, GFP_KERNEL);
+		if (!reader->buf) {
+			kfree(reader);
+			return -ENOMEM;
+		}
+
 		reader->log = log;
 		INIT_LIST_HEAD(&reader->list);
+		mutex_init(&reader->buf_mutex);
 
-		mutex_lock(&log->mutex);
+		spin_lock(&log->lock);
 		reader->r_off = log->head;
 		list_add_tail(&reader->list, &log->readers);
-		mutex_unlock(&log->mutex);
+		spin_unlock(&log->lock);
 
 		file->private_data = reader;
 	} else
@@ -432,7 +896,13 @@ static int logger_release(struct inode *ignored, struct file *file)
 {
 	if (file->f_mode & FMODE_READ) {
 		struct logger_reader *reader = file->private_data;
+		struct logger_log *log = reader->log;
+
+		spin_lock(&log->lock);
 		list_del(&reader->list);
+		spin_unlock(&log->lock);
+		vfree(reader->abuf);
+		kfree(reader->buf);
 		kfree(reader);
 	}
 
@@ -462,21 +932,84 @@ static unsigned int logger_poll(struct file *file, poll_table *wait)
 
 	poll_wait(file, &log->wq, wait);
 
-	mutex_lock(&log->mutex);
+	spin_lock(&log->lock);
 	if (log->w_off != reader->r_off)
 		ret |= POLLIN | POLLRDNORM;
-	mutex_unlock(&log->mutex);
+	spin_unlock(&log->lock);
 
 	return ret;
 }
 
+/*
+ * logger_resize - replaces the log's ring with an empty one of 'size' bytes.
+ *
+ * Everything in the old ring is discarded and all readers start over at the
+ * beginning of the new one. Mappings of the old ring would keep its pages
+ * but share the header page describing the new one, so the resize is
+ * refused with -EBUSY while the log is mapped.
+ */
+static long logger_resize(struct logger_log *log, unsigned long size)
+{
+	struct logger_reader *reader;
+	unsigned char *buffer, *old;
+
+	if (!is_power_of_2(size) || size <= LOGGER_ENTRY_MAX_LEN ||
+	    size > LOGGER_MAX_LOG_SIZE)
+		return -EINVAL;
+
+	buffer = vzalloc(size);
+	if (!buffer)
+		return -ENOMEM;
+
+	mutex_lock(&log->resize_mutex);
+	if (atomic_read(&log->mappings)) {
+		mutex_unlock(&log->resize_mutex);
+		vfree(buffer);
+		return -EBUSY;
+	}
+	spin_lock(&log->lock);
+	old = log->buffer;
+	log->buffer = buffer;
+	log->size = size;
+	log->w_off = 0;
+	log->head = 0;
+	list_for_each_entry(reader, &log->readers, list)
+		reader->r_off = 0;
+	if (log->mmap_header)
+		log->mmap_header->size = size;
+	update_mmap_header(log);
+	spin_unlock(&log->lock);
+	mutex_unlock(&log->resize_mutex);
+
+	vfree(old);
+
+	printk(KERN_INFO "logger: resized log '%s' to %luK\n",
+	       log->misc.name, size >> 10);
+
+	return 0;
+}
+
 static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
 	struct logger_log *log = file_get_log(file);
 	struct logger_reader *reader;
 	long ret = -ENOTTY;
 
-	mutex_lock(&log->mutex);
+	/* these may sleep, so they are handled before taking log->lock */
+	switch (cmd) {
+	case LOGGER_SET_LOG_BUF_SIZE:
+		if (!(file->f_mode & FMODE_WRITE))
+			return -EBADF;
+		if (!capable(CAP_SYS_ADMIN))
+			return -EPERM;
+		return logger_resize(log, arg);
+	case LOGGER_SET_READ_ARCHIVE:
+		if (!(file->f_mode & FMODE_READ))
+			return -EBADF;
+		return logger_set_read_archive(file->private_data, !!arg);
+	}
+
+	spin_lock(&log->lock);
 
 	switch (cmd) {
 	case LOGGER_GET_LOG_BUF_SIZE:
@@ -512,18 +1045,100 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		list_for_each_entry(reader, &log->readers, list)
 			reader->r_off = log->w_off;
 		log->head = log->w_off;
+		update_mmap_header(log);
+		ret = 0;
+		break;
+	case LOGGER_SET_BATCH_READ:
+		if (!(file->f_mode & FMODE_READ)) {
+			ret = -EBADF;
+			break;
+		}
+		reader = file->private_data;
+		reader->batch = !!arg;
 		ret = 0;
 		break;
 	}
 
-	mutex_unlock(&log->mutex);
+	spin_unlock(&log->lock);
 
 	return ret;
 }
 
+static void logger_vma_open(struct vm_area_struct *vma)
+{
+	struct logger_log *log = vma->vm_private_data;
+
+	atomic_inc(&log->mappings);
+}
+
+static void logger_vma_close(struct vm_area_struct *vma)
+{
+	struct logger_log *log = vma->vm_private_data;
+
+	atomic_dec(&log->mappings);
+}
+
+static const struct vm_operations_struct logger_vm_ops = {
+	.open = logger_vma_open,
+	.close = logger_vma_close,
+};
+
+/*
+ * logger_mmap - the log's mmap file operation
+ *
+ * Maps the log read-only: one page holding struct logger_mmap_header,
+ * followed by the ring buffer itself. Entries are laid out exactly as
+ * read() returns them, so collectors can drain the log without a syscall
+ * per entry.
+ */
+static int logger_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct logger_log *log = file_get_log(file);
+	unsigned long size = vma->vm_end - vma->vm_start;
+	unsigned long addr;
+	unsigned char *p;
+	int ret;
+
+	if (!(file->f_mode & FMODE_READ) || !log->mmap_header)
+		return -EACCES;
+
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+
+	mutex_lock(&log->resize_mutex);
+
+	ret = -EINVAL;
+	if (vma->vm_pgoff || size > PAGE_SIZE + PAGE_ALIGN(log->size))
+		goto out;
+
+	vma->vm_flags &= ~VM_MAYWRITE;
+
+	ret = vm_insert_page(vma, vma->vm_start,
+			     virt_to_page(log->mmap_header));
+	if (ret)
+		goto out;
+
+	for (addr = vma->vm_start + PAGE_SIZE, p = log->buffer;
+	     addr < vma->vm_end; addr += PAGE_SIZE, p += PAGE_SIZE) {
+		ret = vm_insert_page(vma, addr, vmalloc_to_page(p));
+		if (ret)
+			goto out;
+	}
+
+	/* counted under resize_mutex, so a resize cannot slip in between */
+	vma->vm_ops = &logger_vm_ops;
+	vma->vm_private_data = log;
+	logger_vma_open(vma);
+
+out:
+	mutex_unlock(&log->resize_mutex);
+	return ret;
+}
+
 static const struct file_operations logger_fops = {
 	.owner = THIS_MODULE,
 	.read = logger_read,
+	.mmap = logger_mmap,
 	.aio_write = logger_aio_write,
 	.poll = logger_poll,
 	.unlocked_ioctl = logger_ioctl,
@@ -533,14 +1148,13 @@ static const struct file_operations logger_fops = {
 };
 
 /*
- * Defines a log structure with name 'NAME' and a size of 'SIZE' bytes, which
- * must be a power of two, greater than LOGGER_ENTRY_MAX_LEN, and less than
- * LONG_MAX minus LOGGER_ENTRY_MAX_LEN.
+ * Defines a log structure with name 'NAME', id 'ID' and a default size of
+ * 'SIZE' bytes, which can be overridden with the module parameter 'PARAM'.
+ * The size must be a power of two, greater than LOGGER_ENTRY_MAX_LEN and at
+ * most LOGGER_MAX_LOG_SIZE. The ring itself is allocated by init_log().
  */
-#define DEFINE_LOGGER_DEVICE(VAR, NAME, SIZE) \
-static unsigned char _buf_ ## VAR[SIZE]; \
+#define DEFINE_LOGGER_DEVICE(VAR, NAME, ID, SIZE, PARAM) \
 static struct logger_log VAR = { \
-	.buffer = _buf_ ## VAR, \
 	.misc = { \
 		.minor = MISC_DYNAMIC_MINOR, \
 		.name = NAME, \
@@ -549,16 +1163,24 @@ static struct logger_log VAR = { \
 	}, \
 	.wq = __WAIT_QUEUE_HEAD_INITIALIZER(VAR .wq), \
 	.readers = LIST_HEAD_INIT(VAR .readers), \
-	.mutex = __MUTEX_INITIALIZER(VAR .mutex), \
+	.lock = __SPIN_LOCK_UNLOCKED(VAR .lock), \
+	.resize_mutex = __MUTEX_INITIALIZER(VAR .resize_mutex), \
+	.mappings = ATOMIC_INIT(0), \
 	.w_off = 0, \
 	.head = 0, \
 	.size = SIZE, \
-};
-
-DEFINE_LOGGER_DEVICE(log_main, LOGGER_LOG_MAIN, 256*1024)
-DEFINE_LOGGER_DEVICE(log_events, LOGGER_LOG_EVENTS, 256*1024)
-DEFINE_LOGGER_DEVICE(log_radio, LOGGER_LOG_RADIO, 256*1024)
-DEFINE_LOGGER_DEVICE(log_system, LOGGER_LOG_SYSTEM, 256*1024)
+	.id = ID, \
+}; \
+module_param_named(PARAM, VAR .size, ulong, S_IRUGO);
+
+DEFINE_LOGGER_DEVICE(log_main, LOGGER_LOG_MAIN, LOGGER_ID_MAIN, 256*1024,
+		     main_size)
+DEFINE_LOGGER_DEVICE(log_events, LOGGER_LOG_EVENTS, LOGGER_ID_EVENTS, 256*1024,
+		     events_size)
+DEFINE_LOGGER_DEVICE(log_radio, LOGGER_LOG_RADIO, LOGGER_ID_RADIO, 256*1024,
+		     radio_size)
+DEFINE_LOGGER_DEVICE(log_system, LOGGER_LOG_SYSTEM, LOGGER_ID_SYSTEM, 256*1024,
+		     system_size)
 
 static struct logger_log *get_log_from_minor(int minor)
 {
@@ -577,6 +1199,35 @@ static int __init init_log(struct logger_log *log)
 {
 	int ret;
 
+	if (!is_power_of_2(log->size) || log->size <= LOGGER_ENTRY_MAX_LEN ||
+	    log->size > LOGGER_MAX_LOG_SIZE) {
+		printk(KERN_ERR "logger: invalid size %lu for log '%s'\n",
+		       (unsigned long) log->size, log->misc.name);
+		return -EINVAL;
+	}
+
+	log->buffer = vzalloc(log->size);
+	if (!log->buffer)
+		return -ENOMEM;
+
+	/* archiving is optional as well, the log works without it */
+	if (archive_init(log))
+		printk(KERN_WARNING "logger: no archive for log '%s'\n",
+		       log->misc.name);
+
+#ifdef CONFIG_PSTORE
+	/* entries aren't kept in pstore without it */
+	log->pstore_buf = kmalloc(sizeof(struct logger_pstore_hdr) +
+				  LOGGER_ENTRY_MAX_LEN, GFP_KERNEL);
+#endif
+
+	/* mmap() is optional, the log works without its header page */
+	log->mmap_header = (void *)get_zeroed_page(GFP_KERNEL);
+	if (log->mmap_header) {
+		log->mmap_header->version = LOGGER_MMAP_VERSION;
+		log->mmap_header->size = log->size;
+	}
+
 	ret = misc_register(&log->misc);
 	if (unlikely(ret)) {
 		printk(KERN_ERR "logger: failed to register misc "
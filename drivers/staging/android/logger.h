@@ -30,6 +30,45 @@ struct logger_entry {
 	char		msg[0];	/* the entry's payload */
 };
 
+/*
+ * struct logger_mmap_header - first page of a log mapped with mmap()
+ *
+ * The ring buffer follows at offset PAGE_SIZE. 'seq' is odd while the
+ * offsets are being updated; a snapshot of 'w_off' and 'head' is consistent
+ * if 'seq' was the same even value before and after reading them.
+ */
+struct logger_mmap_header {
+	__u32		version;	/* LOGGER_MMAP_VERSION */
+	__u32		size;		/* size of the ring buffer */
+	__u32		seq;		/* update sequence count */
+	__u32		w_off;		/* current write head offset */
+	__u32		head;		/* oldest entry still in the ring */
+};
+
+#define LOGGER_MMAP_VERSION	1
+
+/*
+ * struct logger_pstore_hdr - precedes each entry in the pstore logger record
+ *
+ * All logs share that record, so each entry copied there is tagged with
+ * the log it was written to. A record whose ring wrapped starts in the
+ * middle of an entry; readers skip to the first 'magic' followed by a
+ * plausible entry.
+ */
+struct logger_pstore_hdr {
+	__u16		magic;	/* LOGGER_PSTORE_MAGIC */
+	__u16		log_id;	/* LOGGER_ID_* */
+};
+
+#define LOGGER_PSTORE_MAGIC	0x4c47	/* "LG" in little endian */
+
+enum {
+	LOGGER_ID_MAIN		= 0,
+	LOGGER_ID_RADIO		= 1,
+	LOGGER_ID_EVENTS	= 2,
+	LOGGER_ID_SYSTEM	= 3,
+};
+
 #define LOGGER_LOG_RADIO	"log_radio"	/* radio-related messages */
 #define LOGGER_LOG_EVENTS	"log_events"	/* system/hardware events */
 #define LOGGER_LOG_SYSTEM	"log_system"	/* system/framework messages */
@@ -39,11 +78,16 @@ struct logger_entry {
 #define LOGGER_ENTRY_MAX_PAYLOAD	\
 	(LOGGER_ENTRY_MAX_LEN - sizeof(struct logger_entry))
 
+#define LOGGER_MAX_LOG_SIZE		(16*1024*1024)
+
 #define __LOGGERIO	0xAE
 
 #define LOGGER_GET_LOG_BUF_SIZE		_IO(__LOGGERIO, 1) /* size of log */
 #define LOGGER_GET_LOG_LEN		_IO(__LOGGERIO, 2) /* used log len */
 #define LOGGER_GET_NEXT_ENTRY_LEN	_IO(__LOGGERIO, 3) /* next entry len */
 #define LOGGER_FLUSH_LOG		_IO(__LOGGERIO, 4) /* flush log */
+#define LOGGER_SET_BATCH_READ		_IO(__LOGGERIO, 5) /* many per read */
+#define LOGGER_SET_LOG_BUF_SIZE		_IO(__LOGGERIO, 6) /* resize log */
+#define LOGGER_SET_READ_ARCHIVE		_IO(__LOGGERIO, 7) /* read archive */
 
 #endif /* _LINUX_LOGGER_H */
@@ -34,7 +34,13 @@
 #include <linux/mm.h>
 #include <linux/oom.h>
 #include <linux/sched.h>
+#include <linux/spinlock.h>
+#include <linux/rcupdate.h>
 #include <linux/notifier.h>
+#include <linux/kthread.h>
+#include <linux/freezer.h>
+#include <linux/ktime.h>
+#include <linux/wait.h>
 
 static uint32_t lowmem_debug_level = 2;
 static int lowmem_adj[6] = {
@@ -55,6 +61,68 @@ static int lowmem_minfree_size = 4;
 static struct task_struct *lowmem_deathpending;
 static unsigned long lowmem_deathpending_timeout;
 
+/*
+ * Proactive mode: a kthread samples free memory every 'proactive_interval'
+ * milliseconds, tracks how fast it is declining and kills as soon as the
+ * free memory expected 'proactive_lookahead' milliseconds from now would be
+ * below a minfree threshold, instead of waiting for kswapd or direct reclaim
+ * to get there and call the shrinker. While it is off the kthread sleeps on
+ * lowmem_proactive_wait and does not wake up at all.
+ */
+static int lowmem_proactive;
+static DECLARE_WAIT_QUEUE_HEAD(lowmem_proactive_wait);
+static unsigned int lowmem_proactive_interval = 100;
+static unsigned int lowmem_proactive_lookahead = 1000;
+
+/*
+ * Per-kill statistics. A kill completes when the victim's address space is
+ * torn down by the last mmput(), which is when its memory is returned; the
+ * task_struct itself may linger much longer as an unreaped zombie.
+ */
+#define LOWMEM_KILL_RECORDS	16
+
+struct lowmem_kill {
+	struct mm_struct *mm;		/* victim's mm, until it is torn down */
+	pid_t pid;
+	char comm[TASK_COMM_LEN];
+	int oom_adj;
+	int tasksize;			/* rss in pages when killed */
+	int other_free;			/* free pages when killed */
+	int proactive;			/* killed by the kthread */
+	ktime_t start;
+	s64 latency_us;			/* kill to mm torn down, -1 if pending */
+};
+
+static struct lowmem_kill lowmem_kills[LOWMEM_KILL_RECORDS];
+static unsigned int lowmem_kill_next;
+static unsigned long lowmem_kill_count;
+static unsigned long lowmem_kill_proactive_count;
+static s64 lowmem_kill_latency_max_us;
+static s64 lowmem_kill_latency_total_us;
+static unsigned long lowmem_kill_latency_count;
+static unsigned int lowmem_kill_pending;	/* records with an mm */
+
+/* protects the kill records */
+static DEFINE_SPINLOCK(lowmem_stats_lock);
+
+/*
+ * Thread group leaders, hashed by their oom_adj, so that the shrinker only
+ * looks at the tasks it may actually kill instead of walking every process
+ * under tasklist_lock. A zeroed hlist_head is a valid empty bucket, which
+ * matters because tasks are forked long before lowmem_init() runs.
+ *
+ * Lock Ordering: tasklist_lock -> lowmem_bucket_lock -> task_lock
+ *
+ * fork, release_task() and exec take lowmem_bucket_lock under a
+ * write-locked tasklist_lock, so that a task is in its bucket exactly while
+ * it can be found through its pid. It must never be held with interrupts
+ * enabled: an interrupt doing read_lock(&tasklist_lock) would spin against
+ * them.
+ */
+#define LOWMEM_BUCKETS	(OOM_ADJUST_MAX - OOM_DISABLE + 1)
+static struct hlist_head lowmem_buckets[LOWMEM_BUCKETS];
+static DEFINE_SPINLOCK(lowmem_bucket_lock);
+
 #define lowmem_print(level, x...)			\
 	do {						\
 		if (lowmem_debug_level >= (level))	\
@@ -79,17 +147,304 @@ task_notify_func(struct notifier_block *self, unsigned long val, void *data)
 	return NOTIFY_OK;
 }
 
-static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
+/* Caller must hold lowmem_stats_lock. */
+static void lowmem_kill_done(struct lowmem_kill *k, s64 us)
+{
+	k->mm = NULL;
+	k->latency_us = us;
+	lowmem_kill_pending--;
+	lowmem_kill_latency_total_us += us;
+	lowmem_kill_latency_count++;
+	if (us > lowmem_kill_latency_max_us)
+		lowmem_kill_latency_max_us = us;
+}
+
+/* Called from mmput() once the last user of @mm has unmapped it. */
+void lowmem_mm_released(struct mm_struct *mm)
+{
+	unsigned long flags;
+	int i;
+
+	if (likely(!ACCESS_ONCE(lowmem_kill_pending)))
+		return;
+
+	spin_lock_irqsave(&lowmem_stats_lock, flags);
+	for (i = 0; i < LOWMEM_KILL_RECORDS; i++) {
+		struct lowmem_kill *k = &lowmem_kills[i];
+
+		if (k->mm == mm)
+			lowmem_kill_done(k, ktime_us_delta(ktime_get(),
+							   k->start));
+	}
+	spin_unlock_irqrestore(&lowmem_stats_lock, flags);
+}
+
+/*
+ * Caller must hold task_lock(p), so that p->mm is still live and its
+ * release is yet to be reported.
+ */
+static void lowmem_record_kill(struct task_struct *p, int oom_adj,
+			       int tasksize, int other_free, int proactive)
+{
+	struct lowmem_kill *k;
+	unsigned long flags;
+
+	spin_lock_irqsave(&lowmem_stats_lock, flags);
+	k = &lowmem_kills[lowmem_kill_next++ % LOWMEM_KILL_RECORDS];
+	/* a record still pending when overwritten is never completed */
+	if (k->mm)
+		lowmem_kill_pending--;
+	k->mm = p->mm;
+	if (k->mm)
+		lowmem_kill_pending++;
+	k->pid = p->pid;
+	memcpy(k->comm, p->comm, sizeof(k->comm));
+	k->oom_adj = oom_adj;
+	k->tasksize = tasksize;
+	k->other_free = other_free;
+	k->proactive = proactive;
+	k->start = ktime_get();
+	k->latency_us = k->mm ? -1 : 0;
+	lowmem_kill_count++;
+	if (proactive)
+		lowmem_kill_proactive_count++;
+	spin_unlock_irqrestore(&lowmem_stats_lock, flags);
+}
+
+static int lowmem_kill_stats_get(char *buf, const struct kernel_param *kp)
+{
+	unsigned long flags;
+	unsigned int i, n;
+	int len;
+
+	spin_lock_irqsave(&lowmem_stats_lock, flags);
+	len = scnprintf(buf, PAGE_SIZE,
+			"kills %lu proactive %lu latency avg %lldus max %lldus\n",
+			lowmem_kill_count, lowmem_kill_proactive_count,
+			lowmem_kill_latency_count ?
+			div_s64(lowmem_kill_latency_total_us,
+				lowmem_kill_latency_count) : 0LL,
+			lowmem_kill_latency_max_us);
+	n = min_t(unsigned int, lowmem_kill_next, LOWMEM_KILL_RECORDS);
+	for (i = lowmem_kill_next - n; i != lowmem_kill_next; i++) {
+		struct lowmem_kill *k = &lowmem_kills[i % LOWMEM_KILL_RECORDS];
+
+		len += scnprintf(buf + len, PAGE_SIZE - len,
+				 "%d %s adj %d size %d free %d %s latency %lldus\n",
+				 k->pid, k->comm, k->oom_adj, k->tasksize,
+				 k->other_free,
+				 k->proactive ? "proactive" : "shrinker",
+				 k->latency_us);
+	}
+	spin_unlock_irqrestore(&lowmem_stats_lock, flags);
+
+	return len;
+}
+
+static struct kernel_param_ops lowmem_kill_stats_ops = {
+	.get = lowmem_kill_stats_get,
+};
+
+static int lowmem_proactive_set(const char *val, const struct kernel_param *kp)
+{
+	int ret = param_set_bool(val, kp);
+
+	if (!ret && lowmem_proactive)
+		wake_up(&lowmem_proactive_wait);
+	return ret;
+}
+
+static struct kernel_param_ops lowmem_proactive_ops = {
+	.set = lowmem_proactive_set,
+	.get = param_get_bool,
+};
+
+static struct hlist_head *lowmem_bucket(int oom_adj)
+{
+	oom_adj = clamp(oom_adj, OOM_DISABLE, OOM_ADJUST_MAX);
+	return &lowmem_buckets[oom_adj - OOM_DISABLE];
+}
+
+/* Caller must hold lowmem_bucket_lock. */
+static void lowmem_rehash(struct task_struct *p)
+{
+	hlist_del(&p->lowmem_node);
+	hlist_add_head(&p->lowmem_node, lowmem_bucket(p->signal->oom_adj));
+}
+
+/*
+ * Called with tasklist_lock write-held, before anyone can look the new
+ * task up. dup_task_struct() has already initialized p->lowmem_node.
+ */
+void lowmem_task_fork(struct task_struct *p)
+{
+	unsigned long flags;
+
+	if (!thread_group_leader(p) || !p->pid)
+		return;
+
+	spin_lock_irqsave(&lowmem_bucket_lock, flags);
+	hlist_add_head(&p->lowmem_node, lowmem_bucket(p->signal->oom_adj));
+	spin_unlock_irqrestore(&lowmem_bucket_lock, flags);
+}
+
+void lowmem_task_release(struct task_struct *p)
+{
+	unsigned long flags;
+
+	if (hlist_unhashed(&p->lowmem_node))
+		return;
+
+	spin_lock_irqsave(&lowmem_bucket_lock, flags);
+	hlist_del_init(&p->lowmem_node);
+	spin_unlock_irqrestore(&lowmem_bucket_lock, flags);
+}
+
+/* A non-leader thread exec()ed and took over from the leader. */
+void lowmem_task_exec(struct task_struct *leader, struct task_struct *tsk)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&lowmem_bucket_lock, flags);
+	if (!hlist_unhashed(&leader->lowmem_node)) {
+		hlist_del_init(&leader->lowmem_node);
+		hlist_add_head(&tsk->lowmem_node,
+			       lowmem_bucket(tsk->signal->oom_adj));
+	}
+	spin_unlock_irqrestore(&lowmem_bucket_lock, flags);
+}
+
+/*
+ * The bucket is chosen from the value read under lowmem_bucket_lock, so
+ * concurrent writers of oom_adj leave the leader in the right bucket.
+ */
+void lowmem_task_adj_changed(struct task_struct *task)
+{
+	struct task_struct *leader;
+	unsigned long flags;
+
+	rcu_read_lock();
+	/* a live thread keeps its group leader from being released */
+	if (pid_alive(task)) {
+		leader = task->group_leader;
+		spin_lock_irqsave(&lowmem_bucket_lock, flags);
+		if (!hlist_unhashed(&leader->lowmem_node))
+			lowmem_rehash(leader);
+		spin_unlock_irqrestore(&lowmem_bucket_lock, flags);
+	}
+	rcu_read_unlock();
+}
+
+/*
+ * lowmem_min_adj - returns the lowest oom_adj that may be killed with the
+ * given amount of free and file pages, or OOM_ADJUST_MAX + 1 if none.
+ */
+static int lowmem_min_adj(int other_free, int other_file)
+{
+	int array_size = ARRAY_SIZE(lowmem_adj);
+	int i;
+
+	if (lowmem_adj_size < array_size)
+		array_size = lowmem_adj_size;
+	if (lowmem_minfree_size < array_size)
+		array_size = lowmem_minfree_size;
+	for (i = 0; i < array_size; i++) {
+		if (other_free < lowmem_minfree[i] &&
+		    other_file < lowmem_minfree[i])
+			return lowmem_adj[i];
+	}
+
+	return OOM_ADJUST_MAX + 1;
+}
+
+/*
+ * lowmem_kill_one - kills the largest task with the highest oom_adj that is
+ * at least 'min_adj'. Returns the size of the victim in pages, or 0 if
+ * nothing was killed.
+ */
+static int lowmem_kill_one(int min_adj, int other_free, int proactive)
 {
 	struct task_struct *p;
+	struct hlist_node *node;
 	struct task_struct *selected = NULL;
-	int rem = 0;
 	int tasksize;
-	int i;
-	int min_adj = OOM_ADJUST_MAX + 1;
+	int adj;
 	int selected_tasksize = 0;
-	int selected_oom_adj;
-	int array_size = ARRAY_SIZE(lowmem_adj);
+	int selected_oom_adj = min_adj;
+	unsigned long flags;
+
+	spin_lock_irqsave(&lowmem_bucket_lock, flags);
+	/* another caller may have killed while we were deciding */
+	if (lowmem_deathpending &&
+	    time_before_eq(jiffies, lowmem_deathpending_timeout)) {
+		spin_unlock_irqrestore(&lowmem_bucket_lock, flags);
+		return 0;
+	}
+	for (adj = OOM_ADJUST_MAX; adj >= max(min_adj, OOM_DISABLE) && !selected;
+	     adj--) {
+		hlist_for_each_entry(p, node, lowmem_bucket(adj), lowmem_node) {
+			struct mm_struct *mm;
+			struct signal_struct *sig;
+			int oom_adj;
+
+			task_lock(p);
+			mm = p->mm;
+			sig = p->signal;
+			if (!mm || !sig) {
+				task_unlock(p);
+				continue;
+			}
+			oom_adj = sig->oom_adj;
+			if (oom_adj < min_adj) {
+				task_unlock(p);
+				continue;
+			}
+			tasksize = get_mm_rss(mm);
+			task_unlock(p);
+			if (tasksize <= 0)
+				continue;
+			if (selected) {
+				if (oom_adj < selected_oom_adj)
+					continue;
+				if (oom_adj == selected_oom_adj &&
+				    tasksize <= selected_tasksize)
+					continue;
+			}
+			selected = p;
+			selected_tasksize = tasksize;
+			selected_oom_adj = oom_adj;
+			lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
+				     p->pid, p->comm, oom_adj, tasksize);
+		}
+	}
+	if (selected) {
+		lowmem_print(1, "send sigkill to %d (%s), adj %d, size %d%s\n",
+			     selected->pid, selected->comm,
+			     selected_oom_adj, selected_tasksize,
+			     proactive ? ", proactive" : "");
+		lowmem_deathpending = selected;
+		lowmem_deathpending_timeout = jiffies + HZ;
+		get_task_struct(selected);
+	}
+	spin_unlock_irqrestore(&lowmem_bucket_lock, flags);
+
+	if (!selected)
+		return 0;
+
+	task_lock(selected);
+	lowmem_record_kill(selected, selected_oom_adj, selected_tasksize,
+			   other_free, proactive);
+	task_unlock(selected);
+	force_sig(SIGKILL, selected);
+	put_task_struct(selected);
+
+	return selected_tasksize;
+}
+
+static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
+{
+	int rem = 0;
+	int min_adj;
 	int other_free = global_page_state(NR_FREE_PAGES);
 	int other_file = global_page_state(NR_FILE_PAGES) -
 						global_page_state(NR_SHMEM);
@@ -105,17 +460,7 @@ static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
 	    time_before_eq(jiffies, lowmem_deathpending_timeout))
 		return 0;
 
-	if (lowmem_adj_size < array_size)
-		array_size = lowmem_adj_size;
-	if (lowmem_minfree_size < array_size)
-		array_size = lowmem_minfree_size;
-	for (i = 0; i < array_size; i++) {
-		if (other_free < lowmem_minfree[i] &&
-		    other_file < lowmem_minfree[i]) {
-			min_adj = lowmem_adj[i];
-			break;
-		}
-	}
+	min_adj = lowmem_min_adj(other_free, other_file);
 	if (nr_to_scan > 0)
 		lowmem_print(3, "lowmem_shrink %d, %x, ofree %d %d, ma %d\n",
 			     nr_to_scan, gfp_mask, other_free, other_file,
@@ -129,58 +474,100 @@ static int lowmem_shrink(struct shrinker *s, int nr_to_scan, gfp_t gfp_mask)
 			     nr_to_scan, gfp_mask, rem);
 		return rem;
 	}
-	selected_oom_adj = min_adj;
-
-	read_lock(&tasklist_lock);
-	for_each_process(p) {
-		struct mm_struct *mm;
-		struct signal_struct *sig;
-		int oom_adj;
-
-		task_lock(p);
-		mm = p->mm;
-		sig = p->signal;
-		if (!mm || !sig) {
-			task_unlock(p);
+
+	rem -= lowmem_kill_one(min_adj, other_free, 0);
+	lowmem_print(4, "lowmem_shrink %d, %x, return %d\n",
+		     nr_to_scan, gfp_mask, rem);
+	return rem;
+}
+
+/*
+ * lowmem_predict - returns where 'now' pages will be 'lookahead' ms from now
+ * if it keeps falling at 'rate' pages per second.
+ */
+static int lowmem_predict(int now, int rate)
+{
+	if (rate <= 0)
+		return now;
+	return now - (int) div_u64((u64) rate * lowmem_proactive_lookahead,
+				   MSEC_PER_SEC);
+}
+
+static int lowmem_proactive_thread(void *unused)
+{
+	int last_free = 0, last_file = 0;
+	int free_rate = 0, file_rate = 0;
+	unsigned long last = jiffies;
+	bool sampling = false;
+
+	set_freezable();
+
+	while (!kthread_should_stop()) {
+		int other_free, other_file, min_adj;
+		unsigned int ms;
+
+		if (!lowmem_proactive) {
+			sampling = false;
+			wait_event_freezable(lowmem_proactive_wait,
+					     lowmem_proactive ||
+					     kthread_should_stop());
 			continue;
 		}
-		oom_adj = sig->oom_adj;
-		if (oom_adj < min_adj) {
-			task_unlock(p);
+
+		schedule_timeout_interruptible(
+			msecs_to_jiffies(lowmem_proactive_interval ?: 1));
+		try_to_freeze();
+
+		other_free = global_page_state(NR_FREE_PAGES);
+		other_file = global_page_state(NR_FILE_PAGES) -
+						global_page_state(NR_SHMEM);
+
+		/* rates from before the thread went to sleep are meaningless */
+		if (!sampling) {
+			sampling = true;
+			free_rate = 0;
+			file_rate = 0;
+			last_free = other_free;
+			last_file = other_file;
+			last = jiffies;
 			continue;
 		}
-		tasksize = get_mm_rss(mm);
-		task_unlock(p);
-		if (tasksize <= 0)
+
+		ms = jiffies_to_msecs(jiffies - last) ?: 1;
+		last = jiffies;
+
+		/* decline rates in pages per second, averaged over 4 samples */
+		free_rate = (3 * free_rate +
+			     (last_free - other_free) * (int) MSEC_PER_SEC /
+			     (int) ms) / 4;
+		file_rate = (3 * file_rate +
+			     (last_file - other_file) * (int) MSEC_PER_SEC /
+			     (int) ms) / 4;
+		last_free = other_free;
+		last_file = other_file;
+
+		if (!lowmem_proactive)
 			continue;
-		if (selected) {
-			if (oom_adj < selected_oom_adj)
-				continue;
-			if (oom_adj == selected_oom_adj &&
-			    tasksize <= selected_tasksize)
-				continue;
-		}
-		selected = p;
-		selected_tasksize = tasksize;
-		selected_oom_adj = oom_adj;
-		lowmem_print(2, "select %d (%s), adj %d, size %d, to kill\n",
-			     p->pid, p->comm, oom_adj, tasksize);
-	}
-	if (selected) {
-		lowmem_print(1, "send sigkill to %d (%s), adj %d, size %d\n",
-			     selected->pid, selected->comm,
-			     selected_oom_adj, selected_tasksize);
-		lowmem_deathpending = selected;
-		lowmem_deathpending_timeout = jiffies + HZ;
-		force_sig(SIGKILL, selected);
-		rem -= selected_tasksize;
+		if (lowmem_deathpending &&
+		    time_before_eq(jiffies, lowmem_deathpending_timeout))
+			continue;
+
+		min_adj = lowmem_min_adj(lowmem_predict(other_free, free_rate),
+					 lowmem_predict(other_file, file_rate));
+		if (min_adj == OOM_ADJUST_MAX + 1)
+			continue;
+
+		lowmem_print(3, "lowmem_proactive ofree %d %d, rate %d %d, "
+			     "ma %d\n", other_free, other_file, free_rate,
+			     file_rate, min_adj);
+		lowmem_kill_one(min_adj, other_free, 1);
 	}
-	lowmem_print(4, "lowmem_shrink %d, %x, return %d\n",
-		     nr_to_scan, gfp_mask, rem);
-	read_unlock(&tasklist_lock);
-	return rem;
+
+	return 0;
 }
 
+static struct task_struct *lowmem_proactive_task;
+
 static struct shrinker lowmem_shrinker = {
 	.shrink = lowmem_shrink,
 	.seeks = DEFAULT_SEEKS * 16
@@ -190,11 +577,19 @@ static int __init lowmem_init(void)
 {
 	task_free_register(&task_nb);
 	register_shrinker(&lowmem_shrinker);
+	lowmem_proactive_task = kthread_run(lowmem_proactive_thread, NULL,
+					    "lowmemorykiller");
+	if (IS_ERR(lowmem_proactive_task)) {
+		printk(KERN_ERR "lowmemorykiller: no proactive thread\n");
+		lowmem_proactive_task = NULL;
+	}
 	return 0;
 }
 
 static void __exit lowmem_exit(void)
 {
+	if (lowmem_proactive_task)
+		kthread_stop(lowmem_proactive_task);
 	unregister_shrinker(&lowmem_shrinker);
 	task_free_unregister(&task_nb);
 }
@@ -205,6 +600,13 @@ module_param_array_named(adj, lowmem_adj, int, &lowmem_adj_size,
 module_param_array_named(minfree, lowmem_minfree, uint, &lowmem_minfree_size,
 			 S_IRUGO | S_IWUSR);
 module_param_named(debug_level, lowmem_debug_level, uint, S_IRUGO | S_IWUSR);
+module_param_cb(proactive, &lowmem_proactive_ops, &lowmem_proactive,
+		S_IRUGO | S_IWUSR);
+module_param_named(proactive_interval, lowmem_proactive_interval, uint,
+		   S_IRUGO | S_IWUSR);
+module_param_named(proactive_lookahead, lowmem_proactive_lookahead, uint,
+		   S_IRUGO | S_IWUSR);
+module_param_cb(kill_stats, &lowmem_kill_stats_ops, NULL, S_IRUGO);
 
 module_init(lowmem_init);
 module_exit(lowmem_exit);
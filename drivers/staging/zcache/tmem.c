@@ -501,17 +501,27 @@ static void tmem_pampd_destroy_all_in_obj(struct tmem_obj *obj)
  * "flushed" so that the data is not accessible to a subsequent "get".
  * Since these "duplicate puts" are relatively rare, this implementation
  * always flushes for simplicity.
+ *
+ * Creating the pampd (i.e. compressing the page) is by far the most
+ * expensive part of a put. Persistent pampds are only ever freed through
+ * tmem, so for persistent pools that is done before the hashbucket lock
+ * is taken and other puts and gets hashing to the same bucket need not
+ * wait for it. Ephemeral pampds may be evicted by the PAM implementation
+ * at any time, which flushes them by handle, so they must not exist
+ * before they can be found in tmem.
  */
 int tmem_put(struct tmem_pool *pool, struct tmem_oid *oidp, uint32_t index,
 		struct page *page)
 {
 	struct tmem_obj *obj = NULL, *objfound = NULL, *objnew = NULL;
-	void *pampd = NULL, *pampd_del = NULL;
+	void *pampd = NULL, *pampd_del = NULL, *pampd_new = NULL;
 	int ret = -ENOMEM;
 	bool ephemeral;
 	struct tmem_hashbucket *hb;
 
 	ephemeral = is_ephemeral(pool);
+	if (!ephemeral)
+		pampd_new = (*tmem_pamops.create)(pool, oidp, index, page);
 	hb = &pool->hashbucket[tmem_oid_hash(oidp)];
 	spin_lock(&hb->lock);
 	obj = objfound = tmem_obj_find(hb, oidp);
@@ -528,17 +538,25 @@ int tmem_put(struct tmem_pool *pool, struct tmem_oid *oidp, uint32_t index,
 			}
 			pampd = NULL;
 		}
-	} else {
+	}
+	/* a failed put must still have flushed any dup, as done above */
+	if (!ephemeral && pampd_new == NULL)
+		goto free;
+	if (obj == NULL) {
 		obj = objnew = (*tmem_hostops.obj_alloc)(pool);
 		if (unlikely(obj == NULL)) {
-			ret = -ENOMEM;
-			goto out;
+			pampd = pampd_new;
+			goto free;
 		}
 		tmem_obj_init(obj, hb, pool, oidp);
 	}
 	BUG_ON(obj == NULL);
 	BUG_ON(((objnew != obj) && (objfound != obj)) || (objnew == objfound));
-	pampd = (*tmem_pamops.create)(obj->pool, &obj->oid, index, page);
+	if (ephemeral)
+		pampd = (*tmem_pamops.create)(obj->pool, &obj->oid, index,
+						page);
+	else
+		pampd = pampd_new;
 	if (unlikely(pampd == NULL))
 		goto free;
 	ret = tmem_pampd_add_to_obj(obj, index, pampd);
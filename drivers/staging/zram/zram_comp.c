@@ -0,0 +1,320 @@
+/*
+ * Compressed RAM block device
+ *
+ * Copyright (C) 2008, 2009, 2010  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ *
+ * Project home: http://compcache.googlecode.com
+ */
+
+#define KMSG_COMPONENT "zram"
+#define pr_fmt(fmt) KMSG_COMPONENT ": " fmt
+
+#include <linux/kernel.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/err.h>
+#include <linux/mm.h>
+#include <linux/lzo.h>
+#include <linux/crypto.h>
+
+#include "zram_comp.h"
+
+/* The LZO library called directly, the default */
+
+static void *zram_lzo_create(const char *name)
+{
+	return kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
+}
+
+static void zram_lzo_destroy(void *private)
+{
+	kfree(private);
+}
+
+static int zram_lzo_compress(void *private, const unsigned char *src,
+			     unsigned char *dst, size_t *dst_len)
+{
+	int ret = lzo1x_1_compress(src, PAGE_SIZE, dst, dst_len, private);
+
+	return ret == LZO_E_OK ? 0 : ret;
+}
+
+static int zram_lzo_decompress(void *private, const unsigned char *src,
+			       size_t src_len, unsigned char *dst)
+{
+	size_t dst_len = PAGE_SIZE;
+	int ret = lzo1x_decompress_safe(src, src_len, dst, &dst_len);
+
+	return ret == LZO_E_OK ? 0 : ret;
+}
+
+static const struct zram_backend zram_lzo = {
+	.name = "lzo",
+	.create = zram_lzo_create,
+	.destroy = zram_lzo_destroy,
+	.compress = zram_lzo_compress,
+	.decompress = zram_lzo_decompress,
+};
+
+#ifdef CONFIG_ZRAM_CRYPTO
+
+/* Any compressor registered with the crypto API under one of these names */
+static const char * const zram_crypto_names[] = {
+	"deflate",
+};
+
+static void *zram_crypto_create(const char *name)
+{
+	struct crypto_comp *tfm = crypto_alloc_comp(name, 0, 0);
+
+	return IS_ERR(tfm) ? NULL : tfm;
+}
+
+static void zram_crypto_destroy(void *private)
+{
+	crypto_free_comp(private);
+}
+
+static int zram_crypto_compress(void *private, const unsigned char *src,
+				unsigned char *dst, size_t *dst_len)
+{
+	unsigned int len = 2 * PAGE_SIZE;
+	int ret;
+
+	ret = crypto_comp_compress(private, src, PAGE_SIZE, dst, &len);
+	*dst_len = len;
+
+	return ret;
+}
+
+static int zram_crypto_decompress(void *private, const unsigned char *src,
+				  size_t src_len, unsigned char *dst)
+{
+	unsigned int len = PAGE_SIZE;
+
+	return crypto_comp_decompress(private, src, src_len, dst, &len);
+}
+
+static const struct zram_backend zram_crypto = {
+	.create = zram_crypto_create,
+	.destroy = zram_crypto_destroy,
+	.compress = zram_crypto_compress,
+	.decompress = zram_crypto_decompress,
+};
+
+#endif /* CONFIG_ZRAM_CRYPTO */
+
+static const struct zram_backend *zram_backend_find(const char *name)
+{
+#ifdef CONFIG_ZRAM_CRYPTO
+	int i;
+#endif
+
+	if (!strcmp(name, zram_lzo.name))
+		return &zram_lzo;
+
+#ifdef CONFIG_ZRAM_CRYPTO
+	for (i = 0; i < ARRAY_SIZE(zram_crypto_names); i++) {
+		if (!strcmp(name, zram_crypto_names[i]) &&
+		    crypto_has_comp(name, 0, 0))
+			return &zram_crypto;
+	}
+#endif
+
+	return NULL;
+}
+
+int zram_comp_available(const char *name)
+{
+	return zram_backend_find(name) != NULL;
+}
+
+/* Lists the usable compressors, the current one in brackets */
+ssize_t zram_comp_available_show(const char *cur, char *buf)
+{
+	ssize_t len;
+#ifdef CONFIG_ZRAM_CRYPTO
+	int i;
+#endif
+
+	len = sprintf(buf, strcmp(cur, zram_lzo.name) ? "%s" : "[%s]",
+		      zram_lzo.name);
+
+#ifdef CONFIG_ZRAM_CRYPTO
+	for (i = 0; i < ARRAY_SIZE(zram_crypto_names); i++) {
+		const char *name = zram_crypto_names[i];
+
+		if (!crypto_has_comp(name, 0, 0))
+			continue;
+		len += sprintf(buf + len, strcmp(cur, name) ? " %s" : " [%s]",
+			       name);
+	}
+#endif
+
+	len += sprintf(buf + len, "\n");
+	return len;
+}
+
+static void zram_stream_free(struct zram_comp *comp, struct zram_stream *strm)
+{
+	if (strm->private)
+		comp->backend->destroy(strm->private);
+	free_pages((unsigned long)strm->buffer, 1);
+	kfree(strm);
+}
+
+/*
+ * Streams are only ever allocated from process context with GFP_KERNEL,
+ * never from the I/O path, where recursing into reclaim could end up
+ * swapping to this very device.
+ */
+static struct zram_stream *zram_stream_alloc(struct zram_comp *comp)
+{
+	struct zram_stream *strm;
+
+	strm = kzalloc(sizeof(*strm), GFP_KERNEL);
+	if (!strm)
+		return NULL;
+
+	strm->buffer = (void *)__get_free_pages(GFP_KERNEL | __GFP_ZERO, 1);
+	strm->private = comp->backend->create(comp->name);
+	if (!strm->buffer || !strm->private) {
+		zram_stream_free(comp, strm);
+		return NULL;
+	}
+
+	return strm;
+}
+
+/* Caller must hold comp->lock. */
+static struct zram_stream *zram_stream_trim(struct zram_comp *comp)
+{
+	struct zram_stream *strm;
+
+	if (comp->avail_streams <= comp->max_streams || list_empty(&comp->idle))
+		return NULL;
+
+	strm = list_first_entry(&comp->idle, struct zram_stream, list);
+	list_del(&strm->list);
+	comp->avail_streams--;
+
+	return strm;
+}
+
+/*
+ * zram_comp_set_max_streams - grows or shrinks the pool to 'num' streams.
+ * Streams in use are freed as they are returned.
+ */
+void zram_comp_set_max_streams(struct zram_comp *comp, int num)
+{
+	struct zram_stream *strm;
+
+	if (num < 1)
+		num = 1;
+
+	spin_lock(&comp->lock);
+	comp->max_streams = num;
+	while ((strm = zram_stream_trim(comp))) {
+		spin_unlock(&comp->lock);
+		zram_stream_free(comp, strm);
+		spin_lock(&comp->lock);
+	}
+
+	while (comp->avail_streams < comp->max_streams) {
+		comp->avail_streams++;
+		spin_unlock(&comp->lock);
+
+		strm = zram_stream_alloc(comp);
+
+		spin_lock(&comp->lock);
+		if (!strm) {
+			comp->avail_streams--;
+			break;
+		}
+		list_add(&strm->list, &comp->idle);
+		wake_up(&comp->wait);
+	}
+	spin_unlock(&comp->lock);
+}
+
+struct zram_comp *zram_comp_create(const char *name, int max_streams)
+{
+	const struct zram_backend *backend = zram_backend_find(name);
+	struct zram_comp *comp;
+
+	if (!backend)
+		return NULL;
+
+	comp = kzalloc(sizeof(*comp), GFP_KERNEL);
+	if (!comp)
+		return NULL;
+
+	comp->backend = backend;
+	strlcpy(comp->name, name, sizeof(comp->name));
+	spin_lock_init(&comp->lock);
+	INIT_LIST_HEAD(&comp->idle);
+	init_waitqueue_head(&comp->wait);
+
+	zram_comp_set_max_streams(comp, max_streams);
+	if (!comp->avail_streams) {
+		kfree(comp);
+		return NULL;
+	}
+
+	return comp;
+}
+
+/* No stream may be in use. */
+void zram_comp_destroy(struct zram_comp *comp)
+{
+	struct zram_stream *strm, *next;
+
+	list_for_each_entry_safe(strm, next, &comp->idle, list)
+		zram_stream_free(comp, strm);
+	kfree(comp);
+}
+
+static struct zram_stream *zram_stream_get_idle(struct zram_comp *comp)
+{
+	struct zram_stream *strm = NULL;
+
+	spin_lock(&comp->lock);
+	if (!list_empty(&comp->idle)) {
+		strm = list_first_entry(&comp->idle, struct zram_stream, list);
+		list_del(&strm->list);
+	}
+	spin_unlock(&comp->lock);
+
+	return strm;
+}
+
+/* Returns an idle stream, waiting for one if all are busy. */
+struct zram_stream *zram_stream_get(struct zram_comp *comp)
+{
+	struct zram_stream *strm;
+
+	wait_event(comp->wait, (strm = zram_stream_get_idle(comp)));
+	return strm;
+}
+
+void zram_stream_put(struct zram_comp *comp, struct zram_stream *strm)
+{
+	spin_lock(&comp->lock);
+	if (comp->avail_streams > comp->max_streams) {
+		comp->avail_streams--;
+		spin_unlock(&comp->lock);
+		zram_stream_free(comp, strm);
+		return;
+	}
+	list_add(&strm->list, &comp->idle);
+	spin_unlock(&comp->lock);
+
+	wake_up(&comp->wait);
+}
@@ -0,0 +1,89 @@
+/*
+ * Compressed RAM block device
+ *
+ * Copyright (C) 2008, 2009, 2010  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ *
+ * Project home: http://compcache.googlecode.com
+ */
+
+#ifndef _ZRAM_COMP_H_
+#define _ZRAM_COMP_H_
+
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+
+#define ZRAM_COMP_NAME_LEN	16
+
+/*
+ * A compression stream: the backend's private state plus a buffer the
+ * compressed page is written to. A stream is used by one request at a time
+ * and may be held across sleeping allocations.
+ */
+struct zram_stream {
+	void *private;
+	unsigned char *buffer;	/* two pages */
+	struct list_head list;	/* entry in zram_comp's idle list */
+};
+
+struct zram_backend {
+	const char *name;
+	void *(*create)(const char *name);
+	void (*destroy)(void *private);
+	/* compresses one page into 'dst', which holds two pages */
+	int (*compress)(void *private, const unsigned char *src,
+			unsigned char *dst, size_t *dst_len);
+	/* decompresses exactly one page into 'dst' */
+	int (*decompress)(void *private, const unsigned char *src,
+			  size_t src_len, unsigned char *dst);
+};
+
+/*
+ * A pool of up to 'max_streams' streams of one backend. All of them are
+ * allocated up front, when the device is initialized or max_comp_streams
+ * is raised: creating one from the I/O path would mean a GFP_NOIO
+ * allocation of several pages just when memory is short.
+ */
+struct zram_comp {
+	const struct zram_backend *backend;
+	char name[ZRAM_COMP_NAME_LEN];
+	spinlock_t lock;	/* protects the fields below */
+	struct list_head idle;
+	int avail_streams;	/* allocated streams, idle or in use */
+	int max_streams;
+	wait_queue_head_t wait;	/* requests waiting for a stream */
+};
+
+extern int zram_comp_available(const char *name);
+extern ssize_t zram_comp_available_show(const char *cur, char *buf);
+
+extern struct zram_comp *zram_comp_create(const char *name, int max_streams);
+extern void zram_comp_destroy(struct zram_comp *comp);
+extern void zram_comp_set_max_streams(struct zram_comp *comp, int num);
+
+extern struct zram_stream *zram_stream_get(struct zram_comp *comp);
+extern void zram_stream_put(struct zram_comp *comp,
+			    struct zram_stream *strm);
+
+static inline int zram_comp_compress(struct zram_comp *comp,
+		struct zram_stream *strm, const unsigned char *src,
+		size_t *dst_len)
+{
+	return comp->backend->compress(strm->private, src, strm->buffer,
+				       dst_len);
+}
+
+static inline int zram_comp_decompress(struct zram_comp *comp,
+		struct zram_stream *strm, const unsigned char *src,
+		size_t src_len, unsigned char *dst)
+{
+	return comp->backend->decompress(strm->private, src, src_len, dst);
+}
+
+#endif
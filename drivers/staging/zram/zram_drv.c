@@ -29,9 +29,11 @@
 #include <linux/genhd.h>
 #include <linux/highmem.h>
 #include <linux/slab.h>
-#include <linux/lzo.h>
 #include <linux/string.h>
 #include <linux/vmalloc.h>
+#include <linux/cpumask.h>
+#include <linux/jhash.h>
+#include <linux/log2.h>
 
 #include "zram_drv.h"
 
@@ -42,14 +44,18 @@ struct zram *devices;
 /* Module params (documentation at end) */
 unsigned int num_devices;
 
-static void zram_stat_inc(u32 *v)
+static void zram_stat_inc(struct zram *zram, u32 *v)
 {
+	spin_lock(&zram->stat64_lock);
 	*v = *v + 1;
+	spin_unlock(&zram->stat64_lock);
 }
 
-static void zram_stat_dec(u32 *v)
+static void zram_stat_dec(struct zram *zram, u32 *v)
 {
+	spin_lock(&zram->stat64_lock);
 	*v = *v - 1;
+	spin_unlock(&zram->stat64_lock);
 }
 
 static void zram_stat64_add(struct zram *zram, u64 *v, u64 inc)
@@ -89,21 +95,403 @@ static void zram_clear_flag(struct zram *zram, u32 index,
 	zram->table[index].flags &= ~BIT(flag);
 }
 
-static int page_zero_filled(void *ptr)
+/*
+ * Returns 1 if the page consists of one word repeated, which is then stored
+ * in 'element'.
+ */
+static int page_same_filled(void *ptr, unsigned long *element)
 {
 	unsigned int pos;
 	unsigned long *page;
 
 	page = (unsigned long *)ptr;
 
-	for (pos = 0; pos != PAGE_SIZE / sizeof(*page); pos++) {
-		if (page[pos])
+	for (pos = 1; pos != PAGE_SIZE / sizeof(*page); pos++) {
+		if (page[pos] != page[0])
 			return 0;
 	}
 
+	*element = page[0];
 	return 1;
 }
 
+static void zram_fill_page(void *ptr, unsigned long element)
+{
+	unsigned int pos;
+	unsigned long *page;
+
+	page = (unsigned long *)ptr;
+
+	if (!element) {
+		memset(page, 0, PAGE_SIZE);
+		return;
+	}
+
+	for (pos = 0; pos != PAGE_SIZE / sizeof(*page); pos++)
+		page[pos] = element;
+}
+
+static struct hlist_head *zram_dedup_bucket(struct zram *zram, u32 checksum)
+{
+	return &zram->dedup_table[checksum & zram->dedup_mask];
+}
+
+/*
+ * zram_dedup_find - looks for a stored object holding the same 'clen'
+ * bytes of compressed data as 'src' and takes a reference to it.
+ *
+ * Lengths are compared against the clen recorded with each object, never
+ * against the allocator's idea of the object size: that is rounded up to
+ * the allocator's granularity, and two objects whose lengths differ only
+ * in the rounding would otherwise be taken for each other.
+ */
+static struct zram_dedup *zram_dedup_find(struct zram *zram,
+		const unsigned char *src, size_t clen, u32 checksum)
+{
+	struct zram_dedup *d;
+	struct hlist_node *n;
+
+	spin_lock(&zram->dedup_lock);
+	hlist_for_each_entry(d, n, zram_dedup_bucket(zram, checksum), node) {
+		unsigned char *cmem;
+		int same;
+
+		if (d->checksum != checksum || d->size != clen)
+			continue;
+
+		cmem = zs_map_object(zram->mem_pool, d->handle, ZS_MM_RO);
+		same = !memcmp(cmem + sizeof(struct zobj_header), src, clen);
+		zs_unmap_object(zram->mem_pool, d->handle);
+
+		if (same) {
+			d->refcount++;
+			spin_unlock(&zram->dedup_lock);
+			return d;
+		}
+	}
+	spin_unlock(&zram->dedup_lock);
+
+	return NULL;
+}
+
+static void zram_dedup_add(struct zram *zram, struct zram_dedup *d,
+		unsigned long handle, u16 size, u32 checksum)
+{
+	d->handle = handle;
+	d->size = size;
+	d->checksum = checksum;
+	d->refcount = 1;
+
+	spin_lock(&zram->dedup_lock);
+	hlist_add_head(&d->node, zram_dedup_bucket(zram, checksum));
+	spin_unlock(&zram->dedup_lock);
+}
+
+/*
+ * zram_dedup_put - drops a reference to the object 'handle'.
+ * Returns 1 if that was the last one and the object should be freed.
+ */
+static int zram_dedup_put(struct zram *zram, unsigned long handle,
+			  u32 checksum)
+{
+	struct zram_dedup *d;
+	struct hlist_node *n;
+	int last = 1;
+
+	spin_lock(&zram->dedup_lock);
+	hlist_for_each_entry(d, n, zram_dedup_bucket(zram, checksum), node) {
+		if (d->handle != handle)
+			continue;
+		last = !--d->refcount;
+		if (last) {
+			hlist_del(&d->node);
+			kfree(d);
+		}
+		break;
+	}
+	spin_unlock(&zram->dedup_lock);
+
+	return last;
+}
+
+/* Whether the page is kept as a compressed object */
+static int zram_is_compressed(struct zram *zram, u32 index)
+{
+	if (zram_test_flag(zram, index, ZRAM_ZERO) ||
+	    zram_test_flag(zram, index, ZRAM_SAME) ||
+	    zram_test_flag(zram, index, ZRAM_WB) ||
+	    zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))
+		return 0;
+
+	return zram->table[index].handle != 0;
+}
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+
+static void zram_init_slot_locks(struct zram *zram)
+{
+	int i;
+
+	for (i = 0; i < ZRAM_SLOT_LOCKS; i++)
+		spin_lock_init(&zram->slot_locks[i]);
+}
+
+static void zram_slot_lock(struct zram *zram, u32 index)
+{
+	spin_lock(&zram->slot_locks[index % ZRAM_SLOT_LOCKS]);
+}
+
+static void zram_slot_unlock(struct zram *zram, u32 index)
+{
+	spin_unlock(&zram->slot_locks[index % ZRAM_SLOT_LOCKS]);
+}
+
+/*
+ * zram_slot_pin - keeps writeback from replacing entry 'index' while its
+ * object is read outside the slot lock. Caller must hold the slot lock.
+ * Returns 0 if the pin count is saturated; the caller then keeps the slot
+ * lock for the duration instead.
+ */
+static int zram_slot_pin(struct zram *zram, u32 index)
+{
+	if (zram->table[index].count == (u8)~0)
+		return 0;
+	zram->table[index].count++;
+	return 1;
+}
+
+static void zram_slot_unpin(struct zram *zram, u32 index)
+{
+	zram_slot_lock(zram, index);
+	zram->table[index].count--;
+	zram_slot_unlock(zram, index);
+}
+
+/* Seconds since boot, not counting suspend */
+static u32 zram_now(void)
+{
+	struct timespec ts;
+
+	ktime_get_ts(&ts);
+	return ts.tv_sec;
+}
+
+static void zram_accessed(struct zram *zram, u32 index)
+{
+	zram->table[index].ac_time = zram_now();
+}
+
+/*
+ * Blocks are handed out in order, picking up the search where the last
+ * one was found, so that a writeback pass does not rescan the blocks it
+ * has just filled for every page.
+ */
+static unsigned long zram_alloc_wb_block(struct zram *zram)
+{
+	unsigned long blk;
+
+	do {
+		blk = find_next_zero_bit(zram->wb_bitmap, zram->nr_wb_pages,
+					 zram->wb_next);
+		if (blk >= zram->nr_wb_pages) {
+			/* wrap around, to what was freed behind us */
+			blk = find_next_zero_bit(zram->wb_bitmap,
+						 zram->nr_wb_pages, 1);
+			if (blk >= zram->nr_wb_pages)
+				return 0;
+		}
+	} while (test_and_set_bit(blk, zram->wb_bitmap));
+
+	zram->wb_next = blk + 1;
+	return blk;
+}
+
+static void zram_free_wb_block(struct zram *zram, unsigned long blk)
+{
+	clear_bit(blk, zram->wb_bitmap);
+}
+
+static void zram_reset_backing_dev(struct zram *zram)
+{
+	if (!zram->backing_bdev)
+		return;
+
+	blkdev_put(zram->backing_bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+	zram->backing_bdev = NULL;
+	zram->backing_path[0] = '\0';
+
+	vfree(zram->wb_bitmap);
+	zram->wb_bitmap = NULL;
+	zram->nr_wb_pages = 0;
+	zram->wb_next = 0;
+}
+
+/*
+ * zram_set_backing_dev - sets the block device zram_writeback() moves
+ * pages to, or none if 'path' is empty. The device is opened exclusively
+ * and its previous contents are lost. Caller must hold init_lock and the
+ * zram device must not be initialized yet.
+ */
+int zram_set_backing_dev(struct zram *zram, const char *path)
+{
+	struct block_device *bdev;
+	unsigned long nr_pages, *bitmap;
+
+	zram_reset_backing_dev(zram);
+	if (!*path)
+		return 0;
+
+	bdev = blkdev_get_by_path(path, FMODE_READ | FMODE_WRITE | FMODE_EXCL,
+				  zram);
+	if (IS_ERR(bdev))
+		return PTR_ERR(bdev);
+
+	nr_pages = i_size_read(bdev->bd_inode) >> PAGE_SHIFT;
+	if (nr_pages < 2) {
+		blkdev_put(bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+		return -EINVAL;
+	}
+
+	bitmap = vzalloc(BITS_TO_LONGS(nr_pages) * sizeof(long));
+	if (!bitmap) {
+		blkdev_put(bdev, FMODE_READ | FMODE_WRITE | FMODE_EXCL);
+		return -ENOMEM;
+	}
+	/* block 0 is never used, so that 0 can mean "no block" */
+	set_bit(0, bitmap);
+
+	zram->backing_bdev = bdev;
+	zram->nr_wb_pages = nr_pages;
+	zram->wb_bitmap = bitmap;
+	zram->wb_next = 1;
+	strlcpy(zram->backing_path, path, sizeof(zram->backing_path));
+
+	return 0;
+}
+
+/* Reads of written back pages in flight for one bio */
+struct zram_wb_read {
+	struct bio *parent;
+	atomic_t pending;	/* plus one held by zram_read() */
+	int error;
+};
+
+static void zram_wb_read_put(struct zram_wb_read *rd)
+{
+	if (!atomic_dec_and_test(&rd->pending))
+		return;
+
+	if (rd->error) {
+		bio_io_error(rd->parent);
+	} else {
+		set_bit(BIO_UPTODATE, &rd->parent->bi_flags);
+		bio_endio(rd->parent, 0);
+	}
+	kfree(rd);
+}
+
+static void zram_wb_read_end_io(struct bio *bio, int err)
+{
+	struct zram_wb_read *rd = bio->bi_private;
+
+	if (test_bit(BIO_UPTODATE, &bio->bi_flags))
+		flush_dcache_page(bio->bi_io_vec[0].bv_page);
+	else
+		rd->error = -EIO;
+
+	bio_put(bio);
+	zram_wb_read_put(rd);
+}
+
+/*
+ * Starts reading block 'blk' of the backing device straight into 'page'.
+ * We are called from our make_request function, where waiting for the
+ * read would deadlock, so 'parent' is only completed when all the reads
+ * started for it are.
+ */
+static int zram_wb_read_page(struct zram *zram, unsigned long blk,
+			     struct page *page, struct bio *parent,
+			     struct zram_wb_read **rdp)
+{
+	struct zram_wb_read *rd = *rdp;
+	struct bio *bio;
+
+	if (!rd) {
+		rd = kmalloc(sizeof(*rd), GFP_NOIO);
+		if (!rd)
+			return -ENOMEM;
+		rd->parent = parent;
+		atomic_set(&rd->pending, 1);
+		rd->error = 0;
+		*rdp = rd;
+	}
+
+	bio = bio_alloc(GFP_NOIO, 1);
+	if (!bio)
+		return -ENOMEM;
+
+	bio->bi_bdev = zram->backing_bdev;
+	bio->bi_sector = (sector_t)blk << SECTORS_PER_PAGE_SHIFT;
+	bio->bi_end_io = zram_wb_read_end_io;
+	bio->bi_private = rd;
+	if (!bio_add_page(bio, page, PAGE_SIZE, 0)) {
+		bio_put(bio);
+		return -EIO;
+	}
+
+	atomic_inc(&rd->pending);
+	zram_stat64_inc(zram, &zram->stats.wb_reads);
+	submit_bio(READ, bio);
+
+	return 0;
+}
+
+static void zram_wb_write_end_io(struct bio *bio, int err)
+{
+	complete(bio->bi_private);
+}
+
+static int zram_wb_write_page(struct zram *zram, unsigned long blk,
+			      struct page *page)
+{
+	DECLARE_COMPLETION_ONSTACK(done);
+	struct bio *bio;
+	int ret;
+
+	bio = bio_alloc(GFP_KERNEL, 1);
+	if (!bio)
+		return -ENOMEM;
+
+	bio->bi_bdev = zram->backing_bdev;
+	bio->bi_sector = (sector_t)blk << SECTORS_PER_PAGE_SHIFT;
+	bio->bi_end_io = zram_wb_write_end_io;
+	bio->bi_private = &done;
+	if (!bio_add_page(bio, page, PAGE_SIZE, 0)) {
+		bio_put(bio);
+		return -EIO;
+	}
+
+	submit_bio(WRITE, bio);
+	wait_for_completion(&done);
+
+	ret = test_bit(BIO_UPTODATE, &bio->bi_flags) ? 0 : -EIO;
+	bio_put(bio);
+
+	return ret;
+}
+
+#else
+
+static inline void zram_init_slot_locks(struct zram *zram) { }
+static inline void zram_slot_lock(struct zram *zram, u32 index) { }
+static inline void zram_slot_unlock(struct zram *zram, u32 index) { }
+static inline int zram_slot_pin(struct zram *zram, u32 index) { return 0; }
+static inline void zram_slot_unpin(struct zram *zram, u32 index) { }
+static inline void zram_accessed(struct zram *zram, u32 index) { }
+static inline void zram_reset_backing_dev(struct zram *zram) { }
+
+#endif /* CONFIG_ZRAM_WRITEBACK */
+
 static void zram_set_disksize(struct zram *zram, size_t totalram_bytes)
 {
 	if (!zram->disksize) {
@@ -137,44 +525,75 @@ static void zram_free_page(struct zram *zram, size_t index)
 {
 	u32 clen;
 	void *obj;
+	u32 checksum;
 
-	struct page *page = zram->table[index].page;
-	u32 offset = zram->table[index].offset;
+	unsigned long handle = zram->table[index].handle;
 
-	if (unlikely(!page)) {
-		/*
-		 * No memory is allocated for zero filled pages.
-		 * Simply clear zero page flag.
-		 */
-		if (zram_test_flag(zram, index, ZRAM_ZERO)) {
-			zram_clear_flag(zram, index, ZRAM_ZERO);
-			zram_stat_dec(&zram->stats.pages_zero);
-		}
+	/* Let a writeback in progress know the page is gone */
+	zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+
+	/*
+	 * No memory is allocated for zero or pattern filled pages.
+	 * Simply clear the flag.
+	 */
+	if (zram_test_flag(zram, index, ZRAM_ZERO)) {
+		zram_clear_flag(zram, index, ZRAM_ZERO);
+		zram_stat_dec(zram, &zram->stats.pages_zero);
 		return;
 	}
 
+	if (zram_test_flag(zram, index, ZRAM_SAME)) {
+		zram_clear_flag(zram, index, ZRAM_SAME);
+		zram_stat_dec(zram, &zram->stats.pages_same);
+		zram->table[index].element = 0;
+		return;
+	}
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+	if (zram_test_flag(zram, index, ZRAM_WB)) {
+		zram_clear_flag(zram, index, ZRAM_WB);
+		zram_free_wb_block(zram, zram->table[index].blk);
+		zram_stat_dec(zram, &zram->stats.pages_wb);
+		zram->table[index].blk = 0;
+		return;
+	}
+#endif
+
+	if (unlikely(!handle))
+		return;
+
 	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
 		clen = PAGE_SIZE;
-		__free_page(page);
+		zs_free(zram->mem_pool, handle);
 		zram_clear_flag(zram, index, ZRAM_UNCOMPRESSED);
-		zram_stat_dec(&zram->stats.pages_expand);
+		zram_stat_dec(zram, &zram->stats.pages_expand);
 		goto out;
 	}
 
-	obj = kmap_atomic(page, KM_USER0) + offset;
-	clen = xv_get_object_size(obj) - sizeof(struct zobj_header);
-	kunmap_atomic(obj, KM_USER0);
+	clen = zram->table[index].size;
+	obj = zs_map_object(zram->mem_pool, handle, ZS_MM_RO);
+	checksum = ((struct zobj_header *)obj)->checksum;
+	zs_unmap_object(zram->mem_pool, handle);
 
-	xv_free(zram->mem_pool, page, offset);
 	if (clen <= PAGE_SIZE / 2)
-		zram_stat_dec(&zram->stats.good_compress);
+		zram_stat_dec(zram, &zram->stats.good_compress);
+
+	/* Other pages may still share this object */
+	if (!zram_dedup_put(zram, handle, checksum)) {
+		zram_stat_dec(zram, &zram->stats.pages_dedup);
+		zram_stat_dec(zram, &zram->stats.pages_stored);
+		goto clear;
+	}
+
+	zs_free(zram->mem_pool, handle);
 
 out:
 	zram_stat64_sub(zram, &zram->stats.compr_size, clen);
-	zram_stat_dec(&zram->stats.pages_stored);
+	zram_stat_dec(zram, &zram->stats.pages_stored);
 
-	zram->table[index].page = NULL;
-	zram->table[index].offset = 0;
+clear:
+	zram->table[index].handle = 0;
+	zram->table[index].size = 0;
 }
 
 static void handle_zero_page(struct page *page)
@@ -189,17 +608,16 @@ static void handle_zero_page(struct page *page)
 }
 
 static void handle_uncompressed_page(struct zram *zram,
-				struct page *page, u32 index)
+				struct page *page, unsigned long handle)
 {
 	unsigned char *user_mem, *cmem;
 
 	user_mem = kmap_atomic(page, KM_USER0);
-	cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-			zram->table[index].offset;
+	cmem = zs_map_object(zram->mem_pool, handle, ZS_MM_RO);
 
 	memcpy(user_mem, cmem, PAGE_SIZE);
+	zs_unmap_object(zram->mem_pool, handle);
 	kunmap_atomic(user_mem, KM_USER0);
-	kunmap_atomic(cmem, KM_USER1);
 
 	flush_dcache_page(page);
 }
@@ -210,27 +628,75 @@ static void zram_read(struct zram *zram, struct bio *bio)
 	int i;
 	u32 index;
 	struct bio_vec *bvec;
+#ifdef CONFIG_ZRAM_WRITEBACK
+	struct zram_wb_read *rd = NULL;
+#endif
 
 	zram_stat64_inc(zram, &zram->stats.num_reads);
 	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
 
 	bio_for_each_segment(bvec, bio, i) {
-		int ret;
-		size_t clen;
+		int ret, huge, pinned;
+		unsigned long handle;
+		u16 size;
+		struct zram_stream *strm = NULL;
 		struct page *page;
 		struct zobj_header *zheader;
 		unsigned char *user_mem, *cmem;
 
 		page = bvec->bv_page;
 
+		/*
+		 * Writeback may turn a compressed page into a ZRAM_WB one
+		 * under us, but nothing else changes while it is read.
+		 */
+		if (zram_is_compressed(zram, index))
+			strm = zram_stream_get(zram->comp);
+
+		zram_slot_lock(zram, index);
+		zram_accessed(zram, index);
+
 		if (zram_test_flag(zram, index, ZRAM_ZERO)) {
+			zram_slot_unlock(zram, index);
 			handle_zero_page(page);
 			index++;
 			continue;
 		}
 
+		if (zram_test_flag(zram, index, ZRAM_SAME)) {
+			user_mem = kmap_atomic(page, KM_USER0);
+			zram_fill_page(user_mem, zram->table[index].element);
+			kunmap_atomic(user_mem, KM_USER0);
+			zram_slot_unlock(zram, index);
+			flush_dcache_page(page);
+			index++;
+			continue;
+		}
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+		if (zram_test_flag(zram, index, ZRAM_WB)) {
+			unsigned long blk = zram->table[index].blk;
+
+			zram_slot_unlock(zram, index);
+			if (strm)
+				zram_stream_put(zram->comp, strm);
+
+			if (unlikely(zram_wb_read_page(zram, blk, page, bio,
+						       &rd))) {
+				pr_err("Error reading page %u from backing "
+					"device\n", index);
+				zram_stat64_inc(zram,
+					&zram->stats.failed_reads);
+				goto out;
+			}
+			index++;
+			continue;
+		}
+#endif
+
 		/* Requested page is not present in compressed area */
-		if (unlikely(!zram->table[index].page)) {
+		if (unlikely(!zram->table[index].handle)) {
+			zram_slot_unlock(zram, index);
 			pr_debug("Read before write: sector=%lu, size=%u",
 				(ulong)(bio->bi_sector), bio->bi_size);
 			handle_zero_page(page);
@@ -238,29 +704,45 @@ static void zram_read(struct zram *zram, struct bio *bio)
 			continue;
 		}
 
+		/*
+		 * Only the table lookup is done under the slot lock; the
+		 * pin keeps writeback from freeing the object meanwhile.
+		 */
+		handle = zram->table[index].handle;
+		size = zram->table[index].size;
+		huge = zram_test_flag(zram, index, ZRAM_UNCOMPRESSED);
+		pinned = zram_slot_pin(zram, index);
+		if (pinned)
+			zram_slot_unlock(zram, index);
+
 		/* Page is stored uncompressed since it's incompressible */
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
-			handle_uncompressed_page(zram, page, index);
+		if (unlikely(huge)) {
+			handle_uncompressed_page(zram, page, handle);
+			if (pinned)
+				zram_slot_unpin(zram, index);
+			else
+				zram_slot_unlock(zram, index);
 			index++;
 			continue;
 		}
 
 		user_mem = kmap_atomic(page, KM_USER0);
-		clen = PAGE_SIZE;
 
-		cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-				zram->table[index].offset;
+		cmem = zs_map_object(zram->mem_pool, handle, ZS_MM_RO);
 
-		ret = lzo1x_decompress_safe(
-			cmem + sizeof(*zheader),
-			xv_get_object_size(cmem) - sizeof(*zheader),
-			user_mem, &clen);
+		ret = zram_comp_decompress(zram->comp, strm,
+			cmem + sizeof(*zheader), size, user_mem);
 
+		zs_unmap_object(zram->mem_pool, handle);
 		kunmap_atomic(user_mem, KM_USER0);
-		kunmap_atomic(cmem, KM_USER1);
+		if (pinned)
+			zram_slot_unpin(zram, index);
+		else
+			zram_slot_unlock(zram, index);
+		zram_stream_put(zram->comp, strm);
 
 		/* Should NEVER happen. Return bio error if it does. */
-		if (unlikely(ret != LZO_E_OK)) {
+		if (unlikely(ret)) {
 			pr_err("Decompression failed! err=%d, page=%u\n",
 				ret, index);
 			zram_stat64_inc(zram, &zram->stats.failed_reads);
@@ -271,11 +753,26 @@ static void zram_read(struct zram *zram, struct bio *bio)
 		index++;
 	}
 
+#ifdef CONFIG_ZRAM_WRITEBACK
+	/* completed once the reads from the backing device are done */
+	if (rd) {
+		zram_wb_read_put(rd);
+		return;
+	}
+#endif
+
 	set_bit(BIO_UPTODATE, &bio->bi_flags);
 	bio_endio(bio, 0);
 	return;
 
 out:
+#ifdef CONFIG_ZRAM_WRITEBACK
+	if (rd) {
+		rd->error = -EIO;
+		zram_wb_read_put(rd);
+		return;
+	}
+#endif
 	bio_io_error(bio);
 }
 
@@ -289,43 +786,58 @@ static void zram_write(struct zram *zram, struct bio *bio)
 	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
 
 	bio_for_each_segment(bvec, bio, i) {
-		int ret;
-		u32 offset;
+		int ret, huge = 0;
 		size_t clen;
+		u32 checksum = 0;
+		unsigned long element, handle;
+		struct zram_dedup *dedup = NULL;
 		struct zobj_header *zheader;
-		struct page *page, *page_store;
+		struct zram_stream *strm;
+		struct page *page;
 		unsigned char *user_mem, *cmem, *src;
 
 		page = bvec->bv_page;
-		src = zram->compress_buffer;
 
 		/*
 		 * System overwrites unused sectors. Free memory associated
 		 * with this sector now.
 		 */
-		if (zram->table[index].page ||
-				zram_test_flag(zram, index, ZRAM_ZERO))
+		zram_slot_lock(zram, index);
+		if (zram->table[index].handle ||
+				zram_test_flag(zram, index, ZRAM_ZERO) ||
+				zram_test_flag(zram, index, ZRAM_SAME) ||
+				zram_test_flag(zram, index, ZRAM_WB))
 			zram_free_page(zram, index);
-
-		mutex_lock(&zram->lock);
+		zram_accessed(zram, index);
+		zram_slot_unlock(zram, index);
 
 		user_mem = kmap_atomic(page, KM_USER0);
-		if (page_zero_filled(user_mem)) {
+		if (page_same_filled(user_mem, &element)) {
 			kunmap_atomic(user_mem, KM_USER0);
-			mutex_unlock(&zram->lock);
-			zram_stat_inc(&zram->stats.pages_zero);
-			zram_set_flag(zram, index, ZRAM_ZERO);
+			zram_slot_lock(zram, index);
+			if (!element) {
+				zram_stat_inc(zram, &zram->stats.pages_zero);
+				zram_set_flag(zram, index, ZRAM_ZERO);
+			} else {
+				zram_stat_inc(zram, &zram->stats.pages_same);
+				zram_set_flag(zram, index, ZRAM_SAME);
+				zram->table[index].element = element;
+			}
+			zram_slot_unlock(zram, index);
 			index++;
 			continue;
 		}
+		kunmap_atomic(user_mem, KM_USER0);
 
-		ret = lzo1x_1_compress(user_mem, PAGE_SIZE, src, &clen,
-					zram->compress_workmem);
+		strm = zram_stream_get(zram->comp);
+		src = strm->buffer;
 
+		user_mem = kmap_atomic(page, KM_USER0);
+		ret = zram_comp_compress(zram->comp, strm, user_mem, &clen);
 		kunmap_atomic(user_mem, KM_USER0);
 
-		if (unlikely(ret != LZO_E_OK)) {
-			mutex_unlock(&zram->lock);
+		if (unlikely(ret)) {
+			zram_stream_put(zram->comp, strm);
 			pr_err("Compression failed! err=%d\n", ret);
 			zram_stat64_inc(zram, &zram->stats.failed_writes);
 			goto out;
@@ -338,9 +850,10 @@ static void zram_write(struct zram *zram, struct bio *bio)
 		 */
 		if (unlikely(clen > max_zpage_size)) {
 			clen = PAGE_SIZE;
-			page_store = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
-			if (unlikely(!page_store)) {
-				mutex_unlock(&zram->lock);
+			handle = zs_malloc(zram->mem_pool, PAGE_SIZE,
+					   GFP_NOIO | __GFP_HIGHMEM);
+			if (unlikely(!handle)) {
+				zram_stream_put(zram->comp, strm);
 				pr_info("Error allocating memory for "
 					"incompressible page: %u\n", index);
 				zram_stat64_inc(zram,
@@ -348,18 +861,37 @@ static void zram_write(struct zram *zram, struct bio *bio)
 				goto out;
 			}
 
-			offset = 0;
-			zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
-			zram_stat_inc(&zram->stats.pages_expand);
-			zram->table[index].page = page_store;
+			huge = 1;
+			zram_stat_inc(zram, &zram->stats.pages_expand);
 			src = kmap_atomic(page, KM_USER0);
 			goto memstore;
 		}
 
-		if (xv_malloc(zram->mem_pool, clen + sizeof(*zheader),
-				&zram->table[index].page, &offset,
-				GFP_NOIO | __GFP_HIGHMEM)) {
-			mutex_unlock(&zram->lock);
+		/* Share the object of an identical page if there is one */
+		checksum = jhash(src, clen, 0);
+		dedup = zram_dedup_find(zram, src, clen, checksum);
+		if (dedup) {
+			zram_slot_lock(zram, index);
+			zram->table[index].handle = dedup->handle;
+			zram->table[index].size = clen;
+			zram_slot_unlock(zram, index);
+			zram_stat_inc(zram, &zram->stats.pages_dedup);
+			zram_stat_inc(zram, &zram->stats.pages_stored);
+			if (clen <= PAGE_SIZE / 2)
+				zram_stat_inc(zram, &zram->stats.good_compress);
+			zram_stream_put(zram->comp, strm);
+			index++;
+			continue;
+		}
+
+		dedup = kmalloc(sizeof(*dedup), GFP_NOIO);
+		handle = zs_malloc(zram->mem_pool, clen + sizeof(*zheader),
+				   GFP_NOIO | __GFP_HIGHMEM);
+		if (unlikely(!dedup || !handle)) {
+			if (handle)
+				zs_free(zram->mem_pool, handle);
+			kfree(dedup);
+			zram_stream_put(zram->comp, strm);
 			pr_info("Error allocating memory for compressed "
 				"page: %u, size=%zu\n", index, clen);
 			zram_stat64_inc(zram, &zram->stats.failed_writes);
@@ -367,33 +899,37 @@ static void zram_write(struct zram *zram, struct bio *bio)
 		}
 
 memstore:
-		zram->table[index].offset = offset;
-
-		cmem = kmap_atomic(zram->table[index].page, KM_USER1) +
-				zram->table[index].offset;
+		cmem = zs_map_object(zram->mem_pool, handle, ZS_MM_WO);
 
-#if 0
-		/* Back-reference needed for memory defragmentation */
-		if (!zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)) {
+		if (!huge) {
 			zheader = (struct zobj_header *)cmem;
-			zheader->table_idx = index;
+			zheader->checksum = checksum;
 			cmem += sizeof(*zheader);
 		}
-#endif
 
 		memcpy(cmem, src, clen);
 
-		kunmap_atomic(cmem, KM_USER1);
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
+		zs_unmap_object(zram->mem_pool, handle);
+		if (unlikely(huge))
 			kunmap_atomic(src, KM_USER0);
+		else
+			zram_dedup_add(zram, dedup, handle, clen, checksum);
+
+		zram_slot_lock(zram, index);
+		zram->table[index].handle = handle;
+		if (unlikely(huge))
+			zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
+		else
+			zram->table[index].size = clen;
+		zram_slot_unlock(zram, index);
 
 		/* Update stats */
 		zram_stat64_add(zram, &zram->stats.compr_size, clen);
-		zram_stat_inc(&zram->stats.pages_stored);
+		zram_stat_inc(zram, &zram->stats.pages_stored);
 		if (clen <= PAGE_SIZE / 2)
-			zram_stat_inc(&zram->stats.good_compress);
+			zram_stat_inc(zram, &zram->stats.good_compress);
 
-		mutex_unlock(&zram->lock);
+		zram_stream_put(zram->comp, strm);
 		index++;
 	}
 
@@ -453,41 +989,185 @@ static int zram_make_request(struct request_queue *queue, struct bio *bio)
 	return 0;
 }
 
-void zram_reset_device(struct zram *zram)
+#ifdef CONFIG_ZRAM_WRITEBACK
+static int zram_wb_wanted(struct zram *zram, u32 index,
+			  enum zram_wb_mode mode, u32 now, u32 min_idle)
 {
-	size_t index;
+	if (!zram->table[index].handle ||
+	    zram_test_flag(zram, index, ZRAM_ZERO) ||
+	    zram_test_flag(zram, index, ZRAM_SAME) ||
+	    zram_test_flag(zram, index, ZRAM_WB))
+		return 0;
+
+	if (mode == ZRAM_WB_HUGE)
+		return zram_test_flag(zram, index, ZRAM_UNCOMPRESSED);
+
+	return now - zram->table[index].ac_time >= min_idle;
+}
+
+/* Decompresses page 'index' into 'page'. Caller must hold the slot lock. */
+static int zram_wb_copy_page(struct zram *zram, u32 index,
+			     struct zram_stream *strm, struct page *page)
+{
+	unsigned long handle = zram->table[index].handle;
+	unsigned char *user_mem, *cmem;
+	int ret = 0;
+
+	user_mem = kmap_atomic(page, KM_USER0);
+	cmem = zs_map_object(zram->mem_pool, handle, ZS_MM_RO);
+
+	if (zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))
+		memcpy(user_mem, cmem, PAGE_SIZE);
+	else
+		ret = zram_comp_decompress(zram->comp, strm,
+				cmem + sizeof(struct zobj_header),
+				zram->table[index].size, user_mem);
+
+	zs_unmap_object(zram->mem_pool, handle);
+	kunmap_atomic(user_mem, KM_USER0);
+
+	return ret;
+}
+
+/*
+ * zram_writeback - moves pages to the backing device to free their memory
+ * @zram: device, with a backing device set
+ * @mode: which pages to move
+ * @min_idle: for ZRAM_WB_IDLE, seconds since the pages were last accessed
+ *
+ * Pages are copied out under their slot lock and written without it. One
+ * that is freed or overwritten meanwhile stays in memory in its new state.
+ * init_lock is dropped after each page written, so a reset or a sysfs
+ * reader waits for one page's I/O at most rather than for the whole pass.
+ * Returns the number of pages written back, or an error if there were
+ * none.
+ */
+int zram_writeback(struct zram *zram, enum zram_wb_mode mode, u32 min_idle)
+{
+	size_t index, nr_pages;
+	struct page *page;
+	u32 now = zram_now();
+	int ret = 0, done = 0;
+
+	page = alloc_page(GFP_KERNEL);
+	if (!page)
+		return -ENOMEM;
 
 	mutex_lock(&zram->init_lock);
-	zram->init_done = 0;
+	if (!zram->init_done || !zram->backing_bdev) {
+		ret = -EINVAL;
+		goto out;
+	}
+	nr_pages = zram->disksize >> PAGE_SHIFT;
 
-	/* Free various per-device buffers */
-	kfree(zram->compress_workmem);
-	free_pages((unsigned long)zram->compress_buffer, 1);
+	for (index = 0; index < nr_pages; index++) {
+		struct zram_stream *strm = NULL;
+		unsigned long blk;
+		u32 ac_time;
 
-	zram->compress_workmem = NULL;
-	zram->compress_buffer = NULL;
+		/* A quick unlocked look first; checked again below */
+		if (!zram_wb_wanted(zram, index, mode, now, min_idle))
+			continue;
 
-	/* Free all pages that are still in this zram device */
-	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++) {
-		struct page *page;
-		u16 offset;
+		blk = zram_alloc_wb_block(zram);
+		if (!blk) {
+			ret = -ENOSPC;
+			break;
+		}
 
-		page = zram->table[index].page;
-		offset = zram->table[index].offset;
+		if (zram_is_compressed(zram, index))
+			strm = zram_stream_get(zram->comp);
 
-		if (!page)
+		zram_slot_lock(zram, index);
+		if (!zram_wb_wanted(zram, index, mode, now, min_idle) ||
+		    (zram_is_compressed(zram, index) && !strm)) {
+			zram_slot_unlock(zram, index);
+			if (strm)
+				zram_stream_put(zram->comp, strm);
+			zram_free_wb_block(zram, blk);
 			continue;
+		}
 
-		if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED)))
-			__free_page(page);
-		else
-			xv_free(zram->mem_pool, page, offset);
+		ret = zram_wb_copy_page(zram, index, strm, page);
+		if (!ret)
+			zram_set_flag(zram, index, ZRAM_UNDER_WB);
+		zram_slot_unlock(zram, index);
+		if (strm)
+			zram_stream_put(zram->comp, strm);
+
+		if (!ret)
+			ret = zram_wb_write_page(zram, blk, page);
+
+		/* a reader still working on the old object keeps it */
+		zram_slot_lock(zram, index);
+		if (!ret && zram_test_flag(zram, index, ZRAM_UNDER_WB) &&
+		    !zram->table[index].count) {
+			ac_time = zram->table[index].ac_time;
+			zram_free_page(zram, index);
+			zram_set_flag(zram, index, ZRAM_WB);
+			zram->table[index].blk = blk;
+			zram->table[index].ac_time = ac_time;
+			zram_stat_inc(zram, &zram->stats.pages_wb);
+			zram_stat64_inc(zram, &zram->stats.wb_writes);
+			blk = 0;
+			done++;
+		}
+		zram_clear_flag(zram, index, ZRAM_UNDER_WB);
+		zram_slot_unlock(zram, index);
+
+		if (blk)
+			zram_free_wb_block(zram, blk);
+		if (ret)
+			break;
+
+		mutex_unlock(&zram->init_lock);
+		cond_resched();
+		mutex_lock(&zram->init_lock);
+
+		/* the device may have been reset meanwhile */
+		if (!zram->init_done || !zram->backing_bdev)
+			break;
+		nr_pages = zram->disksize >> PAGE_SHIFT;
+	}
+
+out:
+	mutex_unlock(&zram->init_lock);
+	__free_page(page);
+
+	return done ? done : ret;
+}
+#endif
+
+void zram_reset_device(struct zram *zram)
+{
+	size_t index;
+
+	mutex_lock(&zram->init_lock);
+	zram->init_done = 0;
+
+	/* Free the compression streams */
+	if (zram->comp)
+		zram_comp_destroy(zram->comp);
+	zram->comp = NULL;
+
+	/*
+	 * Free all pages that are still in this zram device, one table entry
+	 * at a time so that shared objects are only freed once.
+	 */
+	if (zram->table) {
+		for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++)
+			zram_free_page(zram, index);
 	}
 
 	vfree(zram->table);
 	zram->table = NULL;
 
-	xv_destroy_pool(zram->mem_pool);
+	zram_reset_backing_dev(zram);
+
+	vfree(zram->dedup_table);
+	zram->dedup_table = NULL;
+
+	zs_destroy_pool(zram->mem_pool);
 	zram->mem_pool = NULL;
 
 	/* Reset stats */
@@ -511,16 +1191,11 @@ int zram_init_device(struct zram *zram)
 
 	zram_set_disksize(zram, totalram_pages << PAGE_SHIFT);
 
-	zram->compress_workmem = kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
-	if (!zram->compress_workmem) {
-		pr_err("Error allocating compressor working memory!\n");
-		ret = -ENOMEM;
-		goto fail;
-	}
-
-	zram->compress_buffer = (void *)__get_free_pages(__GFP_ZERO, 1);
-	if (!zram->compress_buffer) {
-		pr_err("Error allocating compressor buffer space\n");
+	zram->comp = zram_comp_create(zram->compressor,
+				      zram->max_comp_streams);
+	if (!zram->comp) {
+		pr_err("Error allocating %s compression streams!\n",
+			zram->compressor);
 		ret = -ENOMEM;
 		goto fail;
 	}
@@ -535,12 +1210,22 @@ int zram_init_device(struct zram *zram)
 		goto fail;
 	}
 
+	zram->dedup_mask = roundup_pow_of_two(max_t(size_t, num_pages /
+				dedup_pages_per_bucket, 1)) - 1;
+	zram->dedup_table = vzalloc((zram->dedup_mask + 1) *
+				    sizeof(*zram->dedup_table));
+	if (!zram->dedup_table) {
+		pr_err("Error allocating zram deduplication table\n");
+		ret = -ENOMEM;
+		goto fail;
+	}
+
 	set_capacity(zram->disk, zram->disksize >> SECTOR_SHIFT);
 
 	/* zram devices sort of resembles non-rotational disks */
 	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, zram->disk->queue);
 
-	zram->mem_pool = xv_create_pool();
+	zram->mem_pool = zs_create_pool();
 	if (!zram->mem_pool) {
 		pr_err("Error creating memory pool\n");
 		ret = -ENOMEM;
@@ -566,7 +1251,9 @@ void zram_slot_free_notify(struct block_device *bdev, unsigned long index)
 	struct zram *zram;
 
 	zram = bdev->bd_disk->private_data;
+	zram_slot_lock(zram, index);
 	zram_free_page(zram, index);
+	zram_slot_unlock(zram, index);
 	zram_stat64_inc(zram, &zram->stats.notify_free);
 }
 
@@ -579,9 +1266,13 @@ static int create_device(struct zram *zram, int device_id)
 {
 	int ret = 0;
 
-	mutex_init(&zram->lock);
 	mutex_init(&zram->init_lock);
 	spin_lock_init(&zram->stat64_lock);
+	spin_lock_init(&zram->dedup_lock);
+	zram_init_slot_locks(zram);
+	strlcpy(zram->compressor, default_compressor,
+		sizeof(zram->compressor));
+	zram->max_comp_streams = num_online_cpus();
 
 	zram->queue = blk_alloc_queue(GFP_KERNEL);
 	if (!zram->queue) {
@@ -18,7 +18,8 @@
 #include <linux/spinlock.h>
 #include <linux/mutex.h>
 
-#include "xvmalloc.h"
+#include "zsmalloc.h"
+#include "zram_comp.h"
 
 /*
  * Some arbitrary value. This is just to catch
@@ -29,13 +30,11 @@ static const unsigned max_num_devices = 32;
 /*
  * Stored at beginning of each compressed object.
  *
- * It stores back-reference to table entry which points to this
- * object. This is required to support memory defragmentation.
+ * Objects are moved around by zsmalloc compaction through their handles,
+ * so no back-reference to the table entry is needed here.
  */
 struct zobj_header {
-#if 0
-	u32 table_idx;
-#endif
+	u32 checksum;	/* of the compressed data, for deduplication */
 };
 
 /*-- Configurable parameters */
@@ -43,6 +42,12 @@ struct zobj_header {
 /* Default zram disk size: 25% of total RAM */
 static const unsigned default_disksize_perc_ram = 25;
 
+/* Default compressor, see zram_comp.c for the others */
+static const char default_compressor[] = "lzo";
+
+/* One deduplication hash bucket per this many disk pages */
+static const unsigned dedup_pages_per_bucket = 16;
+
 /*
  * Pages that compress to size greater than this are stored
  * uncompressed in memory.
@@ -51,8 +56,8 @@ static const unsigned max_zpage_size = PAGE_SIZE / 4 * 3;
 
 /*
  * NOTE: max_zpage_size must be less than or equal to:
- *   XV_MAX_ALLOC_SIZE - sizeof(struct zobj_header)
- * otherwise, xv_malloc() would always return failure.
+ *   ZS_MAX_ALLOC_SIZE - sizeof(struct zobj_header)
+ * otherwise, zs_malloc() would always return failure.
  */
 
 /*-- End of configurable params */
@@ -71,6 +76,15 @@ enum zram_pageflags {
 	/* Page consists entirely of zeros */
 	ZRAM_ZERO,
 
+	/* Page is one word repeated, kept in table[page_no].element */
+	ZRAM_SAME,
+
+	/* Page is on the backing device, at table[page_no].blk */
+	ZRAM_WB,
+
+	/* Page is being written back; cleared if the page is freed */
+	ZRAM_UNDER_WB,
+
 	__NR_ZRAM_PAGEFLAGS,
 };
 
@@ -78,10 +92,17 @@ enum zram_pageflags {
 
 /* Allocated for each disk page */
 struct table {
-	struct page *page;
-	u16 offset;
-	u8 count;	/* object ref count (not yet used) */
+	union {
+		unsigned long handle;	/* zsmalloc object */
+		unsigned long element;	/* ZRAM_SAME pages */
+		unsigned long blk;	/* ZRAM_WB pages */
+	};
+	u16 size;	/* compressed size, excluding zobj_header */
+	u8 count;	/* readers working on the entry, see zram_slot_pin() */
 	u8 flags;
+#ifdef CONFIG_ZRAM_WRITEBACK
+	u32 ac_time;	/* last access, in seconds since boot */
+#endif
 } __attribute__((aligned(4)));
 
 struct zram_stats {
@@ -93,19 +114,46 @@ struct zram_stats {
 	u64 invalid_io;		/* non-page-aligned I/O requests */
 	u64 notify_free;	/* no. of swap slot free notifications */
 	u32 pages_zero;		/* no. of zero filled pages */
+	u32 pages_same;		/* no. of other single pattern pages */
+	u32 pages_dedup;	/* no. of pages sharing a stored object */
 	u32 pages_stored;	/* no. of pages currently stored */
 	u32 good_compress;	/* % of pages with compression ratio<=50% */
 	u32 pages_expand;	/* % of incompressible pages */
+	u32 pages_wb;		/* no. of pages on the backing device */
+	u64 wb_reads;		/* pages read from the backing device */
+	u64 wb_writes;		/* pages written to the backing device */
+};
+
+#ifdef CONFIG_ZRAM_WRITEBACK
+/*
+ * Hashed locks serialising the writeback of a table entry against
+ * reads, writes and frees of it. They are taken on every read and write,
+ * and entries index % ZRAM_SLOT_LOCKS apart share a lock, so ordinary
+ * I/O contends on them too: they only ever cover table updates. Readers
+ * decompress outside the lock with the entry pinned (table.count).
+ */
+#define ZRAM_SLOT_LOCKS		64
+
+/* What zram_writeback() picks */
+enum zram_wb_mode {
+	ZRAM_WB_HUGE,		/* incompressible pages */
+	ZRAM_WB_IDLE,		/* pages not accessed for a while */
 };
+#endif
 
 struct zram {
-	struct xv_pool *mem_pool;
-	void *compress_workmem;
-	void *compress_buffer;
+	struct zs_pool *mem_pool;
+	struct zram_comp *comp;	/* compression streams */
 	struct table *table;
-	spinlock_t stat64_lock;	/* protect 64-bit stats */
-	struct mutex lock;	/* protect compression buffers against
-				 * concurrent writes */
+	spinlock_t stat64_lock;	/* protect stats */
+	/*
+	 * Every compressed object is indexed by the checksum kept in its
+	 * zobj_header, so that pages that compress to identical data share
+	 * one object.
+	 */
+	struct hlist_head *dedup_table;
+	unsigned long dedup_mask;
+	spinlock_t dedup_lock;	/* protects dedup_table */
 	struct request_queue *queue;
 	struct gendisk *disk;
 	int init_done;
@@ -116,6 +164,16 @@ struct zram {
 	 * we can store in a disk.
 	 */
 	u64 disksize;	/* bytes */
+	char compressor[ZRAM_COMP_NAME_LEN];
+	int max_comp_streams;	/* default: number of online CPUs */
+#ifdef CONFIG_ZRAM_WRITEBACK
+	spinlock_t slot_locks[ZRAM_SLOT_LOCKS];
+	struct block_device *backing_bdev;
+	char backing_path[64];
+	unsigned long nr_wb_pages;	/* size of the backing device */
+	unsigned long *wb_bitmap;	/* blocks in use; block 0 is unused */
+	unsigned long wb_next;		/* where to look for a free block */
+#endif
 
 	struct zram_stats stats;
 };
@@ -126,7 +184,22 @@ extern unsigned int num_devices;
 extern struct attribute_group zram_disk_attr_group;
 #endif
 
+/* An entry in zram->dedup_table */
+struct zram_dedup {
+	struct hlist_node node;
+	unsigned long handle;	/* the compressed object */
+	u16 size;		/* exact compressed length, as compressed */
+	u32 checksum;
+	u32 refcount;		/* table entries pointing to the object */
+};
+
 extern int zram_init_device(struct zram *zram);
 extern void zram_reset_device(struct zram *zram);
 
+#ifdef CONFIG_ZRAM_WRITEBACK
+extern int zram_set_backing_dev(struct zram *zram, const char *path);
+extern int zram_writeback(struct zram *zram, enum zram_wb_mode mode,
+			  u32 min_idle);
+#endif
+
 #endif
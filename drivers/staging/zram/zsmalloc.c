@@ -0,0 +1,561 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * Copyright (C) 2008, 2009, 2010  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+/*
+ * Objects are grouped by size into classes. Each class carves same-sized
+ * objects out of "zspages", small groups of order-0 pages, and objects may
+ * straddle the pages of a zspage. Callers identify objects by opaque
+ * handles rather than by location, which lets zs_compact() move objects
+ * out of sparsely used zspages and give those pages back.
+ */
+
+#ifdef CONFIG_ZRAM_DEBUG
+#define DEBUG
+#endif
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#include <linux/highmem.h>
+#include <linux/list_sort.h>
+#include <linux/percpu.h>
+#include <linux/sched.h>
+#include <linux/string.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+
+#include "zsmalloc.h"
+#include "zsmalloc_int.h"
+
+/* The words handles point to, shared by all pools */
+static struct kmem_cache *zs_handle_cache;
+
+static int get_size_class_index(size_t size)
+{
+	if (size <= ZS_MIN_ALLOC_SIZE)
+		return 0;
+
+	return DIV_ROUND_UP(size - ZS_MIN_ALLOC_SIZE, ZS_SIZE_CLASS_DELTA);
+}
+
+/*
+ * Picks the number of pages per zspage that leaves the least space unused
+ * at the end of the zspage, preferring fewer pages on ties.
+ */
+static int get_pages_per_zspage(int size)
+{
+	int i, max_usedpc = 0, best = 1;
+
+	for (i = 1; i <= ZS_MAX_PAGES_PER_ZSPAGE; i++) {
+		int zspage_size = i * PAGE_SIZE;
+		int usedpc = (zspage_size - zspage_size % size) * 100 /
+				zspage_size;
+
+		if (usedpc > max_usedpc) {
+			max_usedpc = usedpc;
+			best = i;
+		}
+	}
+
+	return best;
+}
+
+/*
+ * Copies object 'idx' of 'zspage' to 'buf', or 'buf' to the object if
+ * 'store' is set, one page at a time.
+ */
+static void copy_object(struct zspage *zspage, unsigned int idx,
+			char *buf, int store)
+{
+	unsigned long offset = (unsigned long)idx * zspage->class->size;
+	int size = zspage->class->size;
+
+	while (size) {
+		unsigned int off = offset & ~PAGE_MASK;
+		int len = min_t(int, size, PAGE_SIZE - off);
+		char *vaddr;
+
+		vaddr = kmap_atomic(zspage->pages[offset >> PAGE_SHIFT],
+				    KM_USER1);
+		if (store)
+			memcpy(vaddr + off, buf, len);
+		else
+			memcpy(buf, vaddr + off, len);
+		kunmap_atomic(vaddr, KM_USER1);
+
+		buf += len;
+		offset += len;
+		size -= len;
+	}
+}
+
+static unsigned long obj_encode(struct zspage *zspage, unsigned int idx)
+{
+	return page_to_pfn(zspage->pages[0]) << ZS_OBJ_INDEX_BITS | idx;
+}
+
+static struct zspage *obj_decode(unsigned long obj, unsigned int *idx)
+{
+	*idx = obj & ZS_OBJ_INDEX_MASK;
+	return (struct zspage *)page_private(pfn_to_page(obj >>
+							 ZS_OBJ_INDEX_BITS));
+}
+
+/*
+ * The first page of a zspage needs a pfn that fits in a handle next to
+ * the object index, which a lowmem page always has.
+ */
+static struct page *alloc_first_page(gfp_t flags)
+{
+	struct page *page = alloc_page(flags);
+
+	if (page && page_to_pfn(page) > ZS_MAX_PFN) {
+		__free_page(page);
+		page = alloc_page(flags & ~__GFP_HIGHMEM);
+	}
+	return page;
+}
+
+static struct zspage *alloc_zspage(struct zs_pool *pool,
+				   struct size_class *class, gfp_t flags)
+{
+	struct zspage *zspage;
+	int i;
+
+	zspage = kzalloc(sizeof(*zspage) + class->objs_per_zspage *
+			 sizeof(zspage->handles[0]), flags & ~__GFP_HIGHMEM);
+	if (unlikely(!zspage))
+		return NULL;
+
+	zspage->class = class;
+	INIT_LIST_HEAD(&zspage->list);
+
+	for (i = 0; i < class->pages_per_zspage; i++) {
+		zspage->pages[i] = i ? alloc_page(flags) :
+				       alloc_first_page(flags);
+		if (unlikely(!zspage->pages[i]))
+			goto fail;
+	}
+	set_page_private(zspage->pages[0], (unsigned long)zspage);
+
+	atomic_long_add(class->pages_per_zspage, &pool->pages_allocated);
+	return zspage;
+
+fail:
+	while (i--)
+		__free_page(zspage->pages[i]);
+	kfree(zspage);
+	return NULL;
+}
+
+static void free_zspage(struct zs_pool *pool, struct zspage *zspage)
+{
+	int i;
+
+	set_page_private(zspage->pages[0], 0);
+	for (i = 0; i < zspage->class->pages_per_zspage; i++)
+		__free_page(zspage->pages[i]);
+
+	atomic_long_sub(zspage->class->pages_per_zspage,
+			&pool->pages_allocated);
+	kfree(zspage);
+}
+
+/*
+ * Points 'handle' at a free object of 'zspage' and returns its index.
+ * Caller must hold class->lock and 'zspage' must have a free object.
+ */
+static unsigned int obj_attach(struct size_class *class,
+			       struct zspage *zspage, unsigned long *handle)
+{
+	unsigned int idx = zspage->free_hint;
+
+	while (zspage->handles[idx])
+		idx++;
+
+	zspage->handles[idx] = handle;
+	zspage->free_hint = idx + 1;
+	*handle = obj_encode(zspage, idx);
+
+	class->objs_inuse++;
+	if (++zspage->inuse == class->objs_per_zspage)
+		list_move(&zspage->list, &class->full);
+	return idx;
+}
+
+/*
+ * Caller must hold class->lock. Returns 1 if 'zspage' is left empty, in
+ * which case it has been taken off the class lists and should be freed.
+ */
+static int obj_detach(struct size_class *class, struct zspage *zspage,
+		      unsigned int idx)
+{
+	zspage->handles[idx] = NULL;
+	if (idx < zspage->free_hint)
+		zspage->free_hint = idx;
+
+	class->objs_inuse--;
+	if (zspage->inuse-- == class->objs_per_zspage)
+		list_move(&zspage->list, &class->partial);
+
+	if (zspage->inuse)
+		return 0;
+
+	list_del(&zspage->list);
+	class->zspages--;
+	return 1;
+}
+
+/*
+ * Create a memory pool. Allocates size classes, bounce buffers and other
+ * per-pool metadata.
+ */
+struct zs_pool *zs_create_pool(void)
+{
+	struct zs_pool *pool;
+	int i, cpu;
+
+	pool = vzalloc(sizeof(*pool));
+	if (!pool)
+		return NULL;
+
+	rwlock_init(&pool->migrate_lock);
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->classes[i];
+
+		class->size = min_t(int, ZS_MIN_ALLOC_SIZE +
+				    i * ZS_SIZE_CLASS_DELTA, ZS_MAX_ALLOC_SIZE);
+		class->pages_per_zspage = get_pages_per_zspage(class->size);
+		class->objs_per_zspage = class->pages_per_zspage * PAGE_SIZE /
+					 class->size;
+		spin_lock_init(&class->lock);
+		INIT_LIST_HEAD(&class->partial);
+		INIT_LIST_HEAD(&class->full);
+	}
+
+	pool->area = alloc_percpu(struct zs_map_area);
+	if (!pool->area)
+		goto fail;
+
+	for_each_possible_cpu(cpu) {
+		struct zs_map_area *area = per_cpu_ptr(pool->area, cpu);
+
+		area->buf = kmalloc(ZS_MAX_ALLOC_SIZE, GFP_KERNEL);
+		if (!area->buf)
+			goto fail;
+	}
+
+	return pool;
+
+fail:
+	zs_destroy_pool(pool);
+	return NULL;
+}
+EXPORT_SYMBOL_GPL(zs_create_pool);
+
+/* All objects must have been freed. */
+void zs_destroy_pool(struct zs_pool *pool)
+{
+	int i, cpu;
+
+	if (!pool)
+		return;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->classes[i];
+
+		if (class->zspages)
+			pr_info("Freeing non-empty class with size %db\n",
+				class->size);
+	}
+
+	if (pool->area) {
+		for_each_possible_cpu(cpu)
+			kfree(per_cpu_ptr(pool->area, cpu)->buf);
+		free_percpu(pool->area);
+	}
+
+	vfree(pool);
+}
+EXPORT_SYMBOL_GPL(zs_destroy_pool);
+
+/**
+ * zs_malloc - Allocate block of given size from pool.
+ * @pool: pool to allocate from
+ * @size: size of block to allocate
+ * @flags: gfp flags for the backing pages
+ *
+ * Returns a handle to the object, to be passed to zs_map_object() to
+ * access it, or 0 on failure.
+ *
+ * Allocation requests with size > ZS_MAX_ALLOC_SIZE will fail.
+ */
+unsigned long zs_malloc(struct zs_pool *pool, size_t size, gfp_t flags)
+{
+	unsigned long *handle;
+	struct size_class *class;
+	struct zspage *zspage;
+
+	if (unlikely(!size || size > ZS_MAX_ALLOC_SIZE))
+		return 0;
+
+	handle = kmem_cache_alloc(zs_handle_cache, flags & ~__GFP_HIGHMEM);
+	if (unlikely(!handle))
+		return 0;
+
+	class = &pool->classes[get_size_class_index(size)];
+
+	spin_lock(&class->lock);
+	if (list_empty(&class->partial)) {
+		spin_unlock(&class->lock);
+
+		zspage = alloc_zspage(pool, class, flags);
+		if (unlikely(!zspage)) {
+			kmem_cache_free(zs_handle_cache, handle);
+			return 0;
+		}
+
+		spin_lock(&class->lock);
+		list_add(&zspage->list, &class->partial);
+		class->zspages++;
+	}
+
+	obj_attach(class, list_first_entry(&class->partial, struct zspage,
+					   list), handle);
+	spin_unlock(&class->lock);
+
+	return (unsigned long)handle;
+}
+EXPORT_SYMBOL_GPL(zs_malloc);
+
+void zs_free(struct zs_pool *pool, unsigned long obj)
+{
+	unsigned long *handle = (unsigned long *)obj;
+	struct size_class *class;
+	struct zspage *zspage;
+	unsigned int idx;
+	int empty;
+
+	read_lock(&pool->migrate_lock);
+	zspage = obj_decode(*handle, &idx);
+	class = zspage->class;
+
+	spin_lock(&class->lock);
+	empty = obj_detach(class, zspage, idx);
+	spin_unlock(&class->lock);
+	read_unlock(&pool->migrate_lock);
+
+	if (empty)
+		free_zspage(pool, zspage);
+	kmem_cache_free(zs_handle_cache, handle);
+}
+EXPORT_SYMBOL_GPL(zs_free);
+
+/**
+ * zs_map_object - get a pointer to an object
+ * @pool: pool the object was allocated from
+ * @obj: handle returned by zs_malloc()
+ * @mm: whether the object is read, written or both
+ *
+ * The mapping must be dropped with zs_unmap_object() before sleeping or
+ * mapping another object. The object cannot move in between. KM_USER1 is
+ * used, so the caller may hold a KM_USER0 mapping.
+ */
+void *zs_map_object(struct zs_pool *pool, unsigned long obj,
+		    enum zs_mapmode mm)
+{
+	struct zspage *zspage;
+	struct zs_map_area *area;
+	unsigned long offset;
+	unsigned int idx, off;
+
+	/* also disables preemption, keeping us on this cpu's area */
+	read_lock(&pool->migrate_lock);
+	zspage = obj_decode(*(unsigned long *)obj, &idx);
+	area = this_cpu_ptr(pool->area);
+	area->mm = mm;
+
+	offset = (unsigned long)idx * zspage->class->size;
+	off = offset & ~PAGE_MASK;
+
+	if (off + zspage->class->size <= PAGE_SIZE) {
+		area->vaddr = kmap_atomic(zspage->pages[offset >> PAGE_SHIFT],
+					  KM_USER1);
+		return area->vaddr + off;
+	}
+
+	/* the object straddles two pages */
+	area->vaddr = NULL;
+	if (mm != ZS_MM_WO)
+		copy_object(zspage, idx, area->buf, 0);
+
+	return area->buf;
+}
+EXPORT_SYMBOL_GPL(zs_map_object);
+
+void zs_unmap_object(struct zs_pool *pool, unsigned long obj)
+{
+	struct zs_map_area *area = this_cpu_ptr(pool->area);
+	struct zspage *zspage;
+	unsigned int idx;
+
+	if (area->vaddr) {
+		kunmap_atomic(area->vaddr, KM_USER1);
+	} else if (area->mm != ZS_MM_RO) {
+		zspage = obj_decode(*(unsigned long *)obj, &idx);
+		copy_object(zspage, idx, area->buf, 1);
+	}
+
+	read_unlock(&pool->migrate_lock);
+}
+EXPORT_SYMBOL_GPL(zs_unmap_object);
+
+static int zspage_cmp(void *priv, struct list_head *a, struct list_head *b)
+{
+	return list_entry(a, struct zspage, list)->inuse -
+		list_entry(b, struct zspage, list)->inuse;
+}
+
+/*
+ * Moves objects from the emptiest partial zspage of a class into the
+ * fullest ones until it is empty. Returns the number of pages released,
+ * or 0 if the free objects of the class would not fill a whole zspage.
+ * Caller must hold pool->migrate_lock for writing and class->lock.
+ */
+static int compact_one(struct zs_pool *pool, struct size_class *class,
+		       struct list_head *release)
+{
+	char *buf = this_cpu_ptr(pool->area)->buf;
+	struct zspage *src;
+	unsigned int idx;
+
+	if (class->zspages * class->objs_per_zspage - class->objs_inuse <
+			class->objs_per_zspage)
+		return 0;
+
+	src = list_first_entry(&class->partial, struct zspage, list);
+
+	for (idx = 0; src->inuse; idx++) {
+		unsigned long *handle = src->handles[idx];
+		struct zspage *dst;
+
+		if (!handle)
+			continue;
+
+		dst = list_entry(class->partial.prev, struct zspage, list);
+		copy_object(src, idx, buf, 0);
+		copy_object(dst, obj_attach(class, dst, handle), buf, 1);
+		obj_detach(class, src, idx);
+	}
+
+	list_add(&src->list, release);
+	return class->pages_per_zspage;
+}
+
+static unsigned long compact_class(struct zs_pool *pool,
+				   struct size_class *class)
+{
+	unsigned long freed = 0;
+	LIST_HEAD(release);
+	struct zspage *zspage, *next;
+	int pages, round;
+
+	do {
+		round = 0;
+		write_lock(&pool->migrate_lock);
+		spin_lock(&class->lock);
+
+		/* emptiest first, so sources are taken from the head */
+		list_sort(NULL, &class->partial, zspage_cmp);
+
+		while ((pages = compact_one(pool, class, &release))) {
+			round += pages;
+			if (need_resched())
+				break;
+		}
+
+		freed += round;
+		pool->pages_compacted += round;
+		spin_unlock(&class->lock);
+		write_unlock(&pool->migrate_lock);
+
+		list_for_each_entry_safe(zspage, next, &release, list)
+			free_zspage(pool, zspage);
+		INIT_LIST_HEAD(&release);
+
+		cond_resched();
+	} while (pages);
+
+	return freed;
+}
+
+/**
+ * zs_compact - release the pages of sparsely used zspages
+ * @pool: pool to compact
+ *
+ * Moves objects so that the free space of each size class is gathered into
+ * whole zspages, which are then freed. Returns the number of pages freed.
+ * May sleep.
+ */
+unsigned long zs_compact(struct zs_pool *pool)
+{
+	unsigned long freed = 0;
+	int i;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++)
+		freed += compact_class(pool, &pool->classes[i]);
+
+	return freed;
+}
+EXPORT_SYMBOL_GPL(zs_compact);
+
+/*
+ * Returns total memory used by allocator (userdata + metadata)
+ */
+u64 zs_get_total_size_bytes(struct zs_pool *pool)
+{
+	return (u64)atomic_long_read(&pool->pages_allocated) << PAGE_SHIFT;
+}
+EXPORT_SYMBOL_GPL(zs_get_total_size_bytes);
+
+void zs_get_pool_stats(struct zs_pool *pool, struct zs_pool_stats *stats)
+{
+	int i;
+
+	memset(stats, 0, sizeof(*stats));
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->classes[i];
+
+		spin_lock(&class->lock);
+		stats->obj_allocated += (u64)class->zspages *
+					class->objs_per_zspage * class->size;
+		stats->obj_used += (u64)class->objs_inuse * class->size;
+		spin_unlock(&class->lock);
+	}
+
+	stats->pages_allocated = atomic_long_read(&pool->pages_allocated);
+
+	read_lock(&pool->migrate_lock);
+	stats->pages_compacted = pool->pages_compacted;
+	read_unlock(&pool->migrate_lock);
+}
+EXPORT_SYMBOL_GPL(zs_get_pool_stats);
+
+static int __init zs_init(void)
+{
+	zs_handle_cache = kmem_cache_create("zs_handle", sizeof(unsigned long),
+					    0, 0, NULL);
+	return zs_handle_cache ? 0 : -ENOMEM;
+}
+module_init(zs_init);
@@ -0,0 +1,54 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * Copyright (C) 2008, 2009, 2010  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifndef _ZS_MALLOC_H_
+#define _ZS_MALLOC_H_
+
+#include <linux/types.h>
+
+/*
+ * How an object is going to be accessed. Objects that straddle two pages
+ * are copied through a bounce buffer, so telling the allocator whether the
+ * old contents are needed, or whether new ones have to be written back,
+ * saves a copy.
+ */
+enum zs_mapmode {
+	ZS_MM_RW,
+	ZS_MM_RO,	/* contents are only read */
+	ZS_MM_WO,	/* contents are entirely overwritten */
+};
+
+struct zs_pool_stats {
+	u64 pages_allocated;	/* backing pages */
+	u64 obj_allocated;	/* bytes of object slots, used or not */
+	u64 obj_used;		/* bytes of object slots in use */
+	u64 pages_compacted;	/* pages released by zs_compact() so far */
+};
+
+struct zs_pool;
+
+struct zs_pool *zs_create_pool(void);
+void zs_destroy_pool(struct zs_pool *pool);
+
+unsigned long zs_malloc(struct zs_pool *pool, size_t size, gfp_t flags);
+void zs_free(struct zs_pool *pool, unsigned long handle);
+
+void *zs_map_object(struct zs_pool *pool, unsigned long handle,
+			enum zs_mapmode mm);
+void zs_unmap_object(struct zs_pool *pool, unsigned long handle);
+
+unsigned long zs_compact(struct zs_pool *pool);
+
+u64 zs_get_total_size_bytes(struct zs_pool *pool);
+void zs_get_pool_stats(struct zs_pool *pool, struct zs_pool_stats *stats);
+
+#endif
@@ -0,0 +1,100 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * Copyright (C) 2008, 2009, 2010  Nitin Gupta
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifndef _ZS_MALLOC_INT_H_
+#define _ZS_MALLOC_INT_H_
+
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/list.h>
+#include <linux/log2.h>
+#include <linux/spinlock.h>
+
+/* User configurable params */
+
+/*
+ * A zspage is the group of order-0 pages a size class carves its objects
+ * from. Objects may straddle the pages of a zspage, so using up to this
+ * many pages lets awkward sizes pack with little waste at the end.
+ */
+#define ZS_MAX_PAGES_PER_ZSPAGE	4
+
+#define ZS_MIN_ALLOC_SIZE	32
+#define ZS_MAX_ALLOC_SIZE	PAGE_SIZE
+
+/*
+ * Size classes are separated by ZS_SIZE_CLASS_DELTA bytes: 16 for 4k
+ * pages, so no object wastes more than 15 bytes to rounding.
+ */
+#define ZS_SIZE_CLASS_DELTA	(PAGE_SIZE >> 8)
+#define ZS_SIZE_CLASSES		(DIV_ROUND_UP(ZS_MAX_ALLOC_SIZE - \
+				ZS_MIN_ALLOC_SIZE, ZS_SIZE_CLASS_DELTA) + 1)
+
+/* End of user params */
+
+/*
+ * zs_malloc() hands out the address of a word holding the location of the
+ * object: the pfn of the first page of its zspage, shifted left by
+ * ZS_OBJ_INDEX_BITS, ORed with its index within the zspage. Objects are
+ * moved by rewriting the word. The zspage itself is found through
+ * page_private() of that first page.
+ */
+#define ZS_MAX_OBJS_PER_ZSPAGE	(ZS_MAX_PAGES_PER_ZSPAGE * PAGE_SIZE / \
+				ZS_MIN_ALLOC_SIZE)
+#define ZS_OBJ_INDEX_BITS	order_base_2(ZS_MAX_OBJS_PER_ZSPAGE)
+#define ZS_OBJ_INDEX_MASK	((1UL << ZS_OBJ_INDEX_BITS) - 1)
+#define ZS_MAX_PFN		(ULONG_MAX >> ZS_OBJ_INDEX_BITS)
+
+struct zspage {
+	struct list_head list;	/* in class->partial or class->full */
+	struct size_class *class;
+	int inuse;		/* objects allocated */
+	int free_hint;		/* no free object below this index */
+	struct page *pages[ZS_MAX_PAGES_PER_ZSPAGE];
+	/* back-references for compaction, NULL for free objects */
+	unsigned long *handles[0];
+};
+
+struct size_class {
+	spinlock_t lock;	/* protects everything below */
+	int size;		/* object size */
+	int pages_per_zspage;
+	int objs_per_zspage;
+	/* zspages with free objects, allocated from in list order */
+	struct list_head partial;
+	struct list_head full;
+	unsigned long zspages;	/* stats */
+	unsigned long objs_inuse;
+};
+
+/* Per-cpu bounce buffer for objects straddling two pages */
+struct zs_map_area {
+	char *buf;
+	void *vaddr;		/* kmap of a directly mapped object */
+	enum zs_mapmode mm;
+};
+
+struct zs_pool {
+	/*
+	 * Taken for reading while an object is mapped or freed, and for
+	 * writing while objects are moved, so that a handle always
+	 * resolves to where its object currently is. Nests outside the
+	 * class locks.
+	 */
+	rwlock_t migrate_lock;
+	struct zs_map_area __percpu *area;
+	atomic_long_t pages_allocated;
+	u64 pages_compacted;	/* stats, under migrate_lock */
+	struct size_class classes[ZS_SIZE_CLASSES];
+};
+
+#endif
@@ -915,6 +915,7 @@ static int de_thread(struct task_struct *tsk)
 
 		tsk->group_leader = tsk;
 		leader->group_leader = tsk;
+		lowmem_task_exec(leader, tsk);
 
 		tsk->exit_signal = SIGCHLD;
 
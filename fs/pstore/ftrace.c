@@ -0,0 +1,160 @@
+/*
+ * Persistent Storage - function tracer sink
+ *
+ * Records every traced function call, as a struct pstore_ftrace_record,
+ * with a backend that keeps an ftrace record in RAM surviving a reset. The
+ * last calls on each cpu then show where a hung box was stuck.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ */
+
+#include <linux/debugfs.h>
+#include <linux/ftrace.h>
+#include <linux/init.h>
+#include <linux/irqflags.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/pstore.h>
+#include <linux/smp.h>
+#include <linux/string.h>
+#include <linux/uaccess.h>
+
+#include "internal.h"
+
+static int record_ftrace;
+module_param(record_ftrace, bool, 0400);
+MODULE_PARM_DESC(record_ftrace,
+		 "start recording function calls as soon as a backend registers");
+
+/*
+ * Anything the backend calls is traced as well, the writes it does for
+ * those calls are simply dropped.
+ */
+static DEFINE_PER_CPU(int, pstore_ftrace_active);
+
+static void notrace pstore_ftrace_call(unsigned long ip,
+				       unsigned long parent_ip)
+{
+	struct pstore_ftrace_record rec;
+	unsigned long flags;
+	int *active;
+
+	if (unlikely(oops_in_progress))
+		return;
+
+	local_irq_save(flags);
+	active = &__get_cpu_var(pstore_ftrace_active);
+	if (likely(!*active)) {
+		*active = 1;
+		rec.ip = ip;
+		rec.parent_ip = parent_ip;
+		rec.cpu = raw_smp_processor_id();
+		pstore_write_buf(PSTORE_TYPE_FTRACE, (const char *)&rec,
+				 sizeof(rec));
+		*active = 0;
+	}
+	local_irq_restore(flags);
+}
+
+static struct ftrace_ops pstore_ftrace_ops __read_mostly = {
+	.func	= pstore_ftrace_call,
+};
+
+static DEFINE_MUTEX(pstore_ftrace_lock);
+static bool pstore_ftrace_enabled;
+
+static int pstore_ftrace_set(bool on)
+{
+	int ret = 0;
+
+	mutex_lock(&pstore_ftrace_lock);
+	if (on == pstore_ftrace_enabled)
+		goto out;
+
+	if (on)
+		ret = register_ftrace_function(&pstore_ftrace_ops);
+	else
+		ret = unregister_ftrace_function(&pstore_ftrace_ops);
+	if (ret) {
+		pr_err("pstore: %s ftrace function failed: %d\n",
+		       on ? "registering" : "unregistering", ret);
+		goto out;
+	}
+	pstore_ftrace_enabled = on;
+out:
+	mutex_unlock(&pstore_ftrace_lock);
+	return ret;
+}
+
+static ssize_t pstore_ftrace_knob_write(struct file *f, const char __user *buf,
+					size_t count, loff_t *ppos)
+{
+	char val[8];
+	unsigned long on;
+	int ret;
+
+	if (count >= sizeof(val))
+		return -EINVAL;
+	if (copy_from_user(val, buf, count))
+		return -EFAULT;
+	val[count] = '\0';
+
+	ret = strict_strtoul(strstrip(val), 2, &on);
+	if (ret)
+		return ret;
+
+	ret = pstore_ftrace_set(on);
+	if (ret)
+		return ret;
+
+	return count;
+}
+
+static ssize_t pstore_ftrace_knob_read(struct file *f, char __user *buf,
+				       size_t count, loff_t *ppos)
+{
+	char val[] = { '0' + pstore_ftrace_enabled, '\n' };
+
+	return simple_read_from_buffer(buf, count, ppos, val, sizeof(val));
+}
+
+static const struct file_operations pstore_knob_fops = {
+	.read	= pstore_ftrace_knob_read,
+	.write	= pstore_ftrace_knob_write,
+	.llseek	= default_llseek,
+};
+
+/*
+ * Called once a backend with a write_buf() op registers. Recording is
+ * switched on and off through pstore/record_ftrace in debugfs.
+ */
+void pstore_register_ftrace(void)
+{
+	struct dentry *dir;
+	struct dentry *file;
+
+	dir = debugfs_create_dir("pstore", NULL);
+	if (!dir) {
+		pr_err("pstore: %s: can't create dir\n", __func__);
+		goto out;
+	}
+
+	file = debugfs_create_file("record_ftrace", 0600, dir, NULL,
+				   &pstore_knob_fops);
+	if (!file) {
+		pr_err("pstore: %s: can't create record_ftrace\n", __func__);
+		debugfs_remove(dir);
+	}
+out:
+	if (record_ftrace)
+		pstore_ftrace_set(true);
+}
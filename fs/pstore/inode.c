@@ -31,6 +31,7 @@
 #include <linux/sched.h>
 #include <linux/magic.h>
 #include <linux/pstore.h>
+#include <linux/seq_file.h>
 #include <linux/slab.h>
 #include <linux/uaccess.h>
 
@@ -39,8 +40,9 @@
 #define	PSTORE_NAMELEN	64
 
 struct pstore_private {
+	struct pstore_info *psi;
+	enum pstore_type_id type;
 	u64	id;
-	int	(*erase)(u64);
 	ssize_t	size;
 	char	data[];
 };
@@ -65,6 +67,66 @@ static const struct file_operations pstore_file_operations = {
 	.llseek	= default_llseek,
 };
 
+/*
+ * ftrace records are kept in binary and only turned into text, with the
+ * symbols of the running kernel, when read.
+ */
+static void *pstore_ftrace_seq_start(struct seq_file *s, loff_t *pos)
+{
+	struct pstore_private *ps = s->private;
+
+	if (*pos >= ps->size / sizeof(struct pstore_ftrace_record))
+		return NULL;
+
+	return ps->data + *pos * sizeof(struct pstore_ftrace_record);
+}
+
+static void pstore_ftrace_seq_stop(struct seq_file *s, void *v)
+{
+}
+
+static void *pstore_ftrace_seq_next(struct seq_file *s, void *v, loff_t *pos)
+{
+	++*pos;
+	return pstore_ftrace_seq_start(s, pos);
+}
+
+static int pstore_ftrace_seq_show(struct seq_file *s, void *v)
+{
+	struct pstore_ftrace_record *rec = v;
+
+	seq_printf(s, "%u %08lx  %08lx  %pf <- %pF\n", rec->cpu, rec->ip,
+		   rec->parent_ip, (void *)rec->ip, (void *)rec->parent_ip);
+
+	return 0;
+}
+
+static const struct seq_operations pstore_ftrace_seq_ops = {
+	.start	= pstore_ftrace_seq_start,
+	.next	= pstore_ftrace_seq_next,
+	.stop	= pstore_ftrace_seq_stop,
+	.show	= pstore_ftrace_seq_show,
+};
+
+static int pstore_ftrace_file_open(struct inode *inode, struct file *file)
+{
+	int err;
+
+	err = seq_open(file, &pstore_ftrace_seq_ops);
+	if (err)
+		return err;
+	((struct seq_file *)file->private_data)->private = inode->i_private;
+
+	return 0;
+}
+
+static const struct file_operations pstore_ftrace_file_operations = {
+	.open		= pstore_ftrace_file_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= seq_release,
+};
+
 /*
  * When a file is unlinked from our file system we call the
  * platform driver to erase the record from persistent store.
@@ -73,7 +135,7 @@ static int pstore_unlink(struct inode *dir, struct dentry *dentry)
 {
 	struct pstore_private *p = dentry->d_inode->i_private;
 
-	p->erase(p->id);
+	p->psi->erase(p->type, p->id, p->psi);
 
 	return simple_unlink(dir, dentry);
 }
@@ -176,7 +238,7 @@ int pstore_is_mounted(void)
  */
 int pstore_mkfile(enum pstore_type_id type, char *psname, u64 id,
 			      char *data, size_t size,
-			      struct timespec time, int (*erase)(u64))
+			      struct timespec time, struct pstore_info *psi)
 {
 	struct dentry		*root = pstore_sb->s_root;
 	struct dentry		*dentry;
@@ -192,8 +254,9 @@ int pstore_mkfile(enum pstore_type_id type, char *psname, u64 id,
 	private = kmalloc(sizeof *private + size, GFP_KERNEL);
 	if (!private)
 		goto fail_alloc;
+	private->psi = psi;
+	private->type = type;
 	private->id = id;
-	private->erase = erase;
 
 	switch (type) {
 	case PSTORE_TYPE_DMESG:
@@ -202,6 +265,15 @@ int pstore_mkfile(enum pstore_type_id type, char *psname, u64 id,
 	case PSTORE_TYPE_MCE:
 		sprintf(name, "mce-%s-%lld", psname, id);
 		break;
+	case PSTORE_TYPE_CONSOLE:
+		sprintf(name, "console-%s", psname);
+		break;
+	case PSTORE_TYPE_FTRACE:
+		sprintf(name, "ftrace-%s", psname);
+		break;
+	case PSTORE_TYPE_LOGGER:
+		sprintf(name, "logger-%s", psname);
+		break;
 	case PSTORE_TYPE_UNKNOWN:
 		sprintf(name, "unknown-%s-%lld", psname, id);
 		break;
@@ -219,6 +291,8 @@ int pstore_mkfile(enum pstore_type_id type, char *psname, u64 id,
 
 	memcpy(private->data, data, size);
 	inode->i_size = private->size = size;
+	if (type == PSTORE_TYPE_FTRACE)
+		inode->i_fop = &pstore_ftrace_file_operations;
 
 	inode->i_private = private;
 
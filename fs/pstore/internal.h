@@ -1,6 +1,23 @@
+#include <linux/pstore.h>
+#include <linux/time.h>
+#include <linux/types.h>
+
+/* What the ftrace sink writes with PSTORE_TYPE_FTRACE, per traced call */
+struct pstore_ftrace_record {
+	unsigned long ip;
+	unsigned long parent_ip;
+	unsigned int cpu;
+};
+
+#ifdef CONFIG_PSTORE_FTRACE
+extern void pstore_register_ftrace(void);
+#else
+static inline void pstore_register_ftrace(void) {}
+#endif
+
 extern void	pstore_set_kmsg_bytes(int);
 extern void	pstore_get_records(void);
 extern int	pstore_mkfile(enum pstore_type_id, char *psname, u64 id,
 			      char *data, size_t size,
-			      struct timespec time, int (*erase)(u64));
+			      struct timespec time, struct pstore_info *psi);
 extern int	pstore_is_mounted(void);
@@ -98,7 +98,7 @@ static void pstore_dump(struct kmsg_dumper *dumper,
 		if (reason == KMSG_DUMP_OOPS && pstore_is_mounted())
 			pstore_mkfile(PSTORE_TYPE_DMESG, psinfo->name, id,
 				      psinfo->buf, hsize + l1_cpy + l2_cpy,
-				      CURRENT_TIME, psinfo->erase);
+				      CURRENT_TIME, psinfo);
 		l1 -= l1_cpy;
 		l2 -= l2_cpy;
 		total += l1_cpy + l2_cpy;
@@ -141,6 +141,9 @@ int pstore_register(struct pstore_info *psi)
 
 	kmsg_dump_register(&pstore_dumper);
 
+	if (psi->write_buf)
+		pstore_register_ftrace();
+
 	return 0;
 }
 EXPORT_SYMBOL_GPL(pstore_register);
@@ -152,7 +155,8 @@ EXPORT_SYMBOL_GPL(pstore_register);
 void pstore_get_records(void)
 {
 	struct pstore_info *psi = psinfo;
-	size_t			size;
+	char			*buf = NULL;
+	ssize_t			size;
 	u64			id;
 	enum pstore_type_id	type;
 	struct timespec		time;
@@ -162,10 +166,12 @@ void pstore_get_records(void)
 		return;
 
 	mutex_lock(&psinfo->buf_mutex);
-	while ((size = psi->read(&id, &type, &time)) > 0) {
-		if (pstore_mkfile(type, psi->name, id, psi->buf, size,
-				  time, psi->erase))
+	while ((size = psi->read(&id, &type, &time, &buf, psi)) > 0) {
+		if (pstore_mkfile(type, psi->name, id, buf, (size_t)size,
+				  time, psi))
 			failed++;
+		kfree(buf);
+		buf = NULL;
 	}
 	mutex_unlock(&psinfo->buf_mutex);
 
@@ -193,9 +199,25 @@ int pstore_write(enum pstore_type_id type, char *buf, size_t size)
 	id = psinfo->write(type, size);
 	if (pstore_is_mounted())
 		pstore_mkfile(PSTORE_TYPE_DMESG, psinfo->name, id, psinfo->buf,
-			      size, CURRENT_TIME, psinfo->erase);
+			      size, CURRENT_TIME, psinfo);
 	mutex_unlock(&psinfo->buf_mutex);
 
 	return 0;
 }
 EXPORT_SYMBOL_GPL(pstore_write);
+
+/*
+ * Append to one of the continuous records, such as the ftrace log, of
+ * a backend that keeps them. Safe in any context.
+ */
+int notrace pstore_write_buf(enum pstore_type_id type, const char *buf,
+			     size_t size)
+{
+	struct pstore_info *psi = psinfo;
+
+	if (!psi || !psi->write_buf)
+		return -ENODEV;
+
+	return psi->write_buf(type, buf, size, psi);
+}
+EXPORT_SYMBOL_GPL(pstore_write_buf);
@@ -0,0 +1,608 @@
+/*
+ * RAM backend for pstore
+ *
+ * Keeps kmsg dumps, and the console, ftrace and logger streams, in zones
+ * of a RAM region that survives a warm reset. Each zone is a
+ * persistent_ram ring, optionally protected by Reed-Solomon ECC.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+#include <linux/console.h>
+#include <linux/err.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/platform_device.h>
+#include <linux/pstore.h>
+#include <linux/pstore_ram.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/time.h>
+
+#include "internal.h"
+
+#define PSTORE_RAM_KERNMSG_HDR "===="
+/* "====" and "%lu.%lu\n" of a struct timeval */
+#define PSTORE_RAM_KERNMSG_HDR_MAX 48
+
+#define MIN_MEM_SIZE 4096UL
+
+static ulong record_size = MIN_MEM_SIZE;
+module_param(record_size, ulong, 0400);
+MODULE_PARM_DESC(record_size,
+		"size of each kmsg dump record (default 4096)");
+
+static ulong console_size;
+module_param(console_size, ulong, 0400);
+MODULE_PARM_DESC(console_size, "size of the console log zone");
+
+static ulong ftrace_size;
+module_param(ftrace_size, ulong, 0400);
+MODULE_PARM_DESC(ftrace_size, "size of the ftrace log zone");
+
+static ulong logger_size;
+module_param(logger_size, ulong, 0400);
+MODULE_PARM_DESC(logger_size, "size of the Android logger zone");
+
+static ulong mem_address;
+module_param(mem_address, ulong, 0400);
+MODULE_PARM_DESC(mem_address,
+		"start of reserved RAM used to store the zones");
+
+static ulong mem_size;
+module_param(mem_size, ulong, 0400);
+MODULE_PARM_DESC(mem_size,
+		"size of reserved RAM used to store the zones");
+
+static int ecc;
+module_param(ecc, int, 0400);
+MODULE_PARM_DESC(ecc, "set to 1 to protect the zones with ECC");
+
+struct pstore_ram_context {
+	struct persistent_ram_zone **dprzs;
+	struct persistent_ram_zone *cprz;
+	struct persistent_ram_zone **fprzs;	/* one per cpu */
+	struct persistent_ram_zone *lprz;
+	phys_addr_t phys_addr;
+	unsigned long size;
+	size_t record_size;
+	bool ecc;
+	unsigned int max_dump_cnt;
+	unsigned int max_ftrace_cnt;
+	unsigned int dump_write_cnt;
+	/* read cursors, reset after each pass over the records */
+	unsigned int dump_read_cnt;
+	unsigned int console_read_cnt;
+	unsigned int ftrace_read_cnt;
+	unsigned int logger_read_cnt;
+	struct pstore_info pstore;
+};
+
+static struct pstore_ram_context oops_cxt;
+static struct platform_device *dummy;
+
+static struct persistent_ram_zone *
+pstore_ram_get_next_prz(struct persistent_ram_zone *przs[], unsigned int *c,
+			unsigned int max, u64 *id, enum pstore_type_id *typep,
+			enum pstore_type_id type)
+{
+	struct persistent_ram_zone *prz;
+
+	while (*c < max) {
+		prz = przs[(*c)++];
+		if (prz && persistent_ram_old_size(prz)) {
+			*typep = type;
+			*id = *c - 1;
+			return prz;
+		}
+	}
+
+	return NULL;
+}
+
+/* Parses and skips the header pstore_ram_write() put before a dump */
+static size_t pstore_ram_read_kmsg_hdr(char *buffer, size_t size,
+				       struct timespec *time)
+{
+	char hdr[PSTORE_RAM_KERNMSG_HDR_MAX];
+	unsigned long sec, usec;
+	char *end;
+	size_t len = min(size, sizeof(hdr) - 1);
+
+	memcpy(hdr, buffer, len);
+	hdr[len] = '\0';
+	end = strchr(hdr, '\n');
+	if (!end || sscanf(hdr, PSTORE_RAM_KERNMSG_HDR "%lu.%lu\n",
+			   &sec, &usec) != 2)
+		return 0;
+	time->tv_sec = sec;
+	time->tv_nsec = usec * NSEC_PER_USEC;
+
+	return end - hdr + 1;
+}
+
+/*
+ * Returns the ftrace records of all cpus as one. A ring that wrapped
+ * starts with the tail of a record the writer has half overwritten. The
+ * newest record ends where the ring does, so that tail is the first
+ * old_size % record size bytes, which are dropped.
+ */
+static ssize_t pstore_ram_read_ftrace(struct pstore_ram_context *cxt,
+				      char **buf)
+{
+	struct persistent_ram_zone *prz;
+	size_t size = 0, old_size, skip;
+	char *p;
+	int i;
+
+	for (i = 0; i < cxt->max_ftrace_cnt; i++)
+		size += persistent_ram_old_size(cxt->fprzs[i]);
+	if (!size)
+		return 0;
+
+	p = *buf = kmalloc(size, GFP_KERNEL);
+	if (!p)
+		return -ENOMEM;
+
+	for (i = 0; i < cxt->max_ftrace_cnt; i++) {
+		prz = cxt->fprzs[i];
+		old_size = persistent_ram_old_size(prz);
+		skip = old_size % sizeof(struct pstore_ftrace_record);
+		memcpy(p, persistent_ram_old(prz) + skip, old_size - skip);
+		p += old_size - skip;
+	}
+
+	return p - *buf;
+}
+
+static ssize_t pstore_ram_read(u64 *id, enum pstore_type_id *type,
+			       struct timespec *time, char **buf,
+			       struct pstore_info *psi)
+{
+	struct pstore_ram_context *cxt = psi->data;
+	struct persistent_ram_zone *prz;
+	char *old;
+	ssize_t size;
+	size_t skip = 0;
+	ssize_t ecc_notice_size = 0;
+
+	prz = pstore_ram_get_next_prz(cxt->dprzs, &cxt->dump_read_cnt,
+				      cxt->max_dump_cnt, id, type,
+				      PSTORE_TYPE_DMESG);
+	if (!prz)
+		prz = pstore_ram_get_next_prz(&cxt->cprz,
+				&cxt->console_read_cnt, 1, id, type,
+				PSTORE_TYPE_CONSOLE);
+	if (!prz && !cxt->ftrace_read_cnt++) {
+		size = pstore_ram_read_ftrace(cxt, buf);
+		if (size) {
+			*type = PSTORE_TYPE_FTRACE;
+			*id = 0;
+			time->tv_sec = 0;
+			time->tv_nsec = 0;
+			return size;
+		}
+	}
+	if (!prz)
+		prz = pstore_ram_get_next_prz(&cxt->lprz,
+				&cxt->logger_read_cnt, 1, id, type,
+				PSTORE_TYPE_LOGGER);
+	if (!prz) {
+		cxt->dump_read_cnt = 0;
+		cxt->console_read_cnt = 0;
+		cxt->ftrace_read_cnt = 0;
+		cxt->logger_read_cnt = 0;
+		return 0;
+	}
+
+	old = persistent_ram_old(prz);
+	size = persistent_ram_old_size(prz);
+	time->tv_sec = 0;
+	time->tv_nsec = 0;
+	if (*type == PSTORE_TYPE_DMESG)
+		skip = pstore_ram_read_kmsg_hdr(old, size, time);
+
+	*buf = kmalloc(size - skip + 80, GFP_KERNEL);
+	if (*buf == NULL)
+		return -ENOMEM;
+
+	memcpy(*buf, old + skip, size - skip);
+	/* ftrace and logger records are binary, keep them that way */
+	if (*type == PSTORE_TYPE_DMESG || *type == PSTORE_TYPE_CONSOLE)
+		ecc_notice_size = persistent_ram_ecc_string(prz,
+						*buf + size - skip, 80);
+
+	return size - skip + ecc_notice_size;
+}
+
+static size_t pstore_ram_write_kmsg_hdr(struct persistent_ram_zone *prz)
+{
+	char hdr[PSTORE_RAM_KERNMSG_HDR_MAX];
+	struct timeval timestamp;
+	size_t len;
+
+	do_gettimeofday(&timestamp);
+	len = snprintf(hdr, sizeof(hdr), PSTORE_RAM_KERNMSG_HDR "%lu.%lu\n",
+		       (long)timestamp.tv_sec, (long)timestamp.tv_usec);
+	persistent_ram_write(prz, hdr, len);
+
+	return len;
+}
+
+/* Saves pstore.buf, filled in by pstore_dump(), as the next dump record */
+static u64 pstore_ram_write(enum pstore_type_id type, size_t size)
+{
+	struct pstore_ram_context *cxt = &oops_cxt;
+	struct persistent_ram_zone *prz;
+	u64 id;
+
+	if (type != PSTORE_TYPE_DMESG)
+		return -EINVAL;
+
+	prz = cxt->dprzs[cxt->dump_write_cnt];
+	persistent_ram_zap(prz);
+	pstore_ram_write_kmsg_hdr(prz);
+	persistent_ram_write(prz, cxt->pstore.buf, size);
+
+	id = cxt->dump_write_cnt;
+	cxt->dump_write_cnt = (cxt->dump_write_cnt + 1) % cxt->max_dump_cnt;
+
+	return id;
+}
+
+static int notrace pstore_ram_write_buf(enum pstore_type_id type,
+					const char *buf, size_t size,
+					struct pstore_info *psi)
+{
+	struct pstore_ram_context *cxt = psi->data;
+	struct persistent_ram_zone *prz;
+
+	switch (type) {
+	case PSTORE_TYPE_CONSOLE:
+		prz = cxt->cprz;
+		break;
+	case PSTORE_TYPE_FTRACE:
+		if (!cxt->fprzs)
+			return -ENOSPC;
+		prz = cxt->fprzs[raw_smp_processor_id()];
+		break;
+	case PSTORE_TYPE_LOGGER:
+		prz = cxt->lprz;
+		break;
+	default:
+		return -EINVAL;
+	}
+	if (!prz)
+		return -ENOSPC;
+
+	persistent_ram_write(prz, buf, size);
+
+	return 0;
+}
+
+static int pstore_ram_erase(enum pstore_type_id type, u64 id,
+			    struct pstore_info *psi)
+{
+	struct pstore_ram_context *cxt = psi->data;
+	struct persistent_ram_zone *prz;
+	int i;
+
+	switch (type) {
+	case PSTORE_TYPE_DMESG:
+		if (id >= cxt->max_dump_cnt)
+			return -EINVAL;
+		prz = cxt->dprzs[id];
+		/* the ring still holds the dump, which would come back */
+		persistent_ram_zap(prz);
+		break;
+	case PSTORE_TYPE_CONSOLE:
+		prz = cxt->cprz;
+		break;
+	case PSTORE_TYPE_FTRACE:
+		for (i = 0; i < cxt->max_ftrace_cnt; i++)
+			persistent_ram_free_old(cxt->fprzs[i]);
+		return 0;
+	case PSTORE_TYPE_LOGGER:
+		prz = cxt->lprz;
+		break;
+	default:
+		return -EINVAL;
+	}
+	if (!prz)
+		return -EINVAL;
+
+	persistent_ram_free_old(prz);
+
+	return 0;
+}
+
+static void pstore_ram_console_write(struct console *console, const char *s,
+				     unsigned int count)
+{
+	persistent_ram_write(oops_cxt.cprz, s, count);
+}
+
+static struct console pstore_ram_console = {
+	.name	= "pstore",
+	.write	= pstore_ram_console_write,
+	.flags	= CON_PRINTBUFFER | CON_ENABLED | CON_ANYTIME,
+	.index	= -1,
+};
+
+static struct persistent_ram_zone * __init
+pstore_ram_init_prz(struct pstore_ram_context *cxt, phys_addr_t *paddr,
+		    size_t sz, bool ecc)
+{
+	struct persistent_ram_ecc_info ecc_info = { 0 };
+	struct persistent_ram_zone *prz;
+
+	if (!sz)
+		return NULL;
+
+	prz = persistent_ram_new(*paddr, sz, ecc ? &ecc_info : NULL);
+	if (IS_ERR(prz))
+		return prz;
+
+	*paddr += sz;
+
+	return prz;
+}
+
+static void pstore_ram_free_przs(struct pstore_ram_context *cxt)
+{
+	int i;
+
+	if (cxt->lprz)
+		persistent_ram_free(cxt->lprz);
+	if (cxt->fprzs) {
+		for (i = 0; i < cxt->max_ftrace_cnt && cxt->fprzs[i]; i++)
+			persistent_ram_free(cxt->fprzs[i]);
+		kfree(cxt->fprzs);
+	}
+	if (cxt->cprz)
+		persistent_ram_free(cxt->cprz);
+
+	if (!cxt->dprzs)
+		return;
+
+	for (i = 0; i < cxt->max_dump_cnt && cxt->dprzs[i]; i++)
+		persistent_ram_free(cxt->dprzs[i]);
+	kfree(cxt->dprzs);
+}
+
+static int __init pstore_ram_init_przs(struct pstore_ram_context *cxt,
+				       phys_addr_t *paddr, size_t dump_mem_sz)
+{
+	int err = -ENOMEM;
+	int i;
+
+	if (cxt->record_size <= PSTORE_RAM_KERNMSG_HDR_MAX) {
+		pr_err("pstore_ram: record size %zu too small\n",
+		       cxt->record_size);
+		return -EINVAL;
+	}
+
+	cxt->max_dump_cnt = dump_mem_sz / cxt->record_size;
+	if (!cxt->max_dump_cnt) {
+		pr_err("pstore_ram: no room for a %zu byte dump record\n",
+		       cxt->record_size);
+		return -EINVAL;
+	}
+
+	cxt->dprzs = kzalloc(sizeof(*cxt->dprzs) * cxt->max_dump_cnt,
+			     GFP_KERNEL);
+	if (!cxt->dprzs)
+		return -ENOMEM;
+
+	for (i = 0; i < cxt->max_dump_cnt; i++) {
+		struct persistent_ram_zone *prz;
+
+		prz = pstore_ram_init_prz(cxt, paddr, cxt->record_size,
+					  cxt->ecc);
+		if (IS_ERR(prz)) {
+			err = PTR_ERR(prz);
+			goto fail;
+		}
+		cxt->dprzs[i] = prz;
+	}
+
+	return 0;
+
+fail:
+	pstore_ram_free_przs(cxt);
+	cxt->dprzs = NULL;
+	return err;
+}
+
+/*
+ * The function tracer writes a record for every call, so each cpu gets a
+ * zone of its own, and none of them ECC: a corrupted record is only one
+ * wrong address, not worth encoding every record for.
+ */
+static int __init pstore_ram_init_ftrace_przs(struct pstore_ram_context *cxt,
+					      phys_addr_t *paddr, size_t sz)
+{
+	size_t cpu_sz = sz / nr_cpu_ids;
+	struct persistent_ram_zone *prz;
+	int i;
+
+	if (!cpu_sz)
+		return 0;
+
+	cxt->fprzs = kzalloc(sizeof(*cxt->fprzs) * nr_cpu_ids, GFP_KERNEL);
+	if (!cxt->fprzs)
+		return -ENOMEM;
+	cxt->max_ftrace_cnt = nr_cpu_ids;
+
+	for (i = 0; i < nr_cpu_ids; i++) {
+		prz = pstore_ram_init_prz(cxt, paddr, cpu_sz, false);
+		if (IS_ERR(prz))
+			return PTR_ERR(prz);
+		cxt->fprzs[i] = prz;
+	}
+	*paddr += sz - cpu_sz * nr_cpu_ids;
+
+	return 0;
+}
+
+static int __init pstore_ram_probe(struct platform_device *pdev)
+{
+	struct pstore_ram_platform_data *pdata = pdev->dev.platform_data;
+	struct pstore_ram_context *cxt = &oops_cxt;
+	struct persistent_ram_zone *prz;
+	size_t dump_mem_sz;
+	phys_addr_t paddr;
+	int err = -EINVAL;
+
+	/* Only a single region is supported. */
+	if (cxt->max_dump_cnt)
+		return -EEXIST;
+
+	if (!pdata || !pdata->mem_size) {
+		pr_err("pstore_ram: invalid size specification\n");
+		return -EINVAL;
+	}
+
+	cxt->size = pdata->mem_size;
+	cxt->phys_addr = pdata->mem_address;
+	cxt->record_size = pdata->record_size;
+	cxt->ecc = pdata->ecc;
+
+	dump_mem_sz = cxt->size - pdata->console_size - pdata->ftrace_size -
+		      pdata->logger_size;
+	if (dump_mem_sz > cxt->size) {
+		pr_err("pstore_ram: zones don't fit in %lu bytes\n",
+		       cxt->size);
+		return -EINVAL;
+	}
+
+	paddr = cxt->phys_addr;
+	err = pstore_ram_init_przs(cxt, &paddr, dump_mem_sz);
+	if (err)
+		return err;
+	paddr = cxt->phys_addr + dump_mem_sz;
+
+	prz = pstore_ram_init_prz(cxt, &paddr, pdata->console_size, cxt->ecc);
+	if (IS_ERR(prz)) {
+		err = PTR_ERR(prz);
+		goto fail_buf;
+	}
+	cxt->cprz = prz;
+
+	err = pstore_ram_init_ftrace_przs(cxt, &paddr, pdata->ftrace_size);
+	if (err)
+		goto fail_buf;
+
+	prz = pstore_ram_init_prz(cxt, &paddr, pdata->logger_size, cxt->ecc);
+	if (IS_ERR(prz)) {
+		err = PTR_ERR(prz);
+		goto fail_buf;
+	}
+	cxt->lprz = prz;
+
+	cxt->pstore.owner = THIS_MODULE;
+	cxt->pstore.name = "ram";
+	cxt->pstore.read = pstore_ram_read;
+	cxt->pstore.write = pstore_ram_write;
+	cxt->pstore.write_buf = pstore_ram_write_buf;
+	cxt->pstore.erase = pstore_ram_erase;
+	cxt->pstore.data = cxt;
+	/* a dump record has to fit a whole buffer and our header */
+	cxt->pstore.bufsize = cxt->dprzs[0]->buffer_size -
+			      PSTORE_RAM_KERNMSG_HDR_MAX;
+	cxt->pstore.buf = kmalloc(cxt->pstore.bufsize, GFP_KERNEL);
+	if (!cxt->pstore.buf) {
+		pr_err("pstore_ram: cannot allocate pstore buffer\n");
+		err = -ENOMEM;
+		goto fail_buf;
+	}
+	mutex_init(&cxt->pstore.buf_mutex);
+
+	err = pstore_register(&cxt->pstore);
+	if (err) {
+		pr_err("pstore_ram: registering with pstore failed\n");
+		goto fail_register;
+	}
+
+	if (cxt->cprz)
+		register_console(&pstore_ram_console);
+
+	pr_info("pstore_ram: attached 0x%lx@0x%llx, %u dump records, "
+		"console %lu, ftrace %lu, logger %lu bytes%s\n",
+		cxt->size, (unsigned long long)cxt->phys_addr,
+		cxt->max_dump_cnt, pdata->console_size, pdata->ftrace_size,
+		pdata->logger_size, cxt->ecc ? ", ECC" : "");
+
+	return 0;
+
+fail_register:
+	kfree(cxt->pstore.buf);
+fail_buf:
+	pstore_ram_free_przs(cxt);
+	memset(cxt, 0, sizeof(*cxt));
+	return err;
+}
+
+static struct platform_driver pstore_ram_driver = {
+	.driver		= {
+		.name	= "pstore_ram",
+		.owner	= THIS_MODULE,
+	},
+};
+
+/*
+ * Without a board file to describe the region, e.g. on an emulator, the
+ * module parameters do.
+ */
+static void pstore_ram_register_dummy(void)
+{
+	struct pstore_ram_platform_data *dummy_data;
+
+	if (!mem_size)
+		return;
+
+	pr_info("pstore_ram: using module parameters\n");
+
+	dummy_data = kzalloc(sizeof(*dummy_data), GFP_KERNEL);
+	if (!dummy_data) {
+		pr_info("pstore_ram: could not create platform data\n");
+		return;
+	}
+	dummy_data->mem_size = mem_size;
+	dummy_data->mem_address = mem_address;
+	dummy_data->record_size = record_size;
+	dummy_data->console_size = console_size;
+	dummy_data->ftrace_size = ftrace_size;
+	dummy_data->logger_size = logger_size;
+	dummy_data->ecc = ecc;
+
+	dummy = platform_device_register_data(NULL, "pstore_ram", -1,
+			dummy_data, sizeof(*dummy_data));
+	if (IS_ERR(dummy)) {
+		pr_info("pstore_ram: could not create platform device: %ld\n",
+			PTR_ERR(dummy));
+		dummy = NULL;
+	}
+	kfree(dummy_data);
+}
+
+/*
+ * There is no module_exit(), pstore can't let go of a backend once it
+ * has registered.
+ */
+static int __init pstore_ram_init(void)
+{
+	pstore_ram_register_dummy();
+	return platform_driver_probe(&pstore_ram_driver, pstore_ram_probe);
+}
+module_init(pstore_ram_init);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("RAM backend for pstore");
@@ -0,0 +1,465 @@
+/*
+ * Persistent RAM zones, the ring buffer behind ram_console and pstore_ram
+ *
+ * Copyright (C) 2007-2008 Google, Inc.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <linux/err.h>
+#include <linux/init.h>
+#include <linux/io.h>
+#include <linux/kernel.h>
+#include <linux/log2.h>
+#include <linux/mm.h>
+#include <linux/module.h>
+#include <linux/pstore_ram.h>
+#include <linux/rslib.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/vmalloc.h>
+
+struct persistent_ram_buffer {
+	uint32_t    sig;
+	uint32_t    start;
+	uint32_t    size;
+	uint8_t     data[0];
+};
+
+#define PERSISTENT_RAM_SIG (0x43474244) /* DBGC */
+
+/*
+ * ECC is kept up to date a block at a time: a block's parity is computed
+ * once the writer moves past its end, not on every write into it. Only
+ * the block holding buffer->start can have stale parity, so it is the
+ * one block never checked on recovery. The header changes on every write
+ * and is small, so its parity is always current.
+ */
+
+static void persistent_ram_encode_rs8(struct persistent_ram_zone *prz,
+	uint8_t *data, size_t len, uint8_t *ecc)
+{
+	int i;
+
+	/* Initialize the parity buffer */
+	memset(prz->par_tmp, 0, prz->ecc.ecc_size * sizeof(prz->par_tmp[0]));
+	encode_rs8(prz->rs_decoder, data, len, prz->par_tmp, 0);
+	for (i = 0; i < prz->ecc.ecc_size; i++)
+		ecc[i] = prz->par_tmp[i];
+}
+
+static int persistent_ram_decode_rs8(struct persistent_ram_zone *prz,
+	void *data, size_t len, uint8_t *ecc)
+{
+	int i;
+
+	for (i = 0; i < prz->ecc.ecc_size; i++)
+		prz->par_tmp[i] = ecc[i];
+	return decode_rs8(prz->rs_decoder, data, prz->par_tmp, len,
+				NULL, 0, NULL, 0, NULL);
+}
+
+/* Encodes the blocks that [start, start + count) completes. */
+static void notrace persistent_ram_update_ecc(struct persistent_ram_zone *prz,
+	unsigned int start, unsigned int count)
+{
+	struct persistent_ram_buffer *buffer = prz->buffer;
+	size_t block_size = prz->ecc.ecc_block_size;
+	size_t end = start + count;
+	size_t off, block_end;
+
+	for (off = start & ~(block_size - 1); off < end; off += block_size) {
+		block_end = min(off + block_size, prz->buffer_size);
+		if (block_end > end)
+			break;
+		persistent_ram_encode_rs8(prz, buffer->data + off,
+			block_end - off,
+			prz->par_buffer + (off / block_size) * prz->ecc.ecc_size);
+	}
+}
+
+static void notrace persistent_ram_update_header_ecc(struct persistent_ram_zone *prz)
+{
+	if (!prz->rs_decoder)
+		return;
+
+	persistent_ram_encode_rs8(prz, (uint8_t *)prz->buffer,
+				  sizeof(*prz->buffer), prz->par_header);
+}
+
+static void persistent_ram_ecc_old(struct persistent_ram_zone *prz)
+{
+	struct persistent_ram_buffer *buffer = prz->buffer;
+	size_t block_size = prz->ecc.ecc_block_size;
+	size_t stale = buffer->start & ~(block_size - 1);
+	uint8_t *par = prz->par_buffer;
+	size_t off;
+
+	/* an aligned start is the end of a block that was just encoded */
+	if (!(buffer->start & (block_size - 1)))
+		stale = -1;
+
+	for (off = 0; off < buffer->size; off += block_size) {
+		size_t size = min(block_size, prz->buffer_size - off);
+		int numerr;
+
+		if (off != stale) {
+			numerr = persistent_ram_decode_rs8(prz,
+					buffer->data + off, size, par);
+			if (numerr > 0)
+				prz->corrected_bytes += numerr;
+			else if (numerr < 0)
+				prz->bad_blocks++;
+		}
+		par += prz->ecc.ecc_size;
+	}
+}
+
+static void notrace persistent_ram_update(struct persistent_ram_zone *prz,
+	const void *s, unsigned int start, unsigned int count)
+{
+	memcpy(prz->buffer->data + start, s, count);
+	if (prz->rs_decoder)
+		persistent_ram_update_ecc(prz, start, count);
+}
+
+/*
+ * persistent_ram_write - appends count bytes to the ring, overwriting the
+ * oldest ones once it is full. Safe in any context.
+ */
+int notrace persistent_ram_write(struct persistent_ram_zone *prz,
+	const void *s, unsigned int count)
+{
+	struct persistent_ram_buffer *buffer = prz->buffer;
+	unsigned long flags;
+	unsigned int start, rem;
+	int c = count;
+
+	if (unlikely(c > prz->buffer_size)) {
+		s += c - prz->buffer_size;
+		c = prz->buffer_size;
+	}
+
+	raw_spin_lock_irqsave(&prz->lock, flags);
+	start = buffer->start;
+	rem = prz->buffer_size - start;
+	if (rem < c) {
+		persistent_ram_update(prz, s, start, rem);
+		s += rem;
+		c -= rem;
+		start = 0;
+		buffer->size = prz->buffer_size;
+	}
+	persistent_ram_update(prz, s, start, c);
+
+	buffer->start = start + c;
+	if (buffer->size < prz->buffer_size)
+		buffer->size += c;
+	persistent_ram_update_header_ecc(prz);
+	raw_spin_unlock_irqrestore(&prz->lock, flags);
+
+	return count;
+}
+EXPORT_SYMBOL_GPL(persistent_ram_write);
+
+/* Empties the ring, the old log is left alone. */
+void persistent_ram_zap(struct persistent_ram_zone *prz)
+{
+	unsigned long flags;
+
+	raw_spin_lock_irqsave(&prz->lock, flags);
+	prz->buffer->start = 0;
+	prz->buffer->size = 0;
+	persistent_ram_update_header_ecc(prz);
+	raw_spin_unlock_irqrestore(&prz->lock, flags);
+}
+EXPORT_SYMBOL_GPL(persistent_ram_zap);
+
+static void persistent_ram_save_old(struct persistent_ram_zone *prz)
+{
+	struct persistent_ram_buffer *buffer = prz->buffer;
+	size_t size = buffer->size;
+	size_t start = buffer->start;
+
+	if (prz->rs_decoder)
+		persistent_ram_ecc_old(prz);
+
+	if (!size)
+		return;
+
+	prz->old_log = kmalloc(size, GFP_KERNEL);
+	if (!prz->old_log) {
+		pr_err("persistent_ram: failed to allocate buffer\n");
+		return;
+	}
+
+	prz->old_log_size = size;
+	memcpy(prz->old_log, &buffer->data[start], size - start);
+	memcpy(prz->old_log + size - start, &buffer->data[0], start);
+}
+
+size_t persistent_ram_old_size(struct persistent_ram_zone *prz)
+{
+	return prz->old_log_size;
+}
+EXPORT_SYMBOL_GPL(persistent_ram_old_size);
+
+void *persistent_ram_old(struct persistent_ram_zone *prz)
+{
+	return prz->old_log;
+}
+EXPORT_SYMBOL_GPL(persistent_ram_old);
+
+void persistent_ram_free_old(struct persistent_ram_zone *prz)
+{
+	kfree(prz->old_log);
+	prz->old_log = NULL;
+	prz->old_log_size = 0;
+}
+EXPORT_SYMBOL_GPL(persistent_ram_free_old);
+
+/* What ECC found in the old log, empty without ECC */
+ssize_t persistent_ram_ecc_string(struct persistent_ram_zone *prz,
+	char *str, size_t len)
+{
+	ssize_t ret;
+
+	if (!prz->rs_decoder || !len)
+		return 0;
+
+	if (prz->corrected_bytes || prz->bad_blocks)
+		ret = snprintf(str, len,
+			"\n%d Corrected bytes, %d unrecoverable blocks\n",
+			prz->corrected_bytes, prz->bad_blocks);
+	else
+		ret = snprintf(str, len, "\nNo errors detected\n");
+
+	return min_t(ssize_t, ret, len - 1);
+}
+EXPORT_SYMBOL_GPL(persistent_ram_ecc_string);
+
+static int persistent_ram_init_ecc(struct persistent_ram_zone *prz,
+	const struct persistent_ram_ecc_info *ecc)
+{
+	struct persistent_ram_ecc_info *info = &prz->ecc;
+	int numerr;
+
+	*info = *ecc;
+	if (!info->ecc_block_size)
+		info->ecc_block_size = 128;
+	if (!info->ecc_size)
+		info->ecc_size = 16;
+	if (!info->ecc_symsize)
+		info->ecc_symsize = 8;
+	if (!info->ecc_poly)
+		info->ecc_poly = 0x11d;
+
+	if (!is_power_of_2(info->ecc_block_size)) {
+		pr_err("persistent_ram: ECC block size %d not a power of 2\n",
+		       info->ecc_block_size);
+		return -EINVAL;
+	}
+
+	prz->buffer_size -= (DIV_ROUND_UP(prz->buffer_size,
+					  info->ecc_block_size) + 1) *
+			    info->ecc_size;
+	if (prz->buffer_size > prz->size) {
+		pr_err("persistent_ram: buffer %p, invalid size %zu, "
+		       "non-ecc datasize %zu\n",
+		       prz->vaddr, prz->size, prz->buffer_size);
+		return -EINVAL;
+	}
+
+	prz->par_buffer = prz->buffer->data + prz->buffer_size;
+	prz->par_header = prz->par_buffer +
+		DIV_ROUND_UP(prz->buffer_size, info->ecc_block_size) *
+		info->ecc_size;
+
+	prz->par_tmp = kmalloc(info->ecc_size * sizeof(prz->par_tmp[0]),
+			       GFP_KERNEL);
+	if (!prz->par_tmp)
+		return -ENOMEM;
+
+	/* first consecutive root is 0
+	 * primitive element to generate roots = 1
+	 */
+	prz->rs_decoder = init_rs(info->ecc_symsize, info->ecc_poly, 0, 1,
+				  info->ecc_size);
+	if (!prz->rs_decoder) {
+		pr_info("persistent_ram: init_rs failed\n");
+		return -EINVAL;
+	}
+
+	numerr = persistent_ram_decode_rs8(prz, prz->buffer,
+					   sizeof(*prz->buffer),
+					   prz->par_header);
+	if (numerr > 0) {
+		pr_info("persistent_ram: error in header, %d\n", numerr);
+		prz->corrected_bytes += numerr;
+	} else if (numerr < 0) {
+		pr_info("persistent_ram: uncorrectable error in header\n");
+		prz->bad_blocks++;
+	}
+
+	return 0;
+}
+
+static int persistent_ram_post_init(struct persistent_ram_zone *prz,
+	const struct persistent_ram_ecc_info *ecc)
+{
+	struct persistent_ram_buffer *buffer = prz->buffer;
+	int ret;
+
+	raw_spin_lock_init(&prz->lock);
+	prz->buffer_size = prz->size - sizeof(struct persistent_ram_buffer);
+	if (prz->buffer_size > prz->size) {
+		pr_err("persistent_ram: buffer %p, invalid size %zu, "
+		       "datasize %zu\n", prz->vaddr, prz->size,
+		       prz->buffer_size);
+		return -EINVAL;
+	}
+
+	if (ecc) {
+		ret = persistent_ram_init_ecc(prz, ecc);
+		if (ret)
+			return ret;
+	}
+
+	if (buffer->sig == PERSISTENT_RAM_SIG) {
+		if (buffer->size > prz->buffer_size
+		    || buffer->start > buffer->size)
+			pr_info("persistent_ram: found existing invalid "
+				"buffer, size %u, start %u\n",
+				buffer->size, buffer->start);
+		else {
+			pr_debug("persistent_ram: found existing buffer, "
+				 "size %u, start %u\n",
+				 buffer->size, buffer->start);
+			persistent_ram_save_old(prz);
+		}
+	} else {
+		pr_debug("persistent_ram: no valid data in buffer "
+			 "(sig = 0x%08x)\n", buffer->sig);
+	}
+
+	buffer->sig = PERSISTENT_RAM_SIG;
+	persistent_ram_zap(prz);
+
+	return 0;
+}
+
+/*
+ * Memory carved out of the kernel's own RAM (memblock_reserve()) still
+ * has struct pages and is vmap()ed uncached, anything else, such as a
+ * memmap=nn$ss hole, is ioremap()ed.
+ */
+static void *persistent_ram_vmap(phys_addr_t start, size_t size)
+{
+	struct page **pages;
+	phys_addr_t page_start = start - offset_in_page(start);
+	unsigned int page_count = DIV_ROUND_UP(size + offset_in_page(start),
+					       PAGE_SIZE);
+	pgprot_t prot = pgprot_noncached(PAGE_KERNEL);
+	void *vaddr;
+	unsigned int i;
+
+	pages = kmalloc(sizeof(struct page *) * page_count, GFP_KERNEL);
+	if (!pages)
+		return NULL;
+
+	for (i = 0; i < page_count; i++)
+		pages[i] = pfn_to_page((page_start >> PAGE_SHIFT) + i);
+	vaddr = vmap(pages, page_count, VM_MAP, prot);
+	kfree(pages);
+
+	return vaddr ? vaddr + offset_in_page(start) : NULL;
+}
+
+static bool persistent_ram_is_ram(phys_addr_t start)
+{
+	return pfn_valid(start >> PAGE_SHIFT);
+}
+
+static struct persistent_ram_zone *persistent_ram_alloc(void *vaddr,
+	phys_addr_t start, size_t size,
+	const struct persistent_ram_ecc_info *ecc)
+{
+	struct persistent_ram_zone *prz;
+	int ret;
+
+	prz = kzalloc(sizeof(struct persistent_ram_zone), GFP_KERNEL);
+	if (!prz) {
+		pr_err("persistent_ram: failed to allocate zone\n");
+		return ERR_PTR(-ENOMEM);
+	}
+
+	prz->paddr = start;
+	prz->size = size;
+	prz->vaddr = vaddr;
+	if (!prz->vaddr) {
+		if (persistent_ram_is_ram(start))
+			prz->vaddr = persistent_ram_vmap(start, size);
+		else
+			prz->vaddr = ioremap(start, size);
+	}
+	if (!prz->vaddr) {
+		pr_err("persistent_ram: failed to map 0x%llx bytes at "
+		       "0x%llx\n", (unsigned long long)size,
+		       (unsigned long long)start);
+		kfree(prz);
+		return ERR_PTR(-ENOMEM);
+	}
+	prz->buffer = prz->vaddr;
+
+	ret = persistent_ram_post_init(prz, ecc);
+	if (ret) {
+		persistent_ram_free(prz);
+		return ERR_PTR(ret);
+	}
+
+	return prz;
+}
+
+/*
+ * persistent_ram_new - sets up a zone on 'size' bytes of physical memory
+ * at 'start', keeping whatever a previous boot left there as the old log.
+ * 'ecc' is NULL for no error correction.
+ */
+struct persistent_ram_zone *persistent_ram_new(phys_addr_t start, size_t size,
+	const struct persistent_ram_ecc_info *ecc)
+{
+	return persistent_ram_alloc(NULL, start, size, ecc);
+}
+EXPORT_SYMBOL_GPL(persistent_ram_new);
+
+/* Same as persistent_ram_new() for memory that is already mapped */
+struct persistent_ram_zone *persistent_ram_new_vaddr(void *vaddr, size_t size,
+	const struct persistent_ram_ecc_info *ecc)
+{
+	return persistent_ram_alloc(vaddr, 0, size, ecc);
+}
+EXPORT_SYMBOL_GPL(persistent_ram_new_vaddr);
+
+void persistent_ram_free(struct persistent_ram_zone *prz)
+{
+	if (prz->paddr) {
+		if (persistent_ram_is_ram(prz->paddr))
+			vunmap(prz->vaddr - offset_in_page(prz->paddr));
+		else
+			iounmap(prz->vaddr);
+	}
+	if (prz->rs_decoder)
+		free_rs(prz->rs_decoder);
+	kfree(prz->par_tmp);
+	persistent_ram_free_old(prz);
+	kfree(prz);
+}
+EXPORT_SYMBOL_GPL(persistent_ram_free);
@@ -32,6 +32,13 @@ struct ashmem_pin {
 	__u32 len;	/* length forward from offset, in bytes, page-aligned */
 };
 
+struct ashmem_purge_stats {
+	__u32 purges;		/* times pages of this region were purged */
+	__u32 purged_pages;	/* pages purged over the region's lifetime */
+	__u32 unpinned_pages;	/* pages currently unpinned and not purged */
+	__u32 purge_age_ms;	/* unpinned age of the last purged range */
+};
+
 #define __ASHMEMIOC		0x77
 
 #define ASHMEM_SET_NAME		_IOW(__ASHMEMIOC, 1, char[ASHMEM_NAME_LEN])
@@ -44,5 +51,6 @@ struct ashmem_pin {
 #define ASHMEM_UNPIN		_IOW(__ASHMEMIOC, 8, struct ashmem_pin)
 #define ASHMEM_GET_PIN_STATUS	_IO(__ASHMEMIOC, 9)
 #define ASHMEM_PURGE_ALL_CACHES	_IO(__ASHMEMIOC, 10)
+#define ASHMEM_GET_PURGE_STATS	_IOR(__ASHMEMIOC, 11, struct ashmem_purge_stats)
 
 #endif	/* _LINUX_ASHMEM_H */
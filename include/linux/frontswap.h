@@ -0,0 +1,97 @@
+#ifndef _LINUX_FRONTSWAP_H
+#define _LINUX_FRONTSWAP_H
+
+#include <linux/swap.h>
+#include <linux/mm.h>
+
+/*
+ * Frontswap lets a backend (e.g. zcache) keep swap pages in some form of
+ * memory the kernel cannot address directly, so that a page which fits
+ * never has to go through the block layer at all. A page is identified by
+ * its swap type and offset. put_page returns 0 if the backend took the
+ * page, get_page returns 0 if it filled the page in; on any failure the
+ * page simply goes to (or comes from) the swap device as usual.
+ */
+struct frontswap_ops {
+	void (*init)(unsigned type);
+	int (*put_page)(unsigned type, pgoff_t offset, struct page *page);
+	int (*get_page)(unsigned type, pgoff_t offset, struct page *page);
+	void (*flush_page)(unsigned type, pgoff_t offset);
+	void (*flush_area)(unsigned type);
+};
+
+extern int frontswap_enabled;
+extern struct frontswap_ops frontswap_register_ops(struct frontswap_ops *ops);
+
+extern void __frontswap_init(unsigned type);
+extern int __frontswap_put_page(struct page *page);
+extern int __frontswap_get_page(struct page *page);
+extern void __frontswap_flush_page(unsigned type, pgoff_t offset);
+extern void __frontswap_flush_area(unsigned type);
+
+#ifdef CONFIG_FRONTSWAP
+
+static inline unsigned long *frontswap_map_get(struct swap_info_struct *p)
+{
+	return p->frontswap_map;
+}
+
+static inline void frontswap_map_set(struct swap_info_struct *p,
+				     unsigned long *map)
+{
+	p->frontswap_map = map;
+}
+
+#else
+
+#define frontswap_enabled (0)
+
+static inline unsigned long *frontswap_map_get(struct swap_info_struct *p)
+{
+	return NULL;
+}
+
+static inline void frontswap_map_set(struct swap_info_struct *p,
+				     unsigned long *map)
+{
+}
+
+#endif
+
+static inline void frontswap_init(unsigned type)
+{
+	if (frontswap_enabled)
+		__frontswap_init(type);
+}
+
+static inline int frontswap_put_page(struct page *page)
+{
+	int ret = -1;
+
+	if (frontswap_enabled)
+		ret = __frontswap_put_page(page);
+	return ret;
+}
+
+static inline int frontswap_get_page(struct page *page)
+{
+	int ret = -1;
+
+	if (frontswap_enabled)
+		ret = __frontswap_get_page(page);
+	return ret;
+}
+
+static inline void frontswap_flush_page(unsigned type, pgoff_t offset)
+{
+	if (frontswap_enabled)
+		__frontswap_flush_page(type, offset);
+}
+
+static inline void frontswap_flush_area(unsigned type)
+{
+	if (frontswap_enabled)
+		__frontswap_flush_area(type);
+}
+
+#endif /* _LINUX_FRONTSWAP_H */
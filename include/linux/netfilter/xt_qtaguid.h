@@ -10,4 +10,55 @@
 #define XT_QTAGUID_SOCKET XT_OWNER_SOCKET
 #define xt_qtaguid_match_info xt_owner_match_info
 
+#include <linux/types.h>
+#include <linux/if.h>
+
+/*
+ * Generic netlink access to the same per-tag stats as
+ * /proc/net/xt_qtaguid/stats, as fixed size binary records.
+ *
+ * A QTAGUID_CMD_GET_STATS dump returns one message per
+ * {iface, acct_tag, uid, cnt_set}, each carrying a QTAGUID_A_STATS record
+ * and the QTAGUID_A_GENERATION of the dump. Passing that generation back
+ * in the next request only returns the tags that were billed since, with
+ * their totals; a few unchanged ones may be thrown in. Tags dropped by a
+ * "d" ctrl command are not reported. Which uids are reported follows the
+ * credentials the request was sent with, as for the stats proc file.
+ */
+#define QTAGUID_GENL_NAME	"qtaguid"
+#define QTAGUID_GENL_VERSION	1
+
+enum {
+	QTAGUID_CMD_UNSPEC,
+	QTAGUID_CMD_GET_STATS,
+	__QTAGUID_CMD_MAX,
+};
+#define QTAGUID_CMD_MAX (__QTAGUID_CMD_MAX - 1)
+
+enum {
+	QTAGUID_A_UNSPEC,
+	QTAGUID_A_GENERATION,	/* u64 */
+	QTAGUID_A_STATS,	/* struct qtaguid_stats_record */
+	__QTAGUID_A_MAX,
+};
+#define QTAGUID_A_MAX (__QTAGUID_A_MAX - 1)
+
+enum {
+	QTAGUID_PROTO_TCP,
+	QTAGUID_PROTO_UDP,
+	QTAGUID_PROTO_OTHER,
+	QTAGUID_PROTO_MAX,
+};
+
+struct qtaguid_stats_record {
+	char iface[IFNAMSIZ];
+	__u64 acct_tag;		/* as acct_tag_hex in the stats file */
+	__u32 uid;
+	__u32 cnt_set;
+	__u64 rx_bytes[QTAGUID_PROTO_MAX];
+	__u64 rx_packets[QTAGUID_PROTO_MAX];
+	__u64 tx_bytes[QTAGUID_PROTO_MAX];
+	__u64 tx_packets[QTAGUID_PROTO_MAX];
+};
+
 #endif /* _XT_QTAGUID_MATCH_H */
@@ -68,6 +68,40 @@ extern unsigned long badness(struct task_struct *p, struct mem_cgroup *mem,
 
 extern struct task_struct *find_lock_task_mm(struct task_struct *p);
 
+/*
+ * The Android lowmemorykiller indexes thread group leaders by oom_adj. None
+ * of these may be called with the task's alloc_lock or siglock held.
+ */
+#ifdef CONFIG_ANDROID_LOW_MEMORY_KILLER
+extern void lowmem_task_fork(struct task_struct *p);
+extern void lowmem_task_release(struct task_struct *p);
+extern void lowmem_task_exec(struct task_struct *leader,
+			     struct task_struct *tsk);
+extern void lowmem_task_adj_changed(struct task_struct *task);
+extern void lowmem_mm_released(struct mm_struct *mm);
+#else
+static inline void lowmem_task_fork(struct task_struct *p)
+{
+}
+
+static inline void lowmem_task_release(struct task_struct *p)
+{
+}
+
+static inline void lowmem_task_exec(struct task_struct *leader,
+				    struct task_struct *tsk)
+{
+}
+
+static inline void lowmem_task_adj_changed(struct task_struct *task)
+{
+}
+
+static inline void lowmem_mm_released(struct mm_struct *mm)
+{
+}
+#endif
+
 /* sysctls */
 extern int sysctl_oom_dump_tasks;
 extern int sysctl_oom_kill_allocating_task;
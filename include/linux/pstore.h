@@ -26,6 +26,9 @@
 enum pstore_type_id {
 	PSTORE_TYPE_DMESG	= 0,
 	PSTORE_TYPE_MCE		= 1,
+	PSTORE_TYPE_CONSOLE	= 2,
+	PSTORE_TYPE_FTRACE	= 3,
+	PSTORE_TYPE_LOGGER	= 4,
 	PSTORE_TYPE_UNKNOWN	= 255
 };
 
@@ -35,15 +38,31 @@ struct pstore_info {
 	struct mutex	buf_mutex;	/* serialize access to 'buf' */
 	char		*buf;
 	size_t		bufsize;
-	size_t		(*read)(u64 *id, enum pstore_type_id *type,
-			struct timespec *time);
+	/*
+	 * Returns the size of the next record and a kmalloc()ed copy of it
+	 * in *buf, which pstore frees, or 0 once there are no more.
+	 */
+	ssize_t		(*read)(u64 *id, enum pstore_type_id *type,
+			struct timespec *time, char **buf,
+			struct pstore_info *psi);
 	u64		(*write)(enum pstore_type_id type, size_t size);
-	int		(*erase)(u64 id);
+	/*
+	 * Optional, appends to a continuous record such as the console or
+	 * ftrace log. May be called from any context, so must not sleep
+	 * nor use 'buf'.
+	 */
+	int		(*write_buf)(enum pstore_type_id type, const char *buf,
+			size_t size, struct pstore_info *psi);
+	int		(*erase)(enum pstore_type_id type, u64 id,
+			struct pstore_info *psi);
+	void		*data;
 };
 
 #ifdef CONFIG_PSTORE
 extern int pstore_register(struct pstore_info *);
 extern int pstore_write(enum pstore_type_id type, char *buf, size_t size);
+extern int pstore_write_buf(enum pstore_type_id type, const char *buf,
+			    size_t size);
 #else
 static inline int
 pstore_register(struct pstore_info *psi)
@@ -55,6 +74,11 @@ pstore_write(enum pstore_type_id type, char *buf, size_t size)
 {
 	return -ENODEV;
 }
+static inline int
+pstore_write_buf(enum pstore_type_id type, const char *buf, size_t size)
+{
+	return -ENODEV;
+}
 #endif
 
 #endif /*_LINUX_PSTORE_H*/
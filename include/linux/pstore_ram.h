@@ -0,0 +1,98 @@
+/*
+ * Persistent RAM zones and the pstore backend built on them
+ *
+ * Copyright (C) 2007-2008 Google, Inc.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#ifndef __LINUX_PSTORE_RAM_H__
+#define __LINUX_PSTORE_RAM_H__
+
+#include <linux/spinlock.h>
+#include <linux/types.h>
+
+struct persistent_ram_buffer;
+
+/*
+ * Reed-Solomon parameters. Every ecc_block_size bytes of data, which must
+ * be a power of 2, are protected by ecc_size bytes of parity. Zeroes pick
+ * the defaults: 128 byte blocks, 16 parity bytes, 8 bit symbols.
+ */
+struct persistent_ram_ecc_info {
+	int ecc_block_size;
+	int ecc_size;
+	int ecc_symsize;
+	int ecc_poly;
+};
+
+/*
+ * A ring buffer in RAM that survives a warm reset. Whatever it held at
+ * boot is saved away as the "old" log before the ring is reused.
+ */
+struct persistent_ram_zone {
+	phys_addr_t paddr;
+	size_t size;
+	void *vaddr;		/* mapped by us unless paddr is 0 */
+	struct persistent_ram_buffer *buffer;
+	size_t buffer_size;	/* bytes of data in the ring */
+	raw_spinlock_t lock;	/* serializes writers */
+
+	/* ECC, only with an rs_decoder */
+	uint8_t *par_buffer;
+	uint8_t *par_header;
+	struct rs_control *rs_decoder;
+	uint16_t *par_tmp;
+	int corrected_bytes;
+	int bad_blocks;
+	struct persistent_ram_ecc_info ecc;
+
+	char *old_log;
+	size_t old_log_size;
+};
+
+struct persistent_ram_zone *persistent_ram_new(phys_addr_t start, size_t size,
+		const struct persistent_ram_ecc_info *ecc);
+struct persistent_ram_zone *persistent_ram_new_vaddr(void *vaddr, size_t size,
+		const struct persistent_ram_ecc_info *ecc);
+void persistent_ram_free(struct persistent_ram_zone *prz);
+void persistent_ram_zap(struct persistent_ram_zone *prz);
+
+int persistent_ram_write(struct persistent_ram_zone *prz, const void *s,
+			 unsigned int count);
+
+size_t persistent_ram_old_size(struct persistent_ram_zone *prz);
+void *persistent_ram_old(struct persistent_ram_zone *prz);
+void persistent_ram_free_old(struct persistent_ram_zone *prz);
+ssize_t persistent_ram_ecc_string(struct persistent_ram_zone *prz,
+				  char *str, size_t len);
+
+/*
+ * pstore_ram platform data
+ * @mem_address	physical address of the reserved region
+ * @mem_size	size of the reserved region
+ * @record_size	size of each kmsg dump record, the dumps take up whatever
+ *		the zones below leave of the region
+ * @console_size, @ftrace_size, @logger_size
+ *		size of the zone for each continuous log, 0 for none
+ * @ecc		protect all zones with Reed-Solomon ECC
+ */
+struct pstore_ram_platform_data {
+	unsigned long	mem_address;
+	unsigned long	mem_size;
+	unsigned long	record_size;
+	unsigned long	console_size;
+	unsigned long	ftrace_size;
+	unsigned long	logger_size;
+	int		ecc;
+};
+
+#endif
@@ -0,0 +1,10 @@
+#ifndef _LINUX_SWAPFILE_H
+#define _LINUX_SWAPFILE_H
+
+/*
+ * This was static in swapfile.c, but frontswap.c needs it and there is no
+ * reason to expose it to the many files that include swap.h.
+ */
+extern struct swap_info_struct *swap_info[];
+
+#endif /* _LINUX_SWAPFILE_H */
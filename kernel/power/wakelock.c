@@ -43,6 +43,12 @@ module_param_named(debug_mask, debug_mask, int, S_IRUGO | S_IWUSR | S_IWGRP);
 static DEFINE_SPINLOCK(list_lock);
 static LIST_HEAD(inactive_locks);
 static struct list_head active_wake_locks[WAKE_LOCK_TYPE_COUNT];
+/*
+ * Number of active wake locks without a timeout, per type. Only changed
+ * with list_lock held, but read without it: while any is held, the answer
+ * to has_wake_lock() is known without walking the active list.
+ */
+static atomic_t untimed_wake_locks[WAKE_LOCK_TYPE_COUNT];
 static int current_event_num;
 struct workqueue_struct *suspend_work_queue;
 struct wake_lock main_wake_lock;
@@ -189,6 +195,14 @@ static void update_sleep_wait_stats_locked(int done)
 #endif
 
 
+static inline int wake_lock_untimed(struct wake_lock *lock)
+{
+	int flags = ACCESS_ONCE(lock->flags);
+
+	return (flags & (WAKE_LOCK_ACTIVE | WAKE_LOCK_AUTO_EXPIRE)) ==
+		WAKE_LOCK_ACTIVE;
+}
+
 static void expire_wake_lock(struct wake_lock *lock)
 {
 #ifdef CONFIG_WAKELOCK_STAT
@@ -230,6 +244,8 @@ static long has_wake_lock_locked(int type)
 	long max_timeout = 0;
 
 	BUG_ON(type >= WAKE_LOCK_TYPE_COUNT);
+	if (atomic_read(&untimed_wake_locks[type]))
+		return -1;
 	list_for_each_entry_safe(lock, n, &active_wake_locks[type], link) {
 		if (lock->flags & WAKE_LOCK_AUTO_EXPIRE) {
 			long timeout = lock->expires - jiffies;
@@ -247,6 +263,14 @@ long has_wake_lock(int type)
 {
 	long ret;
 	unsigned long irqflags;
+
+	/*
+	 * A held untimed lock stays held until a wake_unlock(), which
+	 * reevaluates and queues the suspend work itself.
+	 */
+	if (atomic_read(&untimed_wake_locks[type]) &&
+	    !(debug_mask & DEBUG_SUSPEND))
+		return -1;
 	spin_lock_irqsave(&list_lock, irqflags);
 	ret = has_wake_lock_locked(type);
 	if (ret && (debug_mask & DEBUG_SUSPEND) && type == WAKE_LOCK_SUSPEND)
@@ -364,6 +388,9 @@ void wake_lock_destroy(struct wake_lock *lock)
 	if (debug_mask & DEBUG_WAKE_LOCK)
 		pr_info("wake_lock_destroy name=%s\n", lock->name);
 	spin_lock_irqsave(&list_lock, irqflags);
+	if (wake_lock_untimed(lock))
+		atomic_dec(&untimed_wake_locks[lock->flags &
+					       WAKE_LOCK_TYPE_MASK]);
 	lock->flags &= ~WAKE_LOCK_INITIALIZED;
 #ifdef CONFIG_WAKELOCK_STAT
 	if (lock->stat.count) {
@@ -391,11 +418,27 @@ static void wake_lock_internal(
 	int type;
 	unsigned long irqflags;
 	long expire_in;
+	int was_untimed;
+
+	/*
+	 * Drivers take their wake locks for every event they handle.
+	 * Taking an untimed lock again while it is held changes nothing, so
+	 * don't serialize on list_lock for it. With the lock held, no
+	 * suspend can be in progress that would need to see the event.
+	 */
+	if (!has_timeout && wake_lock_untimed(lock) &&
+	    !(debug_mask & DEBUG_WAKE_LOCK)) {
+#ifdef CONFIG_WAKELOCK_STAT
+		if (!ACCESS_ONCE(wait_for_wakeup))
+#endif
+			return;
+	}
 
 	spin_lock_irqsave(&list_lock, irqflags);
 	type = lock->flags & WAKE_LOCK_TYPE_MASK;
 	BUG_ON(type >= WAKE_LOCK_TYPE_COUNT);
 	BUG_ON(!(lock->flags & WAKE_LOCK_INITIALIZED));
+	was_untimed = wake_lock_untimed(lock);
 #ifdef CONFIG_WAKELOCK_STAT
 	if (type == WAKE_LOCK_SUSPEND && wait_for_wakeup) {
 		if (debug_mask & DEBUG_WAKEUP)
@@ -424,12 +467,16 @@ static void wake_lock_internal(
 		lock->expires = jiffies + timeout;
 		lock->flags |= WAKE_LOCK_AUTO_EXPIRE;
 		list_add_tail(&lock->link, &active_wake_locks[type]);
+		if (was_untimed)
+			atomic_dec(&untimed_wake_locks[type]);
 	} else {
 		if (debug_mask & DEBUG_WAKE_LOCK)
 			pr_info("wake_lock: %s, type %d\n", lock->name, type);
 		lock->expires = LONG_MAX;
 		lock->flags &= ~WAKE_LOCK_AUTO_EXPIRE;
 		list_add(&lock->link, &active_wake_locks[type]);
+		if (!was_untimed)
+			atomic_inc(&untimed_wake_locks[type]);
 	}
 	if (type == WAKE_LOCK_SUSPEND) {
 		current_event_num++;
@@ -476,6 +523,12 @@ void wake_unlock(struct wake_lock *lock)
 {
 	int type;
 	unsigned long irqflags;
+
+	/* Many drivers unlock unconditionally, mostly when already unlocked */
+	if (!(ACCESS_ONCE(lock->flags) & WAKE_LOCK_ACTIVE) &&
+	    !(debug_mask & DEBUG_WAKE_LOCK))
+		return;
+
 	spin_lock_irqsave(&list_lock, irqflags);
 	type = lock->flags & WAKE_LOCK_TYPE_MASK;
 #ifdef CONFIG_WAKELOCK_STAT
@@ -483,6 +536,8 @@ void wake_unlock(struct wake_lock *lock)
 #endif
 	if (debug_mask & DEBUG_WAKE_LOCK)
 		pr_info("wake_unlock: %s\n", lock->name);
+	if (wake_lock_untimed(lock))
+		atomic_dec(&untimed_wake_locks[type]);
 	lock->flags &= ~(WAKE_LOCK_ACTIVE | WAKE_LOCK_AUTO_EXPIRE);
 	list_del(&lock->link);
 	list_add(&lock->link, &inactive_locks);
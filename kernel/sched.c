@@ -72,6 +72,7 @@
 #include <linux/ftrace.h>
 #include <linux/slab.h>
 #include <linux/cpuacct.h>
+#include <linux/cpufreq.h>
 
 #include <asm/tlb.h>
 #include <asm/irq_regs.h>
@@ -1796,6 +1797,7 @@ static void activate_task(struct rq *rq, struct task_struct *p, int flags)
 
 	enqueue_task(rq, p, flags);
 	inc_nr_running(rq);
+	cpufreq_sched_update(cpu_of(rq), rq->clock, rq->nr_running);
 }
 
 /*
@@ -1808,6 +1810,7 @@ static void deactivate_task(struct rq *rq, struct task_struct *p, int flags)
 
 	dequeue_task(rq, p, flags);
 	dec_nr_running(rq);
+	cpufreq_sched_update(cpu_of(rq), rq->clock, rq->nr_running);
 }
 
 #ifdef CONFIG_IRQ_TIME_ACCOUNTING
@@ -3921,6 +3924,7 @@ void scheduler_tick(void)
 	update_rq_clock(rq);
 	update_cpu_load_active(rq);
 	curr->sched_class->task_tick(rq, curr, 0);
+	cpufreq_sched_update(cpu, rq->clock, rq->nr_running);
 	raw_spin_unlock(&rq->lock);
 
 	perf_event_task_tick();
@@ -0,0 +1,180 @@
+/*
+ * Frontswap frontend
+ *
+ * This code provides the generic "frontend" layer to call a matching
+ * "backend" driver implementation of frontswap, such as zcache. Swap
+ * pages the backend accepts are tracked in a per swap area bitmap, so
+ * that the swap-in of such a page can be satisfied without issuing any
+ * block I/O, and so that only pages the backend actually holds are ever
+ * passed to it for a get or a flush.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.
+ */
+
+#include <linux/mm.h>
+#include <linux/swap.h>
+#include <linux/swapops.h>
+#include <linux/swapfile.h>
+#include <linux/module.h>
+#include <linux/debugfs.h>
+#include <linux/frontswap.h>
+
+/* set to the registered backend, all hooks are no-ops until then */
+static struct frontswap_ops frontswap_ops __read_mostly;
+
+/*
+ * Checked (in frontswap.h) before every call into this file, so that the
+ * swap paths cost nothing but a load when no backend is registered.
+ */
+int frontswap_enabled __read_mostly;
+EXPORT_SYMBOL(frontswap_enabled);
+
+/* statistics, only ever read through debugfs */
+static u64 frontswap_gets;
+static u64 frontswap_succ_puts;
+static u64 frontswap_failed_puts;
+static u64 frontswap_flushes;
+
+/*
+ * Registers a backend and returns the ops of the previous one, so that
+ * the caller can tell if it replaced something. Swap areas activated
+ * before this call are not known to the backend and never use it.
+ */
+struct frontswap_ops frontswap_register_ops(struct frontswap_ops *ops)
+{
+	struct frontswap_ops old = frontswap_ops;
+
+	frontswap_ops = *ops;
+	frontswap_enabled = 1;
+	return old;
+}
+EXPORT_SYMBOL(frontswap_register_ops);
+
+static inline int frontswap_test(struct swap_info_struct *sis, pgoff_t offset)
+{
+	return sis->frontswap_map && test_bit(offset, sis->frontswap_map);
+}
+
+static inline void frontswap_set(struct swap_info_struct *sis, pgoff_t offset)
+{
+	if (!test_and_set_bit(offset, sis->frontswap_map))
+		atomic_inc(&sis->frontswap_pages);
+}
+
+static inline void frontswap_clear(struct swap_info_struct *sis,
+				   pgoff_t offset)
+{
+	if (test_and_clear_bit(offset, sis->frontswap_map))
+		atomic_dec(&sis->frontswap_pages);
+}
+
+/* Called when a swap area is activated, once its frontswap_map is set. */
+void __frontswap_init(unsigned type)
+{
+	struct swap_info_struct *sis = swap_info[type];
+
+	BUG_ON(sis == NULL);
+	if (sis->frontswap_map == NULL)
+		return;
+	(*frontswap_ops.init)(type);
+}
+EXPORT_SYMBOL(__frontswap_init);
+
+/*
+ * Offers a locked swap cache page to the backend. If a previous copy of
+ * the same swap slot is held and the backend refuses the new one, the old
+ * copy must not be returned by a later get, so it is flushed.
+ */
+int __frontswap_put_page(struct page *page)
+{
+	int ret = -1;
+	swp_entry_t entry = { .val = page_private(page), };
+	int type = swp_type(entry);
+	struct swap_info_struct *sis = swap_info[type];
+	pgoff_t offset = swp_offset(entry);
+	int dup;
+
+	BUG_ON(!PageLocked(page));
+	if (sis->frontswap_map == NULL)
+		return ret;
+
+	dup = frontswap_test(sis, offset);
+	ret = (*frontswap_ops.put_page)(type, offset, page);
+	if (ret == 0) {
+		frontswap_set(sis, offset);
+		frontswap_succ_puts++;
+	} else {
+		if (dup) {
+			(*frontswap_ops.flush_page)(type, offset);
+			frontswap_clear(sis, offset);
+		}
+		frontswap_failed_puts++;
+	}
+	return ret;
+}
+EXPORT_SYMBOL(__frontswap_put_page);
+
+/*
+ * Fills a locked swap cache page from the backend, if it holds the swap
+ * slot. Returns 0 if it did.
+ */
+int __frontswap_get_page(struct page *page)
+{
+	int ret = -1;
+	swp_entry_t entry = { .val = page_private(page), };
+	int type = swp_type(entry);
+	struct swap_info_struct *sis = swap_info[type];
+	pgoff_t offset = swp_offset(entry);
+
+	BUG_ON(!PageLocked(page));
+	if (frontswap_test(sis, offset))
+		ret = (*frontswap_ops.get_page)(type, offset, page);
+	if (ret == 0)
+		frontswap_gets++;
+	return ret;
+}
+EXPORT_SYMBOL(__frontswap_get_page);
+
+/* Called with swap_lock held when a swap slot is freed. */
+void __frontswap_flush_page(unsigned type, pgoff_t offset)
+{
+	struct swap_info_struct *sis = swap_info[type];
+
+	if (frontswap_test(sis, offset)) {
+		(*frontswap_ops.flush_page)(type, offset);
+		frontswap_clear(sis, offset);
+		frontswap_flushes++;
+	}
+}
+EXPORT_SYMBOL(__frontswap_flush_page);
+
+/* Called from swapoff, once every page of the area has been brought in. */
+void __frontswap_flush_area(unsigned type)
+{
+	struct swap_info_struct *sis = swap_info[type];
+
+	if (sis->frontswap_map == NULL)
+		return;
+	(*frontswap_ops.flush_area)(type);
+	atomic_set(&sis->frontswap_pages, 0);
+	memset(sis->frontswap_map, 0, BITS_TO_LONGS(sis->max) * sizeof(long));
+}
+EXPORT_SYMBOL(__frontswap_flush_area);
+
+static int __init init_frontswap(void)
+{
+#ifdef CONFIG_DEBUG_FS
+	struct dentry *root = debugfs_create_dir("frontswap", NULL);
+
+	if (root == NULL)
+		return -ENXIO;
+	debugfs_create_u64("gets", S_IRUGO, root, &frontswap_gets);
+	debugfs_create_u64("succ_puts", S_IRUGO, root, &frontswap_succ_puts);
+	debugfs_create_u64("failed_puts", S_IRUGO, root,
+			   &frontswap_failed_puts);
+	debugfs_create_u64("flushes", S_IRUGO, root, &frontswap_flushes);
+#endif
+	return 0;
+}
+
+module_init(init_frontswap);
@@ -15,13 +15,17 @@
 #define DEBUG
 
 #include <linux/file.h>
+#include <linux/hash.h>
 #include <linux/inetdevice.h>
 #include <linux/module.h>
 #include <linux/netfilter/x_tables.h>
 #include <linux/netfilter/xt_qtaguid.h>
+#include <linux/rculist.h>
+#include <linux/seqlock.h>
 #include <linux/skbuff.h>
 #include <linux/workqueue.h>
 #include <net/addrconf.h>
+#include <net/genetlink.h>
 #include <net/sock.h>
 #include <net/tcp.h>
 #include <net/udp.h>
@@ -123,6 +127,12 @@ static struct proc_dir_entry *iface_stat_all_procfile;
  *    tag_counter_set_list_lock
  * Notice how sock_tag_list_lock is held sometimes when uid_tag_data_tree_lock
  * is acquired.
+ * sock_tag_list_lock, tag_counter_set_list_lock and the tag_stat_list_lock of
+ * each iface_stat are rwlocks. The packet path doesn't take the first and
+ * the last at all: it finds sock_tags in sock_tag_hash and tag_stats in
+ * iface_stat->tag_stat_hash under rcu_read_lock_bh(), and the writers free
+ * what they unlink with call_rcu_bh(). The 64-bit tag of a sock_tag is
+ * rewritten in place on a retag, so it is read under sock_tag_seq.
  *
  * Call tree with all lock holders as of 2011-09-25:
  *
@@ -178,15 +188,20 @@ static struct proc_dir_entry *iface_stat_all_procfile;
  * qtaguid_mt()
  *   account_for_uid()
  *     if_tag_stat_update()
+ *       rcu_read_lock()
+ *         (iface_stat_list)
  *       get_sock_stat()
- *         sock_tag_list_lock
- *       struct iface_stat->tag_stat_list_lock
+ *         rcu_read_lock_bh()
+ *           (sock_tag_hash)
+ *       rcu_read_lock_bh()
+ *         (struct iface_stat->tag_stat_hash)
  *         tag_stat_update()
  *           get_active_counter_set()
- *             tag_counter_set_list_lock
+ *             tag_counter_set_list_lock (read)
+ *       struct iface_stat->tag_stat_list_lock (write, new tags only)
  *         tag_stat_update()
  *           get_active_counter_set()
- *             tag_counter_set_list_lock
+ *             tag_counter_set_list_lock (read)
  *
  *
  * qtaguid_ctrl_parse()
@@ -215,14 +230,26 @@ static LIST_HEAD(iface_stat_list);
 static DEFINE_SPINLOCK(iface_stat_list_lock);
 
 static struct rb_root sock_tag_tree = RB_ROOT;
-static DEFINE_SPINLOCK(sock_tag_list_lock);
+static DEFINE_RWLOCK(sock_tag_list_lock);
+
+/* The same sock_tags as sock_tag_tree, for the packet path */
+#define SOCK_TAG_HASH_BITS 8
+static struct hlist_head sock_tag_hash[1 << SOCK_TAG_HASH_BITS];
+static seqcount_t sock_tag_seq = SEQCNT_ZERO;
 
 static struct rb_root tag_counter_set_tree = RB_ROOT;
-static DEFINE_SPINLOCK(tag_counter_set_list_lock);
+static DEFINE_RWLOCK(tag_counter_set_list_lock);
 
 static struct rb_root uid_tag_data_tree = RB_ROOT;
 static DEFINE_SPINLOCK(uid_tag_data_tree_lock);
 
+/*
+ * Bumped by every netlink stats dump. tag_stat_cpu_update() stamps the
+ * counters with it, so that a dump can skip the tags not billed since
+ * an earlier one.
+ */
+static atomic_long_t stats_generation = ATOMIC_LONG_INIT(1);
+
 static struct rb_root proc_qtu_data_tree = RB_ROOT;
 /* No proc_qtu_data_tree_lock; use uid_tag_data_tree_lock */
 
@@ -408,6 +435,34 @@ static void sock_tag_tree_insert(struct sock_tag *data, struct rb_root *root)
 	rb_insert_color(&data->sock_node, root);
 }
 
+static struct hlist_head *sock_tag_hash_bucket(const struct sock *sk)
+{
+	return &sock_tag_hash[hash_ptr((void *)sk, SOCK_TAG_HASH_BITS)];
+}
+
+/* sock_tag_list_lock should be held for writing. */
+static void sock_tag_add(struct sock_tag *st_entry)
+{
+	sock_tag_tree_insert(st_entry, &sock_tag_tree);
+	hlist_add_head_rcu(&st_entry->hash_node,
+			   sock_tag_hash_bucket(st_entry->sk));
+}
+
+/*
+ * sock_tag_list_lock should be held for writing. The packet path may still
+ * be looking at the sock_tag, so it is freed through sock_tag_free().
+ */
+static void sock_tag_del(struct sock_tag *st_entry)
+{
+	rb_erase(&st_entry->sock_node, &sock_tag_tree);
+	hlist_del_rcu(&st_entry->hash_node);
+}
+
+static void sock_tag_free(struct rcu_head *head)
+{
+	kfree(container_of(head, struct sock_tag, rcu));
+}
+
 static void sock_tag_tree_erase(struct rb_root *st_to_free_tree)
 {
 	struct rb_node *node;
@@ -424,7 +479,7 @@ static void sock_tag_tree_erase(struct rb_root *st_to_free_tree)
 			 get_uid_from_tag(st_entry->tag));
 		rb_erase(&st_entry->sock_node, st_to_free_tree);
 		sockfd_put(st_entry->socket);
-		kfree(st_entry);
+		call_rcu_bh(&st_entry->rcu, sock_tag_free);
 	}
 }
 
@@ -745,17 +800,18 @@ static int get_active_counter_set(tag_t tag)
 		 tag, get_uid_from_tag(tag));
 	/* For now we only handle UID tags for active sets */
 	tag = get_utag_from_tag(tag);
-	spin_lock_bh(&tag_counter_set_list_lock);
+	read_lock_bh(&tag_counter_set_list_lock);
 	tcs = tag_counter_set_tree_search(&tag_counter_set_tree, tag);
 	if (tcs)
 		active_set = tcs->active_set;
-	spin_unlock_bh(&tag_counter_set_list_lock);
+	read_unlock_bh(&tag_counter_set_list_lock);
 	return active_set;
 }
 
 /*
  * Find the entry for tracking the specified interface.
- * Caller must hold iface_stat_list_lock
+ * Caller must hold iface_stat_list_lock or rcu_read_lock(): entries are
+ * added with list_add_rcu() and never freed.
  */
 static struct iface_stat *get_iface_entry(const char *ifname)
 {
@@ -768,7 +824,7 @@ static struct iface_stat *get_iface_entry(const char *ifname)
 	}
 
 	/* Iterate over interfaces */
-	list_for_each_entry(iface_entry, &iface_stat_list, list) {
+	list_for_each_entry_rcu(iface_entry, &iface_stat_list, list) {
 		if (!strcmp(ifname, iface_entry->ifname))
 			goto done;
 	}
@@ -921,7 +977,7 @@ static struct iface_stat *iface_alloc(struct net_device *net_dev)
 		kfree(new_iface);
 		return NULL;
 	}
-	spin_lock_init(&new_iface->tag_stat_list_lock);
+	rwlock_init(&new_iface->tag_stat_list_lock);
 	new_iface->tag_stat_tree = RB_ROOT;
 	_iface_stat_set_active(new_iface, net_dev, true);
 
@@ -941,7 +997,7 @@ static struct iface_stat *iface_alloc(struct net_device *net_dev)
 	isw->iface_entry = new_iface;
 	INIT_WORK(&isw->iface_work, iface_create_proc_worker);
 	schedule_work(&isw->iface_work);
-	list_add(&new_iface->list, &iface_stat_list);
+	list_add_rcu(&new_iface->list, &iface_stat_list);
 	return new_iface;
 }
 
@@ -1131,16 +1187,35 @@ static struct sock_tag *get_sock_stat_nl(const struct sock *sk)
 	return sock_tag_tree_search(&sock_tag_tree, sk);
 }
 
-static struct sock_tag *get_sock_stat(const struct sock *sk)
+/*
+ * Looks up the tag of a tagged sock without taking sock_tag_list_lock.
+ * The sock_tag may be freed as soon as the RCU read side ends, so only its
+ * tag is handed out.
+ */
+static bool get_sock_stat(const struct sock *sk, tag_t *tag)
 {
 	struct sock_tag *sock_tag_entry;
+	struct hlist_node *pos;
+	unsigned int seq;
+	bool found = false;
+
 	MT_DEBUG("qtaguid: get_sock_stat(sk=%p)\n", sk);
 	if (!sk)
-		return NULL;
-	spin_lock_bh(&sock_tag_list_lock);
-	sock_tag_entry = get_sock_stat_nl(sk);
-	spin_unlock_bh(&sock_tag_list_lock);
-	return sock_tag_entry;
+		return false;
+	rcu_read_lock_bh();
+	hlist_for_each_entry_rcu_bh(sock_tag_entry, pos,
+				    sock_tag_hash_bucket(sk), hash_node) {
+		if (sock_tag_entry->sk != sk)
+			continue;
+		do {
+			seq = read_seqcount_begin(&sock_tag_seq);
+			*tag = sock_tag_entry->tag;
+		} while (read_seqcount_retry(&sock_tag_seq, seq));
+		found = true;
+		break;
+	}
+	rcu_read_unlock_bh();
+	return found;
 }
 
 static void
@@ -1216,29 +1291,74 @@ static void iface_stat_update(struct net_device *net_dev, bool stash_only)
 	spin_unlock_bh(&iface_stat_list_lock);
 }
 
+static void tag_stat_cpu_update(struct tag_stat_cpu *tsc, int set,
+				enum ifs_tx_rx direction, int proto, int bytes)
+{
+	tsc->generation = atomic_long_read(&stats_generation);
+	u64_stats_update_begin(&tsc->syncp);
+	data_counters_update(&tsc->dc, set, direction, proto, bytes);
+	u64_stats_update_end(&tsc->syncp);
+}
+
+/*
+ * Bills this cpu's counters of the tag_stat, so BHs must be disabled,
+ * as they are under rcu_read_lock_bh() or tag_stat_list_lock.
+ */
 static void tag_stat_update(struct tag_stat *tag_entry,
 			enum ifs_tx_rx direction, int proto, int bytes)
 {
+	int cpu = smp_processor_id();
 	int active_set;
 	active_set = get_active_counter_set(tag_entry->tn.tag);
 	MT_DEBUG("qtaguid: tag_stat_update(tag=0x%llx (uid=%u) set=%d "
 		 "dir=%d proto=%d bytes=%d)\n",
 		 tag_entry->tn.tag, get_uid_from_tag(tag_entry->tn.tag),
 		 active_set, direction, proto, bytes);
-	data_counters_update(&tag_entry->counters, active_set, direction,
-			     proto, bytes);
+	tag_stat_cpu_update(&tag_entry->counters[cpu], active_set,
+			    direction, proto, bytes);
 	if (tag_entry->parent_counters)
-		data_counters_update(tag_entry->parent_counters, active_set,
-				     direction, proto, bytes);
+		tag_stat_cpu_update(&tag_entry->parent_counters[cpu],
+				    active_set, direction, proto, bytes);
+}
+
+static void tag_stat_free(struct rcu_head *head)
+{
+	struct tag_stat *tag_entry = container_of(head, struct tag_stat, rcu);
+
+	kfree(tag_entry->counters);
+	kfree(tag_entry);
+}
+
+static struct hlist_head *tag_stat_hash_bucket(struct iface_stat *iface_entry,
+					       tag_t tag)
+{
+	return &iface_entry->tag_stat_hash[hash_64(tag, TAG_STAT_HASH_BITS)];
+}
+
+/* Needs rcu_read_lock_bh() or iface_entry->tag_stat_list_lock held. */
+static struct tag_stat *tag_stat_hash_search(struct iface_stat *iface_entry,
+					     tag_t tag)
+{
+	struct tag_stat *ts_entry;
+	struct hlist_node *pos;
+
+	hlist_for_each_entry_rcu_bh(ts_entry, pos,
+				    tag_stat_hash_bucket(iface_entry, tag),
+				    hash_node)
+		if (ts_entry->tn.tag == tag)
+			return ts_entry;
+	return NULL;
 }
 
 /*
  * Create a new entry for tracking the specified {acct_tag,uid_tag} within
- * the interface.
- * iface_entry->tag_stat_list_lock should be held.
+ * the interface, billing parent_counters as well if those are given.
+ * iface_entry->tag_stat_list_lock should be held for writing. The entry is
+ * complete before the packet path can find it.
  */
 static struct tag_stat *create_if_tag_stat(struct iface_stat *iface_entry,
-					   tag_t tag)
+					   tag_t tag,
+					   struct tag_stat_cpu *parent_counters)
 {
 	struct tag_stat *new_tag_stat_entry = NULL;
 	IF_DEBUG("qtaguid: iface_stat: %s(): ife=%p tag=0x%llx"
@@ -1249,8 +1369,19 @@ static struct tag_stat *create_if_tag_stat(struct iface_stat *iface_entry,
 		pr_err("qtaguid: iface_stat: tag stat alloc failed\n");
 		goto done;
 	}
+	new_tag_stat_entry->counters = kzalloc(nr_cpu_ids *
+		sizeof(*new_tag_stat_entry->counters), GFP_ATOMIC);
+	if (!new_tag_stat_entry->counters) {
+		pr_err("qtaguid: iface_stat: tag stat alloc failed\n");
+		kfree(new_tag_stat_entry);
+		new_tag_stat_entry = NULL;
+		goto done;
+	}
 	new_tag_stat_entry->tn.tag = tag;
+	new_tag_stat_entry->parent_counters = parent_counters;
 	tag_stat_tree_insert(new_tag_stat_entry, &iface_entry->tag_stat_tree);
+	hlist_add_head_rcu(&new_tag_stat_entry->hash_node,
+			   tag_stat_hash_bucket(iface_entry, tag));
 done:
 	return new_tag_stat_entry;
 }
@@ -1262,8 +1393,7 @@ static void if_tag_stat_update(const char *ifname, uid_t uid,
 	struct tag_stat *tag_stat_entry;
 	tag_t tag, acct_tag;
 	tag_t uid_tag;
-	struct data_counters *uid_tag_counters;
-	struct sock_tag *sock_tag_entry;
+	struct tag_stat_cpu *uid_tag_counters;
 	struct iface_stat *iface_entry;
 	struct tag_stat *new_tag_stat;
 	MT_DEBUG("qtaguid: if_tag_stat_update(ifname=%s "
@@ -1271,7 +1401,9 @@ static void if_tag_stat_update(const char *ifname, uid_t uid,
 		 ifname, uid, sk, direction, proto, bytes);
 
 
+	rcu_read_lock();
 	iface_entry = get_iface_entry(ifname);
+	rcu_read_unlock();
 	if (!iface_entry) {
 		pr_err("qtaguid: iface_stat: stat_update() %s not found\n",
 		       ifname);
@@ -1286,9 +1418,7 @@ static void if_tag_stat_update(const char *ifname, uid_t uid,
 	 * Look for a tagged sock.
 	 * It will have an acct_uid.
 	 */
-	sock_tag_entry = get_sock_stat(sk);
-	if (sock_tag_entry) {
-		tag = sock_tag_entry->tag;
+	if (get_sock_stat(sk, &tag)) {
 		acct_tag = get_atag_from_tag(tag);
 		uid_tag = get_utag_from_tag(tag);
 	} else {
@@ -1299,20 +1429,32 @@ static void if_tag_stat_update(const char *ifname, uid_t uid,
 	MT_DEBUG("qtaguid: iface_stat: stat_update(): "
 		 " looking for tag=0x%llx (uid=%u) in ife=%p\n",
 		 tag, get_uid_from_tag(tag), iface_entry);
-	/* Loop over tag list under this interface for {acct_tag,uid_tag} */
-	spin_lock_bh(&iface_entry->tag_stat_list_lock);
-
-	tag_stat_entry = tag_stat_tree_search(&iface_entry->tag_stat_tree,
-					      tag);
+	/*
+	 * Loop over tag list under this interface for {acct_tag,uid_tag}.
+	 * Once the tag has been seen on this interface, this is all there is
+	 * to it, and packets on all cpus can do it without sharing a lock.
+	 */
+	rcu_read_lock_bh();
+	tag_stat_entry = tag_stat_hash_search(iface_entry, tag);
 	if (tag_stat_entry) {
 		/*
 		 * Updating the {acct_tag, uid_tag} entry handles both stats:
 		 * {0, uid_tag} will also get updated.
 		 */
 		tag_stat_update(tag_stat_entry, direction, proto, bytes);
-		spin_unlock_bh(&iface_entry->tag_stat_list_lock);
+		rcu_read_unlock_bh();
 		return;
 	}
+	rcu_read_unlock_bh();
+
+	write_lock_bh(&iface_entry->tag_stat_list_lock);
+	/* It may have been added while the lock was dropped */
+	tag_stat_entry = tag_stat_tree_search(&iface_entry->tag_stat_tree,
+					      tag);
+	if (tag_stat_entry) {
+		tag_stat_update(tag_stat_entry, direction, proto, bytes);
+		goto unlock;
+	}
 
 	/* Loop over tag list under this interface for {0,uid_tag} */
 	tag_stat_entry = tag_stat_tree_search(&iface_entry->tag_stat_tree,
@@ -1323,18 +1465,24 @@ static void if_tag_stat_update(const char *ifname, uid_t uid,
 		 * No parent counters. So
 		 *  - No {0, uid_tag} stats and no {acc_tag, uid_tag} stats.
 		 */
-		new_tag_stat = create_if_tag_stat(iface_entry, uid_tag);
-		uid_tag_counters = &new_tag_stat->counters;
+		new_tag_stat = create_if_tag_stat(iface_entry, uid_tag, NULL);
+		if (!new_tag_stat)
+			goto unlock;
+		uid_tag_counters = new_tag_stat->counters;
 	} else {
-		uid_tag_counters = &tag_stat_entry->counters;
+		uid_tag_counters = tag_stat_entry->counters;
+		new_tag_stat = tag_stat_entry;
 	}
 
 	if (acct_tag) {
-		new_tag_stat = create_if_tag_stat(iface_entry, tag);
-		new_tag_stat->parent_counters = uid_tag_counters;
+		new_tag_stat = create_if_tag_stat(iface_entry, tag,
+						  uid_tag_counters);
+		if (!new_tag_stat)
+			goto unlock;
 	}
 	tag_stat_update(new_tag_stat, direction, proto, bytes);
-	spin_unlock_bh(&iface_entry->tag_stat_list_lock);
+unlock:
+	write_unlock_bh(&iface_entry->tag_stat_list_lock);
 }
 
 static int iface_netdev_event_handler(struct notifier_block *nb,
@@ -1728,16 +1876,16 @@ static void prdebug_full_state(int indent_level, const char *fmt, ...)
 	kfree(buff);
 	va_end(args);
 
-	spin_lock_bh(&sock_tag_list_lock);
+	read_lock_bh(&sock_tag_list_lock);
 	prdebug_sock_tag_tree(indent_level, &sock_tag_tree);
-	spin_unlock_bh(&sock_tag_list_lock);
+	read_unlock_bh(&sock_tag_list_lock);
 
-	spin_lock_bh(&sock_tag_list_lock);
+	read_lock_bh(&sock_tag_list_lock);
 	spin_lock_bh(&uid_tag_data_tree_lock);
 	prdebug_uid_tag_data_tree(indent_level, &uid_tag_data_tree);
 	prdebug_proc_qtu_data_tree(indent_level, &proc_qtu_data_tree);
 	spin_unlock_bh(&uid_tag_data_tree_lock);
-	spin_unlock_bh(&sock_tag_list_lock);
+	read_unlock_bh(&sock_tag_list_lock);
 
 	spin_lock_bh(&iface_stat_list_lock);
 	prdebug_iface_stat_list(indent_level, &iface_stat_list);
@@ -1777,7 +1925,7 @@ static int qtaguid_ctrl_proc_read(char *page, char **num_items_returned,
 	CT_DEBUG("qtaguid: proc ctrl page=%p off=%ld char_count=%d *eof=%d\n",
 		page, items_to_skip, char_count, *eof);
 
-	spin_lock_bh(&sock_tag_list_lock);
+	read_lock_bh(&sock_tag_list_lock);
 	for (node = rb_first(&sock_tag_tree);
 	     node;
 	     node = rb_next(node)) {
@@ -1801,7 +1949,7 @@ static int qtaguid_ctrl_proc_read(char *page, char **num_items_returned,
 			       sock_tag_entry->tag, uid,
 			       sock_tag_entry->pid, f_count);
 		if (len >= char_count) {
-			spin_unlock_bh(&sock_tag_list_lock);
+			read_unlock_bh(&sock_tag_list_lock);
 			*outp = '\0';
 			return outp - page;
 		}
@@ -1809,7 +1957,7 @@ static int qtaguid_ctrl_proc_read(char *page, char **num_items_returned,
 		char_count -= len;
 		(*num_items_returned)++;
 	}
-	spin_unlock_bh(&sock_tag_list_lock);
+	read_unlock_bh(&sock_tag_list_lock);
 
 	if (item_index++ >= items_to_skip) {
 		len = snprintf(outp, char_count,
@@ -1904,7 +2052,7 @@ static int ctrl_cmd_delete(const char *input)
 		 input, tag, uid);
 
 	/* Delete socket tags */
-	spin_lock_bh(&sock_tag_list_lock);
+	write_lock_bh(&sock_tag_list_lock);
 	node = rb_first(&sock_tag_tree);
 	while (node) {
 		st_entry = rb_entry(node, struct sock_tag, sock_node);
@@ -1917,7 +2065,7 @@ static int ctrl_cmd_delete(const char *input)
 			 input, st_entry->tag, entry_uid);
 
 		if (!acct_tag || st_entry->tag == tag) {
-			rb_erase(&st_entry->sock_node, &sock_tag_tree);
+			sock_tag_del(st_entry);
 			/* Can't sockfd_put() within spinlock, do it later. */
 			sock_tag_tree_insert(st_entry, &st_to_free_tree);
 			tr_entry = lookup_tag_ref(st_entry->tag, NULL);
@@ -1934,12 +2082,12 @@ static int ctrl_cmd_delete(const char *input)
 				list_del(&st_entry->list);
 		}
 	}
-	spin_unlock_bh(&sock_tag_list_lock);
+	write_unlock_bh(&sock_tag_list_lock);
 
 	sock_tag_tree_erase(&st_to_free_tree);
 
 	/* Delete tag counter-sets */
-	spin_lock_bh(&tag_counter_set_list_lock);
+	write_lock_bh(&tag_counter_set_list_lock);
 	/* Counter sets are only on the uid tag, not full tag */
 	tcs_entry = tag_counter_set_tree_search(&tag_counter_set_tree, tag);
 	if (tcs_entry) {
@@ -1952,7 +2100,7 @@ static int ctrl_cmd_delete(const char *input)
 		rb_erase(&tcs_entry->tn.node, &tag_counter_set_tree);
 		kfree(tcs_entry);
 	}
-	spin_unlock_bh(&tag_counter_set_list_lock);
+	write_unlock_bh(&tag_counter_set_list_lock);
 
 	/*
 	 * If acct_tag is 0, then all entries belonging to uid are
@@ -1960,7 +2108,7 @@ static int ctrl_cmd_delete(const char *input)
 	 */
 	spin_lock_bh(&iface_stat_list_lock);
 	list_for_each_entry(iface_entry, &iface_stat_list, list) {
-		spin_lock_bh(&iface_entry->tag_stat_list_lock);
+		write_lock_bh(&iface_entry->tag_stat_list_lock);
 		node = rb_first(&iface_entry->tag_stat_tree);
 		while (node) {
 			ts_entry = rb_entry(node, struct tag_stat, tn.node);
@@ -1981,10 +2129,11 @@ static int ctrl_cmd_delete(const char *input)
 					 entry_uid);
 				rb_erase(&ts_entry->tn.node,
 					 &iface_entry->tag_stat_tree);
-				kfree(ts_entry);
+				hlist_del_rcu(&ts_entry->hash_node);
+				call_rcu_bh(&ts_entry->rcu, tag_stat_free);
 			}
 		}
-		spin_unlock_bh(&iface_entry->tag_stat_list_lock);
+		write_unlock_bh(&iface_entry->tag_stat_list_lock);
 	}
 	spin_unlock_bh(&iface_stat_list_lock);
 
@@ -2050,12 +2199,12 @@ static int ctrl_cmd_counter_set(const char *input)
 	}
 
 	tag = make_tag_from_uid(uid);
-	spin_lock_bh(&tag_counter_set_list_lock);
+	write_lock_bh(&tag_counter_set_list_lock);
 	tcs = tag_counter_set_tree_search(&tag_counter_set_tree, tag);
 	if (!tcs) {
 		tcs = kzalloc(sizeof(*tcs), GFP_ATOMIC);
 		if (!tcs) {
-			spin_unlock_bh(&tag_counter_set_list_lock);
+			write_unlock_bh(&tag_counter_set_list_lock);
 			pr_err("qtaguid: ctrl_counterset(%s): "
 			       "failed to alloc counter set\n",
 			       input);
@@ -2069,7 +2218,7 @@ static int ctrl_cmd_counter_set(const char *input)
 			 input, tag, get_uid_from_tag(tag), counter_set);
 	}
 	tcs->active_set = counter_set;
-	spin_unlock_bh(&tag_counter_set_list_lock);
+	write_unlock_bh(&tag_counter_set_list_lock);
 	atomic64_inc(&qtu_events.counter_set_changes);
 	res = 0;
 
@@ -2134,12 +2283,12 @@ static int ctrl_cmd_tag(const char *input)
 	}
 	full_tag = combine_atag_with_uid(acct_tag, uid);
 
-	spin_lock_bh(&sock_tag_list_lock);
+	write_lock_bh(&sock_tag_list_lock);
 	sock_tag_entry = get_sock_stat_nl(el_socket->sk);
 	tag_ref_entry = get_tag_ref(full_tag, &uid_tag_data_entry);
 	if (IS_ERR(tag_ref_entry)) {
 		res = PTR_ERR(tag_ref_entry);
-		spin_unlock_bh(&sock_tag_list_lock);
+		write_unlock_bh(&sock_tag_list_lock);
 		goto err_put;
 	}
 	tag_ref_entry->num_sock_tags++;
@@ -2162,7 +2311,9 @@ static int ctrl_cmd_tag(const char *input)
 		BUG_ON(IS_ERR_OR_NULL(prev_tag_ref_entry));
 		BUG_ON(prev_tag_ref_entry->num_sock_tags <= 0);
 		prev_tag_ref_entry->num_sock_tags--;
+		write_seqcount_begin(&sock_tag_seq);
 		sock_tag_entry->tag = full_tag;
+		write_seqcount_end(&sock_tag_seq);
 	} else {
 		CT_DEBUG("qtaguid: ctrl_tag(%s): newtag for sk=%p\n",
 			 input, el_socket->sk);
@@ -2172,7 +2323,7 @@ static int ctrl_cmd_tag(const char *input)
 			pr_err("qtaguid: ctrl_tag(%s): "
 			       "socket tag alloc failed\n",
 			       input);
-			spin_unlock_bh(&sock_tag_list_lock);
+			write_unlock_bh(&sock_tag_list_lock);
 			res = -ENOMEM;
 			goto err_tag_unref_put;
 		}
@@ -2201,10 +2352,10 @@ static int ctrl_cmd_tag(const char *input)
 				 &pqd_entry->sock_tag_list);
 		spin_unlock_bh(&uid_tag_data_tree_lock);
 
-		sock_tag_tree_insert(sock_tag_entry, &sock_tag_tree);
+		sock_tag_add(sock_tag_entry);
 		atomic64_inc(&qtu_events.sockets_tagged);
 	}
-	spin_unlock_bh(&sock_tag_list_lock);
+	write_unlock_bh(&sock_tag_list_lock);
 	/* We keep the ref to the socket (file) until it is untagged */
 	CT_DEBUG("qtaguid: ctrl_tag(%s): done st@%p ...->f_count=%ld\n",
 		 input, sock_tag_entry,
@@ -2254,10 +2405,10 @@ static int ctrl_cmd_untag(const char *input)
 	CT_DEBUG("qtaguid: ctrl_untag(%s): socket->...->f_count=%ld ->sk=%p\n",
 		 input, atomic_long_read(&el_socket->file->f_count),
 		 el_socket->sk);
-	spin_lock_bh(&sock_tag_list_lock);
+	write_lock_bh(&sock_tag_list_lock);
 	sock_tag_entry = get_sock_stat_nl(el_socket->sk);
 	if (!sock_tag_entry) {
-		spin_unlock_bh(&sock_tag_list_lock);
+		write_unlock_bh(&sock_tag_list_lock);
 		res = -EINVAL;
 		goto err_put;
 	}
@@ -2265,7 +2416,7 @@ static int ctrl_cmd_untag(const char *input)
 	 * The socket already belongs to the current process
 	 * so it can do whatever it wants to it.
 	 */
-	rb_erase(&sock_tag_entry->sock_node, &sock_tag_tree);
+	sock_tag_del(sock_tag_entry);
 
 	tag_ref_entry = lookup_tag_ref(sock_tag_entry->tag, &utd_entry);
 	BUG_ON(!tag_ref_entry);
@@ -2291,7 +2442,7 @@ static int ctrl_cmd_untag(const char *input)
 	 * only during a cmd_delete().
 	 */
 	tag_ref_entry->num_sock_tags--;
-	spin_unlock_bh(&sock_tag_list_lock);
+	write_unlock_bh(&sock_tag_list_lock);
 	/*
 	 * Release the sock_fd that was grabbed at tag time,
 	 * and once more for the sockfd_lookup() here.
@@ -2302,7 +2453,7 @@ static int ctrl_cmd_untag(const char *input)
 		 atomic_long_read(&el_socket->file->f_count) - 1);
 	sockfd_put(el_socket);
 
-	kfree(sock_tag_entry);
+	call_rcu_bh(&sock_tag_entry->rcu, sock_tag_free);
 	atomic64_inc(&qtu_events.sockets_untagged);
 
 	return 0;
@@ -2378,6 +2529,8 @@ struct proc_print_info {
 	char **num_items_returned;
 	struct iface_stat *iface_entry;
 	struct tag_stat *ts_entry;
+	/* ts_entry->counters, summed up over all cpus */
+	struct data_counters cnts;
 	int item_index;
 	int items_to_skip;
 	int char_count;
@@ -2416,7 +2569,7 @@ static int pp_stats_line(struct proc_print_info *ppi, int cnt_set)
 		}
 		if (ppi->item_index++ < ppi->items_to_skip)
 			return 0;
-		cnts = &ppi->ts_entry->counters;
+		cnts = &ppi->cnts;
 		len = snprintf(
 			ppi->outp, ppi->char_count,
 			"%d %s 0x%llx %u %u "
@@ -2457,6 +2610,8 @@ static bool pp_sets(struct proc_print_info *ppi)
 {
 	int len;
 	int counter_set;
+
+	tag_stat_counters_fold(ppi->ts_entry->counters, &ppi->cnts);
 	for (counter_set = 0; counter_set < IFS_MAX_COUNTER_SETS;
 	     counter_set++) {
 		len = pp_stats_line(ppi, counter_set);
@@ -2523,19 +2678,19 @@ static int qtaguid_stats_proc_read(char *page, char **num_items_returned,
 	spin_lock_bh(&iface_stat_list_lock);
 	list_for_each_entry(ppi.iface_entry, &iface_stat_list, list) {
 		struct rb_node *node;
-		spin_lock_bh(&ppi.iface_entry->tag_stat_list_lock);
+		read_lock_bh(&ppi.iface_entry->tag_stat_list_lock);
 		for (node = rb_first(&ppi.iface_entry->tag_stat_tree);
 		     node;
 		     node = rb_next(node)) {
 			ppi.ts_entry = rb_entry(node, struct tag_stat, tn.node);
 			if (!pp_sets(&ppi)) {
-				spin_unlock_bh(
+				read_unlock_bh(
 					&ppi.iface_entry->tag_stat_list_lock);
 				spin_unlock_bh(&iface_stat_list_lock);
 				return ppi.outp - page;
 			}
 		}
-		spin_unlock_bh(&ppi.iface_entry->tag_stat_list_lock);
+		read_unlock_bh(&ppi.iface_entry->tag_stat_list_lock);
 	}
 	spin_unlock_bh(&iface_stat_list_lock);
 
@@ -2543,6 +2698,211 @@ static int qtaguid_stats_proc_read(char *page, char **num_items_returned,
 	return ppi.outp - page;
 }
 
+/*------------------------------------------*/
+static struct genl_family qtaguid_genl_family = {
+	.id = GENL_ID_GENERATE,
+	.name = QTAGUID_GENL_NAME,
+	.version = QTAGUID_GENL_VERSION,
+	.maxattr = QTAGUID_A_MAX,
+};
+
+static const struct nla_policy qtaguid_genl_policy[QTAGUID_A_MAX + 1] = {
+	[QTAGUID_A_GENERATION] = { .type = NLA_U64 },
+};
+
+/* Any cpu billed the tag_stat since the given generation */
+static bool tag_stat_changed_since(struct tag_stat *ts_entry,
+				   unsigned long generation)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		if ((long)(ts_entry->counters[cpu].generation - generation)
+		    >= 0)
+			return true;
+	}
+	return false;
+}
+
+static int qtaguid_genl_fill_stats(struct sk_buff *skb,
+				   struct netlink_callback *cb,
+				   struct iface_stat *iface_entry, tag_t tag,
+				   struct data_counters *cnts, int cnt_set)
+{
+	struct qtaguid_stats_record *rec;
+	struct nlattr *attr;
+	void *hdr;
+	int proto;
+
+	hdr = genlmsg_put(skb, NETLINK_CB(cb->skb).pid, cb->nlh->nlmsg_seq,
+			  &qtaguid_genl_family, NLM_F_MULTI,
+			  QTAGUID_CMD_GET_STATS);
+	if (!hdr)
+		return -EMSGSIZE;
+
+	NLA_PUT_U64(skb, QTAGUID_A_GENERATION, cb->args[0]);
+	attr = nla_reserve(skb, QTAGUID_A_STATS, sizeof(*rec));
+	if (!attr)
+		goto nla_put_failure;
+	rec = nla_data(attr);
+	memset(rec, 0, sizeof(*rec));
+	strlcpy(rec->iface, iface_entry->ifname, sizeof(rec->iface));
+	rec->acct_tag = get_atag_from_tag(tag);
+	rec->uid = get_uid_from_tag(tag);
+	rec->cnt_set = cnt_set;
+	for (proto = 0; proto < IFS_MAX_PROTOS; proto++) {
+		rec->rx_bytes[proto] = cnts->bpc[cnt_set][IFS_RX][proto].bytes;
+		rec->rx_packets[proto] =
+			cnts->bpc[cnt_set][IFS_RX][proto].packets;
+		rec->tx_bytes[proto] = cnts->bpc[cnt_set][IFS_TX][proto].bytes;
+		rec->tx_packets[proto] =
+			cnts->bpc[cnt_set][IFS_TX][proto].packets;
+	}
+
+	return genlmsg_end(skb, hdr);
+
+nla_put_failure:
+	genlmsg_cancel(skb, hdr);
+	return -EMSGSIZE;
+}
+
+/*
+ * Whether the sender of a netlink request may read the stats of all uids,
+ * from the credentials it sent: the dump only runs as the sender on its
+ * first call, from its sendmsg(), and later ones run as whoever reads the
+ * socket. Supplementary groups aren't in the credentials, so they are
+ * only looked at while the sender itself is current.
+ */
+static bool creds_can_read_all_uid_stats(const struct ucred *creds)
+{
+	/* root pwnd */
+	return unlikely(!creds->uid) || unlikely(!proc_stats_readall_gid)
+		|| creds->gid == proc_stats_readall_gid
+		|| (creds->pid == task_tgid_vnr(current)
+		    && in_egroup_p(proc_stats_readall_gid));
+}
+
+/* The first tag_stat in the tree with a tag of at least 'tag' */
+static struct rb_node *tag_stat_tree_lower_bound(struct rb_root *root,
+						 tag_t tag)
+{
+	struct rb_node *node = root->rb_node;
+	struct rb_node *found = NULL;
+
+	while (node) {
+		struct tag_stat *ts_entry = rb_entry(node, struct tag_stat,
+						     tn.node);
+
+		if (tag_compare(tag, ts_entry->tn.tag) <= 0) {
+			found = node;
+			node = node->rb_left;
+		} else {
+			node = node->rb_right;
+		}
+	}
+	return found;
+}
+
+/* cb->args[5] of a dump whose requester may read the stats of all uids */
+#define QTAGUID_DUMP_ALL_UIDS	(-1L)
+
+/*
+ * Netlink counterpart of qtaguid_stats_proc_read().
+ * cb->args[0] is the generation reported by this dump, [1] the one asked
+ * for, [2] the list_head of the iface_stat to resume at (iface_stat_list
+ * itself once done; iface_stats are never freed), [3] and [4] the low and
+ * high halves of the lowest tag left to send of it, and [5] the uid
+ * whose stats the requester may read, or QTAGUID_DUMP_ALL_UIDS.
+ * The records of all counter sets of a tag go out in the same skb, so
+ * that the dump can resume at a tag, which stays correct when tag_stats
+ * are added or deleted in between.
+ */
+static int qtaguid_genl_dump_stats(struct sk_buff *skb,
+				   struct netlink_callback *cb)
+{
+	struct iface_stat *iface_entry;
+	struct tag_stat *ts_entry;
+	struct data_counters cnts;
+	struct list_head *pos;
+	struct rb_node *node;
+	unsigned char *mark;
+	tag_t tag;
+	int cnt_set;
+
+	if (unlikely(module_passive))
+		return 0;
+
+	if (!cb->args[0]) {
+		struct nlattr *tb[QTAGUID_A_MAX + 1];
+		struct ucred *creds = NETLINK_CREDS(cb->skb);
+		int err;
+
+		err = nlmsg_parse(cb->nlh, GENL_HDRLEN, tb, QTAGUID_A_MAX,
+				  qtaguid_genl_policy);
+		if (err)
+			return err;
+		if (tb[QTAGUID_A_GENERATION])
+			cb->args[1] = nla_get_u64(tb[QTAGUID_A_GENERATION]);
+		cb->args[0] = atomic_long_inc_return(&stats_generation) - 1;
+		cb->args[5] = creds_can_read_all_uid_stats(creds) ?
+			QTAGUID_DUMP_ALL_UIDS : creds->uid;
+		spin_lock_bh(&iface_stat_list_lock);
+		cb->args[2] = (long)iface_stat_list.next;
+		spin_unlock_bh(&iface_stat_list_lock);
+	}
+
+	tag = (u32)cb->args[3] | (tag_t)(u32)cb->args[4] << 32;
+	spin_lock_bh(&iface_stat_list_lock);
+	for (pos = (struct list_head *)cb->args[2];
+	     pos != &iface_stat_list;
+	     pos = pos->next, tag = 0) {
+		iface_entry = list_entry(pos, struct iface_stat, list);
+		read_lock_bh(&iface_entry->tag_stat_list_lock);
+		for (node = tag_stat_tree_lower_bound(
+				&iface_entry->tag_stat_tree, tag);
+		     node;
+		     node = rb_next(node)) {
+			ts_entry = rb_entry(node, struct tag_stat, tn.node);
+			tag = ts_entry->tn.tag;
+			if ((cb->args[5] != QTAGUID_DUMP_ALL_UIDS &&
+			     get_uid_from_tag(tag) != (uid_t)cb->args[5]) ||
+			    (cb->args[1] &&
+			     !tag_stat_changed_since(ts_entry, cb->args[1])))
+				continue;
+			tag_stat_counters_fold(ts_entry->counters, &cnts);
+			mark = skb_tail_pointer(skb);
+			for (cnt_set = 0; cnt_set < IFS_MAX_COUNTER_SETS;
+			     cnt_set++) {
+				if (qtaguid_genl_fill_stats(skb, cb,
+							    iface_entry, tag,
+							    &cnts,
+							    cnt_set) < 0) {
+					/* all of this tag goes in the next one */
+					nlmsg_trim(skb, mark);
+					read_unlock_bh(
+					    &iface_entry->tag_stat_list_lock);
+					goto out;
+				}
+			}
+		}
+		read_unlock_bh(&iface_entry->tag_stat_list_lock);
+	}
+out:
+	spin_unlock_bh(&iface_stat_list_lock);
+	cb->args[2] = (long)pos;
+	cb->args[3] = (u32)tag;
+	cb->args[4] = tag >> 32;
+	return skb->len;
+}
+
+static struct genl_ops qtaguid_genl_ops[] = {
+	{
+		.cmd = QTAGUID_CMD_GET_STATS,
+		.policy = qtaguid_genl_policy,
+		.dumpit = qtaguid_genl_dump_stats,
+	},
+};
+
 /*------------------------------------------*/
 static int qtudev_open(struct inode *inode, struct file *file)
 {
@@ -2634,7 +2994,7 @@ static int qtudev_release(struct inode *inode, struct file *file)
 		 pqd_entry, pqd_entry->pid, utd_entry,
 		 utd_entry->num_active_tags);
 
-	spin_lock_bh(&sock_tag_list_lock);
+	write_lock_bh(&sock_tag_list_lock);
 	spin_lock_bh(&uid_tag_data_tree_lock);
 
 	list_for_each_safe(entry, next, &pqd_entry->sock_tag_list) {
@@ -2660,7 +3020,7 @@ static int qtudev_release(struct inode *inode, struct file *file)
 		tr->num_sock_tags--;
 		free_tag_ref_from_utd_entry(tr, utd_entry);
 
-		rb_erase(&st_entry->sock_node, &sock_tag_tree);
+		sock_tag_del(st_entry);
 		list_del(&st_entry->list);
 		/* Can't sockfd_put() within spinlock, do it later. */
 		sock_tag_tree_insert(st_entry, &st_to_free_tree);
@@ -2681,7 +3041,7 @@ static int qtudev_release(struct inode *inode, struct file *file)
 	file->private_data = NULL;
 
 	spin_unlock_bh(&uid_tag_data_tree_lock);
-	spin_unlock_bh(&sock_tag_list_lock);
+	write_unlock_bh(&sock_tag_list_lock);
 
 
 	sock_tag_tree_erase(&st_to_free_tree);
@@ -2768,7 +3128,10 @@ static int __init qtaguid_mt_init(void)
 	if (qtaguid_proc_register(&xt_qtaguid_procdir)
 	    || iface_stat_init(xt_qtaguid_procdir)
 	    || xt_register_match(&qtaguid_mt_reg)
-	    || misc_register(&qtu_device))
+	    || misc_register(&qtu_device)
+	    || genl_register_family_with_ops(&qtaguid_genl_family,
+					     qtaguid_genl_ops,
+					     ARRAY_SIZE(qtaguid_genl_ops)))
 		return -1;
 	return 0;
 }
@@ -12,8 +12,13 @@
 
 #include <linux/types.h>
 #include <linux/rbtree.h>
+#include <linux/rcupdate.h>
 #include <linux/spinlock_types.h>
 #include <linux/workqueue.h>
+#include <linux/cache.h>
+#include <linux/cpumask.h>
+#include <linux/string.h>
+#include <linux/u64_stats_sync.h>
 
 /* Iface handling */
 #define IDEBUG_MASK (1<<0)
@@ -149,6 +154,9 @@ static inline tag_t make_atag_from_value(uint32_t value)
  */
 #define DEFAULT_MAX_SOCK_TAGS 1024
 
+/* Buckets for the per-iface tag_stat lookups done by the packet path */
+#define TAG_STAT_HASH_BITS 6
+
 /*
  * For now we only track 2 sets of counters.
  * The default set is 0.
@@ -185,16 +193,57 @@ struct tag_node {
 	tag_t tag;
 };
 
+/*
+ * One cpu's share of a tag_stat's counters. It is only ever updated by
+ * that cpu with BHs disabled, so packets on different cpus never contend
+ * for it, and needs neither a lock nor atomic ops.
+ */
+struct tag_stat_cpu {
+	struct data_counters dc;
+	struct u64_stats_sync syncp;
+	/* stats_generation as of the last update, for netlink dumps */
+	unsigned long generation;
+} ____cacheline_aligned_in_smp;
+
 struct tag_stat {
 	struct tag_node tn;
-	struct data_counters counters;
+	/* in iface_stat.tag_stat_hash, walked under rcu_read_lock_bh() */
+	struct hlist_node hash_node;
+	struct rcu_head rcu;
+	/* nr_cpu_ids entries, use tag_stat_counters_fold() to read them */
+	struct tag_stat_cpu *counters;
 	/*
 	 * If this tag is acct_tag based, we need to count against the
 	 * matching parent uid_tag.
 	 */
-	struct data_counters *parent_counters;
+	struct tag_stat_cpu *parent_counters;
 };
 
+/* Sums up the per-cpu counters of a tag_stat into *sum */
+static inline void tag_stat_counters_fold(struct tag_stat_cpu *tsc,
+					  struct data_counters *sum)
+{
+	struct data_counters snap;
+	struct byte_packet_counters *from, *to;
+	unsigned int start;
+	int cpu, i;
+
+	memset(sum, 0, sizeof(*sum));
+	for_each_possible_cpu(cpu) {
+		do {
+			start = u64_stats_fetch_begin_bh(&tsc[cpu].syncp);
+			snap = tsc[cpu].dc;
+		} while (u64_stats_fetch_retry_bh(&tsc[cpu].syncp, start));
+
+		from = &snap.bpc[0][0][0];
+		to = &sum->bpc[0][0][0];
+		for (i = 0; i < sizeof(snap.bpc) / sizeof(*from); i++) {
+			to[i].bytes += from[i].bytes;
+			to[i].packets += from[i].packets;
+		}
+	}
+}
+
 struct iface_stat {
 	struct list_head list;  /* in iface_stat_list */
 	char *ifname;
@@ -217,8 +266,15 @@ struct iface_stat {
 
 	struct proc_dir_entry *proc_ptr;
 
+	/*
+	 * Changed only when a tag is first seen on this iface or deleted,
+	 * with tag_stat_list_lock held for writing. The packet path looks
+	 * tags up in tag_stat_hash under RCU, the tree is for walking them
+	 * in order.
+	 */
 	struct rb_root tag_stat_tree;
-	spinlock_t tag_stat_list_lock;
+	struct hlist_head tag_stat_hash[1 << TAG_STAT_HASH_BITS];
+	rwlock_t tag_stat_list_lock;
 };
 
 /* This is needed to create proc_dir_entries from atomic context. */
@@ -235,6 +291,9 @@ struct iface_stat_work {
  */
 struct sock_tag {
 	struct rb_node sock_node;
+	/* in sock_tag_hash, walked under rcu_read_lock_bh() */
+	struct hlist_node hash_node;
+	struct rcu_head rcu;
 	struct sock *sk;  /* Only used as a number, never dereferenced */
 	/* The socket is needed for sockfd_put() */
 	struct socket *socket;
@@ -154,6 +154,8 @@ char *pp_tag_stat(struct tag_stat *ts)
 	char *tn_str;
 	char *counters_str;
 	char *parent_counters_str;
+	struct data_counters counters;
+	struct data_counters parent_counters;
 	char *res;
 
 	if (!ts) {
@@ -162,8 +164,12 @@ char *pp_tag_stat(struct tag_stat *ts)
 		return res;
 	}
 	tn_str = pp_tag_node(&ts->tn);
-	counters_str = pp_data_counters(&ts->counters, true);
-	parent_counters_str = pp_data_counters(ts->parent_counters, false);
+	tag_stat_counters_fold(ts->counters, &counters);
+	counters_str = pp_data_counters(&counters, true);
+	if (ts->parent_counters)
+		tag_stat_counters_fold(ts->parent_counters, &parent_counters);
+	parent_counters_str = pp_data_counters(
+		ts->parent_counters ? &parent_counters : NULL, false);
 	res = kasprintf(GFP_ATOMIC,
 			"tag_stat@%p{%s, counters=%s, parent_counters=%s}",
 			ts, tn_str, counters_str, parent_counters_str);
@@ -507,14 +513,14 @@ void prdebug_iface_stat_list(int indent_level,
 		pr_debug("%*d: %s\n", indent_level*2, indent_level, str);
 		kfree(str);
 
-		spin_lock_bh(&iface_entry->tag_stat_list_lock);
+		read_lock_bh(&iface_entry->tag_stat_list_lock);
 		if (!RB_EMPTY_ROOT(&iface_entry->tag_stat_tree)) {
 			indent_level++;
 			prdebug_tag_stat_tree(indent_level,
 					      &iface_entry->tag_stat_tree);
 			indent_level--;
 		}
-		spin_unlock_bh(&iface_entry->tag_stat_list_lock);
+		read_unlock_bh(&iface_entry->tag_stat_list_lock);
 	}
 	indent_level--;
 	str = "}";
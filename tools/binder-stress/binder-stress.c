@@ -0,0 +1,436 @@
+/*
+ * binder-stress.c - Load binder with synchronous transactions
+ *
+ * Becomes the context manager of /dev/binder, serves it with a number of
+ * looper threads and forks client processes whose threads call it back
+ * to back, each call carrying a payload of the given size and getting a
+ * 4-byte reply. After the given time it prints the calls made per second,
+ * their mean and worst latency and, when debugfs is mounted, how often
+ * binder_main_lock was taken and found contended meanwhile:
+ *
+ *	binder-stress [-c clients] [-t threads] [-l loopers] [-s size]
+ *		      [-d seconds] [-D device]
+ *
+ * Every payload byte is checked by the server and every reply by its
+ * client, so that a buffer filled with the main lock dropped is checked
+ * as well as timed. Sweeping the number of clients shows how calls scale
+ * with senders, e.g. before and after a change to the locking:
+ *
+ *	for c in 1 2 4 8 16; do ./binder-stress -c $c -s 4096; done
+ *
+ * Needs a binder device whose context manager is not taken yet, i.e. not
+ * on a running Android system, where servicemanager holds it.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "binder.h"
+
+#define MAP_SIZE	(1024 * 1024)
+#define MAX_SIZE	(MAP_SIZE / 4)
+#define STATS_FILE	"/sys/kernel/debug/binder/stats"
+
+struct shared {
+	volatile int start;
+	volatile int stop;
+	unsigned long long calls;
+	unsigned long long ns;
+	unsigned long long max_ns;
+	unsigned long long bad;
+};
+
+static struct shared *shared;
+static const char *device = "/dev/binder";
+static int server_fd;
+static size_t size = 128;
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-c clients] [-t threads] [-l loopers] [-s size]\n"
+		"       [-d seconds] [-D device]\n"
+		"  threads is per client process, size is the payload in\n"
+		"  bytes, at most %d\n", prog, MAX_SIZE);
+	exit(1);
+}
+
+static unsigned long parse_ulong(const char *prog, const char *arg)
+{
+	char *end;
+	unsigned long val = strtoul(arg, &end, 0);
+
+	if (!*arg || *end)
+		usage(prog);
+	return val;
+}
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int open_binder(void)
+{
+	int fd = open(device, O_RDWR);
+
+	if (fd < 0) {
+		perror(device);
+		exit(1);
+	}
+	/* the driver refuses writable mappings */
+	if (mmap(NULL, MAP_SIZE, PROT_READ, MAP_PRIVATE, fd, 0) ==
+	    MAP_FAILED) {
+		perror("mmap");
+		exit(1);
+	}
+	return fd;
+}
+
+static int write_read(int fd, void *wbuf, size_t wsize, void *rbuf,
+		      size_t rsize, size_t *rdone)
+{
+	struct binder_write_read bwr;
+
+	bwr.write_size = wsize;
+	bwr.write_consumed = 0;
+	bwr.write_buffer = (unsigned long)wbuf;
+	bwr.read_size = rsize;
+	bwr.read_consumed = 0;
+	bwr.read_buffer = (unsigned long)rbuf;
+	while (ioctl(fd, BINDER_WRITE_READ, &bwr) < 0) {
+		if (errno != EINTR)
+			return -1;
+		/* only the part not consumed yet is retried */
+		bwr.write_buffer += bwr.write_consumed;
+		bwr.write_size -= bwr.write_consumed;
+		bwr.write_consumed = 0;
+	}
+	if (rdone)
+		*rdone = bwr.read_consumed;
+	return 0;
+}
+
+/* Appends a command and its argument to a write buffer */
+static size_t put_cmd(char *buf, size_t pos, uint32_t cmd, const void *arg,
+		      size_t arg_size)
+{
+	memcpy(buf + pos, &cmd, sizeof(cmd));
+	memcpy(buf + pos + sizeof(cmd), arg, arg_size);
+	return pos + sizeof(cmd) + arg_size;
+}
+
+/* The size of a return command's argument */
+static size_t arg_size(uint32_t cmd)
+{
+	return _IOC_SIZE(cmd);
+}
+
+static void *looper(void *unused)
+{
+	char wbuf[256], rbuf[256];
+	struct binder_transaction_data tr, reply;
+	const unsigned char *data;
+	uint32_t cmd, seq = 0;
+	size_t wpos, rpos, rdone;
+	void *ptr;
+	size_t i;
+
+	(void)unused;
+	wpos = put_cmd(wbuf, 0, BC_ENTER_LOOPER, NULL, 0);
+	for (;;) {
+		if (write_read(server_fd, wbuf, wpos, rbuf, sizeof(rbuf),
+			       &rdone) < 0)
+			break;
+		wpos = 0;
+		for (rpos = 0; rpos + sizeof(cmd) <= rdone;
+		     rpos += sizeof(cmd) + arg_size(cmd)) {
+			memcpy(&cmd, rbuf + rpos, sizeof(cmd));
+			if (cmd != BR_TRANSACTION)
+				continue;
+			memcpy(&tr, rbuf + rpos + sizeof(cmd), sizeof(tr));
+			data = tr.data.ptr.buffer;
+			if (tr.data_size != size) {
+				__sync_fetch_and_add(&shared->bad, 1);
+			} else {
+				memcpy(&seq, data, sizeof(seq));
+				for (i = sizeof(seq); i < size; i++)
+					if (data[i] != (unsigned char)seq)
+						break;
+				if (i < size)
+					__sync_fetch_and_add(&shared->bad, 1);
+			}
+
+			ptr = (void *)tr.data.ptr.buffer;
+			wpos = put_cmd(wbuf, wpos, BC_FREE_BUFFER, &ptr,
+				       sizeof(ptr));
+			memset(&reply, 0, sizeof(reply));
+			reply.data_size = sizeof(seq);
+			reply.data.ptr.buffer = &seq;
+			wpos = put_cmd(wbuf, wpos, BC_REPLY, &reply,
+				       sizeof(reply));
+			/* seq must stay put until the reply is written */
+			if (write_read(server_fd, wbuf, wpos, NULL, 0,
+				       NULL) < 0)
+				return NULL;
+			wpos = 0;
+		}
+	}
+	return NULL;
+}
+
+static void *caller(void *arg)
+{
+	int fd = *(int *)arg;
+	char wbuf[256], rbuf[256];
+	struct binder_transaction_data tr;
+	unsigned char *payload;
+	uint32_t cmd, seq = 0, got;
+	unsigned long long calls = 0, ns = 0, max_ns = 0, bad = 0, t0, t;
+	size_t wpos, rpos, rdone;
+	void *free_ptr = NULL;
+	int done;
+
+	payload = malloc(size);
+	if (!payload) {
+		perror("malloc");
+		exit(1);
+	}
+
+	while (!shared->stop) {
+		seq++;
+		memset(payload, (unsigned char)seq, size);
+		memcpy(payload, &seq, sizeof(seq));
+
+		wpos = 0;
+		if (free_ptr)
+			wpos = put_cmd(wbuf, wpos, BC_FREE_BUFFER, &free_ptr,
+				       sizeof(free_ptr));
+		free_ptr = NULL;
+		memset(&tr, 0, sizeof(tr));
+		tr.target.handle = 0;
+		tr.code = 1;
+		tr.data_size = size;
+		tr.data.ptr.buffer = payload;
+		wpos = put_cmd(wbuf, wpos, BC_TRANSACTION, &tr, sizeof(tr));
+
+		t0 = now_ns();
+		for (done = 0; !done; wpos = 0) {
+			if (write_read(fd, wbuf, wpos, rbuf, sizeof(rbuf),
+				       &rdone) < 0) {
+				perror("BINDER_WRITE_READ");
+				exit(1);
+			}
+			for (rpos = 0; rpos + sizeof(cmd) <= rdone;
+			     rpos += sizeof(cmd) + arg_size(cmd)) {
+				memcpy(&cmd, rbuf + rpos, sizeof(cmd));
+				if (cmd == BR_DEAD_REPLY ||
+				    cmd == BR_FAILED_REPLY) {
+					fprintf(stderr, "call failed\n");
+					exit(1);
+				}
+				if (cmd != BR_REPLY)
+					continue;
+				memcpy(&tr, rbuf + rpos + sizeof(cmd),
+				       sizeof(tr));
+				memcpy(&got, tr.data.ptr.buffer, sizeof(got));
+				if (tr.data_size != sizeof(got) || got != seq)
+					bad++;
+				free_ptr = (void *)tr.data.ptr.buffer;
+				done = 1;
+			}
+		}
+		t = now_ns() - t0;
+		calls++;
+		ns += t;
+		if (t > max_ns)
+			max_ns = t;
+	}
+
+	__sync_fetch_and_add(&shared->calls, calls);
+	__sync_fetch_and_add(&shared->ns, ns);
+	__sync_fetch_and_add(&shared->bad, bad);
+	while ((t = shared->max_ns) < max_ns &&
+	       !__sync_bool_compare_and_swap(&shared->max_ns, t, max_ns))
+		;
+	free(payload);
+	return NULL;
+}
+
+static void client(int threads)
+{
+	pthread_t *tids = calloc(threads, sizeof(*tids));
+	int fd, i;
+
+	if (!tids) {
+		perror("calloc");
+		exit(1);
+	}
+	while (!shared->start)
+		usleep(1000);
+	if (shared->stop)
+		exit(0);
+	fd = open_binder();
+	for (i = 0; i < threads; i++)
+		if (pthread_create(&tids[i], NULL, caller, &fd)) {
+			fprintf(stderr, "pthread_create failed\n");
+			exit(1);
+		}
+	for (i = 0; i < threads; i++)
+		pthread_join(tids[i], NULL);
+	exit(0);
+}
+
+/* Reads binder_main_lock's acquired and contended counts, if it can */
+static int lock_stats(unsigned long *acquired, unsigned long *contended)
+{
+	FILE *f = fopen(STATS_FILE, "r");
+	char line[256];
+	int ret = -1;
+
+	if (!f)
+		return -1;
+	while (fgets(line, sizeof(line), f))
+		if (sscanf(line, "lock: acquired %lu contended %lu",
+			   acquired, contended) == 2) {
+			ret = 0;
+			break;
+		}
+	fclose(f);
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long clients = 4, threads = 1, loopers = 4, seconds = 5;
+	unsigned long acq0, con0, acq1, con1;
+	size_t max_threads = 0;
+	int have_stats, status, opt, ret = 0;
+	pthread_t tid;
+	pid_t *pids;
+	unsigned long i;
+
+	while ((opt = getopt(argc, argv, "c:t:l:s:d:D:")) != -1) {
+		switch (opt) {
+		case 'c':
+			clients = parse_ulong(argv[0], optarg);
+			break;
+		case 't':
+			threads = parse_ulong(argv[0], optarg);
+			break;
+		case 'l':
+			loopers = parse_ulong(argv[0], optarg);
+			break;
+		case 's':
+			size = parse_ulong(argv[0], optarg);
+			break;
+		case 'd':
+			seconds = parse_ulong(argv[0], optarg);
+			break;
+		case 'D':
+			device = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc || !clients || !threads || !loopers ||
+	    !seconds || size < sizeof(uint32_t) || size > MAX_SIZE)
+		usage(argv[0]);
+
+	shared = mmap(NULL, sizeof(*shared), PROT_READ | PROT_WRITE,
+		      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (shared == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+
+	pids = calloc(clients, sizeof(*pids));
+	if (!pids) {
+		perror("calloc");
+		return 1;
+	}
+	/*
+	 * The clients are forked first, so that they inherit neither the
+	 * server's binder fd and mapping nor its threads, and wait for it.
+	 */
+	for (i = 0; i < clients; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			perror("fork");
+			clients = i;
+			ret = 1;
+			break;
+		}
+		if (!pids[i])
+			client(threads);
+	}
+
+	if (!ret) {
+		server_fd = open_binder();
+		/* only our own loopers, never ones requested by the driver */
+		if (ioctl(server_fd, BINDER_SET_MAX_THREADS, &max_threads) < 0 ||
+		    ioctl(server_fd, BINDER_SET_CONTEXT_MGR, 0) < 0) {
+			perror("BINDER_SET_CONTEXT_MGR");
+			ret = 1;
+		}
+	}
+	for (i = 0; !ret && i < loopers; i++)
+		if (pthread_create(&tid, NULL, looper, NULL)) {
+			fprintf(stderr, "pthread_create failed\n");
+			ret = 1;
+		}
+
+	have_stats = !lock_stats(&acq0, &con0);
+	if (ret)
+		shared->stop = 1;
+	shared->start = 1;
+	if (!ret) {
+		sleep(seconds);
+		shared->stop = 1;
+	}
+	for (i = 0; i < clients; i++) {
+		if (waitpid(pids[i], &status, 0) < 0 ||
+		    !WIFEXITED(status) || WEXITSTATUS(status))
+			ret = 1;
+	}
+	if (!shared->calls)
+		return 1;
+	have_stats = have_stats && !lock_stats(&acq1, &con1);
+
+	printf("%lu clients x %lu threads, %lu loopers, %zu bytes: "
+	       "%.0f calls/s, avg %.1fus max %.1fus",
+	       clients, threads, loopers, size,
+	       (double)shared->calls / seconds,
+	       shared->calls ? shared->ns / 1000.0 / shared->calls : 0,
+	       shared->max_ns / 1000.0);
+	if (have_stats)
+		printf(", lock contended %lu of %lu",
+		       con1 - con0, acq1 - acq0);
+	printf("\n");
+	if (shared->bad) {
+		fprintf(stderr, "%llu calls with a bad payload or reply\n",
+			shared->bad);
+		ret = 1;
+	}
+	/* the loopers are still blocked in the driver */
+	return ret;
+}
@@ -0,0 +1,250 @@
+/*
+ * interactive-replay.c - Replay load samples through the interactive governor
+ *
+ * Feeds a recorded load trace to the speed selection of
+ * drivers/cpufreq/cpufreq_interactive.c and prints the speed it settles
+ * on at each sample, so that target_loads and the input boost can be
+ * tuned on a host.
+ *
+ * Each input line is one event, with its time in us:
+ *
+ *	time load	a timer sample, load being the % busy since the last one
+ *	time input	a touch or key event
+ *
+ * Lines starting with '#' are skipped. Like the governor's timer, a speed
+ * is only lowered once min_sample_time has passed since the last change,
+ * and picked from the table as the highest at or below the wanted one.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cpufreq_interactive_policy.h"
+
+#define MAX_FREQS	32
+#define MAX_LOADS	(2 * MAX_FREQS + 1)
+
+static unsigned int freqs[MAX_FREQS];
+static int nfreqs;
+static unsigned long long residency[MAX_FREQS];
+
+static unsigned int target_loads[MAX_LOADS] = { 85 };
+static int ntarget_loads = 1;
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-f freq,freq,...] [-t target_loads]\n"
+		"       [-m min_sample_time] [-b input_boost_freq]\n"
+		"       [-d input_boost_duration] [-B boost_factor]\n"
+		"       [-M max_boost] [-S sustain_load] [file]\n"
+		"  freqs are in kHz and times in us, target_loads is\n"
+		"  \"load freq:load ...\" as in sysfs\n", prog);
+	exit(1);
+}
+
+static unsigned long parse_ulong(const char *prog, const char *arg)
+{
+	char *end;
+	unsigned long val = strtoul(arg, &end, 0);
+
+	if (!*arg || *end)
+		usage(prog);
+	return val;
+}
+
+static void parse_freqs(const char *prog, char *arg)
+{
+	char *tok;
+
+	nfreqs = 0;
+	for (tok = strtok(arg, ","); tok; tok = strtok(NULL, ",")) {
+		if (nfreqs == MAX_FREQS)
+			usage(prog);
+		freqs[nfreqs] = parse_ulong(prog, tok);
+		if (nfreqs && freqs[nfreqs] <= freqs[nfreqs - 1])
+			usage(prog);
+		nfreqs++;
+	}
+	if (!nfreqs)
+		usage(prog);
+}
+
+/* Same rules as the target_loads attribute */
+static void parse_target_loads(const char *prog, char *arg)
+{
+	char *tok;
+	int i = 0;
+
+	for (tok = strtok(arg, " :"); tok; tok = strtok(NULL, " :")) {
+		if (i == MAX_LOADS)
+			usage(prog);
+		target_loads[i] = parse_ulong(prog, tok);
+		if (i & 1) {
+			if (i > 1 && target_loads[i] <= target_loads[i - 2])
+				usage(prog);
+		} else if (!target_loads[i] || target_loads[i] > 100) {
+			usage(prog);
+		}
+		i++;
+	}
+	if (!(i & 1))
+		usage(prog);
+	ntarget_loads = i;
+}
+
+/* CPUFREQ_RELATION_H: the highest speed at or below freq, else the lowest */
+static int freq_index(unsigned int freq)
+{
+	int i;
+
+	for (i = nfreqs - 1; i > 0; i--)
+		if (freqs[i] <= freq)
+			break;
+	return i;
+}
+
+int main(int argc, char *argv[])
+{
+	/* the defaults of the governor */
+	struct interactive_params params = { 0, 0, 0 };
+	unsigned long min_sample_time = 30000;
+	unsigned long boost_freq = 0;
+	unsigned long boost_duration = 80000;
+	char default_freqs[] = "200000,400000,600000,800000,1000000,1200000";
+	unsigned long long t, last = 0, last_sample = 0, change_time = 0;
+	unsigned long long boost_until = 0, busy = 0, from;
+	unsigned long lineno = 0, changes = 0;
+	unsigned int load, lsc, max, wanted, new;
+	int cur, idx, opt;
+	char line[256], what[16];
+	const char *why;
+	FILE *in = stdin;
+
+	parse_freqs(argv[0], default_freqs);
+
+	while ((opt = getopt(argc, argv, "f:t:m:b:d:B:M:S:")) != -1) {
+		switch (opt) {
+		case 'f':
+			parse_freqs(argv[0], optarg);
+			break;
+		case 't':
+			parse_target_loads(argv[0], optarg);
+			break;
+		case 'm':
+			min_sample_time = parse_ulong(argv[0], optarg);
+			break;
+		case 'b':
+			boost_freq = parse_ulong(argv[0], optarg);
+			break;
+		case 'd':
+			boost_duration = parse_ulong(argv[0], optarg);
+			break;
+		case 'B':
+			params.boost_factor = parse_ulong(argv[0], optarg);
+			break;
+		case 'M':
+			params.max_boost = parse_ulong(argv[0], optarg);
+			break;
+		case 'S':
+			params.sustain_load = parse_ulong(argv[0], optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind < argc - 1)
+		usage(argv[0]);
+	if (optind == argc - 1) {
+		in = fopen(argv[optind], "r");
+		if (!in) {
+			perror(argv[optind]);
+			return 1;
+		}
+	}
+
+	max = freqs[nfreqs - 1];
+	cur = 0;
+
+	while (fgets(line, sizeof(line), in)) {
+		lineno++;
+		if (line[0] == '#' || line[strspn(line, " \t\n")] == '\0')
+			continue;
+
+		if (sscanf(line, "%llu %15s", &t, what) != 2 || t < last) {
+			fprintf(stderr, "line %lu: bad event\n", lineno);
+			return 1;
+		}
+		residency[cur] += t - last;
+		last = t;
+
+		if (!strcmp(what, "input")) {
+			if (!boost_duration)
+				continue;
+			boost_until = t + boost_duration;
+			idx = freq_index(interactive_boost_freq(boost_freq,
+								max));
+			if (idx > cur) {
+				cur = idx;
+				change_time = t;
+				busy = 0;
+				changes++;
+			}
+			printf("%llu: input boost until %llu, at %u\n",
+			       t, boost_until, freqs[cur]);
+			continue;
+		}
+
+		load = parse_ulong(argv[0], what);
+		if (load > 100) {
+			fprintf(stderr, "line %lu: bad load\n", lineno);
+			return 1;
+		}
+
+		/* the long-term load, since the last speed change */
+		from = last_sample > change_time ? last_sample : change_time;
+		busy += (unsigned long long)load * (t - from);
+		last_sample = t;
+		lsc = t > change_time ? busy / (t - change_time) : load;
+
+		wanted = interactive_get_target(&params,
+				interactive_target_load(target_loads,
+							ntarget_loads,
+							freqs[cur]),
+				load, lsc, freqs[cur], max);
+		if (t < boost_until &&
+		    wanted < interactive_boost_freq(boost_freq, max))
+			wanted = interactive_boost_freq(boost_freq, max);
+		idx = freq_index(wanted);
+		new = freqs[idx];
+
+		if (idx == cur) {
+			why = "hold";
+		} else if (idx < cur && t - change_time < min_sample_time) {
+			why = "hold, min_sample_time";
+		} else {
+			why = idx > cur ? "up" : "down";
+			cur = idx;
+			change_time = t;
+			busy = 0;
+			changes++;
+		}
+
+		printf("%llu: load=%u since_change=%u wanted=%u %s at %u\n",
+		       t, load, lsc, new, why, freqs[cur]);
+	}
+
+	printf("%lu speed changes\n", changes);
+	for (idx = 0; idx < nfreqs; idx++)
+		if (residency[idx])
+			printf("%u: %llu us\n", freqs[idx], residency[idx]);
+	if (in != stdin)
+		fclose(in);
+	return 0;
+}
@@ -0,0 +1,248 @@
+/*
+ * fault-latency.c - Time page faults that swap pages back in
+ *
+ * Fills a region of anonymous memory, pushes it out to swap by touching a
+ * larger balloon, and then times the first access to each page of the
+ * region that mincore() reports as swapped out, i.e. each major fault:
+ *
+ *	fault-latency [-m size_mb] [-b balloon_mb] [-r] [-v]
+ *
+ * By default every page holds a few words and is otherwise zero, which
+ * zcache compresses well, so with zcache enabled for frontswap these
+ * faults are served from compressed memory. With -r the pages are
+ * random, which zcache refuses as poorly compressible, so the same faults
+ * go to the swap device. Comparing the two, or the default pattern with
+ * and without "nofrontswap" on the command line, gives the cost of a
+ * frontswap hit against the block path on the same machine.
+ *
+ * Pages brought in by swap readahead are found resident and not timed.
+ * The counts of swap-ins from the block device (pswpin) and from
+ * frontswap (its debugfs gets) over the timed pass are printed along
+ * with the latencies, so that it is clear which path served them.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define FRONTSWAP_GETS	"/sys/kernel/debug/frontswap/gets"
+
+static size_t page_size;
+static int random_pages;
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-m size_mb] [-b balloon_mb] [-r] [-v]\n"
+		"  -b defaults to the free memory and page cache plus size,\n"
+		"  -r fills the pages with random data, -v prints every\n"
+		"  fault in us\n", prog);
+	exit(1);
+}
+
+static unsigned long parse_ulong(const char *prog, const char *arg)
+{
+	char *end;
+	unsigned long val = strtoul(arg, &end, 0);
+
+	if (!*arg || *end)
+		usage(prog);
+	return val;
+}
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* xorshift, seeded per page so that the contents can be checked */
+static uint64_t next_rand(uint64_t *x)
+{
+	*x ^= *x << 13;
+	*x ^= *x >> 7;
+	*x ^= *x << 17;
+	return *x;
+}
+
+static void fill_page(uint64_t *p, size_t n, int rnd)
+{
+	uint64_t x = 0x9e3779b97f4a7c15ULL * (n + 1);
+	size_t i, words = page_size / sizeof(*p);
+
+	if (!rnd) {
+		memset(p, 0, page_size);
+		for (i = 0; i < 4; i++)
+			p[i * 64] = next_rand(&x);
+		return;
+	}
+	for (i = 0; i < words; i++)
+		p[i] = next_rand(&x);
+}
+
+static int check_page(const uint64_t *p, size_t n)
+{
+	uint64_t want[page_size / sizeof(*p)];
+
+	fill_page(want, n, random_pages);
+	return memcmp(p, want, page_size);
+}
+
+/* Allocates and writes mb of incompressible memory, then frees it */
+static int balloon(unsigned long mb)
+{
+	size_t len = (size_t)mb << 20, off;
+	char *b = mmap(NULL, len, PROT_READ | PROT_WRITE,
+		       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (b == MAP_FAILED) {
+		perror("balloon");
+		return -1;
+	}
+	for (off = 0; off < len; off += page_size)
+		fill_page((uint64_t *)(b + off), off / page_size, 1);
+	munmap(b, len);
+	return 0;
+}
+
+/* Reads a value from a file, e.g. a /proc/meminfo or /proc/vmstat line */
+static long long read_value(const char *file, const char *key)
+{
+	FILE *f = fopen(file, "r");
+	char line[256];
+	size_t len = key ? strlen(key) : 0;
+	long long val = -1;
+
+	if (!f)
+		return -1;
+	while (fgets(line, sizeof(line), f))
+		if (!key) {
+			val = strtoll(line, NULL, 10);
+			break;
+		} else if (!strncmp(line, key, len) && line[len] == ' ') {
+			val = strtoll(line + len + 1, NULL, 10);
+			break;
+		}
+	fclose(f);
+	return val;
+}
+
+static int cmp_ull(const void *a, const void *b)
+{
+	unsigned long long x = *(const unsigned long long *)a;
+	unsigned long long y = *(const unsigned long long *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned long size = 64, balloon_mb = 0;
+	unsigned long long *lat, t0, total = 0;
+	long long pswpin, gets;
+	size_t pages, n, faults = 0, bad = 0;
+	unsigned char vec;
+	volatile uint64_t *p;
+	char *region;
+	int verbose = 0, opt;
+
+	page_size = sysconf(_SC_PAGESIZE);
+
+	while ((opt = getopt(argc, argv, "m:b:rv")) != -1) {
+		switch (opt) {
+		case 'm':
+			size = parse_ulong(argv[0], optarg);
+			break;
+		case 'b':
+			balloon_mb = parse_ulong(argv[0], optarg);
+			break;
+		case 'r':
+			random_pages = 1;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc || !size)
+		usage(argv[0]);
+	if (!balloon_mb)
+		balloon_mb = (read_value("/proc/meminfo", "MemFree:") +
+			      read_value("/proc/meminfo", "Cached:")) / 1024 +
+			     size;
+
+	pages = ((size_t)size << 20) / page_size;
+	lat = calloc(pages, sizeof(*lat));
+	region = mmap(NULL, pages * page_size, PROT_READ | PROT_WRITE,
+		      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (!lat || region == MAP_FAILED) {
+		perror("region");
+		return 1;
+	}
+	for (n = 0; n < pages; n++)
+		fill_page((uint64_t *)(region + n * page_size), n,
+			  random_pages);
+
+	if (balloon(balloon_mb))
+		return 1;
+
+	pswpin = read_value("/proc/vmstat", "pswpin");
+	gets = read_value(FRONTSWAP_GETS, NULL);
+	for (n = 0; n < pages; n++) {
+		p = (volatile uint64_t *)(region + n * page_size);
+		if (mincore((void *)p, page_size, &vec) < 0) {
+			perror("mincore");
+			return 1;
+		}
+		if (vec & 1)
+			continue;
+		t0 = now_ns();
+		(void)*p;
+		lat[faults] = now_ns() - t0;
+		total += lat[faults];
+		if (verbose)
+			printf("%zu: %.1f\n", n, lat[faults] / 1000.0);
+		faults++;
+	}
+	pswpin = read_value("/proc/vmstat", "pswpin") - pswpin;
+	if (gets >= 0)
+		gets = read_value(FRONTSWAP_GETS, NULL) - gets;
+
+	for (n = 0; n < pages; n++)
+		if (check_page((uint64_t *)(region + n * page_size), n))
+			bad++;
+
+	printf("%s pages, %zu of %zu swapped in by a fault",
+	       random_pages ? "random" : "compressible", faults, pages);
+	if (faults) {
+		qsort(lat, faults, sizeof(*lat), cmp_ull);
+		printf(": avg %.1fus p50 %.1fus p90 %.1fus p99 %.1fus "
+		       "max %.1fus",
+		       total / 1000.0 / faults, lat[faults / 2] / 1000.0,
+		       lat[faults * 9 / 10] / 1000.0,
+		       lat[faults * 99 / 100] / 1000.0,
+		       lat[faults - 1] / 1000.0);
+	}
+	printf("\n  pswpin %lld", pswpin);
+	if (gets >= 0)
+		printf(", frontswap gets %lld", gets);
+	printf("\n");
+
+	if (bad) {
+		fprintf(stderr, "%zu pages read back wrong\n", bad);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,164 @@
+/*
+ * hotplug-replay.c - Replay runqueue samples through the Tegra3 hotplug policy
+ *
+ * Feeds recorded samples to the same code as arch/arm/mach-tegra/cpu-tegra3.c
+ * uses to bring cores on and off line, and prints what it decides, so that
+ * the tunables can be tried out on a host.
+ *
+ * Each input line is one sample, taken every down_delay while the cpu is
+ * at the bottom of the G cluster or every up2gn_delay otherwise:
+ *
+ *	nr_running nr_online [min_cpus max_cpus flags]
+ *
+ * nr_running does not count the hotplug worker. flags is made of the
+ * letters u (EDP favors one more core), d (EDP favors one less), s (speeds
+ * are skewed) and i (idle), or "-" for none. Without them, min_cpus is 1,
+ * max_cpus is 4 and the flags are "u". Lines starting with '#' are skipped.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cpu-tegra3-policy.h"
+
+static const char * const decisions[] = {
+	[TEGRA_HP_HOLD]		= "hold",
+	[TEGRA_HP_ONLINE]	= "online",
+	[TEGRA_HP_OFFLINE]	= "offline",
+};
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-w load_weight] [-u up_load] [-d down_load]\n"
+		"       [-n down_samples] [-s] [file]\n"
+		"  -s  simulate: apply the decisions to nr_online instead of\n"
+		"      taking it from the samples after the first one\n",
+		prog);
+	exit(1);
+}
+
+static unsigned int parse_uint(const char *prog, const char *arg)
+{
+	char *end;
+	unsigned long val = strtoul(arg, &end, 0);
+
+	if (!*arg || *end)
+		usage(prog);
+	return val;
+}
+
+int main(int argc, char *argv[])
+{
+	/* the defaults of the module parameters */
+	struct tegra_hp_params params = {
+		.load_weight	= 50,
+		.up_load	= 125,
+		.down_load	= 80,
+		.down_samples	= 10,
+	};
+	struct tegra_hp_load load;
+	struct tegra_hp_cpus cpus;
+	unsigned int nr_running, nr_online, sim_online = 0;
+	unsigned long lineno = 0, samples = 0, onlined = 0, offlined = 0;
+	char line[256], flags[16];
+	int simulate = 0;
+	FILE *in = stdin;
+	int opt, n, decision;
+
+	while ((opt = getopt(argc, argv, "w:u:d:n:s")) != -1) {
+		switch (opt) {
+		case 'w':
+			params.load_weight = parse_uint(argv[0], optarg);
+			if (params.load_weight < 1 || params.load_weight > 100)
+				usage(argv[0]);
+			break;
+		case 'u':
+			params.up_load = parse_uint(argv[0], optarg);
+			break;
+		case 'd':
+			params.down_load = parse_uint(argv[0], optarg);
+			break;
+		case 'n':
+			params.down_samples = parse_uint(argv[0], optarg);
+			break;
+		case 's':
+			simulate = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind < argc - 1)
+		usage(argv[0]);
+	if (optind == argc - 1) {
+		in = fopen(argv[optind], "r");
+		if (!in) {
+			perror(argv[optind]);
+			return 1;
+		}
+	}
+
+	while (fgets(line, sizeof(line), in)) {
+		lineno++;
+		if (line[0] == '#' || line[strspn(line, " \t\n")] == '\0')
+			continue;
+
+		memset(&cpus, 0, sizeof(cpus));
+		cpus.min_cpus = 1;
+		cpus.max_cpus = 4;
+		strcpy(flags, "u");
+		n = sscanf(line, "%u %u %u %u %15s", &nr_running, &nr_online,
+			   &cpus.min_cpus, &cpus.max_cpus, flags);
+		if (n != 2 && n != 4 && n != 5) {
+			fprintf(stderr, "line %lu: bad sample\n", lineno);
+			return 1;
+		}
+		cpus.edp_favor_up = !!strchr(flags, 'u');
+		cpus.edp_favor_down = !!strchr(flags, 'd');
+		cpus.skewed = !!strchr(flags, 's');
+		cpus.idle = !!strchr(flags, 'i');
+
+		if (simulate && samples)
+			nr_online = sim_online;
+		cpus.nr_online = nr_online;
+
+		if (!samples)
+			tegra_hp_load_reset(&load, nr_running, nr_online);
+		else
+			tegra_hp_load_update(&load, &params, nr_running,
+					     nr_online);
+		samples++;
+
+		decision = tegra_hp_decide(&load, &params, &cpus);
+		sim_online = nr_online;
+		if (decision == TEGRA_HP_ONLINE) {
+			onlined++;
+			if (sim_online < cpus.max_cpus)
+				sim_online++;
+		} else if (decision == TEGRA_HP_OFFLINE) {
+			offlined++;
+			if (sim_online > 1)
+				sim_online--;
+		}
+
+		printf("%lu: nr_running=%u nr_online=%u avg=%d.%02d "
+		       "trend=%d below=%u %s\n", lineno, nr_running, nr_online,
+		       load.avg / TEGRA_HP_LOAD_SCALE,
+		       load.avg % TEGRA_HP_LOAD_SCALE, load.trend, load.below,
+		       decisions[decision]);
+	}
+
+	printf("%lu samples, %lu online, %lu offline\n",
+	       samples, onlined, offlined);
+	if (in != stdin)
+		fclose(in);
+	return 0;
+}
@@ -0,0 +1,135 @@
+#!/bin/sh
+#
+# Compares how quickly cpufreq governors react to bursts of work.
+#
+#	burst-latency.sh [-n bursts] [-b loops] [-i idle_s] governor...
+#
+# For each governor, cpu0 is left idle for idle_s seconds, then kept busy
+# with a shell loop of the given length, bursts times over. The ftrace
+# cpu_frequency events then show, for every burst, how long cpu0 took to
+# be raised above the speed it was at and to reach its top speed, and
+# how many speed changes the governor made in all.
+#
+# Needs debugfs mounted on /sys/kernel/debug and taskset. On a machine
+# without a cpufreq driver, e.g. under QEMU, load cpufreq_fake first
+# (CONFIG_CPU_FREQ_FAKE): it changes no real speed, so the loops take
+# the same time for every governor and only the reactions differ.
+#
+#	modprobe cpufreq_fake
+#	./burst-latency.sh -n 20 interactive ondemand sched
+#
+
+BURSTS=10
+LOOPS=100000
+IDLE=1
+
+while getopts n:b:i: opt; do
+	case $opt in
+	n) BURSTS=$OPTARG ;;
+	b) LOOPS=$OPTARG ;;
+	i) IDLE=$OPTARG ;;
+	*) echo "usage: $0 [-n bursts] [-b loops] [-i idle_s] governor..." >&2
+	   exit 1 ;;
+	esac
+done
+shift $((OPTIND - 1))
+[ $# -gt 0 ] || set -- interactive ondemand sched
+
+TRACING=/sys/kernel/debug/tracing
+CPUFREQ=/sys/devices/system/cpu/cpu0/cpufreq
+
+if [ ! -w $TRACING/trace_marker ] || [ ! -d $CPUFREQ ]; then
+	echo "$0: needs root, ftrace and a cpufreq driver" >&2
+	exit 1
+fi
+
+# everything below, the bursts included, runs on cpu0
+taskset -p 1 $$ > /dev/null || exit 1
+
+busy() {
+	i=0
+	while [ $i -lt $LOOPS ]; do
+		i=$((i + 1))
+	done
+}
+
+run() {
+	echo 0 > $TRACING/tracing_on
+	echo > $TRACING/trace
+	echo 1 > $TRACING/events/power/cpu_frequency/enable
+	echo 1 > $TRACING/tracing_on
+
+	n=1
+	while [ $n -le $BURSTS ]; do
+		sleep $IDLE
+		echo "burst_start $n" > $TRACING/trace_marker
+		busy
+		echo "burst_end $n" > $TRACING/trace_marker
+		n=$((n + 1))
+	done
+
+	echo 0 > $TRACING/tracing_on
+	echo 0 > $TRACING/events/power/cpu_frequency/enable
+}
+
+report() {
+	awk -v gov=$1 -v freq=$2 -v max=$3 '
+	{
+		for (i = 1; i <= NF; i++)
+			if ($i ~ /^[0-9]+\.[0-9]+:$/)
+				ts = substr($i, 1, length($i) - 1)
+	}
+	/cpu_frequency:/ && / cpu_id=0$/ {
+		sub(/.*state=/, "")
+		f = $1 + 0
+		changes++
+		if (busy && !up && f > start_freq) {
+			up = 1
+			up_total += ts - t0
+			if (ts - t0 > up_max)
+				up_max = ts - t0
+		}
+		if (busy && !top && f >= max) {
+			top = 1
+			top_total += ts - t0
+		}
+		freq = f
+	}
+	/tracing_mark_write: burst_start/ {
+		busy = 1
+		t0 = ts
+		start_freq = freq
+		up = top = (freq >= max)
+		bursts++
+	}
+	/tracing_mark_write: burst_end/ {
+		ups += up
+		tops += top
+		busy = 0
+		len += ts - t0
+	}
+	END {
+		printf "%-12s %d bursts of %.1fms avg, %d speed changes\n",
+		       gov, bursts, bursts ? 1000 * len / bursts : 0, changes
+		printf "%-12s raised in %d, avg %.1fms max %.1fms;", "",
+		       ups, up_total / (ups ? ups : 1) * 1000, up_max * 1000
+		printf " at max in %d, avg %.1fms\n",
+		       tops, top_total / (tops ? tops : 1) * 1000
+	}' $TRACING/trace
+}
+
+old_gov=$(cat $CPUFREQ/scaling_governor)
+max=$(cat $CPUFREQ/scaling_max_freq)
+
+for gov in "$@"; do
+	if ! echo $gov > $CPUFREQ/scaling_governor 2> /dev/null; then
+		echo "$gov: not available" >&2
+		continue
+	fi
+	sleep $IDLE
+	freq=$(cat $CPUFREQ/scaling_cur_freq)
+	run
+	report $gov $freq $max
+done
+
+echo $old_gov > $CPUFREQ/scaling_governor
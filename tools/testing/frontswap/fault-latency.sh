@@ -0,0 +1,59 @@
+#!/bin/sh
+#
+# Compares the latency of swap-in faults served by frontswap with those
+# served by the swap device.
+#
+#	fault-latency.sh [-m size_mb] [-n runs]
+#
+# Runs tools/frontswap/fault-latency runs times with compressible pages,
+# which zcache takes, and with random ones, which it refuses and which
+# therefore take the block path, and prints each result. Both kinds of
+# page are pushed out and faulted back the same way, so the difference
+# is that of a frontswap hit against a read from the swap device.
+#
+# Needs root, an active swap area and debugfs mounted on /sys/kernel/debug.
+# For the frontswap side, boot with "zcache" (CONFIG_ZCACHE and
+# CONFIG_FRONTSWAP) and only enable swap afterwards, as areas enabled
+# before zcache registers are never used by frontswap. Booting with
+# "zcache nofrontswap" instead makes the compressible pages take the
+# block path too, for a check that the pattern makes no difference:
+#
+#	swapon /dev/sdb1
+#	./fault-latency.sh -m 128 -n 3
+#
+
+SIZE=64
+RUNS=1
+
+while getopts m:n: opt; do
+	case $opt in
+	m) SIZE=$OPTARG ;;
+	n) RUNS=$OPTARG ;;
+	*) echo "usage: $0 [-m size_mb] [-n runs]" >&2
+	   exit 1 ;;
+	esac
+done
+
+TOOL=$(dirname $0)/../../frontswap/fault-latency
+if [ ! -x $TOOL ]; then
+	make -C $(dirname $TOOL) > /dev/null || exit 1
+fi
+
+if [ $(wc -l < /proc/swaps) -lt 2 ]; then
+	echo "$0: no swap area is active" >&2
+	exit 1
+fi
+if [ ! -r /sys/kernel/debug/frontswap/gets ]; then
+	echo "$0: no frontswap in debugfs, only the block path is timed" >&2
+fi
+grep -o 'zcache[^ ]*\|nofrontswap' /proc/cmdline | tr '\n' ' '
+echo
+
+ret=0
+r=1
+while [ $r -le $RUNS ]; do
+	$TOOL -m $SIZE || ret=1
+	$TOOL -m $SIZE -r || ret=1
+	r=$((r + 1))
+done
+exit $ret
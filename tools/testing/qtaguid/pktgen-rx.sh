@@ -0,0 +1,119 @@
+#!/bin/sh
+#
+# Measures how many received packets per second the xt_qtaguid match can
+# account, with every cpu receiving at once.
+#
+#	pktgen-rx.sh [-n cpus] [-c count] [-s pkt_size]
+#
+# One veth pair is created per cpu, qtgNa/qtgNb, and the pktgen thread of
+# cpu N sends count UDP packets of pkt_size bytes from qtgNa to an address
+# of qtgNb. veth hands each packet to the receive path on the sending cpu,
+# so all cpus run the INPUT hook concurrently. There, an Android style
+# accounting rule ("-m owner --socket-exists") makes xt_qtaguid account
+# every packet to uid 0 on qtgNb, and a second rule drops it, so nothing
+# is spent on a reply. The total rate is that of packets counted by the
+# drop rule, i.e. of packets that made it through the match, rather than
+# pktgen's transmit rate, which also counts packets dropped when the
+# backlog overflows. Each cpu's received count and pktgen rate are
+# printed as well.
+#
+# Comparing two kernels, e.g. with the tag stat lookups under the iface
+# and sock tag locks and under RCU, is done by running the same command
+# on each. The packets have no socket, so the sock tag lookup is only
+# reached for its NULL check; the tag stat lookup and the counters are
+# taken by every packet.
+#
+# Needs root, CONFIG_NET_PKTGEN, CONFIG_VETH, CONFIG_NETFILTER_XT_MATCH_QTAGUID
+# and ip and iptables:
+#
+#	modprobe pktgen
+#	./pktgen-rx.sh -n 4 -c 2000000 -s 64
+#
+
+CPUS=$(grep -c ^processor /proc/cpuinfo)
+COUNT=1000000
+SIZE=64
+
+while getopts n:c:s: opt; do
+	case $opt in
+	n) CPUS=$OPTARG ;;
+	c) COUNT=$OPTARG ;;
+	s) SIZE=$OPTARG ;;
+	*) echo "usage: $0 [-n cpus] [-c count] [-s pkt_size]" >&2
+	   exit 1 ;;
+	esac
+done
+
+PG=/proc/net/pktgen
+
+if [ ! -w $PG/pgctrl ]; then
+	echo "$0: needs root and pktgen" >&2
+	exit 1
+fi
+
+pgset() {
+	echo "$2" > $1
+	if ! grep -q "Result: OK" $1; then
+		echo "$0: $1: $2: $(grep Result: $1)" >&2
+		exit 1
+	fi
+}
+
+cleanup() {
+	iptables -D INPUT -i qtg+ -j DROP 2> /dev/null
+	iptables -D INPUT -i qtg+ -m owner --socket-exists 2> /dev/null
+	i=0
+	while [ $i -lt $CPUS ]; do
+		[ -w $PG/kpktgend_$i ] && echo rem_device_all > $PG/kpktgend_$i
+		ip link del qtg${i}a 2> /dev/null
+		i=$((i + 1))
+	done
+}
+trap cleanup EXIT
+
+i=0
+while [ $i -lt $CPUS ]; do
+	ip link add qtg${i}a type veth peer name qtg${i}b || exit 1
+	ip addr add 10.77.$i.2/24 dev qtg${i}b
+	echo 0 > /proc/sys/net/ipv4/conf/qtg${i}b/rp_filter
+	ip link set qtg${i}a up
+	ip link set qtg${i}b up
+
+	pgset $PG/kpktgend_$i rem_device_all
+	pgset $PG/kpktgend_$i "add_device qtg${i}a"
+	dev=$PG/qtg${i}a
+	pgset $dev "count $COUNT"
+	# veth takes the skb over, so it can't be a clone pktgen sends again
+	pgset $dev "clone_skb 0"
+	pgset $dev "pkt_size $SIZE"
+	pgset $dev "delay 0"
+	pgset $dev "dst 10.77.$i.2"
+	pgset $dev "src_min 10.77.$i.3"
+	pgset $dev "src_max 10.77.$i.3"
+	pgset $dev "dst_mac $(cat /sys/class/net/qtg${i}b/address)"
+	pgset $dev "udp_dst_min 9"
+	pgset $dev "udp_dst_max 9"
+	i=$((i + 1))
+done
+
+iptables -I INPUT -i qtg+ -j DROP || exit 1
+iptables -I INPUT -i qtg+ -m owner --socket-exists || exit 1
+
+start=$(date +%s%N)
+echo start > $PG/pgctrl
+end=$(date +%s%N)
+usecs=$(((end - start) / 1000))
+
+i=0
+while [ $i -lt $CPUS ]; do
+	rx=$(cat /sys/class/net/qtg${i}b/statistics/rx_packets)
+	tx=$(grep -o '[0-9]*pps' $PG/qtg${i}a)
+	printf "cpu %d: %d packets received, pktgen sent at %s\n" \
+	       $i $rx ${tx:-?}
+	i=$((i + 1))
+done
+
+dropped=$(iptables -vxnL INPUT | awk '/DROP/ && / qtg\+ / { print $1 }')
+printf "%d cpus, %d byte packets: %d through the match in %dus, %d pps\n" \
+       $CPUS $SIZE ${dropped:-0} $usecs \
+       $((${dropped:-0} * 1000000 / (usecs ? usecs : 1)))
@@ -0,0 +1,118 @@
+#!/bin/sh
+#
+# Churns a zram device and checks how much memory compaction gets back.
+#
+#	churn.sh [-d device] [-s size_mb] [-r rounds] [-c chunk_kb]
+#
+# The device, zram0 unless given, is filled with pages that compress to
+# sizes spread over most zsmalloc size classes. Each round then rewrites
+# a random half of its chunks with pages of other sizes, which moves their
+# objects to other classes and leaves holes behind. The memory stats are
+# printed after the fill, after every round and after writing to
+# 'compact', and the device contents are compared with a copy kept in a
+# temporary file, so that objects moved by compaction are checked too.
+# The device is reset at the end.
+#
+# Needs root and an unused device:
+#
+#	modprobe zram
+#	./churn.sh -s 64 -r 8
+#
+
+DEV=zram0
+SIZE=32
+ROUNDS=4
+CHUNK=64
+
+while getopts d:s:r:c: opt; do
+	case $opt in
+	d) DEV=$OPTARG ;;
+	s) SIZE=$OPTARG ;;
+	r) ROUNDS=$OPTARG ;;
+	c) CHUNK=$OPTARG ;;
+	*) echo "usage: $0 [-d device] [-s size_mb] [-r rounds] [-c chunk_kb]" >&2
+	   exit 1 ;;
+	esac
+done
+
+SYS=/sys/block/$DEV
+PAGES_PER_CHUNK=$((CHUNK / 4))
+CHUNKS=$((SIZE * 1024 / CHUNK))
+
+if [ ! -w $SYS/disksize ] || [ ! -b /dev/$DEV ]; then
+	echo "$0: needs root and /dev/$DEV" >&2
+	exit 1
+fi
+if [ "$(cat $SYS/initstate)" != 0 ]; then
+	echo "$0: $DEV is in use" >&2
+	exit 1
+fi
+
+TMP=$(mktemp -d) || exit 1
+trap 'rm -rf $TMP' EXIT
+
+# Prints 'pages' 4k pages: each is a random run of hex digits, which
+# compresses to about half its length, padded with dots to 4k.
+gen() {
+	awk -v seed=$1 -v pages=$2 'BEGIN {
+		srand(seed)
+		for (pad = "."; length(pad) < 4096; pad = pad pad)
+			;
+		for (p = 0; p < pages; p++) {
+			k = int(rand() * 512)
+			for (i = 0; i < k; i++)
+				printf "%08x", int(rand() * 4294967296)
+			printf "%s", substr(pad, 1, 4096 - 8 * k)
+		}
+	}'
+}
+
+# write_chunks seed first count: writes count chunks of new pages from
+# chunk first on, to the device and to the copy.
+write_chunks() {
+	gen $1 $(($3 * PAGES_PER_CHUNK)) > $TMP/data
+	dd if=$TMP/data of=/dev/$DEV bs=${CHUNK}k seek=$2 conv=notrunc,fsync \
+		2> /dev/null || exit 1
+	dd if=$TMP/data of=$TMP/image bs=${CHUNK}k seek=$2 conv=notrunc \
+		2> /dev/null || exit 1
+}
+
+stats() {
+	printf "%-14s orig %6dk compr %6dk used %6dk frag %3d%% compacted %d\n" \
+	       "$1" $(($(cat $SYS/orig_data_size) / 1024)) \
+	       $(($(cat $SYS/compr_data_size) / 1024)) \
+	       $(($(cat $SYS/mem_used_total) / 1024)) \
+	       $(cat $SYS/mem_fragmentation) $(cat $SYS/pages_compacted)
+}
+
+echo $((SIZE * 1024 * 1024)) > $SYS/disksize || exit 1
+
+write_chunks 1 0 $CHUNKS
+stats fill
+
+r=1
+while [ $r -le $ROUNDS ]; do
+	# a random half of the chunks
+	for c in $(awk -v seed=$r -v n=$CHUNKS 'BEGIN {
+			srand(seed)
+			for (i = 0; i < n; i++)
+				if (rand() < 0.5)
+					print i
+		}'); do
+		write_chunks $((r * CHUNKS + c + 1)) $c 1
+	done
+	stats "round $r"
+	r=$((r + 1))
+done
+
+echo 1 > $SYS/compact
+stats compact
+
+ret=0
+if ! cmp -s /dev/$DEV $TMP/image; then
+	echo "$0: $DEV contents differ from what was written" >&2
+	ret=1
+fi
+
+echo 1 > $SYS/reset
+exit $ret